@@ -1,8 +1,8 @@
 /*
  The following code is a modified version of the CUDA BarnesHut v3.1 code
- by Martin Burtscher. Modifications were made to transform the code from a
- three-dimensional Barnes-Hut implementation to a two-dimensional implementation.
- Since our application (graph layout) only needs two dimensions.
+ by Martin Burtscher. Modifications were made to compute ForceAtlas2
+ repulsion (instead of gravitation) between the nodes of a three-dimensional
+ graph layout.
 
  What follows is the copyright notice associated with that
  original code, as it is provided by the copyright holder:
@@ -49,9 +49,10 @@
 #include <stdio.h>
 #include <assert.h>
 #include "RPBHKernels.cuh"
+#include "RPFA2Math.hpp"
 
 // Variables marked extern in header.
-__device__ float minxdg, minydg, maxxdg, maxydg;
+__device__ float minxdg, minydg, minzdg, maxxdg, maxydg, maxzdg;
 
 
 // Variables for use in this file only.
@@ -71,17 +72,20 @@ __global__
 __launch_bounds__(THREADS1, FACTOR1)
 void BoundingBoxKernel(int nnodesd, int nbodiesd, volatile int * __restrict startd,
                        volatile int   * __restrict childd, volatile float * __restrict node_massd,
-                       volatile float2 * __restrict body_posd, volatile float2 * __restrict node_posd,
+                       volatile float3 * __restrict body_posd, volatile float3 * __restrict node_posd,
                        volatile float * __restrict maxxd,  volatile float * __restrict maxyd,
-                       volatile float * __restrict minxd,  volatile float * __restrict minyd)
+                       volatile float * __restrict maxzd,
+                       volatile float * __restrict minxd,  volatile float * __restrict minyd,
+                       volatile float * __restrict minzd)
 {
     register int i, j, k, inc;
-    register float val, minx, maxx, miny, maxy;
-    __shared__ volatile float sminx[THREADS1], smaxx[THREADS1], sminy[THREADS1], smaxy[THREADS1];
+    register float val, minx, maxx, miny, maxy, minz, maxz;
+    __shared__ volatile float sminx[THREADS1], smaxx[THREADS1], sminy[THREADS1], smaxy[THREADS1], sminz[THREADS1], smaxz[THREADS1];
 
     // initialize with valid data (in case #bodies < #threads)
     minx = maxx = body_posd[0].x;
     miny = maxy = body_posd[0].y;
+    minz = maxz = body_posd[0].z;
 
     // scan all bodies
     i = threadIdx.x;
@@ -94,6 +98,9 @@ void BoundingBoxKernel(int nnodesd, int nbodiesd, volatile int * __restrict star
         val = body_posd[j].y;
         miny = fminf(miny, val);
         maxy = fmaxf(maxy, val);
+        val = body_posd[j].z;
+        minz = fminf(minz, val);
+        maxz = fmaxf(maxz, val);
     }
 
     // reduction in shared memory
@@ -101,6 +108,8 @@ void BoundingBoxKernel(int nnodesd, int nbodiesd, volatile int * __restrict star
     smaxx[i] = maxx;
     sminy[i] = miny;
     smaxy[i] = maxy;
+    sminz[i] = minz;
+    smaxz[i] = maxz;
 
     for (j = THREADS1 / 2; j > 0; j /= 2)
     {
@@ -112,6 +121,8 @@ void BoundingBoxKernel(int nnodesd, int nbodiesd, volatile int * __restrict star
             smaxx[i] = maxx = fmaxf(maxx, smaxx[k]);
             sminy[i] = miny = fminf(miny, sminy[k]);
             smaxy[i] = maxy = fmaxf(maxy, smaxy[k]);
+            sminz[i] = minz = fminf(minz, sminz[k]);
+            smaxz[i] = maxz = fmaxf(maxz, smaxz[k]);
         }
     }
 
@@ -123,6 +134,8 @@ void BoundingBoxKernel(int nnodesd, int nbodiesd, volatile int * __restrict star
         maxxd[k] = maxx;
         minyd[k] = miny;
         maxyd[k] = maxy;
+        minzd[k] = minz;
+        maxzd[k] = maxz;
         __threadfence();
 
         inc = gridDim.x - 1;
@@ -135,21 +148,25 @@ void BoundingBoxKernel(int nnodesd, int nbodiesd, volatile int * __restrict star
                 maxx = fmaxf(maxx, maxxd[j]);
                 miny = fminf(miny, minyd[j]);
                 maxy = fmaxf(maxy, maxyd[j]);
+                minz = fminf(minz, minzd[j]);
+                maxz = fmaxf(maxz, maxzd[j]);
             }
             // compute 'radius'
-            radiusd = fmaxf(maxx - minx, maxy - miny) * 0.5f;
+            radiusd = fmaxf(fmaxf(maxx - minx, maxy - miny), maxz - minz) * 0.5f;
 
             // insert the root node into the BH tree.
             k = nnodesd;
             bottomd = k;
+            maxdepthd = 1;
 
             node_massd[k] = -1.0f;
             node_posd[k].x = (minx + maxx) * 0.5f;
             node_posd[k].y = (miny + maxy) * 0.5f;
+            node_posd[k].z = (minz + maxz) * 0.5f;
             startd[k] = 0;
 
-            k *= 4; // skip over the children of all nodes
-            for (i = 0; i < 4; i++) childd[k + i] = -1;
+            k *= 8; // skip over the children of all nodes
+            for (i = 0; i < 8; i++) childd[k + i] = -1;
 
             stepd++;
         }
@@ -166,8 +183,8 @@ __launch_bounds__(1024, 1)void ClearKernel1(int nnodesd, int nbodiesd, volatile
 {
     register int k, inc, top, bottom;
 
-    top = 4 * nnodesd; // children of root node initialized before.
-    bottom = 4 * nbodiesd;
+    top = 8 * nnodesd; // children of root node initialized before.
+    bottom = 8 * nbodiesd;
     inc = blockDim.x * gridDim.x;
     k = (bottom & (-WARPSIZE)) + threadIdx.x + blockIdx.x * blockDim.x;
     if (k < bottom) k += inc;
@@ -184,18 +201,19 @@ __launch_bounds__(1024, 1)void ClearKernel1(int nnodesd, int nbodiesd, volatile
 __global__
 __launch_bounds__(THREADS2, FACTOR2)
 void TreeBuildingKernel(int nnodesd, int nbodiesd, volatile int * __restrict childd,
-                        volatile float2 * __restrict body_posd, volatile float2 * __restrict node_posd)
+                        volatile float3 * __restrict body_posd, volatile float3 * __restrict node_posd)
 {
     register int i, j, depth, localmaxdepth, skip, inc;
-    register float x, y, r;
-    register float px, py;
-    register float dx, dy;
+    register float x, y, z, r;
+    register float px, py, pz;
+    register float dx, dy, dz;
     register int ch, n, cell, locked, patch;
-    register float rootr, rootx, rooty;
+    register float rootr, rootx, rooty, rootz;
 
     // cache root data
     rootx = node_posd[nnodesd].x;
     rooty = node_posd[nnodesd].y;
+    rootz = node_posd[nnodesd].z;
     rootr = radiusd;
 
     localmaxdepth = 1;
@@ -212,34 +230,31 @@ void TreeBuildingKernel(int nnodesd, int nbodiesd, volatile int * __restrict chi
             skip = 0;
             px = body_posd[i].x;
             py = body_posd[i].y;
+            pz = body_posd[i].z;
             n = nnodesd;
             depth = 1;
             r = rootr * 0.5f;
-            dx = dy = -r;
-            j = 0;
             // determine which child to follow,
-            if (rootx < px) {j  = 1; dx = r;}
-            if (rooty < py) {j |= 2; dy = r;}
-            x = rootx + dx;
-            y = rooty + dy;
+            j = RPGraph::bh_child_index(rootx, rooty, rootz, px, py, pz);
+            x = rootx + (j & 1 ? r : -r);
+            y = rooty + (j & 2 ? r : -r);
+            z = rootz + (j & 4 ? r : -r);
         }
 
         // follow path to leaf cell
-        ch = childd[n*4+j];
+        ch = childd[n*8+j];
 
         while (ch >= nbodiesd)
         {
             n = ch;
             depth++;
             r *= 0.5f;
-            dx = dy = -r;
-            j = 0;
             // determine which child to follow
-            if (x < px) {j  = 1; dx = r;}
-            if (y < py) {j |= 2; dy = r;}
-            x += dx;
-            y += dy;
-            ch = childd[n*4+j];
+            j = RPGraph::bh_child_index(x, y, z, px, py, pz);
+            x += (j & 1 ? r : -r);
+            y += (j & 2 ? r : -r);
+            z += (j & 4 ? r : -r);
+            ch = childd[n*8+j];
         }
 
         // here ch is either leaf (< nbodiesd), null (-1), locked (-2)
@@ -248,7 +263,7 @@ void TreeBuildingKernel(int nnodesd, int nbodiesd, volatile int * __restrict chi
         {
         // here we insert body into either empty cell, or split leafcell.
             // skip if child pointer is locked and try again later
-            locked = n*4+j;
+            locked = n*8+j;
             if (ch == -1)
             {
                 if (-1 == atomicCAS((int *)&childd[locked], -1, i))
@@ -268,10 +283,11 @@ void TreeBuildingKernel(int nnodesd, int nbodiesd, volatile int * __restrict chi
 
                     // if bodies have same position, offset the body to insert
                     // and redo traversal
-                    if (body_posd[ch].x == px && body_posd[ch].y == py)
+                    if (body_posd[ch].x == px && body_posd[ch].y == py && body_posd[ch].z == pz)
                     {
                         body_posd[i].x *= .99;
                         body_posd[i].y *= .99;
+                        body_posd[i].z *= .99;
                         skip = 0; // start all over
                         childd[locked] = ch; // release lock
                         break;
@@ -285,7 +301,7 @@ void TreeBuildingKernel(int nnodesd, int nbodiesd, volatile int * __restrict chi
                         cell = atomicSub((int *)&bottomd, 1) - 1;
                         assert(cell > nbodiesd);
 
-                        if (patch != -1) childd[n*4+j] = cell;
+                        if (patch != -1) childd[n*8+j] = cell;
                         patch = max(patch, cell);
 
                         // 2.) Make newly created cell current
@@ -293,25 +309,24 @@ void TreeBuildingKernel(int nnodesd, int nbodiesd, volatile int * __restrict chi
                         n = cell;
                         r *= 0.5f;
 
-                        // 3.) Insert old body into correct quadrant
-                        j = 0;
-                        if (x < body_posd[ch].x) j  = 1;
-                        if (y < body_posd[ch].y) j |= 2;
-                        childd[cell*4+j] = ch;
-
-                        // 4.) Determine center + quadrant for cell of new body
-                        j = 0;
-                        dx = dy = -r;
-                        if (x < px) {j  = 1; dx = r;}
-                        if (y < py) {j |= 2; dy = r;}
+                        // 3.) Insert old body into correct octant
+                        j = RPGraph::bh_child_index(x, y, z, body_posd[ch].x, body_posd[ch].y, body_posd[ch].z);
+                        childd[cell*8+j] = ch;
+
+                        // 4.) Determine center + octant for cell of new body
+                        j = RPGraph::bh_child_index(x, y, z, px, py, pz);
+                        dx = (j & 1 ? r : -r);
+                        dy = (j & 2 ? r : -r);
+                        dz = (j & 4 ? r : -r);
                         x += dx;
                         y += dy;
+                        z += dz;
 
                         // 5.) Visit this cell/check if in use (possibly by old body)
-                        ch = childd[n*4+j];
+                        ch = childd[n*8+j];
                         // repeat until the two bodies are different children
                     } while (ch >= 0);
-                    childd[n*4+j] = i; // insert new body
+                    childd[n*8+j] = i; // insert new body
 
                     localmaxdepth = max(depth, localmaxdepth);
                     i += inc;  // move on to next body
@@ -357,12 +372,12 @@ void ClearKernel2(int nnodesd, volatile int * __restrict startd, volatile float
 __global__
 __launch_bounds__(THREADS3, FACTOR3)
 void SummarizationKernel(const int nnodesd, const int nbodiesd, volatile int * __restrict countd, const int * __restrict childd,
-                         volatile float * __restrict body_massd, volatile float * __restrict node_massd, volatile float2 * __restrict body_posd, volatile float2 * __restrict node_posd)
+                         volatile float * __restrict body_massd, volatile float * __restrict node_massd, volatile float3 * __restrict body_posd, volatile float3 * __restrict node_posd)
 {
     register int i, j, k, ch, inc, cnt, bottom, flag;
-    register float m, cm, px, py;
-    __shared__ int  child[THREADS3 * 4];
-    __shared__ float mass[THREADS3 * 4];
+    register float m, cm, px, py, pz;
+    __shared__ int  child[THREADS3 * 8];
+    __shared__ float mass[THREADS3 * 8];
 
     bottom = bottomd;
     inc = blockDim.x * gridDim.x;
@@ -377,20 +392,21 @@ void SummarizationKernel(const int nnodesd, const int nbodiesd, volatile int * _
         {
             if (node_massd[k] < 0.0f)
             {
-                for (i = 0; i < 4; i++)
+                for (i = 0; i < 8; i++)
                 {
-                    ch = childd[k*4+i];
+                    ch = childd[k*8+i];
                     child[i*THREADS3+threadIdx.x] = ch;  // cache children
                     if ((ch >= nbodiesd) && ((mass[i*THREADS3+threadIdx.x] = node_massd[ch]) < 0.0f)) break;
                 }
-                if (i == 4)
+                if (i == 8)
                 {
                     // all children are ready
                     cm = 0.0f;
                     px = 0.0f;
                     py = 0.0f;
+                    pz = 0.0f;
                     cnt = 0;
-                    for (i = 0; i < 4; i++)
+                    for (i = 0; i < 8; i++)
                     {
                         ch = child[i*THREADS3+threadIdx.x];
                         if (ch >= 0)
@@ -401,6 +417,7 @@ void SummarizationKernel(const int nnodesd, const int nbodiesd, volatile int * _
                                 cnt += countd[ch];
                                 px += node_posd[ch].x * m;
                                 py += node_posd[ch].y * m;
+                                pz += node_posd[ch].z * m;
                             }
                             else
                             {
@@ -408,6 +425,7 @@ void SummarizationKernel(const int nnodesd, const int nbodiesd, volatile int * _
                                 cnt++;
                                 px += body_posd[ch].x * m;
                                 py += body_posd[ch].y * m;
+                                pz += body_posd[ch].z * m;
                             }
                             // add child's contribution
                             cm += m;
@@ -417,6 +435,7 @@ void SummarizationKernel(const int nnodesd, const int nbodiesd, volatile int * _
                     m = 1.0f / cm;
                     node_posd[k].x = px * m;
                     node_posd[k].y = py * m;
+                    node_posd[k].z = pz * m;
                     __threadfence();  // make sure data are visible before setting mass
                     node_massd[k] = cm;
                 }
@@ -440,18 +459,18 @@ void SummarizationKernel(const int nnodesd, const int nbodiesd, volatile int * _
         {
             if (j == 0)
             {
-                j = 4;
-                for (i = 0; i < 4; i++)
+                j = 8;
+                for (i = 0; i < 8; i++)
                 {
-                    ch = childd[k*4+i];
+                    ch = childd[k*8+i];
                     child[i*THREADS3+threadIdx.x] = ch;  // cache children
                     if ((ch < nbodiesd) || ((mass[i*THREADS3+threadIdx.x] = node_massd[ch]) >= 0.0f)) j--;
                 }
             }
             else
             {
-                j = 4;
-                for (i = 0; i < 4; i++)
+                j = 8;
+                for (i = 0; i < 8; i++)
                 {
                     ch = child[i*THREADS3+threadIdx.x];
                     if ((ch < nbodiesd) || (mass[i*THREADS3+threadIdx.x] >= 0.0f) || ((mass[i*THREADS3+threadIdx.x] = node_massd[ch]) >= 0.0f)) j--;
@@ -464,8 +483,9 @@ void SummarizationKernel(const int nnodesd, const int nbodiesd, volatile int * _
                 cm = 0.0f;
                 px = 0.0f;
                 py = 0.0f;
+                pz = 0.0f;
                 cnt = 0;
-                for (i = 0; i < 4; i++)
+                for (i = 0; i < 8; i++)
                 {
                     ch = child[i*THREADS3+threadIdx.x];
                     if (ch >= 0)
@@ -476,6 +496,7 @@ void SummarizationKernel(const int nnodesd, const int nbodiesd, volatile int * _
                             cnt += countd[ch];
                             px += node_posd[ch].x * m;
                             py += node_posd[ch].y * m;
+                            pz += node_posd[ch].z * m;
                         }
                         else
                         {
@@ -483,6 +504,7 @@ void SummarizationKernel(const int nnodesd, const int nbodiesd, volatile int * _
                             cnt++;
                             px += body_posd[ch].x * m;
                             py += body_posd[ch].y * m;
+                            pz += body_posd[ch].z * m;
                         }
                         // add child's contribution
                         cm += m;
@@ -492,6 +514,7 @@ void SummarizationKernel(const int nnodesd, const int nbodiesd, volatile int * _
                 m = 1.0f / cm;
                 node_posd[k].x = px * m;
                 node_posd[k].y = py * m;
+                node_posd[k].z = pz * m;
                 flag = 1;
             }
         }
@@ -527,16 +550,16 @@ void SortKernel(int nnodesd, int nbodiesd, int * __restrict sortd, int * __restr
         if (start >= 0)
         {
             j = 0;
-            for (i = 0; i < 4; i++)
+            for (i = 0; i < 8; i++)
             {
-                ch = childd[k*4+i];
+                ch = childd[k*8+i];
                 if (ch >= 0)
                 {
                     if (i != j)
                     {
                         // move children to front (needed later for speed)
-                        childd[k*4+i] = -1;
-                        childd[k*4+j] = ch;
+                        childd[k*8+i] = -1;
+                        childd[k*8+j] = ch;
                     }
                     j++;
                     if (ch >= nbodiesd)
@@ -568,11 +591,12 @@ __launch_bounds__(THREADS5, FACTOR5)
 void ForceCalculationKernel(int nnodesd, int nbodiesd, float itolsqd, float epssqd,
                             volatile int * __restrict sortd, volatile int * __restrict childd,
                             volatile float * __restrict body_massd, volatile float * __restrict node_massd,
-                            volatile float2 * __restrict body_posd, volatile float2 * __restrict node_posd,
-                            volatile float * __restrict fxd, volatile float * __restrict fyd, const float k_rd)
+                            volatile float3 * __restrict body_posd, volatile float3 * __restrict node_posd,
+                            volatile float * __restrict fxd, volatile float * __restrict fyd,
+                            volatile float * __restrict fzd, const float k_rd)
 {
     register int i, j, k, n, depth, base, sbase, diff, pd, nd;
-    register float px, py, ax, ay, dx, dy, tmp;
+    register float px, py, pz, ax, ay, az, dx, dy, dz, tmp, f;
     __shared__ volatile int pos[MAXDEPTH * THREADS5/WARPSIZE], node[MAXDEPTH * THREADS5/WARPSIZE];
     __shared__ float dq[MAXDEPTH * THREADS5/WARPSIZE];
 
@@ -613,16 +637,18 @@ void ForceCalculationKernel(int nnodesd, int nbodiesd, float itolsqd, float epss
             // cache position info
             px = body_posd[i].x;
             py = body_posd[i].y;
+            pz = body_posd[i].z;
 
             ax = 0.0f;
             ay = 0.0f;
+            az = 0.0f;
 
             // initialize iteration stack, i.e., push root node onto stack
             depth = j;
             if (sbase == threadIdx.x)
             {
                 pos[j] = 0;
-                node[j] = nnodesd * 4;
+                node[j] = nnodesd * 8;
             }
 
             do
@@ -630,7 +656,7 @@ void ForceCalculationKernel(int nnodesd, int nbodiesd, float itolsqd, float epss
                 // stack is not empty
                 pd = pos[depth];
                 nd = node[depth];
-                while (pd < 4)
+                while (pd < 8)
                 {
                     // node on top of stack has more children to process
                     n = childd[nd + pd];  // load child pointer
@@ -642,26 +668,32 @@ void ForceCalculationKernel(int nnodesd, int nbodiesd, float itolsqd, float epss
                         {
                             dx = px - body_posd[n].x;
                             dy = py - body_posd[n].y;
+                            dz = pz - body_posd[n].z;
                         }
                         else
                         {
                             dx = px - node_posd[n].x;
                             dy = py - node_posd[n].y;
+                            dz = pz - node_posd[n].z;
                         }
-                        tmp = dx*dx + dy*dy + epssqd;  // compute distance squared (plus softening)
+                        tmp = dx*dx + dy*dy + dz*dz + epssqd;  // compute distance squared (plus softening)
 
                         // check body-body interaction
                         if (n < nbodiesd)
                         {
-                            ax += k_rd * dx * body_massd[i] * body_massd[n] / tmp;
-                            ay += k_rd * dy * body_massd[i] * body_massd[n] / tmp;
+                            f = RPGraph::fa2_repulsion_factor(k_rd, body_massd[i], body_massd[n], tmp);
+                            ax += dx * f;
+                            ay += dy * f;
+                            az += dz * f;
                         }
 
                         // or, if n is cell, ensure all threads agree that cell is far enough away
                         else if(__all_sync(__activemask(), tmp >= dq[depth]))
                         {
-                            ax += k_rd * dx * body_massd[i] * node_massd[n] / tmp;
-                            ay += k_rd * dy * body_massd[i] * node_massd[n] / tmp;
+                            f = RPGraph::fa2_repulsion_factor(k_rd, body_massd[i], node_massd[n], tmp);
+                            ax += dx * f;
+                            ay += dy * f;
+                            az += dz * f;
                         }
                         else
                         {
@@ -673,12 +705,12 @@ void ForceCalculationKernel(int nnodesd, int nbodiesd, float itolsqd, float epss
                             }
                             depth++;
                             pd = 0;
-                            nd = n * 4;
+                            nd = n * 8;
                         }
                     }
                     else
                     {
-                        pd = 4;  // early out because all remaining children are also zero
+                        pd = 8;  // early out because all remaining children are also zero
                     }
                 }
                 depth--;  // done with this level
@@ -688,6 +720,13 @@ void ForceCalculationKernel(int nnodesd, int nbodiesd, float itolsqd, float epss
             // save computed acceleration
             fxd[i] += ax;
             fyd[i] += ay;
+            fzd[i] += az;
         }
     }
 }
+
+void getTreeStats(int &maxdepth, int &bottom)
+{
+    cudaMemcpyFromSymbol(&maxdepth, maxdepthd, sizeof(int));
+    cudaMemcpyFromSymbol(&bottom, bottomd, sizeof(int));
+}
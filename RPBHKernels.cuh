@@ -52,15 +52,17 @@
 #include "RPBHFA2LaunchParameters.cuh"
 
 extern __device__ volatile int errd;
-extern __device__ float minxdg, minydg, maxxdg, maxydg;
+extern __device__ float minxdg, minydg, minzdg, maxxdg, maxydg, maxzdg;
 
 __global__
 __launch_bounds__(THREADS1, FACTOR1)
 void BoundingBoxKernel(int nnodesd, int nbodiesd, volatile int * __restrict startd,
                        volatile int   * __restrict childd, volatile float * __restrict node_massd,
-                       volatile float2 * __restrict body_posd, volatile float2 * __restrict node_posd,
+                       volatile float3 * __restrict body_posd, volatile float3 * __restrict node_posd,
                        volatile float * __restrict maxxd,  volatile float * __restrict maxyd,
-                       volatile float * __restrict minxd,  volatile float * __restrict minyd);
+                       volatile float * __restrict maxzd,
+                       volatile float * __restrict minxd,  volatile float * __restrict minyd,
+                       volatile float * __restrict minzd);
 
 __global__
 __launch_bounds__(1024, 1)
@@ -69,7 +71,7 @@ void ClearKernel1(int nnodesd, int nbodiesd, volatile int * __restrict childd);
 __global__
 __launch_bounds__(THREADS2, FACTOR2)
 void TreeBuildingKernel(int nnodesd, int nbodiesd, volatile int * __restrict childd,
-                        volatile float2 * __restrict body_posd, volatile float2 * __restrict node_posd);
+                        volatile float3 * __restrict body_posd, volatile float3 * __restrict node_posd);
 
 __global__
 __launch_bounds__(1024, 1)
@@ -78,7 +80,7 @@ void ClearKernel2(int nnodesd, volatile int * __restrict startd, volatile float
 __global__
 __launch_bounds__(THREADS3, FACTOR3)
 void SummarizationKernel(const int nnodesd, const int nbodiesd, volatile int * __restrict countd, const int * __restrict childd,
-                         volatile float * __restrict body_massd, volatile float * __restrict node_massd, volatile float2 * __restrict body_posd, volatile float2 * __restrict node_posd);
+                         volatile float * __restrict body_massd, volatile float * __restrict node_massd, volatile float3 * __restrict body_posd, volatile float3 * __restrict node_posd);
 
 __global__
 __launch_bounds__(THREADS4, FACTOR4)
@@ -89,7 +91,11 @@ __launch_bounds__(THREADS5, FACTOR5)
 void ForceCalculationKernel(int nnodesd, int nbodiesd, float itolsqd, float epssqd,
                             volatile int * __restrict sortd, volatile int * __restrict childd,
                             volatile float * __restrict body_massd, volatile float * __restrict node_massd,
-                            volatile float2 * __restrict body_posd, volatile float2 * __restrict node_posd,
-                            volatile float * __restrict fxd, volatile float * __restrict fyd, const float k_rd);
+                            volatile float3 * __restrict body_posd, volatile float3 * __restrict node_posd,
+                            volatile float * __restrict fxd, volatile float * __restrict fyd,
+                            volatile float * __restrict fzd, const float k_rd);
+
+// Depth and lowest cell id of the tree built in the last step.
+void getTreeStats(int &maxdepth, int &bottom);
 
 #endif
@@ -24,189 +24,461 @@
 #include "RPBarnesHutApproximator.hpp"
 #include <math.h>
 #include <stdlib.h>
-#include <queue>
+#include <algorithm>
+
+// Cells are not split beyond this depth, so that leaves with many
+// (nearly) coincident particles can't cause unbounded recursion.
+#define BH_MAXDEPTH 32
+
+// The top levels of the tree are built sequentially, the (up to 8^depth)
+// subtrees below this depth in parallel.
+#define BH_PARALLEL_DEPTH 2
+
+// Number of independent accumulators used when summing interactions,
+// chosen such that the compiler can map them onto SIMD lanes.
+#define BH_LANES 8
 
 namespace RPGraph
 {
-    BarnesHutCell::BarnesHutCell(Coordinate position, float length, Coordinate particle_position, float particle_mass)
-    : cell_center{position}, length{length}, mass_center(particle_position), total_mass{particle_mass}
-    {
-        lb = position.x - length/2.0;
-        rb = position.x + length/2.0;
-        bb = position.y - length/2.0;
-        ub = position.y + length/2.0;
-
-        // Initialize the top and bottom boundaries for the z-dimension.
-        //Modify for z coordinate- 8th November
-        zb = position.z - length / 2.0;
-        zt = position.z + length / 2.0;
-    }
+    BarnesHutCell::BarnesHutCell(Coordinate position, float length)
+    : cell_center{position}, mass_center{position}, total_mass{0.0f}, length{length}
+    {}
 
     BarnesHutCell::~BarnesHutCell()
     {
         for (nid_t n = 0; n < 8; ++n) delete sub_cells[n];
     }
 
-/*
-    void BarnesHutCell::add_leafcell(int quadrant, float mass, Coordinate pos)
+    int BarnesHutCell::octant(Coordinate particle_position)
     {
-        Coordinate leafcell_center_coordinate = Coordinate(0,0,0); //Modify for z coordinate- 8th November
-        if (quadrant == 0)
-            leafcell_center_coordinate = Coordinate(this->cell_center.x-length/4.0,this->cell_center.y+length/4);
-        else if (quadrant == 1)
-            leafcell_center_coordinate = Coordinate(this->cell_center.x+length/4.0,this->cell_center.y+length/4);
-        else if (quadrant == 2)
-            leafcell_center_coordinate = Coordinate(this->cell_center.x+length/4.0,this->cell_center.y-length/4);
-        else if (quadrant == 3)
-            leafcell_center_coordinate = Coordinate(this->cell_center.x-length/4.0,this->cell_center.y-length/4);
-
-        sub_cells[quadrant] = new BarnesHutCell(leafcell_center_coordinate, this->length/2.0, pos, mass);
-        num_subparticles += 1;
+        int octant = 0;
+        if (particle_position.x >= cell_center.x) octant |= 1;
+        if (particle_position.y >= cell_center.y) octant |= 2;
+        if (particle_position.z >= cell_center.z) octant |= 4;
+        return octant;
+    }
 
+    Coordinate BarnesHutCell::subcellCenter(int octant)
+    {
+        const float quarter_length = length / 4.0;
+        return Coordinate(cell_center.x + (octant & 1 ? quarter_length : -quarter_length),
+                          cell_center.y + (octant & 2 ? quarter_length : -quarter_length),
+                          cell_center.z + (octant & 4 ? quarter_length : -quarter_length));
     }
-*/
 
-//Modify for z coordinate- 8th November
-void BarnesHutCell::add_leafcell(int octant, float mass, Coordinate pos)
-{
-    Coordinate leafcell_center_coordinate = Coordinate(0, 0, 0);
-    float half_length = this->length / 4.0;
-
-    if (octant == 0)
-        leafcell_center_coordinate = Coordinate(this->cell_center.x - half_length, this->cell_center.y + half_length, this->cell_center.z + half_length);
-    else if (octant == 1)
-        leafcell_center_coordinate = Coordinate(this->cell_center.x + half_length, this->cell_center.y + half_length, this->cell_center.z + half_length);
-    else if (octant == 2)
-        leafcell_center_coordinate = Coordinate(this->cell_center.x + half_length, this->cell_center.y - half_length, this->cell_center.z + half_length);
-    else if (octant == 3)
-        leafcell_center_coordinate = Coordinate(this->cell_center.x - half_length, this->cell_center.y - half_length, this->cell_center.z + half_length);
-    else if (octant == 4)
-        leafcell_center_coordinate = Coordinate(this->cell_center.x - half_length, this->cell_center.y + half_length, this->cell_center.z - half_length);
-    else if (octant == 5)
-        leafcell_center_coordinate = Coordinate(this->cell_center.x + half_length, this->cell_center.y + half_length, this->cell_center.z - half_length);
-    else if (octant == 6)
-        leafcell_center_coordinate = Coordinate(this->cell_center.x + half_length, this->cell_center.y - half_length, this->cell_center.z - half_length);
-    else if (octant == 7)
-        leafcell_center_coordinate = Coordinate(this->cell_center.x - half_length, this->cell_center.y - half_length, this->cell_center.z - half_length);
-
-    sub_cells[octant] = new BarnesHutCell(leafcell_center_coordinate, this->length / 2.0, pos, mass);
-    num_subparticles += 1;
-}
+    // Sum of (p - q_i) * m_i / |p - q_i|^2 over all `count' particles q_i.
+    // Particles coinciding with p (including p itself) are skipped.
+    static void sum_interactions(float px, float py, float pz,
+                                 const float *x, const float *y, const float *z,
+                                 const float *m, size_t count,
+                                 float &fx, float &fy, float &fz)
+    {
+        float ax[BH_LANES] = {0}, ay[BH_LANES] = {0}, az[BH_LANES] = {0};
 
+        size_t i = 0;
+        for (; i + BH_LANES <= count; i += BH_LANES)
+        {
+            for (int l = 0; l < BH_LANES; ++l)
+            {
+                const float dx = px - x[i+l];
+                const float dy = py - y[i+l];
+                const float dz = pz - z[i+l];
+                const float d2 = dx*dx + dy*dy + dz*dz;
+                const float w = d2 > 0.0f ? m[i+l] / d2 : 0.0f;
+                ax[l] += dx * w;
+                ay[l] += dy * w;
+                az[l] += dz * w;
+            }
+        }
 
+        for (; i < count; ++i)
+        {
+            const float dx = px - x[i];
+            const float dy = py - y[i];
+            const float dz = pz - z[i];
+            const float d2 = dx*dx + dy*dy + dz*dz;
+            const float w = d2 > 0.0f ? m[i] / d2 : 0.0f;
+            ax[0] += dx * w;
+            ay[0] += dy * w;
+            az[0] += dz * w;
+        }
 
+        fx = fy = fz = 0.0f;
+        for (int l = 0; l < BH_LANES; ++l)
+        {
+            fx += ax[l];
+            fy += ay[l];
+            fz += az[l];
+        }
+    }
 
-    BarnesHutApproximator::BarnesHutApproximator(Coordinate root_center, float root_length, float theta)
-    : root_center{root_center}, root_length{root_length}, theta{theta}
+    BarnesHutApproximator::BarnesHutApproximator(Coordinate root_center, float root_length,
+                                                 float theta, nid_t leaf_capacity)
+    : root_center{root_center}, root_length{root_length}, theta{theta},
+      leaf_capacity{std::max(leaf_capacity, (nid_t)1)}, tree_depth{0}, tree_cells{0}
     {
         this->reset(root_center, root_length);
     }
 
+    BarnesHutApproximator::~BarnesHutApproximator()
+    {
+        delete root_cell;
+    }
+
     void BarnesHutApproximator::reset(Coordinate root_center, float root_length)
     {
         delete root_cell; // this recursively deletes the entire tree
         root_cell = nullptr;
+        summarized = false;
 
         this->root_center = root_center;
         this->root_length = root_length;
+
+        particle_x.clear();
+        particle_y.clear();
+        particle_z.clear();
+        particle_mass.clear();
     }
 
+    void BarnesHutApproximator::insertParticle(RPGraph::Coordinate particle_position, float particle_mass)
+    {
+        particle_x.push_back(particle_position.x);
+        particle_y.push_back(particle_position.y);
+        particle_z.push_back(particle_position.z);
+        this->particle_mass.push_back(particle_mass);
+        summarized = false;
+    }
 
-    Real3DVector BarnesHutApproximator::approximateForce(Coordinate particle_pos, float particle_mass, float theta)//Modify for z coordinate- 8th November
+    void BarnesHutApproximator::buildTree(ThreadPool *pool)
     {
-        Real3DVector force = Real3DVector(0.0, 0.0, 0.0);//Modify for z coordinate- 8th November
-        std::queue<BarnesHutCell*> cells_to_check;
-        cells_to_check.push(root_cell);
+        delete root_cell;
+        root_cell = new BarnesHutCell(root_center, root_length);
 
-        BarnesHutCell *cur_cell;
-        while (!cells_to_check.empty())
+        const float half_length = root_length / 2.0;
+        for (nid_t id = 0; id < particle_x.size(); ++id)
         {
-            cur_cell = cells_to_check.front();
-            cells_to_check.pop();
+            // Particles out of bounds don't take part in the approximation.
+            if (particle_x[id] > root_center.x + half_length || particle_x[id] < root_center.x - half_length ||
+                particle_y[id] > root_center.y + half_length || particle_y[id] < root_center.y - half_length ||
+                particle_z[id] > root_center.z + half_length || particle_z[id] < root_center.z - half_length)
+                continue;
+            root_cell->bucket.push_back(id);
+        }
 
-            const float D2 = distance2(particle_pos, cur_cell->mass_center);
-            if (D2 == 0)
-            {
-                // If we approximate the force of a particle on itself...
-                if (cur_cell->num_subparticles == 0) continue;
-                else return Real3DVector(rand(), rand(), rand());//Modify for z coordinate- 8th November
+        if (pool == nullptr || pool->size() == 1)
+        {
+            splitLeaf(root_cell, 0);
+            return;
+        }
 
-            }
+        std::vector<BarnesHutCell *> subtrees;
+        splitTop(root_cell, 0, subtrees);
 
-            // length / D >= theta is the criterion to divide into subcells.
-            if (cur_cell->length*cur_cell->length / D2 < theta*theta || cur_cell->num_subparticles == 0)
-                force += direction(particle_pos, cur_cell->mass_center)  *
-                (particle_mass * cur_cell->total_mass / D2);
+        std::vector<uint64_t> cost_prefix(subtrees.size()+1, 0);
+        for (size_t i = 0; i < subtrees.size(); ++i)
+            cost_prefix[i+1] = cost_prefix[i] + subtrees[i]->bucket.size();
 
-            else
-                for (int i = 0; i < 8; ++i) //Modify for z coordinate- 8th November
-                    if (cur_cell->sub_cells[i] != nullptr) cells_to_check.push(cur_cell->sub_cells[i]);
+        pool->parallel_for(subtrees.size(), [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i) splitLeaf(subtrees[i], BH_PARALLEL_DEPTH);
+        }, cost_prefix.data());
+    }
+
+    // Splits `cell' down to BH_PARALLEL_DEPTH, and collects the cells at
+    // that depth that still have to be split.
+    void BarnesHutApproximator::splitTop(BarnesHutCell *cell, int depth,
+                                         std::vector<BarnesHutCell *> &subtrees)
+    {
+        if (cell->bucket.size() <= leaf_capacity) return;
+        if (depth == BH_PARALLEL_DEPTH)
+        {
+            subtrees.push_back(cell);
+            return;
         }
-        return force;
+
+        distributeBucket(cell);
+        for (int i = 0; i < 8; ++i)
+            if (cell->sub_cells[i] != nullptr) splitTop(cell->sub_cells[i], depth+1, subtrees);
     }
 
-    void BarnesHutApproximator::insertParticle(RPGraph::Coordinate particle_position, float particle_mass)
+    void BarnesHutApproximator::splitLeaf(BarnesHutCell *cell, int depth)
+    {
+        if (cell->bucket.size() <= leaf_capacity || depth >= BH_MAXDEPTH) return;
+
+        distributeBucket(cell);
+
+        // All particles may have ended up in the same subcell.
+        for (int i = 0; i < 8; ++i)
+            if (cell->sub_cells[i] != nullptr) splitLeaf(cell->sub_cells[i], depth+1);
+    }
+
+    void BarnesHutApproximator::distributeBucket(BarnesHutCell *cell)
     {
-        if(not root_cell)
+        // Distribute the particles in the bucket over (new) subcells.
+        cell->is_leaf = false;
+        for (nid_t id : cell->bucket)
         {
-            root_cell = new BarnesHutCell(this->root_center, this->root_length,
-                                          particle_position, particle_mass);
+            const int octant = cell->octant(Coordinate(particle_x[id], particle_y[id], particle_z[id]));
+            if (cell->sub_cells[octant] == nullptr)
+                cell->sub_cells[octant] = new BarnesHutCell(cell->subcellCenter(octant),
+                                                            cell->length / 2.0);
+            cell->sub_cells[octant]->bucket.push_back(id);
+        }
+        std::vector<nid_t>().swap(cell->bucket);
+    }
+
+    void BarnesHutApproximator::summarize(ThreadPool *pool)
+    {
+        if (summarized) return;
+        buildTree(pool);
+
+        bucket_x.clear();
+        bucket_y.clear();
+        bucket_z.clear();
+        bucket_mass.clear();
+        bucket_id.clear();
+        leaves.clear();
+
+        tree_depth = 0;
+        tree_cells = 0;
+        summarizeCell(root_cell, 0);
+
+        // Estimate the cost of each leaf from the interactions its particles
+        // had last time (none for new particles), plus one per particle.
+        particle_cost.resize(particle_x.size(), 0);
+        leaf_cost_prefix.assign(leaves.size()+1, 0);
+        for (size_t i = 0; i < leaves.size(); ++i)
+        {
+            uint64_t cost = 0;
+            const nid_t begin = leaves[i]->bucket_offset;
+            for (nid_t b = begin; b < begin + leaves[i]->bucket_size; ++b)
+                cost += particle_cost[bucket_id[b]] + 1;
+            leaf_cost_prefix[i+1] = leaf_cost_prefix[i] + cost;
+        }
+
+        summarized = true;
+    }
+
+    void BarnesHutApproximator::summarizeCell(BarnesHutCell *cell, int depth)
+    {
+        float mass = 0.0f, mx = 0.0f, my = 0.0f, mz = 0.0f;
+        tree_depth = std::max(tree_depth, depth);
+        tree_cells++;
+
+        if (cell->is_leaf)
+        {
+            // Leaves are packed in depth-first order, so that the
+            // particles of nearby leaves are also close in memory.
+            cell->bucket_offset = bucket_id.size();
+            cell->bucket_size = cell->bucket.size();
+            for (nid_t id : cell->bucket)
+            {
+                bucket_x.push_back(particle_x[id]);
+                bucket_y.push_back(particle_y[id]);
+                bucket_z.push_back(particle_z[id]);
+                bucket_mass.push_back(particle_mass[id]);
+                bucket_id.push_back(id);
+
+                mass += particle_mass[id];
+                mx += particle_x[id] * particle_mass[id];
+                my += particle_y[id] * particle_mass[id];
+                mz += particle_z[id] * particle_mass[id];
+            }
+            if (cell->bucket_size > 0) leaves.push_back(cell);
         }
 
         else
         {
-            BarnesHutCell *cur_cell = root_cell;
-            while (true)
+            for (int i = 0; i < 8; ++i)
             {
-                const int octant_new_particle  = (particle_position-cur_cell->cell_center).octant();//Modify for z coordinate- 8th November
+                BarnesHutCell *sub_cell = cell->sub_cells[i];
+                if (sub_cell == nullptr) continue;
+                summarizeCell(sub_cell, depth+1);
+                mass += sub_cell->total_mass;
+                mx += sub_cell->mass_center.x * sub_cell->total_mass;
+                my += sub_cell->mass_center.y * sub_cell->total_mass;
+                mz += sub_cell->mass_center.z * sub_cell->total_mass;
+            }
+        }
 
-                if (particle_position.x > cur_cell->rb || particle_position.x < cur_cell->lb ||
-                particle_position.y > cur_cell->ub || particle_position.y < cur_cell->bb ||
-                particle_position.z > cur_cell->zt || particle_position.z < cur_cell->zb) // Check for z-axis bounds//Modify for z coordinate- 8th November
-                {
-                    //fprintf(stderr, "error: Barnes-Hut: Can't insert particle out of bounds of this cell.\n");
-                    return;
-                }
+        cell->total_mass = mass;
+        if (mass > 0.0f) cell->mass_center = Coordinate(mx/mass, my/mass, mz/mass);
+    }
 
-                // N.B. a BarnesHutCell is never empty, but can lack subparticles/cells.
-                // If so, we need to create, and insert, a subcell for the single particle that
-                // is stored in this cell.
-                if (cur_cell->num_subparticles == 0)
-                {
-                    if (particle_position == cur_cell->mass_center)
-                    {
-                        // We want two particles in the same place...
-                        // Thats equivalent to a single particle with summed masses.
-                        // mass_center won't change.
-                        cur_cell->total_mass += particle_mass;
-                        return;
-                    }
-
-                    // We move the single particle to a subcell.
-                    int octant_existing_particle  = (cur_cell->mass_center - cur_cell->cell_center).octant();//Modify for z coordinate- 8th November
-                    cur_cell->add_leafcell(octant_existing_particle , cur_cell->total_mass, cur_cell->mass_center);//Modify for z coordinate- 8th November
-                }
+    const uint32_t BarnesHutApproximator::NO_CLUSTER;
 
-                // We assume inserting will succeed, and update total_mass and mass_center accordingly
-                cur_cell->total_mass  += particle_mass;
-                cur_cell->mass_center  = cur_cell->mass_center * (float) (cur_cell->num_subparticles);
-                cur_cell->mass_center += particle_position;
-                cur_cell->mass_center /= (cur_cell->num_subparticles+1);
+    void BarnesHutApproximator::clusterLevels(int num_levels,
+                                              std::vector<std::vector<BarnesHutCluster>> &levels,
+                                              std::vector<std::vector<uint32_t>> &cluster_of)
+    {
+        summarize();
+        num_levels = std::max(num_levels, 1);
+        levels.assign(num_levels, std::vector<BarnesHutCluster>());
+        cluster_of.assign(num_levels, std::vector<uint32_t>(particle_x.size(), NO_CLUSTER));
+        std::vector<uint32_t> path(num_levels, NO_CLUSTER);
+        if (root_cell->total_mass > 0.0f) collectClusters(root_cell, 0, path, levels, cluster_of);
+    }
 
-                // If we can add a leaf-cell in an empty slot, we do so.
-                if (cur_cell->sub_cells[octant_new_particle] == nullptr)//Modify for z coordinate- 8th November
-                {
-                    cur_cell->add_leafcell(octant_new_particle, particle_mass, particle_position);//Modify for z coordinate- 8th November
-                    return;
-                }
+    // `path[d]' is the cluster at level d containing `cell', for d < depth.
+    void BarnesHutApproximator::collectClusters(BarnesHutCell *cell, int depth,
+                                                std::vector<uint32_t> &path,
+                                                std::vector<std::vector<BarnesHutCluster>> &levels,
+                                                std::vector<std::vector<uint32_t>> &cluster_of)
+    {
+        const int num_levels = levels.size();
+
+        // A leaf also stands for itself at all levels below its own.
+        const int last = cell->is_leaf ? num_levels - 1 : std::min(depth, num_levels - 1);
+        for (int d = depth; d <= last; ++d)
+        {
+            const uint32_t parent = d == 0 ? NO_CLUSTER : path[d-1];
+            path[d] = levels[d].size();
+            levels[d].push_back(BarnesHutCluster{cell->mass_center, cell->total_mass, 0, parent});
+        }
 
-                // Else we recurse to the occupied cell.
-                else
+        if (cell->is_leaf)
+        {
+            for (nid_t b = cell->bucket_offset; b < cell->bucket_offset + cell->bucket_size; ++b)
+            {
+                for (int d = 0; d < num_levels; ++d)
                 {
-                    cur_cell->num_subparticles += 1;
-                    cur_cell = cur_cell->sub_cells[octant_new_particle];//Modify for z coordinate- 8th November
+                    cluster_of[d][bucket_id[b]] = path[d];
+                    levels[d][path[d]].size++;
                 }
             }
+            return;
+        }
+
+        for (int i = 0; i < 8; ++i)
+        {
+            BarnesHutCell *sub_cell = cell->sub_cells[i];
+            if (sub_cell == nullptr || sub_cell->total_mass <= 0.0f) continue;
+            collectClusters(sub_cell, depth+1, path, levels, cluster_of);
+        }
+    }
+
+    // Collects the cells (as point masses) and the leaf particles that
+    // any particle within the box [box_min, box_max] interacts with.
+    void BarnesHutApproximator::buildInteractionList(Coordinate box_min, Coordinate box_max,
+                                                     float theta, InteractionList &list)
+    {
+        list.x.clear();
+        list.y.clear();
+        list.z.clear();
+        list.mass.clear();
+        list.cells_to_check.clear();
+        if (root_cell) list.cells_to_check.push_back(root_cell);
+
+        while (!list.cells_to_check.empty())
+        {
+            BarnesHutCell *cur_cell = list.cells_to_check.back();
+            list.cells_to_check.pop_back();
+
+            // Squared distance between mass center and the nearest point in the box.
+            const Coordinate mc = cur_cell->mass_center;
+            const float dx = fmaxf(fmaxf(box_min.x - mc.x, mc.x - box_max.x), 0.0f);
+            const float dy = fmaxf(fmaxf(box_min.y - mc.y, mc.y - box_max.y), 0.0f);
+            const float dz = fmaxf(fmaxf(box_min.z - mc.z, mc.z - box_max.z), 0.0f);
+            const float D2 = dx*dx + dy*dy + dz*dz;
+
+            // length / D >= theta is the criterion to divide into subcells.
+            if (D2 > 0 && cur_cell->length*cur_cell->length / D2 < theta*theta)
+            {
+                list.x.push_back(mc.x);
+                list.y.push_back(mc.y);
+                list.z.push_back(mc.z);
+                list.mass.push_back(cur_cell->total_mass);
+            }
+
+            else if (cur_cell->is_leaf)
+            {
+                const nid_t begin = cur_cell->bucket_offset;
+                const nid_t end = begin + cur_cell->bucket_size;
+                list.x.insert(list.x.end(), bucket_x.begin()+begin, bucket_x.begin()+end);
+                list.y.insert(list.y.end(), bucket_y.begin()+begin, bucket_y.begin()+end);
+                list.z.insert(list.z.end(), bucket_z.begin()+begin, bucket_z.begin()+end);
+                list.mass.insert(list.mass.end(), bucket_mass.begin()+begin, bucket_mass.begin()+end);
+            }
+
+            else
+                for (int i = 0; i < 8; ++i) //Modify for z coordinate- 8th November
+                    if (cur_cell->sub_cells[i] != nullptr) list.cells_to_check.push_back(cur_cell->sub_cells[i]);
+        }
+    }
+
+    Real3DVector BarnesHutApproximator::approximateForce(Coordinate particle_pos, float particle_mass, float theta)//Modify for z coordinate- 8th November
+    {
+        summarize();
+
+        InteractionList list;
+        buildInteractionList(particle_pos, particle_pos, theta, list);
+
+        float fx, fy, fz;
+        sum_interactions(particle_pos.x, particle_pos.y, particle_pos.z,
+                         list.x.data(), list.y.data(), list.z.data(), list.mass.data(),
+                         list.mass.size(), fx, fy, fz);
+        return Real3DVector(fx, fy, fz) * particle_mass;
+    }
+
+    void BarnesHutApproximator::approximateForces(Real3DVector *forces, float theta, float scale,
+                                                  ThreadPool *pool)
+    {
+        summarize(pool);
+
+        if (pool == nullptr)
+            return approximateLeafForces(0, leaves.size(), forces, theta, scale);
+
+        pool->parallel_for(leaves.size(), [&](size_t begin, size_t end)
+        {
+            approximateLeafForces(begin, end, forces, theta, scale);
+        }, leaf_cost_prefix.data());
+    }
+
+    const std::vector<uint32_t> &BarnesHutApproximator::interactionCounts() const
+    {
+        return particle_cost;
+    }
+
+    int BarnesHutApproximator::depth() const
+    {
+        return tree_depth;
+    }
+
+    uint32_t BarnesHutApproximator::numCells() const
+    {
+        return tree_cells;
+    }
+
+    void BarnesHutApproximator::approximateLeafForces(size_t first_leaf, size_t last_leaf,
+                                                      Real3DVector *forces, float theta, float scale)
+    {
+        InteractionList list;
+        for (size_t l = first_leaf; l < last_leaf; ++l)
+        {
+            BarnesHutCell *leaf = leaves[l];
+            const nid_t begin = leaf->bucket_offset;
+            const nid_t end = begin + leaf->bucket_size;
+
+            // Bounding box of the particles in this leaf.
+            Coordinate box_min(bucket_x[begin], bucket_y[begin], bucket_z[begin]);
+            Coordinate box_max = box_min;
+            for (nid_t i = begin+1; i < end; ++i)
+            {
+                box_min = Coordinate(fminf(box_min.x, bucket_x[i]), fminf(box_min.y, bucket_y[i]), fminf(box_min.z, bucket_z[i]));
+                box_max = Coordinate(fmaxf(box_max.x, bucket_x[i]), fmaxf(box_max.y, bucket_y[i]), fmaxf(box_max.z, bucket_z[i]));
+            }
+
+            buildInteractionList(box_min, box_max, theta, list);
+
+            for (nid_t i = begin; i < end; ++i)
+            {
+                float fx, fy, fz;
+                sum_interactions(bucket_x[i], bucket_y[i], bucket_z[i],
+                                 list.x.data(), list.y.data(), list.z.data(), list.mass.data(),
+                                 list.mass.size(), fx, fy, fz);
+                forces[bucket_id[i]] += Real3DVector(fx, fy, fz) * (bucket_mass[i] * scale);
+                particle_cost[bucket_id[i]] = list.mass.size();
+            }
         }
     }
 }
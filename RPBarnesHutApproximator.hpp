@@ -26,46 +26,136 @@
 
 #include "RPGraph.hpp"
 #include "RPCommon.hpp"
+#include "RPThreadPool.hpp"
+#include <vector>
 
 namespace RPGraph
 {
     class BarnesHutCell
     {
     public:
-        void add_leafcell(int quadrant, float mass, Coordinate pos);
-        float lb, rb, ub, bb, zt, zb; //Modify for z coordinate- 8th November
-
-        // BarnesHutCell always contain either a single particle, or subcells (at most 4).
-        BarnesHutCell(Coordinate position, float length, Coordinate particle_position, float particle_mass);
+        // BarnesHutCell is either a leaf, holding a bucket of particles, or
+        // an internal cell with subcells (at most 8, one per octant).
+        BarnesHutCell(Coordinate position, float length);
         ~BarnesHutCell();
 
+        // Octant of `particle_position' wrt. cell_center, in [0, 8).
+        // Bit 0 is set for +x, bit 1 for +y and bit 2 for +z.
+        int octant(Coordinate particle_position);
+        Coordinate subcellCenter(int octant);
+
         Coordinate cell_center, mass_center;
-        nid_t num_subparticles = 0;
         float total_mass;
-        const float length;   // length of a cell = width = height
-        //BarnesHutCell *sub_cells[4] = {nullptr, nullptr, nullptr, nullptr}; // per quadrant.
-        //Modify for z coordinate- 8th November
+        const float length;   // length of a cell = width = height = depth
         BarnesHutCell *sub_cells[8] = {nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr}; // per octant in 3D.
 
-        void insertParticle(Coordinate particle_position, float particle_mass);
+        // While building, `bucket' holds the ids of the particles in a leaf.
+        // After summarizing, they are stored contiguously in the SoA arrays
+        // of the BarnesHutApproximator, at [bucket_offset, bucket_offset+bucket_size).
+        bool is_leaf = true;
+        std::vector<nid_t> bucket;
+        nid_t bucket_offset = 0, bucket_size = 0;
+    };
+
+    // A cell of the tree, as a cluster of the particles below it. `parent'
+    // is the index of the enclosing cluster one level up, if any.
+    struct BarnesHutCluster
+    {
+        Coordinate mass_center;
+        float mass;
+        nid_t size;
+        uint32_t parent;
     };
 
     class BarnesHutApproximator
     {
     public:
-        BarnesHutApproximator(Coordinate root_center, float root_length, float theta);
-        Real3DVector approximateForce(Coordinate particle_pos, float particle_mass, float theta); //Modify for z coordinate- 7th November
+        BarnesHutApproximator(Coordinate root_center, float root_length, float theta,
+                              nid_t leaf_capacity = 32);
+        ~BarnesHutApproximator();
+
+        // Particles are identified by the order in which they are inserted,
+        // starting from 0 after each reset(). The tree itself is built
+        // by summarize().
         void insertParticle(Coordinate particle_position, float particle_mass);
 
+        // Builds the tree, computes mass and mass center of each cell, and
+        // packs the leaf buckets into contiguous arrays. Subtrees are built
+        // in parallel if a `pool' is given. Called by the approximate*
+        // methods if needed, but must be called explicitly before querying
+        // the tree from multiple threads.
+        void summarize(ThreadPool *pool = nullptr);
+
+        Real3DVector approximateForce(Coordinate particle_pos, float particle_mass, float theta); //Modify for z coordinate- 7th November
+
+        // Adds `scale' times the approximated force on each inserted particle
+        // to forces[id]. All particles in a leaf share a single traversal.
+        // Leaves are processed in parallel if a `pool' is given.
+        void approximateForces(Real3DVector *forces, float theta, float scale,
+                               ThreadPool *pool = nullptr);
+
+        // Number of interactions (cells and particles) of each particle
+        // during the last call to approximateForces(), by id.
+        const std::vector<uint32_t> &interactionCounts() const;
+
+        // Depth (the root being at depth 0) and number of cells of the
+        // tree, as of the last summarize().
+        int depth() const;
+        uint32_t numCells() const;
+
+        // Clusters of the tree's first `num_levels' levels: levels[d] has
+        // the cells at depth d, and the leaves above it, so each level
+        // covers all particles. Cells without mass are left out.
+        // cluster_of[d][id] is the cluster of particle `id' at level d
+        // (NO_CLUSTER if it was out of bounds). Summarizes if needed.
+        static const uint32_t NO_CLUSTER = 0xFFFFFFFF;
+        void clusterLevels(int num_levels, std::vector<std::vector<BarnesHutCluster>> &levels,
+                           std::vector<std::vector<uint32_t>> &cluster_of);
+
         void reset(Coordinate root_center, float root_length);
-        void setTheta(float theta);
 
     private:
         BarnesHutCell *root_cell = nullptr;
-        const float theta;
         Coordinate root_center;
         float root_length;
-
+        const float theta;
+        const nid_t leaf_capacity;
+        bool summarized;
+        int tree_depth;
+        uint32_t tree_cells;
+
+        // Position and mass of each inserted particle, by id.
+        std::vector<float> particle_x, particle_y, particle_z, particle_mass;
+
+        // Leaf buckets in SoA form, grouped per leaf (see BarnesHutCell).
+        std::vector<float> bucket_x, bucket_y, bucket_z, bucket_mass;
+        std::vector<nid_t> bucket_id;
+        std::vector<BarnesHutCell *> leaves;
+        std::vector<uint64_t> leaf_cost_prefix; // Of leaves, see summarize().
+
+        // Kept across reset(), as particles keep their ids between
+        // iterations of a layout.
+        std::vector<uint32_t> particle_cost;
+
+        // Cells and particles a traversal has to interact with, in SoA form.
+        struct InteractionList
+        {
+            std::vector<float> x, y, z, mass;
+            std::vector<BarnesHutCell *> cells_to_check;
+        };
+
+        void buildTree(ThreadPool *pool);
+        void distributeBucket(BarnesHutCell *cell);
+        void splitLeaf(BarnesHutCell *cell, int depth);
+        void splitTop(BarnesHutCell *cell, int depth, std::vector<BarnesHutCell *> &subtrees);
+        void summarizeCell(BarnesHutCell *cell, int depth);
+        void collectClusters(BarnesHutCell *cell, int depth, std::vector<uint32_t> &path,
+                             std::vector<std::vector<BarnesHutCluster>> &levels,
+                             std::vector<std::vector<uint32_t>> &cluster_of);
+        void buildInteractionList(Coordinate box_min, Coordinate box_max,
+                                  float theta, InteractionList &list);
+        void approximateLeafForces(size_t first_leaf, size_t last_leaf,
+                                   Real3DVector *forces, float theta, float scale);
     };
 }
 
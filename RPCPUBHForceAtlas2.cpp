@@ -0,0 +1,745 @@
+/*
+ ==============================================================================
+
+ RPCPUBHForceAtlas2.cpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#include "RPCPUBHForceAtlas2.hpp"
+#include "RPFA2Math.hpp"
+#include <math.h>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <mutex>
+
+namespace RPGraph
+{
+    // Bounds of the `tid'th of `num_threads' contiguous parts of [0, n).
+    static inline int part_begin(int n, int tid, int num_threads)
+    {
+        return (long long) n * tid / num_threads;
+    }
+
+    CPUBHForceAtlas2::CPUBHForceAtlas2(GraphLayout &layout, bool strong_gravity,
+                                       float gravity, float scale, ThreadPool *pool)
+    : ForceAtlas2(layout, true, strong_gravity, gravity, scale), pool{pool}
+    {
+        if (this->pool == nullptr)
+        {
+            own_pool.reset(new ThreadPool());
+            this->pool = own_pool.get();
+        }
+        num_threads = this->pool->size();
+
+        nbodies = layout.graph.num_nodes();
+        body_x.resize(nbodies);
+        body_y.resize(nbodies);
+        body_z.resize(nbodies);
+        body_mass.resize(nbodies);
+        fx.assign(nbodies, 0.0f);
+        fy.assign(nbodies, 0.0f);
+        fz.assign(nbodies, 0.0f);
+        fx_prev.assign(nbodies, 0.0f);
+        fy_prev.assign(nbodies, 0.0f);
+        fz_prev.assign(nbodies, 0.0f);
+        body_cost.assign(nbodies, 0);
+        repulsion_cost_prefix.resize(nbodies+1);
+        swg_partial.resize(this->num_threads);
+        etra_partial.resize(this->num_threads);
+
+        for (nid_t n = 0; n < layout.graph.num_nodes(); ++n)
+        {
+            body_x[n] = layout.getX(n);
+            body_y[n] = layout.getY(n);
+            body_z[n] = layout.getZ(n);
+            body_mass[n] = ForceAtlas2::mass(n);
+        }
+
+        // Attraction is computed per body rather than per edge (as on the
+        // GPU), so that threads never write to the same body.
+        adj_offsets.assign(nbodies+1, 0);
+        for (nid_t n = 0; n < layout.graph.num_nodes(); ++n)
+        {
+            for (nid_t t : layout.graph.neighbors_with_geq_id(n))
+            {
+                adj_offsets[n+1]++;
+                adj_offsets[t+1]++;
+            }
+        }
+        for (int n = 0; n < nbodies; ++n) adj_offsets[n+1] += adj_offsets[n];
+
+        adj_targets.resize(adj_offsets[nbodies]);
+        adj_weights.resize(adj_offsets[nbodies]);
+        std::vector<uint64_t> fill(adj_offsets.begin(), adj_offsets.end()-1);
+        for (nid_t n = 0; n < layout.graph.num_nodes(); ++n)
+        {
+            for (nid_t t : layout.graph.neighbors_with_geq_id(n))
+            {
+                const float w = layout.graph.get_edge_weight(n, t);
+                adj_targets[fill[n]] = t;
+                adj_weights[fill[n]++] = w;
+                adj_targets[fill[t]] = n;
+                adj_weights[fill[t]++] = w;
+            }
+        }
+
+        maxdepth = 1;
+        allocateCells(std::max(2 * nbodies, 1024));
+    }
+
+    CPUBHForceAtlas2::~CPUBHForceAtlas2() {}
+
+    void CPUBHForceAtlas2::allocateCells(int nnodes)
+    {
+        this->nnodes = nnodes;
+        node_x.resize(nnodes+1);
+        node_y.resize(nnodes+1);
+        node_z.resize(nnodes+1);
+        node_mass.resize(nnodes+1);
+        countl.resize(nnodes+1);
+        sortl.resize(nnodes+1);
+        childl.reset(new std::atomic<int>[(nnodes+1) * 8]);
+        startl.reset(new std::atomic<int>[nnodes+1]);
+        readyl.reset(new std::atomic<int>[nnodes+1]);
+    }
+
+    void CPUBHForceAtlas2::gravityAndAttraction(int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            const float px = body_x[i];
+            const float py = body_y[i];
+            const float pz = body_z[i];
+
+            const float f_g = fa2_gravity_factor(k_g, strong_gravity, body_mass[i], px, py, pz);
+            float ax = -px * f_g;
+            float ay = -py * f_g;
+            float az = -pz * f_g;
+
+            // Force just depends linearly on distance (and on edge weight).
+            for (uint64_t e = adj_offsets[i]; e < adj_offsets[i+1]; ++e)
+            {
+                const int t = adj_targets[e];
+                const float w = adj_weights[e];
+                ax += (body_x[t] - px) * w;
+                ay += (body_y[t] - py) * w;
+                az += (body_z[t] - pz) * w;
+            }
+
+            fx[i] += ax;
+            fy[i] += ay;
+            fz[i] += az;
+        }
+    }
+
+    void CPUBHForceAtlas2::boundingBox()
+    {
+        std::vector<float> bounds(num_threads * 6);
+        pool->run_on_all([&](int tid)
+        {
+            float minx = body_x[0], maxx = body_x[0];
+            float miny = body_y[0], maxy = body_y[0];
+            float minz = body_z[0], maxz = body_z[0];
+            const int end = part_begin(nbodies, tid+1, num_threads);
+            for (int j = part_begin(nbodies, tid, num_threads); j < end; ++j)
+            {
+                minx = fminf(minx, body_x[j]);
+                maxx = fmaxf(maxx, body_x[j]);
+                miny = fminf(miny, body_y[j]);
+                maxy = fmaxf(maxy, body_y[j]);
+                minz = fminf(minz, body_z[j]);
+                maxz = fmaxf(maxz, body_z[j]);
+            }
+            float *b = &bounds[tid * 6];
+            b[0] = minx; b[1] = maxx;
+            b[2] = miny; b[3] = maxy;
+            b[4] = minz; b[5] = maxz;
+        });
+
+        float minx = bounds[0], maxx = bounds[1];
+        float miny = bounds[2], maxy = bounds[3];
+        float minz = bounds[4], maxz = bounds[5];
+        for (int tid = 1; tid < num_threads; ++tid)
+        {
+            const float *b = &bounds[tid * 6];
+            minx = fminf(minx, b[0]); maxx = fmaxf(maxx, b[1]);
+            miny = fminf(miny, b[2]); maxy = fmaxf(maxy, b[3]);
+            minz = fminf(minz, b[4]); maxz = fmaxf(maxz, b[5]);
+        }
+
+        // compute 'radius'; it is not 0 even if all bodies coincide, as
+        // buildTree() separates coinciding bodies by a fraction of it.
+        radius = fmaxf(fmaxf(maxx - minx, maxy - miny), maxz - minz) * 0.5f;
+        radius = fmaxf(radius, 1e-3f * fmaxf(1.0f, fmaxf(fmaxf(fabsf(minx), fabsf(miny)), fabsf(minz))));
+
+        // insert the root node into the BH tree.
+        bottom = nnodes;
+        maxdepth = 1;
+        node_mass[nnodes] = -1.0f;
+        node_x[nnodes] = (minx + maxx) * 0.5f;
+        node_y[nnodes] = (miny + maxy) * 0.5f;
+        node_z[nnodes] = (minz + maxz) * 0.5f;
+        startl[nnodes] = 0;
+        for (int i = 0; i < 8; i++) childl[nnodes*8 + i] = -1;
+    }
+
+    // Sets all child pointers of cells in [begin, end) to null (-1).
+    void CPUBHForceAtlas2::clearChildren(int begin, int end)
+    {
+        for (int k = begin; k < end; ++k)
+            for (int i = 0; i < 8; i++)
+                childl[k*8 + i].store(-1, std::memory_order_relaxed);
+    }
+
+    void CPUBHForceAtlas2::buildTree(int tid)
+    {
+        int j = 0, depth = 0, n = 0, ch, cell, locked, patch;
+        float x = 0, y = 0, z = 0, r = 0;
+        int localmaxdepth = 1;
+        bool skip = true;
+
+        // Offsets of bodies that coincide with one already in the tree.
+        std::minstd_rand jitter(tid + 1);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+        const float rootx = node_x[nnodes];
+        const float rooty = node_y[nnodes];
+        const float rootz = node_z[nnodes];
+
+        int i = part_begin(nbodies, tid, num_threads);
+        const int end = part_begin(nbodies, tid+1, num_threads);
+
+        // iterate over all bodies assigned to thread
+        while (i < end)
+        {
+            if (out_of_cells.load(std::memory_order_relaxed)) return;
+
+            const float px = body_x[i];
+            const float py = body_y[i];
+            const float pz = body_z[i];
+
+            if (skip)
+            {
+                // new body, so start traversing at root
+                skip = false;
+                n = nnodes;
+                depth = 1;
+                r = radius * 0.5f;
+                j = bh_child_index(rootx, rooty, rootz, px, py, pz);
+                x = rootx + (j & 1 ? r : -r);
+                y = rooty + (j & 2 ? r : -r);
+                z = rootz + (j & 4 ? r : -r);
+            }
+
+            // follow path to leaf cell
+            ch = childl[n*8+j].load(std::memory_order_acquire);
+            while (ch >= nbodies)
+            {
+                n = ch;
+                depth++;
+                r *= 0.5f;
+                j = bh_child_index(x, y, z, px, py, pz);
+                x += (j & 1 ? r : -r);
+                y += (j & 2 ? r : -r);
+                z += (j & 4 ? r : -r);
+                ch = childl[n*8+j].load(std::memory_order_acquire);
+            }
+
+            // here ch is either leaf (< nbodies), null (-1), locked (-2)
+            if (ch == -2)
+            {
+                // skip if child pointer is locked and try again later
+                std::this_thread::yield();
+                continue;
+            }
+
+            locked = n*8+j;
+            if (ch == -1)
+            {
+                // if null, just insert the new body
+                int expected = -1;
+                if (childl[locked].compare_exchange_strong(expected, i, std::memory_order_release))
+                {
+                    localmaxdepth = std::max(depth, localmaxdepth);
+                    i++;  // move on to next body
+                    skip = true;
+                }
+                // else: failed to claim cell, re-traverse.
+                continue;
+            }
+
+            // there already is a body in this position
+            int expected = ch;
+            if (!childl[locked].compare_exchange_strong(expected, -2, std::memory_order_acquire))
+                continue; // failed to aquire lock, re-traverse.
+
+            // if bodies have same position, offset the body to insert
+            // by a small random vector and redo traversal. (A
+            // multiplicative offset leaves bodies at the origin there.)
+            if (body_x[ch] == px && body_y[ch] == py && body_z[ch] == pz)
+            {
+                const float offset = radius * 1e-3f;
+                body_x[i] += offset * unit(jitter);
+                body_y[i] += offset * unit(jitter);
+                body_z[i] += offset * unit(jitter);
+                skip = true; // start all over
+                childl[locked].store(ch, std::memory_order_release); // release lock
+                continue;
+            }
+
+            patch = -1;
+            // create new cell(s) and insert the new and old body
+            do
+            {
+                // 1.) Create new cell
+                cell = bottom.fetch_sub(1) - 1;
+                if (cell < nbodies)
+                {
+                    // Out of cells, the tree is rebuilt with more of them.
+                    out_of_cells = true;
+                    childl[locked].store(patch == -1 ? ch : patch, std::memory_order_release);
+                    return;
+                }
+
+                if (patch != -1) childl[n*8+j].store(cell, std::memory_order_relaxed);
+                patch = std::max(patch, cell);
+
+                // 2.) Make newly created cell current
+                depth++;
+                n = cell;
+                r *= 0.5f;
+
+                // 3.) Insert old body into correct octant
+                j = bh_child_index(x, y, z, body_x[ch], body_y[ch], body_z[ch]);
+                childl[cell*8+j].store(ch, std::memory_order_relaxed);
+
+                // 4.) Determine center + octant for cell of new body
+                j = bh_child_index(x, y, z, px, py, pz);
+                x += (j & 1 ? r : -r);
+                y += (j & 2 ? r : -r);
+                z += (j & 4 ? r : -r);
+
+                // 5.) Visit this cell/check if in use (possibly by old body)
+                ch = childl[n*8+j].load(std::memory_order_relaxed);
+                // repeat until the two bodies are different children
+            } while (ch >= 0);
+            childl[n*8+j].store(i, std::memory_order_relaxed); // insert new body
+
+            localmaxdepth = std::max(depth, localmaxdepth);
+            i++;  // move on to next body
+            skip = true;
+
+            childl[locked].store(patch, std::memory_order_release); // unlock
+        }
+
+        // record maximum tree depth
+        int cur = maxdepth.load();
+        while (localmaxdepth > cur && !maxdepth.compare_exchange_weak(cur, localmaxdepth));
+    }
+
+    // Marks cells in [begin, end) as not summarized, not sorted.
+    void CPUBHForceAtlas2::clearCells(int begin, int end)
+    {
+        for (int k = begin; k < end; ++k)
+        {
+            readyl[k].store(0, std::memory_order_relaxed);
+            startl[k].store(-1, std::memory_order_relaxed);
+        }
+    }
+
+    // Computes mass, center of mass and body count of each cell.
+    void CPUBHForceAtlas2::summarize(int tid)
+    {
+        // Cells are created top-down from `bottom' (decreasing ids), so child
+        // cells always have smaller ids than their parent. Iterating
+        // upwards, a thread only waits for cells owned by other threads.
+        const int first = bottom.load();
+        for (int k = first + tid; k <= nnodes; k += num_threads)
+        {
+            float cm = 0.0f, px = 0.0f, py = 0.0f, pz = 0.0f;
+            int cnt = 0;
+            for (int i = 0; i < 8; i++)
+            {
+                const int ch = childl[k*8+i].load(std::memory_order_relaxed);
+                if (ch < 0) continue;
+
+                float m;
+                if (ch >= nbodies)
+                {
+                    while (readyl[ch].load(std::memory_order_acquire) == 0)
+                        std::this_thread::yield();
+                    m = node_mass[ch];
+                    cnt += countl[ch];
+                    px += node_x[ch] * m;
+                    py += node_y[ch] * m;
+                    pz += node_z[ch] * m;
+                }
+                else
+                {
+                    m = body_mass[ch];
+                    cnt++;
+                    px += body_x[ch] * m;
+                    py += body_y[ch] * m;
+                    pz += body_z[ch] * m;
+                }
+                // add child's contribution
+                cm += m;
+            }
+            countl[k] = cnt;
+            node_mass[k] = cm;
+            // Cells holding only removed nodes have no mass, and pull on nothing.
+            node_x[k] = cm > 0.0f ? px / cm : 0.0f;
+            node_y[k] = cm > 0.0f ? py / cm : 0.0f;
+            node_z[k] = cm > 0.0f ? pz / cm : 0.0f;
+            readyl[k].store(1, std::memory_order_release);
+        }
+    }
+
+    // Orders bodies in `sortl' such that bodies close in the tree are
+    // close in the array, and compacts the children of each cell.
+    void CPUBHForceAtlas2::sortBodies(int tid)
+    {
+        const int first = bottom.load();
+        for (int k = nnodes - tid; k >= first; k -= num_threads)
+        {
+            int start;
+            while ((start = startl[k].load(std::memory_order_acquire)) < 0)
+                std::this_thread::yield();
+
+            int j = 0;
+            for (int i = 0; i < 8; i++)
+            {
+                const int ch = childl[k*8+i].load(std::memory_order_relaxed);
+                if (ch < 0) continue;
+
+                if (i != j)
+                {
+                    // move children to front (needed later for speed)
+                    childl[k*8+i].store(-1, std::memory_order_relaxed);
+                    childl[k*8+j].store(ch, std::memory_order_relaxed);
+                }
+                j++;
+                if (ch >= nbodies)
+                {
+                    // child is a cell
+                    startl[ch].store(start, std::memory_order_release);
+                    start += countl[ch];
+                }
+                else
+                {
+                    // child is a body
+                    sortl[start] = ch;
+                    start++;
+                }
+            }
+        }
+    }
+
+    void CPUBHForceAtlas2::computeRepulsion(int begin, int end)
+    {
+        const int depth_limit = maxdepth.load();
+
+        // precompute values that depend only on tree level
+        std::vector<float> dq(depth_limit + 1);
+        const float width = radius * 2;
+        dq[0] = width * width * itolsq;
+        for (int i = 1; i <= depth_limit; i++) dq[i] = dq[i - 1] * 0.25f;
+        for (int i = 0; i <= depth_limit; i++) dq[i] += epssq;
+
+        std::vector<int> pos(depth_limit + 1), node(depth_limit + 1);
+
+        // iterate over all bodies in range, in tree order
+        for (int k = begin; k < end; ++k)
+        {
+            const int i = sortl[k];
+            const float px = body_x[i];
+            const float py = body_y[i];
+            const float pz = body_z[i];
+            const float mi = body_mass[i];
+            float ax = 0.0f, ay = 0.0f, az = 0.0f;
+            uint32_t interactions = 0;
+
+            // initialize iteration stack, i.e., push root node onto stack
+            int depth = 0;
+            pos[0] = 0;
+            node[0] = nnodes * 8;
+
+            do
+            {
+                // stack is not empty
+                int pd = pos[depth];
+                int nd = node[depth];
+                while (pd < 8)
+                {
+                    // node on top of stack has more children to process
+                    const int n = childl[nd + pd].load(std::memory_order_relaxed);
+                    pd++;
+
+                    if (n < 0) break; // all remaining children are also null
+
+                    float dx, dy, dz;
+                    if (n < nbodies)
+                    {
+                        dx = px - body_x[n];
+                        dy = py - body_y[n];
+                        dz = pz - body_z[n];
+                    }
+                    else
+                    {
+                        dx = px - node_x[n];
+                        dy = py - node_y[n];
+                        dz = pz - node_z[n];
+                    }
+                    const float tmp = dx*dx + dy*dy + dz*dz + epssq;  // distance squared (plus softening)
+
+                    if (n < nbodies || tmp >= dq[depth])
+                    {
+                        const float m = n < nbodies ? body_mass[n] : node_mass[n];
+                        const float f = fa2_repulsion_factor(k_r, mi, m, tmp);
+                        ax += dx * f;
+                        ay += dy * f;
+                        az += dz * f;
+                        interactions++;
+                    }
+                    else
+                    {
+                        // push cell onto stack
+                        pos[depth] = pd;
+                        node[depth] = nd;
+                        depth++;
+                        pd = 0;
+                        nd = n * 8;
+                    }
+                }
+                depth--;  // done with this level
+            } while (depth >= 0);
+
+            fx[i] += ax;
+            fy[i] += ay;
+            fz[i] += az;
+            body_cost[i] = interactions;
+        }
+    }
+
+    void CPUBHForceAtlas2::updateSpeeds()
+    {
+        pool->run_on_all([&](int tid)
+        {
+            float swg_thread = 0.0f, etra_thread = 0.0f;
+            const int end = part_begin(nbodies, tid+1, num_threads);
+            for (int j = part_begin(nbodies, tid, num_threads); j < end; ++j)
+            {
+                swg_thread  += body_mass[j] * fa2_swinging(fx[j], fy[j], fz[j], fx_prev[j], fy_prev[j], fz_prev[j]);
+                etra_thread += body_mass[j] * fa2_traction(fx[j], fy[j], fz[j], fx_prev[j], fy_prev[j], fz_prev[j]);
+            }
+            swg_partial[tid] = swg_thread;
+            etra_partial[tid] = etra_thread;
+        });
+
+        float total_swinging = 0.0f, total_effective_traction = 0.0f;
+        for (int tid = 0; tid < num_threads; ++tid)
+        {
+            total_swinging += swg_partial[tid];
+            total_effective_traction += etra_partial[tid];
+        }
+
+        fa2_update_speeds(total_swinging, total_effective_traction, nbodies,
+                          jitter_tolerance, k_s_max, speed_efficiency, global_speed);
+        last_step.total_swinging = total_swinging;
+        last_step.total_traction = total_effective_traction;
+    }
+
+    void CPUBHForceAtlas2::displace(int begin, int end, float &max_displacement, double &sum_displacement)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            const float swg = fa2_swinging(fx[i], fy[i], fz[i], fx_prev[i], fy_prev[i], fz_prev[i]);
+            const float factor = fa2_displacement_factor(global_speed, swg) * temperatureOf(i);
+            const float d = sqrtf(fx[i]*fx[i] + fy[i]*fy[i] + fz[i]*fz[i]) * factor;
+            max_displacement = std::max(max_displacement, d);
+            sum_displacement += d;
+
+            body_x[i] += fx[i] * factor;
+            body_y[i] += fy[i] * factor;
+            body_z[i] += fz[i] * factor;
+            fx_prev[i] = fx[i];
+            fy_prev[i] = fy[i];
+            fz_prev[i] = fz[i];
+            fx[i] = 0.0f;
+            fy[i] = 0.0f;
+            fz[i] = 0.0f;
+        }
+    }
+
+    void CPUBHForceAtlas2::doStep()
+    {
+        // The tree needs a body to bound.
+        if (nbodies == 0)
+        {
+            iteration++;
+            return;
+        }
+
+        // Attraction is scheduled by degree.
+        pool->parallel_for(nbodies, [&](size_t begin, size_t end)
+        {
+            gravityAndAttraction(begin, end);
+        }, adj_offsets.data());
+
+        // Build Barnes-Hut tree, with more cells if we ran out of them.
+        do
+        {
+            out_of_cells = false;
+            boundingBox();
+            pool->parallel_for(nnodes - nbodies, [&](size_t begin, size_t end)
+            {
+                clearChildren(nbodies + begin, nbodies + end);
+            });
+            pool->run_on_all([&](int tid) { buildTree(tid); });
+            if (out_of_cells) allocateCells(nnodes * 2);
+        } while (out_of_cells);
+
+        const int first = bottom.load();
+        last_step.tree_depth = maxdepth.load();
+        last_step.tree_cells = nnodes + 1 - first;
+        pool->parallel_for(nnodes - first, [&](size_t begin, size_t end)
+        {
+            clearCells(first + begin, first + end);
+        });
+        readyl[nnodes] = 0;
+        startl[nnodes] = 0;
+        pool->run_on_all([&](int tid) { summarize(tid); });
+        pool->run_on_all([&](int tid) { sortBodies(tid); });
+
+        // Traversal cost differs per region of the tree. It is estimated
+        // by the interactions of each body in the last step, plus one.
+        repulsion_cost_prefix[0] = 0;
+        for (int k = 0; k < nbodies; ++k)
+            repulsion_cost_prefix[k+1] = repulsion_cost_prefix[k] + body_cost[sortl[k]] + 1;
+        pool->parallel_for(nbodies, [&](size_t begin, size_t end)
+        {
+            computeRepulsion(begin, end);
+        }, repulsion_cost_prefix.data());
+
+        updateSpeeds();
+
+        std::mutex displacement_mutex;
+        float max_displacement = 0.0f;
+        double sum_displacement = 0.0;
+        pool->parallel_for(nbodies, [&](size_t begin, size_t end)
+        {
+            float range_max = 0.0f;
+            double range_sum = 0.0;
+            displace(begin, end, range_max, range_sum);
+            std::lock_guard<std::mutex> lock(displacement_mutex);
+            max_displacement = std::max(max_displacement, range_max);
+            sum_displacement += range_sum;
+        });
+        last_step.max_displacement = max_displacement;
+        last_step.mean_displacement = nbodies > 0 ? sum_displacement / nbodies : 0.0f;
+        iteration++;
+    }
+
+    void CPUBHForceAtlas2::setThreadPool(ThreadPool *pool)
+    {
+        this->pool = pool;
+        num_threads = pool->size();
+        swg_partial.resize(num_threads);
+        etra_partial.resize(num_threads);
+    }
+
+    std::vector<uint32_t> CPUBHForceAtlas2::interactionCounts()
+    {
+        return body_cost;
+    }
+
+    // Only the bodies the engine has, which the graph may have outgrown
+    // (see updateGraph()).
+    void CPUBHForceAtlas2::sync_layout()
+    {
+        for (nid_t n = 0; n < (nid_t)nbodies; ++n)
+        {
+            layout.setX(n, body_x[n]);
+            layout.setY(n, body_y[n]);
+            layout.setZ(n, body_z[n]);
+        }
+    }
+
+    void CPUBHForceAtlas2::getState(std::vector<float> &positions,
+                                    std::vector<float> &prev_forces)
+    {
+        positions.resize(3 * (size_t)nbodies);
+        prev_forces.resize(3 * (size_t)nbodies);
+        for (int n = 0; n < nbodies; ++n)
+        {
+            positions[3*n]   = body_x[n];
+            positions[3*n+1] = body_y[n];
+            positions[3*n+2] = body_z[n];
+            prev_forces[3*n]   = fx_prev[n];
+            prev_forces[3*n+1] = fy_prev[n];
+            prev_forces[3*n+2] = fz_prev[n];
+        }
+    }
+
+    void CPUBHForceAtlas2::setState(const std::vector<float> &positions,
+                                    const std::vector<float> &prev_forces)
+    {
+        for (int n = 0; n < nbodies; ++n)
+        {
+            body_x[n] = positions[3*n];
+            body_y[n] = positions[3*n+1];
+            body_z[n] = positions[3*n+2];
+            fx_prev[n] = prev_forces[3*n];
+            fy_prev[n] = prev_forces[3*n+1];
+            fz_prev[n] = prev_forces[3*n+2];
+        }
+        sync_layout();
+    }
+
+    void CPUBHForceAtlas2::graphChanged(nid_t old_num_nodes,
+                                        const std::vector<std::pair<nid_t, nid_t>> &changed_edges)
+    {
+        nbodies = layout.graph.num_nodes();
+        body_x.resize(nbodies);
+        body_y.resize(nbodies);
+        body_z.resize(nbodies);
+        body_mass.resize(nbodies);
+        fx.resize(nbodies, 0.0f);
+        fy.resize(nbodies, 0.0f);
+        fz.resize(nbodies, 0.0f);
+        fx_prev.resize(nbodies, 0.0f);
+        fy_prev.resize(nbodies, 0.0f);
+        fz_prev.resize(nbodies, 0.0f);
+        body_cost.resize(nbodies, 0);
+        repulsion_cost_prefix.resize(nbodies+1);
+        for (nid_t n = old_num_nodes; n < (nid_t)nbodies; ++n)
+        {
+            body_x[n] = layout.getX(n);
+            body_y[n] = layout.getY(n);
+            body_z[n] = layout.getZ(n);
+        }
+        // All of them, as nodes may have been removed without changed edges.
+        for (nid_t n = 0; n < (nid_t)nbodies; ++n) body_mass[n] = ForceAtlas2::mass(n);
+
+        updateAdjacency(adj_offsets, adj_targets, adj_weights, changed_edges);
+        // Cell ids start after the body ids.
+        if (nnodes < 2 * nbodies) allocateCells(2 * nbodies);
+    }
+}
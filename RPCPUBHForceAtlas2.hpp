@@ -0,0 +1,116 @@
+/*
+ ==============================================================================
+
+ RPCPUBHForceAtlas2.hpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#ifndef RPCPUBHForceAtlas2_hpp
+#define RPCPUBHForceAtlas2_hpp
+
+#include "RPForceAtlas2.hpp"
+#include "RPThreadPool.hpp"
+#include <atomic>
+#include <vector>
+#include <memory>
+
+namespace RPGraph
+{
+    // Multithreaded host port of the CUDA engine. It uses the same
+    // linear-array Barnes-Hut octree (see RPBHKernels.cu): a bounding box
+    // reduction, lock-free tree insertion into `child', summarization, sorting
+    // of bodies in tree order and a stack-based force traversal. Phases run
+    // on a ThreadPool, those whose threads wait on each other on all of its
+    // threads at once.
+    class CPUBHForceAtlas2: public ForceAtlas2
+    {
+    public:
+        // If no pool is given, one with all hardware threads is created.
+        CPUBHForceAtlas2(GraphLayout &layout, bool strong_gravity,
+                         float gravity, float scale, ThreadPool *pool = nullptr);
+        ~CPUBHForceAtlas2();
+        void doStep() override;
+        void sync_layout() override;
+        std::vector<uint32_t> interactionCounts() override;
+        void setThreadPool(ThreadPool *pool) override;
+
+    protected:
+        void getState(std::vector<float> &positions,
+                      std::vector<float> &prev_forces) override;
+        void setState(const std::vector<float> &positions,
+                      const std::vector<float> &prev_forces) override;
+        void graphChanged(nid_t old_num_nodes,
+                          const std::vector<std::pair<nid_t, nid_t>> &changed_edges) override;
+
+    private:
+        std::unique_ptr<ThreadPool> own_pool;
+        ThreadPool *pool;
+        int num_threads; // of the pool
+        int nbodies;
+        int nnodes; // Id of the root cell, cells are in [bottom, nnodes].
+
+        // Per body.
+        std::vector<float> body_x, body_y, body_z, body_mass;
+        std::vector<float> fx, fy, fz, fx_prev, fy_prev, fz_prev;
+
+        // Symmetric adjacency (CSR) of the graph, with edge weights.
+        std::vector<uint64_t> adj_offsets; // Also the cost prefix of attraction.
+        std::vector<nid_t> adj_targets;
+        std::vector<float> adj_weights;
+
+        // Per cell (indexed by cell id, so bodies' entries are unused).
+        std::vector<float> node_x, node_y, node_z, node_mass;
+        std::vector<int> countl, sortl;
+
+        // Interactions of each body in the last traversal, and the
+        // resulting cost prefix of bodies in tree (sorted) order.
+        std::vector<uint32_t> body_cost;
+        std::vector<uint64_t> repulsion_cost_prefix;
+        std::unique_ptr<std::atomic<int>[]> childl;  // 8 per cell.
+        std::unique_ptr<std::atomic<int>[]> startl;
+        std::unique_ptr<std::atomic<int>[]> readyl;  // cell summarized?
+
+        float radius;
+        std::atomic<int> bottom;
+        std::atomic<int> maxdepth;
+        std::atomic<bool> out_of_cells;
+
+        void allocateCells(int nnodes);
+
+        // Phases of one step, cf. the kernels in RPBHKernels.cu and RPFA2Kernels.cu.
+        // Methods taking a `tid' run on all threads at once, the others
+        // process a range of bodies (or cells).
+        void gravityAndAttraction(int begin, int end);
+        void boundingBox();
+        void clearChildren(int begin, int end);
+        void buildTree(int tid);
+        void clearCells(int begin, int end);
+        void summarize(int tid);
+        void sortBodies(int tid);
+        void computeRepulsion(int begin, int end);
+        void updateSpeeds();
+        // Also returns the largest and the summed distance moved.
+        void displace(int begin, int end, float &max_displacement, double &sum_displacement);
+
+        // Partial sums of the speed reduction, per thread.
+        std::vector<float> swg_partial, etra_partial;
+    };
+}
+
+#endif /* RPCPUBHForceAtlas2_hpp */
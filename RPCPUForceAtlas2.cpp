@@ -22,11 +22,14 @@
 */
 
 #include "RPCPUForceAtlas2.hpp"
+#include "RPFA2Math.hpp"
 #include <stdlib.h>
 #include <math.h>
 #include <limits>
 #include <cmath>
 #include <chrono>
+#include <algorithm>
+#include <mutex>
 
 
 
@@ -58,10 +61,17 @@ namespace RPGraph
 */
     CPUForceAtlas2::CPUForceAtlas2(GraphLayout &layout, bool use_barneshut,
                                bool strong_gravity, float gravity,
-                               float scale)
+                               float scale, ThreadPool *pool)
 :  ForceAtlas2(layout, use_barneshut, strong_gravity, gravity, scale),
-   BH_Approximator{layout.getCenter(), layout.getSpan()+10, theta}
+   BH_Approximator{layout.getCenter(), layout.getSpan()+10, theta},
+   pool{pool}
 {
+    if (this->pool == nullptr)
+    {
+        own_pool.reset(new ThreadPool());
+        this->pool = own_pool.get();
+    }
+
     forces      = (Real3DVector *)malloc(sizeof(Real3DVector) * layout.graph.num_nodes());
     prev_forces = (Real3DVector *)malloc(sizeof(Real3DVector) * layout.graph.num_nodes());
     for (nid_t n = 0; n < layout.graph.num_nodes(); ++n)
@@ -69,6 +79,34 @@ namespace RPGraph
         forces[n]      = Real3DVector(0.0f, 0.0f, 0.0f); // Initialize with 0s in all three dimensions
         prev_forces[n] = Real3DVector(0.0f, 0.0f, 0.0f); // Initialize with 0s in all three dimensions
     }
+
+    // Store every edge with both of its endpoints.
+    const nid_t num_nodes = layout.graph.num_nodes();
+    adj_offsets.assign(num_nodes+1, 0);
+    for (nid_t n = 0; n < num_nodes; ++n)
+    {
+        for (nid_t t : layout.graph.neighbors_with_geq_id(n))
+        {
+            adj_offsets[n+1]++;
+            adj_offsets[t+1]++;
+        }
+    }
+    for (nid_t n = 0; n < num_nodes; ++n) adj_offsets[n+1] += adj_offsets[n];
+
+    adj_targets.resize(adj_offsets[num_nodes]);
+    adj_weights.resize(adj_offsets[num_nodes]);
+    std::vector<uint64_t> fill(adj_offsets.begin(), adj_offsets.end()-1);
+    for (nid_t n = 0; n < num_nodes; ++n)
+    {
+        for (nid_t t : layout.graph.neighbors_with_geq_id(n))
+        {
+            const float edge_weight = layout.graph.get_edge_weight(n, t);
+            adj_targets[fill[n]] = t;
+            adj_weights[fill[n]++] = edge_weight;
+            adj_targets[fill[t]] = n;
+            adj_weights[fill[t]++] = edge_weight;
+        }
+    }
 }
 
 CPUForceAtlas2::~CPUForceAtlas2()
@@ -143,12 +181,14 @@ CPUForceAtlas2::~CPUForceAtlas2()
     }
 */
 
+// Only writes to forces[n], so nodes can be processed in parallel.
 void CPUForceAtlas2::apply_attract(nid_t n)
 {
     Real3DVector f = Real3DVector(0.0, 0.0, 0.0); // Initialize with 0s in all three dimensions
-    for (nid_t t : layout.graph.neighbors_with_geq_id(n))
+    for (uint64_t e = adj_offsets[n]; e < adj_offsets[n+1]; ++e)
     {
-        float edge_weight = layout.graph.get_edge_weight(n, t);
+        const nid_t t = adj_targets[e];
+        const float edge_weight = adj_weights[e];
 
         // Here we define the magnitude of the attractive force `f_a'
         // *divided* by the length distance between `n' and `t', i.e. `f_a_over_d'
@@ -164,12 +204,6 @@ void CPUForceAtlas2::apply_attract(nid_t n)
         }
 
         f += layout.getDistanceVector(n, t) * f_a_over_d * edge_weight; // Ensure this is a 3D vector
-
-        //TODO: this is temporary, but required due to
-        //      iteration over neighbors_with_geq_id
-        forces[t] += layout.getDistanceVector(n, t) * (-f_a_over_d) * edge_weight; // Ensure this is a 3D vector
-
-        // forces[n] += getNormalizedDistanceVector(n, t) * f_a(n, t); // If required, uncomment and ensure 3D compatibility
     }
     forces[n] += f;
 }
@@ -179,27 +213,27 @@ void CPUForceAtlas2::apply_attract(nid_t n)
 
 
 //Modify for z coordinate- 14th November
+// Exact repulsion. With Barnes-Hut, repulsion is applied to all nodes
+// at once by apply_repulsion_bh().
 void CPUForceAtlas2::apply_repulsion(nid_t n)
 {
-    if (use_barneshut)
-    {
-        // Assuming BH_Approximator is updated for 3D
-        forces[n] += (BH_Approximator.approximateForce(layout.getCoordinate(n), mass(n), theta) * k_r);
-    }
-    else
+    for (nid_t t = 0; t < layout.graph.num_nodes(); ++t)
     {
-        for (nid_t t = 0; t < layout.graph.num_nodes(); ++t)
-        {
-            if (n == t) continue;
-            float distance = layout.getDistance(n, t); // Ensure this calculates 3D distance
-            float f_r = distance == 0.0 ? std::numeric_limits<float>::max() : k_r * mass(n) * mass(t) / (distance * distance);
-            
-            // Ensure getDistanceVector returns a 3D vector and handles 3D distance calculation
-            forces[n] += layout.getDistanceVector(n, t) * f_r;
-        }
+        if (n == t) continue;
+        float distance = layout.getDistance(n, t); // Ensure this calculates 3D distance
+        float f_r = distance == 0.0 ? std::numeric_limits<float>::max() : k_r * mass(n) * mass(t) / (distance * distance);
+
+        // Away from `t', i.e. against the distance vector from `n' to `t'.
+        forces[n] += layout.getDistanceVector(n, t) * (-f_r);
     }
 }
 
+void CPUForceAtlas2::apply_repulsion_bh()
+{
+    // Node ids equal particle ids, since rebuild_bh() inserts in order.
+    BH_Approximator.approximateForces(forces, theta, k_r, pool);
+}
+
 //Modify for z coordinate- 14th November
 /*
     void CPUForceAtlas2::apply_gravity(nid_t n)
@@ -251,7 +285,8 @@ void CPUForceAtlas2::apply_repulsion(nid_t n)
     // Eq. (8)
     float CPUForceAtlas2::swg(nid_t n)
     {
-        return (forces[n] - prev_forces[n]).magnitude();
+        return fa2_swinging(forces[n].x, forces[n].y, forces[n].z,
+                            prev_forces[n].x, prev_forces[n].y, prev_forces[n].z);
     }
 
     // Eq. (9)
@@ -263,65 +298,52 @@ void CPUForceAtlas2::apply_repulsion(nid_t n)
     // Eq. (12)
     float CPUForceAtlas2::tra(nid_t n)
     {
-        return (forces[n] + prev_forces[n]).magnitude() / 2.0;
+        return fa2_traction(forces[n].x, forces[n].y, forces[n].z,
+                            prev_forces[n].x, prev_forces[n].y, prev_forces[n].z);
     }
 
     void CPUForceAtlas2::updateSpeeds()
     {
-        // The following speed-update procedure for ForceAtlas2 follows
-        // the one by Gephi:
-        // https://github.com/gephi/gephi/blob/6efb108718fa67d1055160f3a18b63edb4ca7be2/modules/LayoutPlugin/src/main/java/org/gephi/layout/plugin/forceAtlas2/ForceAtlas2.java
-
         // `Auto adjust speeds'
-        float total_swinging = 0.0;
-        float total_effective_traction = 0.0;
-        for (nid_t nid = 0; nid < layout.graph.num_nodes(); ++nid)
-        {
-            total_swinging += mass(nid) * swg(nid); // Eq. (11)
-            total_effective_traction += mass(nid) * tra(nid); // Eq. (13)
-        }
-
-        // We want to find the right jitter tollerance for this graph,
-        // such that totalSwinging < tolerance * totalEffectiveTraction
-
-        float estimated_optimal_jitter_tollerance = 0.05 * std::sqrt(layout.graph.num_nodes());
-        float minJT = std::sqrt(estimated_optimal_jitter_tollerance);
-        float jt = jitter_tolerance * fmaxf(minJT,
-                                           fminf(k_s_max,
-                                                 estimated_optimal_jitter_tollerance * total_effective_traction / powf(layout.graph.num_nodes(), 2.0)
-                                                 )
-                                           );
-        float min_speed_efficiency = 0.05;
-
-        // `Protect against erratic behavior'
-        if (total_swinging / total_effective_traction > 2.0)
-        {
-            if (speed_efficiency > min_speed_efficiency) speed_efficiency *= 0.5;
-            jt = fmaxf(jt, jitter_tolerance);
-        }
-
-        // `Speed efficiency is how the speed really corrosponds to the swinging vs. convergence tradeoff.'
-        // `We adjust it slowly and carefully'
-        float targetSpeed = jt * speed_efficiency * total_effective_traction / total_swinging;
-
-        if (total_swinging > jt * total_effective_traction)
+        // Partial sums are taken over fixed blocks of nodes, such that
+        // the totals don't depend on how the blocks are scheduled.
+        const nid_t num_nodes = layout.graph.num_nodes();
+        const nid_t block_size = 4096;
+        const nid_t num_blocks = (num_nodes + block_size - 1) / block_size;
+        std::vector<float> block_swinging(num_blocks), block_traction(num_blocks);
+
+        pool->parallel_for(num_blocks, [&](size_t begin, size_t end)
         {
-            if (speed_efficiency > min_speed_efficiency)
+            for (size_t b = begin; b < end; ++b)
             {
-                speed_efficiency *= 0.7;
+                float swinging = 0.0, traction = 0.0;
+                const nid_t last = std::min((nid_t)((b+1) * block_size), num_nodes);
+                for (nid_t nid = b * block_size; nid < last; ++nid)
+                {
+                    swinging += mass(nid) * swg(nid); // Eq. (11)
+                    traction += mass(nid) * tra(nid); // Eq. (13)
+                }
+                block_swinging[b] = swinging;
+                block_traction[b] = traction;
             }
-        }
-        else if (global_speed < 1000)
+        });
+
+        float total_swinging = 0.0;
+        float total_effective_traction = 0.0;
+        for (nid_t b = 0; b < num_blocks; ++b)
         {
-            speed_efficiency *= 1.3;
+            total_swinging += block_swinging[b];
+            total_effective_traction += block_traction[b];
         }
 
-        // `But the speed shouldn't rise much too quickly, ... would make convergence drop dramatically'.
-        float max_rise = 0.5;
-        global_speed += fminf(targetSpeed - global_speed, max_rise * global_speed);
+        fa2_update_speeds(total_swinging, total_effective_traction,
+                          layout.graph.num_nodes(), jitter_tolerance, k_s_max,
+                          speed_efficiency, global_speed);
+        last_step.total_swinging = total_swinging;
+        last_step.total_traction = total_effective_traction;
     }
 
-    void CPUForceAtlas2::apply_displacement(nid_t n)
+    float CPUForceAtlas2::apply_displacement(nid_t n)
     {
         if (prevent_overlap)
         {
@@ -332,8 +354,9 @@ void CPUForceAtlas2::apply_repulsion(nid_t n)
         else
         {
 
-            float factor = global_speed / (1.0 + std::sqrt(global_speed * swg(n)));
+            float factor = fa2_displacement_factor(global_speed, swg(n)) * temperatureOf(n);
             layout.moveNode(n, forces[n] * factor);
+            return forces[n].magnitude() * factor;
         }
     }
 
@@ -341,35 +364,128 @@ void CPUForceAtlas2::apply_repulsion(nid_t n)
     {
         BH_Approximator.reset(layout.getCenter(), layout.getSpan()+10);
 
+        // Removed nodes are inserted too, without mass, so that particle
+        // ids stay node ids.
         for (nid_t n = 0; n < layout.graph.num_nodes(); ++n)
-        {
-            BH_Approximator.insertParticle(layout.getCoordinate(n),
-                                           layout.graph.degree(n)+1);
-        }
+            BH_Approximator.insertParticle(layout.getCoordinate(n), mass(n));
+        BH_Approximator.summarize(pool);
+        last_step.tree_depth = BH_Approximator.depth();
+        last_step.tree_cells = BH_Approximator.numCells();
     }
 
     void CPUForceAtlas2::doStep()
     {
-        if (use_barneshut) rebuild_bh();
+        if (use_barneshut)
+        {
+            rebuild_bh();
+            apply_repulsion_bh();
+        }
 
-        for (nid_t n = 0; n < layout.graph.num_nodes(); ++n)
+        // Attraction dominates the cost per node, so nodes are
+        // scheduled by degree.
+        pool->parallel_for(layout.graph.num_nodes(), [&](size_t begin, size_t end)
+        {
+            for (nid_t n = begin; n < end; ++n)
+            {
+                apply_gravity(n);
+                apply_attract(n);
+            }
+        }, adj_offsets.data());
+
+        if (not use_barneshut)
         {
-            apply_gravity(n);
-            apply_attract(n);
-            apply_repulsion(n);
+            pool->parallel_for(layout.graph.num_nodes(), [&](size_t begin, size_t end)
+            {
+                for (nid_t n = begin; n < end; ++n) apply_repulsion(n);
+            });
         }
 
         updateSpeeds();
 
-        for (nid_t n = 0; n < layout.graph.num_nodes(); ++n)
+        std::mutex displacement_mutex;
+        float max_displacement = 0.0f;
+        double sum_displacement = 0.0;
+        pool->parallel_for(layout.graph.num_nodes(), [&](size_t begin, size_t end)
         {
-            apply_displacement(n);
-            prev_forces[n]  = forces[n];
-            forces[n]       = Real3DVector(0.0f, 0.0f, 0.0f);//Modify for z coordinate- 14th November
-        }
+            float range_max = 0.0f;
+            double range_sum = 0.0;
+            for (nid_t n = begin; n < end; ++n)
+            {
+                const float d = apply_displacement(n);
+                range_max = std::max(range_max, d);
+                range_sum += d;
+                prev_forces[n]  = forces[n];
+                forces[n]       = Real3DVector(0.0f, 0.0f, 0.0f);//Modify for z coordinate- 14th November
+            }
+            std::lock_guard<std::mutex> lock(displacement_mutex);
+            max_displacement = std::max(max_displacement, range_max);
+            sum_displacement += range_sum;
+        });
+        last_step.max_displacement = max_displacement;
+        last_step.mean_displacement = layout.graph.num_nodes() > 0 ? sum_displacement / layout.graph.num_nodes() : 0.0f;
         iteration++;
     }
 
     void CPUForceAtlas2::sync_layout() {}
 
+    void CPUForceAtlas2::setThreadPool(ThreadPool *pool)
+    {
+        this->pool = pool;
+    }
+
+    void CPUForceAtlas2::getState(std::vector<float> &positions,
+                                  std::vector<float> &prev_forces)
+    {
+        const nid_t num_nodes = layout.graph.num_nodes();
+        positions.resize(3 * (size_t)num_nodes);
+        prev_forces.resize(3 * (size_t)num_nodes);
+        for (nid_t n = 0; n < num_nodes; ++n)
+        {
+            positions[3*n]   = layout.getX(n);
+            positions[3*n+1] = layout.getY(n);
+            positions[3*n+2] = layout.getZ(n);
+            prev_forces[3*n]   = this->prev_forces[n].x;
+            prev_forces[3*n+1] = this->prev_forces[n].y;
+            prev_forces[3*n+2] = this->prev_forces[n].z;
+        }
+    }
+
+    void CPUForceAtlas2::setState(const std::vector<float> &positions,
+                                  const std::vector<float> &prev_forces)
+    {
+        for (nid_t n = 0; n < layout.graph.num_nodes(); ++n)
+        {
+            layout.setX(n, positions[3*n]);
+            layout.setY(n, positions[3*n+1]);
+            layout.setZ(n, positions[3*n+2]);
+            this->prev_forces[n] = Real3DVector(prev_forces[3*n], prev_forces[3*n+1],
+                                                prev_forces[3*n+2]);
+        }
+    }
+
+    // Masses are the degrees of the graph, so only the adjacency and
+    // the arrays of new nodes need updating.
+    void CPUForceAtlas2::graphChanged(nid_t old_num_nodes,
+                                      const std::vector<std::pair<nid_t, nid_t>> &changed_edges)
+    {
+        const nid_t num_nodes = layout.graph.num_nodes();
+        if (num_nodes > old_num_nodes)
+        {
+            forces      = (Real3DVector *)realloc(forces, sizeof(Real3DVector) * num_nodes);
+            prev_forces = (Real3DVector *)realloc(prev_forces, sizeof(Real3DVector) * num_nodes);
+            for (nid_t n = old_num_nodes; n < num_nodes; ++n)
+            {
+                forces[n]      = Real3DVector(0.0f, 0.0f, 0.0f);
+                prev_forces[n] = Real3DVector(0.0f, 0.0f, 0.0f);
+            }
+        }
+        updateAdjacency(adj_offsets, adj_targets, adj_weights, changed_edges);
+    }
+
+    std::vector<uint32_t> CPUForceAtlas2::interactionCounts()
+    {
+        if (not use_barneshut) return std::vector<uint32_t>();
+        return BH_Approximator.interactionCounts();
+    }
+
 }
@@ -25,22 +25,47 @@
 #define RPCPUForceAtlas2_hpp
 
 #include "RPForceAtlas2.hpp"
+#include "RPThreadPool.hpp"
+#include <memory>
+#include <vector>
 
 namespace RPGraph
 {
     class CPUForceAtlas2 : public ForceAtlas2
     {
     public:
+        // Each phase of a step runs on `pool'. If no pool is
+        // given, one with all hardware threads is created.
         CPUForceAtlas2(GraphLayout &layout, bool use_barneshut,
-                       bool strong_gravity, float gravity, float scale);
+                       bool strong_gravity, float gravity, float scale,
+                       ThreadPool *pool = nullptr);
         ~CPUForceAtlas2();
         void doStep() override;
         void sync_layout() override;
+        std::vector<uint32_t> interactionCounts() override;
+        void setThreadPool(ThreadPool *pool) override;
+
+    protected:
+        void getState(std::vector<float> &positions,
+                      std::vector<float> &prev_forces) override;
+        void setState(const std::vector<float> &positions,
+                      const std::vector<float> &prev_forces) override;
+        void graphChanged(nid_t old_num_nodes,
+                          const std::vector<std::pair<nid_t, nid_t>> &changed_edges) override;
 
     private:
         Real3DVector *forces, *prev_forces;//Modify for z coordinate- 14th November
         BarnesHutApproximator BH_Approximator;
 
+        std::unique_ptr<ThreadPool> own_pool;
+        ThreadPool *pool;
+
+        // Symmetric adjacency (CSR) of the graph, with edge weights, such
+        // that attraction on a node can be computed by a single thread.
+        std::vector<uint64_t> adj_offsets; // Also the cost prefix of apply_attract.
+        std::vector<nid_t> adj_targets;
+        std::vector<float> adj_weights;
+
         float swg(nid_t n);            // swinging ..
         float s(nid_t n);              // swinging as well ..
         float tra(nid_t n);            // traction ..
@@ -48,10 +73,11 @@ namespace RPGraph
         // Substeps of one step in layout process.
         void rebuild_bh();
         void apply_repulsion(nid_t n);
+        void apply_repulsion_bh();
         void apply_gravity(nid_t n);
         void apply_attract(nid_t n);
         void updateSpeeds();
-        void apply_displacement(nid_t n);
+        float apply_displacement(nid_t n); // Returns the distance moved.
     };
 }
 #endif
@@ -29,6 +29,17 @@
 #include <cuda_runtime_api.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdexcept>
+
+// Error of the CUDA runtime, thrown by assert_d rather than exiting once
+// cuda_errors_throw is set (by the C interface, which must not exit).
+// Defined in RPGPUForceAtlas2.cu.
+struct CudaError : std::runtime_error
+{
+    cudaError_t code;
+    CudaError(cudaError_t code) : std::runtime_error(cudaGetErrorString(code)), code{code} {}
+};
+extern bool cuda_errors_throw;
 
 #define cudaCatchError(ans) { assert_d((ans), __FILE__, __LINE__); }
 inline void assert_d(cudaError_t code, const char *file, int line, bool abort=true)
@@ -36,6 +47,7 @@ inline void assert_d(cudaError_t code, const char *file, int line, bool abort=tr
     if (code != cudaSuccess)
     {
         fprintf(stderr,"error: (GPUassert) %s (error %d). %s:%d\n", cudaGetErrorString(code), code, file, line);
+        if (cuda_errors_throw) throw CudaError(code);
         if (abort) exit(code);
     }
 }
@@ -0,0 +1,203 @@
+/*
+ ==============================================================================
+
+ RPDensityMap.cpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#include "RPDensityMap.hpp"
+#include "RPPNGEncoder.hpp"
+#include <math.h>
+#include <cmath>
+#include <algorithm>
+
+namespace RPGraph
+{
+    static void parallel_range(ThreadPool *pool, size_t n, const ThreadPool::RangeFn &f)
+    {
+        if (pool) pool->parallel_for(n, f);
+        else f(0, n);
+    }
+
+    // Control points of the color map, evenly spaced over [0, 1].
+    static const float color_map[][3] =
+    {
+        {0.00f, 0.00f, 0.00f},
+        {0.50f, 0.00f, 0.15f},
+        {0.90f, 0.20f, 0.05f},
+        {1.00f, 0.65f, 0.00f},
+        {1.00f, 0.95f, 0.40f},
+        {1.00f, 1.00f, 1.00f},
+    };
+    static const int color_map_size = sizeof(color_map) / sizeof(color_map[0]);
+
+    DensityMap::DensityMap(int width, int height, int num_threads)
+    : image_w{std::max(width, 1)}, image_h{std::max(height, 1)}, max_density{0.0f}
+    {
+        // A few bands per thread, such that they balance.
+        num_threads = std::max(num_threads, 1);
+        num_bands = std::min(image_h, 4 * num_threads);
+        band_rows = (image_h + num_bands - 1) / num_bands;
+        num_bands = (image_h + band_rows - 1) / band_rows;
+        points.resize((size_t) num_threads * num_bands);
+    }
+
+    int DensityMap::width() const
+    {
+        return image_w;
+    }
+
+    int DensityMap::height() const
+    {
+        return image_h;
+    }
+
+    void DensityMap::add(int thread, float x, float y, float weight)
+    {
+        if (!std::isfinite(x) || !std::isfinite(y)) return;
+
+        // Pixel centers are at integer coordinates.
+        const float fx = floorf(x), fy = floorf(y);
+        if (fx < -1.0f || fy < -1.0f || fx >= image_w || fy >= image_h) return;
+
+        // Into the bands of both rows the point is spread over.
+        const int y0 = (int) fy;
+        const int first = std::max(y0, 0) / band_rows;
+        const int last = std::min(y0 + 1, image_h - 1) / band_rows;
+        for (int band = first; band <= last; ++band)
+            points[(size_t) thread * num_bands + band].push_back(Point{x, y, weight});
+    }
+
+    void DensityMap::render(float sigma, ThreadPool *pool)
+    {
+        const size_t num_pixels = (size_t) image_w * image_h;
+        const size_t num_threads = points.size() / num_bands;
+        density.assign(num_pixels, 0.0f);
+        parallel_range(pool, num_bands, [&](size_t begin, size_t end)
+        {
+            for (size_t band = begin; band < end; ++band)
+            {
+                const int row_begin = band * band_rows;
+                const int row_end = std::min(row_begin + band_rows, image_h);
+                for (size_t thread = 0; thread < num_threads; ++thread)
+                {
+                    for (const Point &p : points[thread * num_bands + band])
+                    {
+                        const float fx = floorf(p.x), fy = floorf(p.y);
+                        const int x0 = (int) fx, y0 = (int) fy;
+                        const float tx = p.x - fx, ty = p.y - fy;
+                        const float w[4] = {(1-tx) * (1-ty), tx * (1-ty), (1-tx) * ty, tx * ty};
+                        for (int i = 0; i < 4; ++i)
+                        {
+                            const int px = x0 + (i & 1), py = y0 + (i >> 1);
+                            if (px < 0 || px >= image_w || py < row_begin || py >= row_end) continue;
+                            density[(size_t) py * image_w + px] += p.weight * w[i];
+                        }
+                    }
+                }
+            }
+        });
+
+        // Separable Gaussian, truncated at 3 sigma, first along rows and
+        // then along columns. Both passes run over rows, which keeps the
+        // second one cache friendly.
+        if (sigma > 0.0f)
+        {
+            const int radius = (int) ceilf(3.0f * sigma);
+            std::vector<float> kernel(2*radius + 1);
+            float kernel_sum = 0.0f;
+            for (int k = -radius; k <= radius; ++k)
+            {
+                kernel[k + radius] = expf(-0.5f * k * k / (sigma * sigma));
+                kernel_sum += kernel[k + radius];
+            }
+            for (float &k : kernel) k /= kernel_sum;
+
+            std::vector<float> blurred(num_pixels);
+            parallel_range(pool, image_h, [&](size_t begin, size_t end)
+            {
+                for (size_t y = begin; y < end; ++y)
+                {
+                    const float *in = &density[y * image_w];
+                    float *out = &blurred[y * image_w];
+                    for (int x = 0; x < image_w; ++x)
+                    {
+                        float sum = 0.0f;
+                        const int k_lo = std::max(-radius, -x);
+                        const int k_hi = std::min(radius, image_w - 1 - x);
+                        for (int k = k_lo; k <= k_hi; ++k) sum += kernel[k + radius] * in[x + k];
+                        out[x] = sum;
+                    }
+                }
+            });
+            parallel_range(pool, image_h, [&](size_t begin, size_t end)
+            {
+                for (size_t y = begin; y < end; ++y)
+                {
+                    float *out = &density[y * image_w];
+                    std::fill(out, out + image_w, 0.0f);
+                    const int k_lo = std::max(-radius, -(int) y);
+                    const int k_hi = std::min(radius, image_h - 1 - (int) y);
+                    for (int k = k_lo; k <= k_hi; ++k)
+                    {
+                        const float *in = &blurred[(y + k) * image_w];
+                        const float w = kernel[k + radius];
+                        for (int x = 0; x < image_w; ++x) out[x] += w * in[x];
+                    }
+                }
+            });
+        }
+
+        max_density = 0.0f;
+        for (float d : density) max_density = std::max(max_density, d);
+    }
+
+    void DensityMap::colorMap8(uint8_t *rgb, ThreadPool *pool) const
+    {
+        const float scale = max_density > 0.0f ? 1.0f / log1pf(max_density) : 0.0f;
+        parallel_range(pool, image_h, [&](size_t begin, size_t end)
+        {
+            for (size_t row = begin; row < end; ++row)
+            {
+                const int y = image_h - 1 - row;
+                for (int x = 0; x < image_w; ++x)
+                {
+                    const float d = density[(size_t) y * image_w + x];
+                    const float t = std::min(std::max(log1pf(d) * scale, 0.0f), 1.0f)
+                                  * (color_map_size - 1);
+                    const int i = std::min((int) t, color_map_size - 2);
+                    const float f = t - i;
+                    uint8_t *out = &rgb[(row * image_w + x) * 3];
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        const float v = color_map[i][c] + (color_map[i+1][c] - color_map[i][c]) * f;
+                        out[c] = (uint8_t) (v * 255.0f + 0.5f);
+                    }
+                }
+            }
+        });
+    }
+
+    void DensityMap::writePNG(std::string path, int level, ThreadPool *pool) const
+    {
+        std::vector<uint8_t> rgb((size_t) image_w * image_h * 3);
+        colorMap8(rgb.data(), pool);
+        RPGraph::writePNG(path, rgb.data(), image_w, image_h, level, pool);
+    }
+}
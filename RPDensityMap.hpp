@@ -0,0 +1,84 @@
+/*
+ ==============================================================================
+
+ RPDensityMap.hpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#ifndef RPDensityMap_hpp
+#define RPDensityMap_hpp
+
+#include "RPThreadPool.hpp"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace RPGraph
+{
+    // Renders the density of weighted points, e.g. nodes and samples along
+    // edges, as an image. Points are splatted into a histogram with a cell
+    // per pixel, which is then blurred with a Gaussian and color mapped.
+    // Each thread collects its points by band of rows, and each band of
+    // the histogram is then filled by a single thread, so rendering costs
+    // O(points + pixels) time and memory, regardless of how long the edges
+    // are on screen or how many threads there are.
+    // Pixel (0, 0) is the bottom left of the image, as in Rasterizer.
+    class DensityMap
+    {
+    public:
+        // Points may be added by `num_threads' threads.
+        DensityMap(int width, int height, int num_threads = 1);
+
+        // Adds `weight' at (x, y), spread bilinearly over the four nearest
+        // pixels, on behalf of `thread'. Different threads may add at the
+        // same time.
+        void add(int thread, float x, float y, float weight);
+
+        // Splats the points into the histogram and blurs it with a Gaussian
+        // of standard deviation `sigma' pixels (none if sigma <= 0).
+        void render(float sigma, ThreadPool *pool = nullptr);
+
+        // Maps log(1 + density) linearly onto a black-red-yellow-white
+        // color map, as interleaved RGB with 8 bits per channel. Rows run
+        // from the top of the image to its bottom.
+        void colorMap8(uint8_t *rgb, ThreadPool *pool = nullptr) const;
+
+        // Writes the color mapped image, see RPGraph::writePNG for `level'.
+        void writePNG(std::string path, int level = 6, ThreadPool *pool = nullptr) const;
+
+        int width() const;
+        int height() const;
+
+    private:
+        struct Point
+        {
+            float x, y, weight;
+        };
+
+        const int image_w, image_h;
+        int num_bands, band_rows;
+        // Points by thread and band, at [thread * num_bands + band]. Points
+        // spread over rows of two bands are in both.
+        std::vector<std::vector<Point>> points;
+        std::vector<float> density;
+        float max_density;
+    };
+}
+
+#endif /* RPDensityMap_hpp */
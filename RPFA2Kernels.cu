@@ -24,11 +24,14 @@
 #include <stdio.h>
 #include "RPFA2Kernels.cuh"
 #include "RPBHFA2LaunchParameters.cuh"
+#include "RPFA2Math.hpp"
 
 /// Some variables for FA2 related to `speed'
 static __device__ float k_s_maxd = 10.0;
 static __device__ float global_speedd = 1.0;
 static __device__ float speed_efficiencyd = 1.0;
+static __device__ float total_swingingd = 0.0;
+static __device__ float total_tractiond = 0.0;
 static __device__ float jitter_toleranced = 1.0;
 static __device__ unsigned int blkcntd_speed_kernel = 0;
 
@@ -36,8 +39,9 @@ __global__
 __launch_bounds__(THREADS6, FACTOR6)
 void GravityKernel(int nbodiesd, const float k_g, const bool strong_gravity,
                    volatile float * __restrict body_massd,
-                   volatile float2 * __restrict body_posd,
-                   volatile float * __restrict fxd, volatile float * __restrict fyd)
+                   volatile float3 * __restrict body_posd,
+                   volatile float * __restrict fxd, volatile float * __restrict fyd,
+                   volatile float * __restrict fzd)
 {
     register int i, inc;
 
@@ -47,37 +51,25 @@ void GravityKernel(int nbodiesd, const float k_g, const bool strong_gravity,
     {
         const float px = body_posd[i].x;
         const float py = body_posd[i].y;
+        const float pz = body_posd[i].z;
 
-        // `f_g' is the magnitude of gravitational force
-        float f_g;
-        if(strong_gravity)
-        {
-            f_g = k_g * body_massd[i];
-        }
-        else // weak gravity
-        {
-            if (px != 0.0 || py != 0.0)
-            {
-                f_g = k_g * body_massd[i] * rsqrtf(px*px + py*py);
-            }
-
-            else
-            {
-                f_g = 0.0;
-            }
-        }
+        // `f_g' is the magnitude of gravitational force, over distance.
+        const float f_g = RPGraph::fa2_gravity_factor(k_g, strong_gravity, body_massd[i], px, py, pz);
 
         fxd[i] += (-px * f_g);
         fyd[i] += (-py * f_g);
+        fzd[i] += (-pz * f_g);
     }
 }
 
 __global__
 __launch_bounds__(THREADS6, FACTOR6)
 void AttractiveForceKernel(int nedgesd,
-                           volatile float2 * __restrict body_posd,
+                           volatile float3 * __restrict body_posd,
                            volatile float * __restrict fxd, volatile float * __restrict fyd,
-                           volatile int * __restrict sourcesd, volatile int * __restrict targetsd)
+                           volatile float * __restrict fzd,
+                           volatile int * __restrict sourcesd, volatile int * __restrict targetsd,
+                           volatile float * __restrict weightsd)
 {
     register int i, inc, source, target;
     // iterate over all edges assigned to thread
@@ -86,37 +78,38 @@ void AttractiveForceKernel(int nedgesd,
     {
         source = sourcesd[i];
         target = targetsd[i];
+        const float w = weightsd[i];
 
-        // dx and dy are distance to between the neighbors.
+        // dx, dy and dz are distance to between the neighbors.
         const float dx = body_posd[target].x-body_posd[source].x;
         const float dy = body_posd[target].y-body_posd[source].y;
+        const float dz = body_posd[target].z-body_posd[source].z;
 
-        // Force just depends linearly on distance.
-        const float fsx = dx;
-        const float fsy = dy;
-
-        const float ftx = -dx;
-        const float fty = -dy;
-
+        // Force just depends linearly on distance (and on edge weight).
+        const float fsx = dx * w;
+        const float fsy = dy * w;
+        const float fsz = dz * w;
 
         // these memory accesses aren't coalesced...
         atomicAdd((float*)fxd+source, fsx);
         atomicAdd((float*)fyd+source, fsy);
+        atomicAdd((float*)fzd+source, fsz);
 
-        atomicAdd((float*)fxd+target, ftx);
-        atomicAdd((float*)fyd+target, fty);
+        atomicAdd((float*)fxd+target, -fsx);
+        atomicAdd((float*)fyd+target, -fsy);
+        atomicAdd((float*)fzd+target, -fsz);
     }
 }
 
 __global__
 __launch_bounds__(THREADS1, FACTOR1)
 void SpeedKernel(int nbodiesd,
-                 volatile float * __restrict fxd , volatile float * __restrict fyd,
-                 volatile float * __restrict fx_prevd , volatile float * __restrict fy_prevd,
+                 volatile float * __restrict fxd , volatile float * __restrict fyd, volatile float * __restrict fzd,
+                 volatile float * __restrict fx_prevd , volatile float * __restrict fy_prevd, volatile float * __restrict fz_prevd,
                  volatile float * __restrict body_massd, volatile float * __restrict swgd, volatile float * __restrict etrad)
 {
     register int i, j, k, inc;
-    register float swg_thread, swg_body, etra_thread, etra_body, dx, dy, mass;
+    register float swg_thread, etra_thread, mass;
     // setra: effective_traction (in shared mem.)
     // sswg: swing per node (in shared mem.)
     __shared__ volatile float sswg[THREADS1], setra[THREADS1];
@@ -132,16 +125,8 @@ void SpeedKernel(int nbodiesd,
     for (j = i + blockIdx.x * THREADS1; j < nbodiesd; j += inc)
     {
         mass = body_massd[j];
-
-        dx = fxd[j] - fx_prevd[j];
-        dy = fyd[j] - fy_prevd[j];
-        swg_body = sqrtf(dx*dx + dy*dy);
-        swg_thread += mass * swg_body;
-
-        dx = fxd[j] + fx_prevd[j];
-        dy = fyd[j] + fy_prevd[j];
-        etra_body = sqrtf(dx*dx + dy*dy) / 2.0;
-        etra_thread += mass * etra_body;
+        swg_thread  += mass * RPGraph::fa2_swinging(fxd[j], fyd[j], fzd[j], fx_prevd[j], fy_prevd[j], fz_prevd[j]);
+        etra_thread += mass * RPGraph::fa2_traction(fxd[j], fyd[j], fzd[j], fx_prevd[j], fy_prevd[j], fz_prevd[j]);
     }
 
     // reduction in shared memory
@@ -181,41 +166,14 @@ void SpeedKernel(int nbodiesd,
                 swg_thread  += swgd[j];
                 etra_thread += etrad[j];
             }
+
             // we need to do some calculations to derive
             // from this the new global speed
-            float estimated_optimal_jitter_tollerance = 0.05 * sqrtf(nbodiesd);
-            float minJT = sqrtf(estimated_optimal_jitter_tollerance);
-            float jt = jitter_toleranced * fmaxf(minJT,
-                                                 fminf(k_s_maxd, estimated_optimal_jitter_tollerance * etra_thread / powf(nbodiesd, 2.0)
-                                                       ));
-            float min_speed_efficiency = 0.05;
-
-            // `Protect against erratic behavior'
-            if (swg_thread / etra_thread > 2.0)
-            {
-                if (speed_efficiencyd > min_speed_efficiency) speed_efficiencyd *= 0.5;
-                jt = fmaxf(jt, jitter_toleranced);
-            }
-
-            // `Speed efficiency is how the speed really corrosponds to the swinging vs. convergence tradeoff.'
-            // `We adjust it slowly and carefully'
-            float targetSpeed = jt * speed_efficiencyd * etra_thread / swg_thread;
-
-            if (swg_thread > jt * etra_thread)
-            {
-                if (speed_efficiencyd > min_speed_efficiency)
-                {
-                    speed_efficiencyd *= 0.7;
-                }
-            }
-            else if (global_speedd < 1000)
-            {
-                speed_efficiencyd *= 1.3;
-            }
-
-            // `But the speed shouldn't rise much too quickly, ... would make convergence drop dramatically'.
-            float max_rise = 0.5;
-            global_speedd += fminf(targetSpeed - global_speedd, max_rise * global_speedd);
+            RPGraph::fa2_update_speeds(swg_thread, etra_thread, nbodiesd,
+                                       jitter_toleranced, k_s_maxd,
+                                       speed_efficiencyd, global_speedd);
+            total_swingingd = swg_thread;
+            total_tractiond = etra_thread;
         }
     }
 }
@@ -223,12 +181,12 @@ void SpeedKernel(int nbodiesd,
 __global__
 __launch_bounds__(THREADS6, FACTOR6)
 void DisplacementKernel(int nbodiesd,
-                       volatile float2 * __restrict body_posd,
-                       volatile float * __restrict fxd, volatile float * __restrict fyd,
-                       volatile float * __restrict fx_prevd, volatile float * __restrict fy_prevd)
+                       volatile float3 * __restrict body_posd,
+                       volatile float * __restrict fxd, volatile float * __restrict fyd, volatile float * __restrict fzd,
+                       volatile float * __restrict fx_prevd, volatile float * __restrict fy_prevd, volatile float * __restrict fz_prevd)
 {
     register int i, inc;
-    register float factor, swg, dx, dy, fx, fy;
+    register float factor, swg, fx, fy, fz;
     register float global_speed = global_speedd;
     // iterate over all bodies assigned to thread
     inc = blockDim.x * gridDim.x;
@@ -236,16 +194,36 @@ void DisplacementKernel(int nbodiesd,
     {
         fx = fxd[i];
         fy = fyd[i];
-        dx = fx - fx_prevd[i];
-        dy = fy - fy_prevd[i];
-        swg = sqrtf(dx*dx + dy*dy);
-        factor = global_speed / (1.0 + sqrtf(global_speed * swg));
+        fz = fzd[i];
+        swg = RPGraph::fa2_swinging(fx, fy, fz, fx_prevd[i], fy_prevd[i], fz_prevd[i]);
+        factor = RPGraph::fa2_displacement_factor(global_speed, swg);
 
         body_posd[i].x += fx * factor;
         body_posd[i].y += fy * factor;
+        body_posd[i].z += fz * factor;
         fx_prevd[i] = fx;
         fy_prevd[i] = fy;
+        fz_prevd[i] = fz;
         fxd[i] = 0.0;
         fyd[i] = 0.0;
+        fzd[i] = 0.0;
     }
 }
+
+void getSpeedState(float &global_speed, float &speed_efficiency)
+{
+    cudaMemcpyFromSymbol(&global_speed, global_speedd, sizeof(float));
+    cudaMemcpyFromSymbol(&speed_efficiency, speed_efficiencyd, sizeof(float));
+}
+
+void setSpeedState(float global_speed, float speed_efficiency)
+{
+    cudaMemcpyToSymbol(global_speedd, &global_speed, sizeof(float));
+    cudaMemcpyToSymbol(speed_efficiencyd, &speed_efficiency, sizeof(float));
+}
+
+void getSpeedTotals(float &total_swinging, float &total_traction)
+{
+    cudaMemcpyFromSymbol(&total_swinging, total_swingingd, sizeof(float));
+    cudaMemcpyFromSymbol(&total_traction, total_tractiond, sizeof(float));
+}
@@ -30,28 +30,37 @@ __global__
 __launch_bounds__(THREADS6, FACTOR6)
 void GravityKernel(int nbodiesd, const float k_g, const bool strong_gravity,
                    volatile float * __restrict body_massd,
-                   volatile float2 * __restrict body_posd,
-                   volatile float * __restrict fxd, volatile float * __restrict fyd);
+                   volatile float3 * __restrict body_posd,
+                   volatile float * __restrict fxd, volatile float * __restrict fyd,
+                   volatile float * __restrict fzd);
 
 __global__
 __launch_bounds__(THREADS6, FACTOR6)
 void AttractiveForceKernel(int nedgesd,
-                           volatile float2 * __restrict body_posd,
+                           volatile float3 * __restrict body_posd,
                            volatile float * __restrict fxd, volatile float * __restrict fyd,
-                           volatile int * __restrict sourcesd, volatile int * __restrict targetsd);
+                           volatile float * __restrict fzd,
+                           volatile int * __restrict sourcesd, volatile int * __restrict targetsd,
+                           volatile float * __restrict weightsd);
 
 __global__
 __launch_bounds__(THREADS1, FACTOR1)
 void SpeedKernel(int nbodiesd,
-                 volatile float * __restrict fxd , volatile float * __restrict fyd,
-                 volatile float * __restrict fx_prevd , volatile float * __restrict fy_prevd,
+                 volatile float * __restrict fxd , volatile float * __restrict fyd, volatile float * __restrict fzd,
+                 volatile float * __restrict fx_prevd , volatile float * __restrict fy_prevd, volatile float * __restrict fz_prevd,
                  volatile float * __restrict body_massd, volatile float * __restrict swgd, volatile float * __restrict etrad);
 
 __global__
 __launch_bounds__(THREADS6, FACTOR6)
 void DisplacementKernel(int nbodiesd,
-                       volatile float2 * __restrict body_posd,
-                       volatile float * __restrict fxd, volatile float * __restrict fyd,
-                       volatile float * __restrict fx_prevd, volatile float * __restrict fy_prevd);
+                       volatile float3 * __restrict body_posd,
+                       volatile float * __restrict fxd, volatile float * __restrict fyd, volatile float * __restrict fzd,
+                       volatile float * __restrict fx_prevd, volatile float * __restrict fy_prevd, volatile float * __restrict fz_prevd);
+
+// Copy the adaptive speed kept by SpeedKernel from and to the device.
+void getSpeedState(float &global_speed, float &speed_efficiency);
+void setSpeedState(float global_speed, float speed_efficiency);
+// Total swinging and effective traction of the last SpeedKernel.
+void getSpeedTotals(float &total_swinging, float &total_traction);
 
 #endif
@@ -0,0 +1,143 @@
+/*
+ ==============================================================================
+
+ RPFA2Math.hpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+// Per-body arithmetic of ForceAtlas2 and the Barnes-Hut octree, shared by the
+// CUDA kernels and the host code. Everything here operates on plain floats,
+// so this header compiles both with nvcc and with a regular C++ compiler.
+
+#ifndef RPFA2Math_hpp
+#define RPFA2Math_hpp
+
+#include <math.h>
+
+#ifdef __CUDACC__
+#define RP_HOST_DEVICE __host__ __device__
+#else
+#define RP_HOST_DEVICE
+#endif
+
+namespace RPGraph
+{
+    // Octant of (px, py, pz) wrt. the cell center (x, y, z), in [0, 8).
+    // Bit 0 is set for +x, bit 1 for +y and bit 2 for +z.
+    RP_HOST_DEVICE inline int bh_child_index(float x, float y, float z,
+                                             float px, float py, float pz)
+    {
+        int j = 0;
+        if (x < px) j  = 1;
+        if (y < py) j |= 2;
+        if (z < pz) j |= 4;
+        return j;
+    }
+
+    // Magnitude of the gravitational force, divided by the distance
+    // of the body to the origin.
+    RP_HOST_DEVICE inline float fa2_gravity_factor(float k_g, bool strong_gravity, float mass,
+                                                   float px, float py, float pz)
+    {
+        if (strong_gravity) return k_g * mass;
+
+        const float d2 = px*px + py*py + pz*pz;
+        return d2 == 0.0f ? 0.0f : k_g * mass / sqrtf(d2);
+    }
+
+    // Barnes-Hut repulsion between bodies (or cells) with masses m1 and m2,
+    // divided by their distance. `d2' is the (softened) squared distance.
+    RP_HOST_DEVICE inline float fa2_repulsion_factor(float k_r, float m1, float m2, float d2)
+    {
+        return k_r * m1 * m2 / d2;
+    }
+
+    // Eq. (8)
+    RP_HOST_DEVICE inline float fa2_swinging(float fx, float fy, float fz,
+                                             float fx_prev, float fy_prev, float fz_prev)
+    {
+        const float dx = fx - fx_prev;
+        const float dy = fy - fy_prev;
+        const float dz = fz - fz_prev;
+        return sqrtf(dx*dx + dy*dy + dz*dz);
+    }
+
+    // Eq. (12)
+    RP_HOST_DEVICE inline float fa2_traction(float fx, float fy, float fz,
+                                             float fx_prev, float fy_prev, float fz_prev)
+    {
+        const float dx = fx + fx_prev;
+        const float dy = fy + fy_prev;
+        const float dz = fz + fz_prev;
+        return sqrtf(dx*dx + dy*dy + dz*dz) / 2.0f;
+    }
+
+    RP_HOST_DEVICE inline float fa2_displacement_factor(float global_speed, float swinging)
+    {
+        return global_speed / (1.0f + sqrtf(global_speed * swinging));
+    }
+
+    // Updates `speed_efficiency' and `global_speed' from the total swinging and
+    // total effective traction of an iteration. This follows the procedure of Gephi:
+    // https://github.com/gephi/gephi/blob/6efb108718fa67d1055160f3a18b63edb4ca7be2/modules/LayoutPlugin/src/main/java/org/gephi/layout/plugin/forceAtlas2/ForceAtlas2.java
+    RP_HOST_DEVICE inline void fa2_update_speeds(float total_swinging, float total_effective_traction,
+                                                 int nbodies, float jitter_tolerance, float k_s_max,
+                                                 float &speed_efficiency, float &global_speed)
+    {
+        // We want to find the right jitter tollerance for this graph,
+        // such that totalSwinging < tolerance * totalEffectiveTraction
+        float estimated_optimal_jitter_tollerance = 0.05 * sqrtf(nbodies);
+        float minJT = sqrtf(estimated_optimal_jitter_tollerance);
+        float jt = jitter_tolerance * fmaxf(minJT,
+                                            fminf(k_s_max,
+                                                  estimated_optimal_jitter_tollerance * total_effective_traction / powf(nbodies, 2.0)
+                                                  )
+                                            );
+        float min_speed_efficiency = 0.05;
+
+        // `Protect against erratic behavior'
+        if (total_swinging / total_effective_traction > 2.0)
+        {
+            if (speed_efficiency > min_speed_efficiency) speed_efficiency *= 0.5;
+            jt = fmaxf(jt, jitter_tolerance);
+        }
+
+        // `Speed efficiency is how the speed really corrosponds to the swinging vs. convergence tradeoff.'
+        // `We adjust it slowly and carefully'
+        float targetSpeed = jt * speed_efficiency * total_effective_traction / total_swinging;
+
+        if (total_swinging > jt * total_effective_traction)
+        {
+            if (speed_efficiency > min_speed_efficiency)
+            {
+                speed_efficiency *= 0.7;
+            }
+        }
+        else if (global_speed < 1000)
+        {
+            speed_efficiency *= 1.3;
+        }
+
+        // `But the speed shouldn't rise much too quickly, ... would make convergence drop dramatically'.
+        float max_rise = 0.5;
+        global_speed += fminf(targetSpeed - global_speed, max_rise * global_speed);
+    }
+}
+
+#endif /* RPFA2Math_hpp */
@@ -22,6 +22,28 @@
 */
 
 #include "RPForceAtlas2.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+// Checkpoint format, in host (i.e. little endian on all platforms we build
+// for) byte order:
+//   char[8]    magic "RPFA2CP1"
+//   uint32     number of nodes
+//   uint32     number of edges
+//   int32      iteration
+//   float      global_speed, speed_efficiency
+//   uint32     length of the RNG state, followed by the state (as text,
+//              the way std::mt19937 prints itself)
+//   float[3n]  positions, x, y, z per node
+//   float[3n]  previous forces, x, y, z per node
+#define CHECKPOINT_MAGIC "RPFA2CP1"
 
 namespace RPGraph
 {
@@ -51,7 +73,11 @@ namespace RPGraph
         prevent_overlap = false;
         use_linlog = false;
 
-        layout.randomizePositions();
+        // Unless warm-started from a previous layout (see loadPositions).
+        // Then the speed starts low, and rises by at most half per step
+        // (see fa2_update_speeds), so the first steps don't scatter it.
+        if (not layout.hasPositions()) layout.randomizePositions();
+        else global_speed = 0.01;
     }
 
     ForceAtlas2::~ForceAtlas2(){};
@@ -71,8 +97,362 @@ namespace RPGraph
         k_g = g;
     }
 
+    // Removed nodes neither attract nor repel.
     float ForceAtlas2::mass(nid_t n)
     {
-        return layout.graph.degree(n) + 1.0;
+        return layout.isRemoved(n) ? 0.0 : layout.graph.degree(n) + 1.0;
+    }
+
+    std::vector<uint32_t> ForceAtlas2::interactionCounts()
+    {
+        return std::vector<uint32_t>();
+    }
+
+    void ForceAtlas2::setThreadPool(ThreadPool *) {}
+
+    int ForceAtlas2::getIteration() const
+    {
+        return iteration;
+    }
+
+    StepTelemetry ForceAtlas2::telemetry()
+    {
+        StepTelemetry t = last_step;
+        t.iteration = iteration;
+        t.global_speed = global_speed;
+        t.speed_efficiency = speed_efficiency;
+        return t;
+    }
+
+    // JSON has no NaN or infinities, so those are null.
+    static std::string json_number(float value)
+    {
+        if (not std::isfinite(value)) return "null";
+        char number[32];
+        snprintf(number, sizeof(number), "%.6g", value);
+        return number;
+    }
+
+    // Also null if negative, i.e. not tracked by the engine.
+    static std::string json_measure(float value)
+    {
+        return value < 0.0f ? "null" : json_number(value);
+    }
+
+    std::string StepTelemetry::toJSON() const
+    {
+        char line[512];
+        snprintf(line, sizeof(line),
+                 "{\"iteration\": %d, \"total_swinging\": %s, \"total_traction\": %s, "
+                 "\"global_speed\": %s, \"speed_efficiency\": %s, "
+                 "\"displacement\": {\"max\": %s, \"mean\": %s}, "
+                 "\"tree\": {\"depth\": %d, \"cells\": %u}}",
+                 iteration, json_number(total_swinging).c_str(), json_number(total_traction).c_str(),
+                 json_number(global_speed).c_str(), json_number(speed_efficiency).c_str(),
+                 json_measure(max_displacement).c_str(), json_measure(mean_displacement).c_str(),
+                 tree_depth, tree_cells);
+        return line;
+    }
+
+    void StepTelemetry::writeBinary(FILE *file) const
+    {
+        const int32_t depth = tree_depth;
+        const float values[6] = {total_swinging, total_traction, global_speed,
+                                 speed_efficiency, max_displacement, mean_displacement};
+        const int32_t it = iteration;
+        fwrite(&it, sizeof(it), 1, file);
+        fwrite(values, sizeof(values), 1, file);
+        fwrite(&depth, sizeof(depth), 1, file);
+        fwrite(&tree_cells, sizeof(tree_cells), 1, file);
+    }
+
+    static void write_or_fail(FILE *f, const void *data, size_t size, std::string path)
+    {
+        if (size > 0 and fwrite(data, size, 1, f) != 1)
+        {
+            fprintf(stderr, "error: Couldn't write checkpoint %s\n", path.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    static void read_or_fail(FILE *f, void *data, size_t size, std::string path)
+    {
+        if (size > 0 and fread(data, size, 1, f) != 1)
+        {
+            fprintf(stderr, "error: Checkpoint %s is truncated.\n", path.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    double ForceAtlas2::energy(const std::vector<std::pair<nid_t, nid_t>> &pairs)
+    {
+        sync_layout();
+        const nid_t num_nodes = layout.graph.num_nodes();
+
+        // Gravity: k_g * m * d is pulled by a constant force, strong
+        // gravity is a spring of k_g * m.
+        double gravity = 0.0;
+        for (nid_t n = 0; n < num_nodes; ++n)
+        {
+            const Coordinate p = layout.getCoordinate(n);
+            const double d2 = (double)p.x*p.x + (double)p.y*p.y + (double)p.z*p.z;
+            gravity += strong_gravity ? mass(n) * d2 / 2.0 : mass(n) * sqrt(d2);
+        }
+        gravity *= k_g;
+
+        // Attraction of magnitude w * d, or w * log(1 + d) with linlog.
+        double attraction = 0.0;
+        for (nid_t n = 0; n < num_nodes; ++n)
+        {
+            for (nid_t t : layout.graph.neighbors_with_geq_id(n))
+            {
+                const double d = layout.getDistance(n, t);
+                const double w = layout.graph.get_edge_weight(n, t);
+                attraction += use_linlog ? w * ((1.0 + d) * log1p(d) - d) : w * d * d / 2.0;
+            }
+        }
+
+        // Repulsion of magnitude k_r * m1 * m2 / d.
+        double repulsion = 0.0;
+        for (const std::pair<nid_t, nid_t> &pair : pairs)
+        {
+            const double d = std::max(layout.getDistance(pair.first, pair.second), 1e-6f);
+            repulsion -= mass(pair.first) * mass(pair.second) * log(d);
+        }
+        if (not pairs.empty())
+            repulsion *= k_r * ((double)num_nodes * (num_nodes - 1) / 2.0) / pairs.size();
+
+        return gravity + attraction + repulsion;
+    }
+
+    void ForceAtlas2::writeCheckpoint(std::string path)
+    {
+        std::vector<float> positions, prev_forces;
+        getState(positions, prev_forces);
+        const std::string rng_state = layout.randomState();
+
+        const uint32_t num_nodes = layout.graph.num_nodes();
+        const uint32_t num_edges = layout.graph.num_edges();
+        const uint32_t rng_length = rng_state.size();
+
+        // Written next to `path' first, so that it can be renamed over it.
+        const std::string tmp_path = path + ".tmp";
+        FILE *f = fopen(tmp_path.c_str(), "wb");
+        if (not f)
+        {
+            fprintf(stderr, "error: Couldn't open %s for writing.\n", tmp_path.c_str());
+            exit(EXIT_FAILURE);
+        }
+        write_or_fail(f, CHECKPOINT_MAGIC, 8, tmp_path);
+        write_or_fail(f, &num_nodes, sizeof(num_nodes), tmp_path);
+        write_or_fail(f, &num_edges, sizeof(num_edges), tmp_path);
+        write_or_fail(f, &iteration, sizeof(iteration), tmp_path);
+        write_or_fail(f, &global_speed, sizeof(global_speed), tmp_path);
+        write_or_fail(f, &speed_efficiency, sizeof(speed_efficiency), tmp_path);
+        write_or_fail(f, &rng_length, sizeof(rng_length), tmp_path);
+        write_or_fail(f, rng_state.data(), rng_length, tmp_path);
+        write_or_fail(f, positions.data(), positions.size() * sizeof(float), tmp_path);
+        write_or_fail(f, prev_forces.data(), prev_forces.size() * sizeof(float), tmp_path);
+
+        // The data must be on disk before the rename is.
+        if (fflush(f) != 0 or fsync(fileno(f)) != 0 or fclose(f) != 0)
+        {
+            fprintf(stderr, "error: Couldn't write checkpoint %s\n", tmp_path.c_str());
+            exit(EXIT_FAILURE);
+        }
+        if (rename(tmp_path.c_str(), path.c_str()) != 0)
+        {
+            fprintf(stderr, "error: Couldn't move %s to %s\n", tmp_path.c_str(), path.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        // And the rename must be on disk before the checkpoint counts.
+        const size_t slash = path.rfind('/');
+        const std::string dir_path = slash == std::string::npos ? "." : path.substr(0, std::max(slash, (size_t) 1));
+        const int dir = open(dir_path.c_str(), O_RDONLY);
+        if (dir < 0 or fsync(dir) != 0)
+        {
+            fprintf(stderr, "error: Couldn't sync directory %s\n", dir_path.c_str());
+            exit(EXIT_FAILURE);
+        }
+        close(dir);
+    }
+
+    // Opens the checkpoint at `path', positioned after its magic.
+    static FILE *open_checkpoint(std::string path)
+    {
+        FILE *f = fopen(path.c_str(), "rb");
+        if (not f)
+        {
+            fprintf(stderr, "error: No checkpoint at %s\n", path.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        char magic[8];
+        read_or_fail(f, magic, 8, path);
+        if (memcmp(magic, CHECKPOINT_MAGIC, 8) != 0)
+        {
+            fprintf(stderr, "error: %s is not a ForceAtlas2 checkpoint.\n", path.c_str());
+            exit(EXIT_FAILURE);
+        }
+        return f;
+    }
+
+    int ForceAtlas2::checkpointIteration(std::string path)
+    {
+        FILE *f = open_checkpoint(path);
+        uint32_t num_nodes, num_edges;
+        int checkpoint_iteration;
+        read_or_fail(f, &num_nodes, sizeof(num_nodes), path);
+        read_or_fail(f, &num_edges, sizeof(num_edges), path);
+        read_or_fail(f, &checkpoint_iteration, sizeof(checkpoint_iteration), path);
+        fclose(f);
+        return checkpoint_iteration;
+    }
+
+    void ForceAtlas2::readCheckpoint(std::string path)
+    {
+        FILE *f = open_checkpoint(path);
+        uint32_t num_nodes, num_edges, rng_length;
+        read_or_fail(f, &num_nodes, sizeof(num_nodes), path);
+        read_or_fail(f, &num_edges, sizeof(num_edges), path);
+        if (num_nodes != layout.graph.num_nodes() or num_edges != layout.graph.num_edges())
+        {
+            fprintf(stderr, "error: Checkpoint %s is of a graph with %u nodes and %u edges.\n",
+                    path.c_str(), num_nodes, num_edges);
+            exit(EXIT_FAILURE);
+        }
+
+        int checkpoint_iteration;
+        float checkpoint_speed, checkpoint_efficiency;
+        read_or_fail(f, &checkpoint_iteration, sizeof(checkpoint_iteration), path);
+        read_or_fail(f, &checkpoint_speed, sizeof(checkpoint_speed), path);
+        read_or_fail(f, &checkpoint_efficiency, sizeof(checkpoint_efficiency), path);
+        read_or_fail(f, &rng_length, sizeof(rng_length), path);
+        std::string rng_state(rng_length, ' ');
+        read_or_fail(f, &rng_state[0], rng_length, path);
+
+        std::vector<float> positions(3 * (size_t)num_nodes), prev_forces(3 * (size_t)num_nodes);
+        read_or_fail(f, positions.data(), positions.size() * sizeof(float), path);
+        read_or_fail(f, prev_forces.data(), prev_forces.size() * sizeof(float), path);
+        fclose(f);
+
+        iteration = checkpoint_iteration;
+        global_speed = checkpoint_speed;
+        speed_efficiency = checkpoint_efficiency;
+        layout.setRandomState(rng_state);
+        setState(positions, prev_forces);
+    }
+
+    void ForceAtlas2::updateGraph(const std::vector<std::pair<nid_t, nid_t>> &changed_edges)
+    {
+        // New nodes are placed at the current positions of their neighbours.
+        sync_layout();
+        const nid_t num_added = layout.addNodes();
+        graphChanged(layout.graph.num_nodes() - num_added, changed_edges);
+        if (not temperature.empty()) temperature.resize(layout.graph.num_nodes(), 1.0f);
+    }
+
+    void ForceAtlas2::graphChanged(nid_t, const std::vector<std::pair<nid_t, nid_t>> &)
+    {
+        fprintf(stderr, "error: This engine doesn't support graph updates.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    void ForceAtlas2::updateAdjacency(std::vector<uint64_t> &offsets, std::vector<nid_t> &targets,
+                                      std::vector<float> &weights,
+                                      const std::vector<std::pair<nid_t, nid_t>> &changed_edges)
+    {
+        const nid_t old_num_nodes = offsets.size() - 1;
+        const nid_t num_nodes = layout.graph.num_nodes();
+
+        // The other endpoints of the changed edges, per endpoint.
+        std::unordered_map<nid_t, std::vector<nid_t>> changed;
+        for (const std::pair<nid_t, nid_t> &edge : changed_edges)
+        {
+            if (edge.first == edge.second) continue;
+            changed[edge.first].push_back(edge.second);
+            changed[edge.second].push_back(edge.first);
+        }
+        for (std::pair<const nid_t, std::vector<nid_t>> &entry : changed)
+        {
+            std::sort(entry.second.begin(), entry.second.end());
+            entry.second.erase(std::unique(entry.second.begin(), entry.second.end()), entry.second.end());
+        }
+
+        // Changed edges are dropped from the lists of their endpoints, and
+        // appended again as they are now, if they still exist.
+        std::vector<uint64_t> new_offsets(num_nodes+1, 0);
+        std::vector<nid_t> new_targets;
+        std::vector<float> new_weights;
+        new_targets.reserve(targets.size() + 2 * changed_edges.size());
+        new_weights.reserve(targets.size() + 2 * changed_edges.size());
+        for (nid_t n = 0; n < num_nodes; ++n)
+        {
+            auto it = changed.find(n);
+            if (n < old_num_nodes)
+            {
+                if (it == changed.end())
+                {
+                    new_targets.insert(new_targets.end(), targets.begin() + offsets[n], targets.begin() + offsets[n+1]);
+                    new_weights.insert(new_weights.end(), weights.begin() + offsets[n], weights.begin() + offsets[n+1]);
+                }
+                else
+                {
+                    for (uint64_t e = offsets[n]; e < offsets[n+1]; ++e)
+                    {
+                        if (std::binary_search(it->second.begin(), it->second.end(), targets[e])) continue;
+                        new_targets.push_back(targets[e]);
+                        new_weights.push_back(weights[e]);
+                    }
+                }
+            }
+            if (it != changed.end())
+            {
+                for (nid_t t : it->second)
+                {
+                    if (not layout.graph.adjacent(n, t)) continue;
+                    new_targets.push_back(t);
+                    new_weights.push_back(layout.graph.get_edge_weight(n, t));
+                }
+            }
+            new_offsets[n+1] = new_targets.size();
+        }
+        offsets.swap(new_offsets);
+        targets.swap(new_targets);
+        weights.swap(new_weights);
+    }
+
+    void ForceAtlas2::focus(const std::vector<nid_t> &nodes, int hops, float cold)
+    {
+        const nid_t num_nodes = layout.graph.num_nodes();
+
+        // Breadth-first, a pass over the edges per hop, since the graph
+        // only lists the neighbours with larger ids of each node.
+        std::vector<int> distance(num_nodes, -1);
+        for (nid_t n : nodes) if (n < num_nodes) distance[n] = 0;
+        for (int d = 0; d < hops; ++d)
+        {
+            bool reached = false;
+            for (nid_t n = 0; n < num_nodes; ++n)
+            {
+                for (nid_t t : layout.graph.neighbors_with_geq_id(n))
+                {
+                    if (distance[n] == d and distance[t] < 0) distance[t] = d + 1;
+                    else if (distance[t] == d and distance[n] < 0) distance[n] = d + 1;
+                    else continue;
+                    reached = true;
+                }
+            }
+            if (not reached) break;
+        }
+
+        temperature.resize(num_nodes);
+        for (nid_t n = 0; n < num_nodes; ++n) temperature[n] = distance[n] >= 0 ? 1.0f : cold;
+    }
+
+    void ForceAtlas2::clearFocus()
+    {
+        temperature.clear();
     }
 }
@@ -26,25 +26,131 @@
 
 #include "RPLayoutAlgorithm.hpp"
 #include "RPBarnesHutApproximator.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
 
 namespace RPGraph
 {
+    // Convergence statistics of a step, see ForceAtlas2::telemetry().
+    struct StepTelemetry
+    {
+        int iteration = 0;
+        float total_swinging = 0.0f, total_traction = 0.0f;
+        float global_speed = 0.0f, speed_efficiency = 0.0f;
+        // Largest and mean distance moved by a node; -1 if the engine
+        // doesn't track them.
+        float max_displacement = -1.0f, mean_displacement = -1.0f;
+        // Of the Barnes-Hut tree of the step; 0 if none was built.
+        int tree_depth = 0;
+        uint32_t tree_cells = 0;
+
+        // One line of JSON, without a newline. Untracked values are null.
+        std::string toJSON() const;
+        // Appends a record of 36 bytes, in host byte order: int32
+        // iteration, the six floats in the order above, int32 tree_depth
+        // and uint32 tree_cells.
+        void writeBinary(FILE *file) const;
+    };
+
     class ForceAtlas2 : public LayoutAlgorithm
     {
         public:
             ForceAtlas2(GraphLayout &layout, bool use_barneshut,
                         bool strong_gravity, float gravity, float scale);
-            ~ForceAtlas2();
+            virtual ~ForceAtlas2();
 
             virtual void doStep() = 0;
             void doSteps(int n);
             void setScale(float s);
             void setGravity(float s);
             float mass(nid_t n);
+
+            // Number of Barnes-Hut interactions (cells and nodes) of each
+            // node in the last step. Empty if not recorded by the engine.
+            virtual std::vector<uint32_t> interactionCounts();
+            // Runs the following steps on `pool'. Ignored by engines that
+            // don't run on a ThreadPool.
+            virtual void setThreadPool(ThreadPool *pool);
             bool prevent_overlap, use_barneshut, use_linlog, strong_gravity;
 
+            // Number of steps done so far.
+            int getIteration() const;
+
+            // Statistics of the last step. The engines collect them while
+            // stepping, at no extra cost, so this can be called after
+            // any step.
+            virtual StepTelemetry telemetry();
+
+            // Energy of the layout, of which the forces (without overlap
+            // prevention) are the negative gradient, so lower is better.
+            // Repulsion is estimated from `pairs', a uniform sample of
+            // distinct node pairs, scaled up to all pairs; energies are
+            // only comparable for the same sample. Syncs the layout.
+            double energy(const std::vector<std::pair<nid_t, nid_t>> &pairs);
+
+            // Writes all state that changes between steps (positions,
+            // previous forces, adaptive speed, iteration and the layout's
+            // RNG) to `path', atomically: a partial checkpoint never
+            // replaces a complete one. Reading it into an engine of the
+            // same kind, for the same graph and parameters, continues the
+            // layout exactly as if it hadn't been interrupted.
+            // The format is given in the implementation.
+            void writeCheckpoint(std::string path);
+            void readCheckpoint(std::string path);
+            // The iteration the checkpoint at `path' was written after.
+            static int checkpointIteration(std::string path);
+
+            // Dynamic graphs: after edges of the graph were added, removed
+            // or reweighted, given by the UGraph ids of their endpoints,
+            // updates the masses and attraction of those endpoints rather
+            // than starting over. Nodes new to the graph are placed next to
+            // their neighbours (see GraphLayout::addNodes()). Follow with
+            // focus() to settle the change locally. Nodes removed from the
+            // layout before (see GraphLayout::removeNode()) lose their mass.
+            // Only the CPU engines support this.
+            void updateGraph(const std::vector<std::pair<nid_t, nid_t>> &changed_edges);
+
+            // Focused refinement: nodes within `hops' edges of `nodes' move
+            // at their usual speed, all others at `cold' times that, so a
+            // local change settles in a few dozen steps while the rest of
+            // the layout stays in place. Lasts until clearFocus(). Only
+            // the CPU engines support this.
+            void focus(const std::vector<nid_t> &nodes, int hops, float cold = 0.05f);
+            void clearFocus();
+
         protected:
+            // Positions and previous forces of all nodes, as x, y, z per
+            // node, as the engine holds them between steps. Engines that
+            // keep the adaptive speed elsewhere also sync global_speed and
+            // speed_efficiency here; setState is called after they are set.
+            virtual void getState(std::vector<float> &positions,
+                                  std::vector<float> &prev_forces) = 0;
+            virtual void setState(const std::vector<float> &positions,
+                                  const std::vector<float> &prev_forces) = 0;
+
+            // The engine's part of updateGraph(), called once the layout
+            // has grown from `old_num_nodes' to the nodes of the graph.
+            virtual void graphChanged(nid_t old_num_nodes,
+                                      const std::vector<std::pair<nid_t, nid_t>> &changed_edges);
+            // Updates a symmetric adjacency (CSR) of the graph, as the CPU
+            // engines keep it: the lists of the endpoints of the changed
+            // edges are updated, all others moved as they are.
+            void updateAdjacency(std::vector<uint64_t> &offsets, std::vector<nid_t> &targets,
+                                 std::vector<float> &weights,
+                                 const std::vector<std::pair<nid_t, nid_t>> &changed_edges);
+
+            // Factor of each node's displacement, see focus(). Empty
+            // unless focused.
+            std::vector<float> temperature;
+            float temperatureOf(nid_t n) const
+            {
+                return temperature.empty() ? 1.0f : temperature[n];
+            }
+
             int iteration;
+            StepTelemetry last_step; // Filled in by the engines.
             float k_r, k_g; // scalars for repulsive and gravitational force.
             float delta; // edgeweight influence.
             float global_speed;
@@ -0,0 +1,112 @@
+/*
+ ==============================================================================
+
+ RPFrameStream.cpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#include "RPFrameStream.hpp"
+#include <stdlib.h>
+#include <algorithm>
+
+namespace RPGraph
+{
+    FrameStream::FrameStream(std::string target, int width, int height,
+                             StreamFormat format, int fps)
+    : target{target}, frame_w{width}, frame_h{height}, format{format},
+      out{nullptr}, is_pipe{false}
+    {
+        if (!target.empty() && target[0] == '|')
+        {
+            is_pipe = true;
+            out = popen(target.substr(1).c_str(), "w");
+        }
+        else
+        {
+            out = fopen(target.c_str(), "wb");
+        }
+        if (!out)
+        {
+            fprintf(stderr, "error: Could not open %s for writing.\n", target.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        if (format == STREAM_Y4M)
+        {
+            fprintf(out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+                    frame_w, frame_h, std::max(fps, 1));
+            planes.resize((size_t) frame_w * frame_h * 3);
+        }
+    }
+
+    FrameStream::~FrameStream()
+    {
+        const int status = is_pipe ? pclose(out) : fclose(out);
+        if (status != 0)
+            fprintf(stderr, "warning: Closing %s failed (status %d).\n", target.c_str(), status);
+    }
+
+    int FrameStream::width() const
+    {
+        return frame_w;
+    }
+
+    int FrameStream::height() const
+    {
+        return frame_h;
+    }
+
+    void FrameStream::writeFrame(const uint8_t *rgb, ThreadPool *pool)
+    {
+        const size_t num_pixels = (size_t) frame_w * frame_h;
+        if (format == STREAM_RGB)
+        {
+            if (fwrite(rgb, 3, num_pixels, out) != num_pixels)
+            {
+                fprintf(stderr, "error: Could not write a frame to %s.\n", target.c_str());
+                exit(EXIT_FAILURE);
+            }
+            return;
+        }
+
+        // BT.601, limited range, which Y4M readers assume by default.
+        uint8_t *y_plane = &planes[0];
+        uint8_t *u_plane = &planes[num_pixels];
+        uint8_t *v_plane = &planes[2 * num_pixels];
+        const ThreadPool::RangeFn convert = [&](size_t begin, size_t end)
+        {
+            for (size_t p = begin; p < end; ++p)
+            {
+                const float r = rgb[3*p], g = rgb[3*p + 1], b = rgb[3*p + 2];
+                y_plane[p] = (uint8_t) ( 16.0f + 0.2568f * r + 0.5041f * g + 0.0979f * b + 0.5f);
+                u_plane[p] = (uint8_t) (128.0f - 0.1482f * r - 0.2910f * g + 0.4392f * b + 0.5f);
+                v_plane[p] = (uint8_t) (128.0f + 0.4392f * r - 0.3678f * g - 0.0714f * b + 0.5f);
+            }
+        };
+        if (pool) pool->parallel_for(num_pixels, convert);
+        else convert(0, num_pixels);
+
+        fputs("FRAME\n", out);
+        if (fwrite(planes.data(), 1, planes.size(), out) != planes.size())
+        {
+            fprintf(stderr, "error: Could not write a frame to %s.\n", target.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+}
@@ -0,0 +1,67 @@
+/*
+ ==============================================================================
+
+ RPFrameStream.hpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#ifndef RPFrameStream_hpp
+#define RPFrameStream_hpp
+
+#include "RPThreadPool.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace RPGraph
+{
+    // Uncompressed video: YUV4MPEG2 with 4:4:4 chroma, which video tools
+    // (e.g. ffmpeg, mpv) read directly, or raw 8-bit RGB frames, which
+    // they read given the frame size and pixel format (rgb24).
+    enum StreamFormat { STREAM_Y4M, STREAM_RGB };
+
+    // Appends frames to a single file, or to the input of a command if
+    // `target' starts with '|' (e.g. "|ffmpeg -i - movie.mp4"). Frames are
+    // interleaved 8-bit RGB with rows from top to bottom, as produced by
+    // Rasterizer::toneMap8.
+    class FrameStream
+    {
+    public:
+        FrameStream(std::string target, int width, int height,
+                    StreamFormat format = STREAM_Y4M, int fps = 25);
+        ~FrameStream();
+
+        // Converts the frame on `pool', if given, and writes it.
+        void writeFrame(const uint8_t *rgb, ThreadPool *pool = nullptr);
+
+        int width() const;
+        int height() const;
+
+    private:
+        std::string target;
+        const int frame_w, frame_h;
+        const StreamFormat format;
+        FILE *out;
+        bool is_pipe;
+        std::vector<uint8_t> planes; // Y, U and V of the current frame.
+    };
+}
+
+#endif /* RPFrameStream_hpp */
@@ -32,6 +32,8 @@
 #include "RPBHKernels.cuh"
 #include "RPFA2Kernels.cuh"
 
+bool cuda_errors_throw = false;
+
 namespace RPGraph
 {
     CUDAForceAtlas2::CUDAForceAtlas2(GraphLayout &layout, bool use_barneshut,
@@ -51,23 +53,28 @@ namespace RPGraph
         nbodies = layout.graph.num_nodes();
         nedges  = layout.graph.num_edges();
 
-        body_pos = (float2 *)malloc(sizeof(float2) * layout.graph.num_nodes());
+        body_pos = (float3 *)malloc(sizeof(float3) * layout.graph.num_nodes());
         body_mass = (float *)malloc(sizeof(float) * layout.graph.num_nodes());
         sources  = (int *)  malloc(sizeof(int)   * layout.graph.num_edges());
         targets  = (int *)  malloc(sizeof(int)   * layout.graph.num_edges());
+        weights  = (float *)malloc(sizeof(float) * layout.graph.num_edges());
         fx       = (float *)malloc(sizeof(float) * layout.graph.num_nodes());
         fy       = (float *)malloc(sizeof(float) * layout.graph.num_nodes());
+        fz       = (float *)malloc(sizeof(float) * layout.graph.num_nodes());
         fx_prev  = (float *)malloc(sizeof(float) * layout.graph.num_nodes());
         fy_prev  = (float *)malloc(sizeof(float) * layout.graph.num_nodes());
+        fz_prev  = (float *)malloc(sizeof(float) * layout.graph.num_nodes());
 
         for (nid_t n = 0; n < layout.graph.num_nodes(); ++n)
         {
-            body_pos[n] = {layout.getX(n), layout.getY(n)};
+            body_pos[n] = {layout.getX(n), layout.getY(n), layout.getZ(n)};
             body_mass[n] = ForceAtlas2::mass(n);
             fx[n] = 0.0;
             fy[n] = 0.0;
+            fz[n] = 0.0;
             fx_prev[n] = 0.0;
             fy_prev[n] = 0.0;
+            fz_prev[n] = 0.0;
         }
 
         int cur_sources_idx = 0;
@@ -78,87 +85,118 @@ namespace RPGraph
         {
             for (nid_t target_id : layout.graph.neighbors_with_geq_id(source_id))
             {
+                weights[cur_sources_idx] = layout.graph.get_edge_weight(source_id, target_id);
                 sources[cur_sources_idx++] = source_id;
                 targets[cur_targets_idx++] = target_id;
             }
         }
 
-        // GPU initialization and setup //
-        cudaDeviceProp deviceProp;
-        cudaGetDeviceProperties(&deviceProp, 0);
-
-        if (deviceProp.warpSize != WARPSIZE)
+        // Freed on errors, which throw rather than exit for the C
+        // interface, so that the destructor isn't needed.
+        childl = countl = startl = sortl = sourcesl = targetsl = nullptr;
+        weightsl = body_massl = node_massl = nullptr;
+        body_posl = node_posl = nullptr;
+        minxl = minyl = minzl = maxxl = maxyl = maxzl = nullptr;
+        fxl = fyl = fzl = fx_prevl = fy_prevl = fz_prevl = nullptr;
+        swgl = etral = nullptr;
+        try
         {
-            printf("Warpsize of device is %d, but we anticipated %d\n", deviceProp.warpSize, WARPSIZE);
-            exit(EXIT_FAILURE);
+            // GPU initialization and setup //
+            cudaDeviceProp deviceProp;
+            cudaGetDeviceProperties(&deviceProp, 0);
 
-        }
-        cudaFuncSetCacheConfig(BoundingBoxKernel, cudaFuncCachePreferShared);
-        cudaFuncSetCacheConfig(TreeBuildingKernel, cudaFuncCachePreferL1);
-        cudaFuncSetCacheConfig(ClearKernel1, cudaFuncCachePreferL1);
-        cudaFuncSetCacheConfig(ClearKernel2, cudaFuncCachePreferL1);
-        cudaFuncSetCacheConfig(SummarizationKernel, cudaFuncCachePreferShared);
-        cudaFuncSetCacheConfig(SortKernel, cudaFuncCachePreferL1);
+            if (deviceProp.warpSize != WARPSIZE)
+            {
+                printf("Warpsize of device is %d, but we anticipated %d\n", deviceProp.warpSize, WARPSIZE);
+                if (cuda_errors_throw) throw CudaError(cudaErrorInvalidDevice);
+                exit(EXIT_FAILURE);
+            }
+            cudaFuncSetCacheConfig(BoundingBoxKernel, cudaFuncCachePreferShared);
+            cudaFuncSetCacheConfig(TreeBuildingKernel, cudaFuncCachePreferL1);
+            cudaFuncSetCacheConfig(ClearKernel1, cudaFuncCachePreferL1);
+            cudaFuncSetCacheConfig(ClearKernel2, cudaFuncCachePreferL1);
+            cudaFuncSetCacheConfig(SummarizationKernel, cudaFuncCachePreferShared);
+            cudaFuncSetCacheConfig(SortKernel, cudaFuncCachePreferL1);
 #if __CUDA_ARCH__ < 300
-        cudaFuncSetCacheConfig(ForceCalculationKernel, cudaFuncCachePreferL1);
+            cudaFuncSetCacheConfig(ForceCalculationKernel, cudaFuncCachePreferL1);
 #endif
-        cudaFuncSetCacheConfig(DisplacementKernel, cudaFuncCachePreferL1);
-
-        cudaGetLastError();  // reset error value
-
-        // Allocate space on device.
-        mp_count = deviceProp.multiProcessorCount;
-        max_threads_per_block = deviceProp.maxThreadsPerBlock;
-
-        nnodes = std::max(2 * nbodies, mp_count * max_threads_per_block);
-
-        // Round up to next multiple of WARPSIZE
-        while ((nnodes & (WARPSIZE-1)) != 0) nnodes++;
-        nnodes--;
-
-        // child stores structure of the quadtree. values point to IDs.
-        cudaCatchError(cudaMalloc((void **)&childl,  sizeof(int)   * (nnodes+1) * 4));
-
-        // the following properties, for each node in the quadtree (both internal and leaf)
-        cudaCatchError(cudaMalloc((void **)&body_massl,   sizeof(float) * nbodies));
-        cudaCatchError(cudaMalloc((void **)&node_massl,   sizeof(float) * (nnodes+1)));
-        cudaCatchError(cudaMalloc((void **)&body_posl,sizeof(float2) * nbodies));
-        cudaCatchError(cudaMalloc((void **)&node_posl,    sizeof(float2) * (nnodes+1)));
-        // count contains the number of nested nodes for each node in quadtree
-        cudaCatchError(cudaMalloc((void **)&countl,  sizeof(int)   * (nnodes+1)));
-        // start contains ...
-        cudaCatchError(cudaMalloc((void **)&startl,  sizeof(int)   * (nnodes+1)));
-        cudaCatchError(cudaMalloc((void **)&sortl,   sizeof(int)   * (nnodes+1)));
-
-
-        cudaCatchError(cudaMalloc((void **)&sourcesl,sizeof(int)   * (nedges)));
-        cudaCatchError(cudaMalloc((void **)&targetsl,sizeof(int)   * (nedges)));
-        cudaCatchError(cudaMalloc((void **)&fxl,     sizeof(float) * (nbodies)));
-        cudaCatchError(cudaMalloc((void **)&fyl,     sizeof(float) * (nbodies)));
-        cudaCatchError(cudaMalloc((void **)&fx_prevl,sizeof(float) * (nbodies)));
-        cudaCatchError(cudaMalloc((void **)&fy_prevl,sizeof(float) * (nbodies)));
-
-        // Used for reduction in BoundingBoxKernel
-        cudaCatchError(cudaMalloc((void **)&maxxl,   sizeof(float) * mp_count * FACTOR1));
-        cudaCatchError(cudaMalloc((void **)&maxyl,   sizeof(float) * mp_count * FACTOR1));
-        cudaCatchError(cudaMalloc((void **)&minxl,   sizeof(float) * mp_count * FACTOR1));
-        cudaCatchError(cudaMalloc((void **)&minyl,   sizeof(float) * mp_count * FACTOR1));
-
-        // Used for reduction in SpeedKernel
-        cudaCatchError(cudaMalloc((void **)&swgl,    sizeof(float) * mp_count * FACTOR1));
-        cudaCatchError(cudaMalloc((void **)&etral,   sizeof(float) * mp_count * FACTOR1));
-
-        // Copy host data to device.
-        cudaCatchError(cudaMemcpy(body_massl, body_mass, sizeof(float) * nbodies, cudaMemcpyHostToDevice));
-        cudaCatchError(cudaMemcpy(body_posl,  body_pos,  sizeof(float2) * nbodies, cudaMemcpyHostToDevice));
-        cudaCatchError(cudaMemcpy(sourcesl, sources, sizeof(int) * nedges, cudaMemcpyHostToDevice));
-        cudaCatchError(cudaMemcpy(targetsl, targets, sizeof(int) * nedges, cudaMemcpyHostToDevice));
-
-        // cpy fx, fy , fx_prevl, fy_prevl so they are all initialized to 0 in device memory.
-        cudaCatchError(cudaMemcpy(fxl, fx,           sizeof(float) * nbodies, cudaMemcpyHostToDevice));
-        cudaCatchError(cudaMemcpy(fyl, fy,           sizeof(float) * nbodies, cudaMemcpyHostToDevice));
-        cudaCatchError(cudaMemcpy(fx_prevl, fx_prev, sizeof(float) * nbodies, cudaMemcpyHostToDevice));
-        cudaCatchError(cudaMemcpy(fy_prevl, fy_prev, sizeof(float) * nbodies, cudaMemcpyHostToDevice));
+            cudaFuncSetCacheConfig(DisplacementKernel, cudaFuncCachePreferL1);
+
+            cudaGetLastError();  // reset error value
+
+            // Allocate space on device.
+            mp_count = deviceProp.multiProcessorCount;
+            max_threads_per_block = deviceProp.maxThreadsPerBlock;
+
+            nnodes = std::max(2 * nbodies, mp_count * max_threads_per_block);
+
+            // Round up to next multiple of WARPSIZE
+            while ((nnodes & (WARPSIZE-1)) != 0) nnodes++;
+            nnodes--;
+
+            // child stores structure of the octree. values point to IDs.
+            cudaCatchError(cudaMalloc((void **)&childl,  sizeof(int)   * (nnodes+1) * 8));
+
+            // the following properties, for each node in the octree (both internal and leaf)
+            cudaCatchError(cudaMalloc((void **)&body_massl,   sizeof(float) * nbodies));
+            cudaCatchError(cudaMalloc((void **)&node_massl,   sizeof(float) * (nnodes+1)));
+            cudaCatchError(cudaMalloc((void **)&body_posl,sizeof(float3) * nbodies));
+            cudaCatchError(cudaMalloc((void **)&node_posl,    sizeof(float3) * (nnodes+1)));
+            // count contains the number of nested nodes for each node in octree
+            cudaCatchError(cudaMalloc((void **)&countl,  sizeof(int)   * (nnodes+1)));
+            // start contains ...
+            cudaCatchError(cudaMalloc((void **)&startl,  sizeof(int)   * (nnodes+1)));
+            cudaCatchError(cudaMalloc((void **)&sortl,   sizeof(int)   * (nnodes+1)));
+
+
+            cudaCatchError(cudaMalloc((void **)&sourcesl,sizeof(int)   * (nedges)));
+            cudaCatchError(cudaMalloc((void **)&targetsl,sizeof(int)   * (nedges)));
+            cudaCatchError(cudaMalloc((void **)&weightsl,sizeof(float) * (nedges)));
+            cudaCatchError(cudaMalloc((void **)&fxl,     sizeof(float) * (nbodies)));
+            cudaCatchError(cudaMalloc((void **)&fyl,     sizeof(float) * (nbodies)));
+            cudaCatchError(cudaMalloc((void **)&fzl,     sizeof(float) * (nbodies)));
+            cudaCatchError(cudaMalloc((void **)&fx_prevl,sizeof(float) * (nbodies)));
+            cudaCatchError(cudaMalloc((void **)&fy_prevl,sizeof(float) * (nbodies)));
+            cudaCatchError(cudaMalloc((void **)&fz_prevl,sizeof(float) * (nbodies)));
+
+            // Used for reduction in BoundingBoxKernel
+            cudaCatchError(cudaMalloc((void **)&maxxl,   sizeof(float) * mp_count * FACTOR1));
+            cudaCatchError(cudaMalloc((void **)&maxyl,   sizeof(float) * mp_count * FACTOR1));
+            cudaCatchError(cudaMalloc((void **)&maxzl,   sizeof(float) * mp_count * FACTOR1));
+            cudaCatchError(cudaMalloc((void **)&minxl,   sizeof(float) * mp_count * FACTOR1));
+            cudaCatchError(cudaMalloc((void **)&minyl,   sizeof(float) * mp_count * FACTOR1));
+            cudaCatchError(cudaMalloc((void **)&minzl,   sizeof(float) * mp_count * FACTOR1));
+
+            // Used for reduction in SpeedKernel
+            cudaCatchError(cudaMalloc((void **)&swgl,    sizeof(float) * mp_count * FACTOR1));
+            cudaCatchError(cudaMalloc((void **)&etral,   sizeof(float) * mp_count * FACTOR1));
+
+            // Copy host data to device.
+            cudaCatchError(cudaMemcpy(body_massl, body_mass, sizeof(float) * nbodies, cudaMemcpyHostToDevice));
+            cudaCatchError(cudaMemcpy(body_posl,  body_pos,  sizeof(float3) * nbodies, cudaMemcpyHostToDevice));
+            cudaCatchError(cudaMemcpy(sourcesl, sources, sizeof(int) * nedges, cudaMemcpyHostToDevice));
+            cudaCatchError(cudaMemcpy(targetsl, targets, sizeof(int) * nedges, cudaMemcpyHostToDevice));
+            cudaCatchError(cudaMemcpy(weightsl, weights, sizeof(float) * nedges, cudaMemcpyHostToDevice));
+
+            // cpy fx, fy, fz, fx_prevl, fy_prevl, fz_prevl so they are all initialized to 0 in device memory.
+            cudaCatchError(cudaMemcpy(fxl, fx,           sizeof(float) * nbodies, cudaMemcpyHostToDevice));
+            cudaCatchError(cudaMemcpy(fyl, fy,           sizeof(float) * nbodies, cudaMemcpyHostToDevice));
+            cudaCatchError(cudaMemcpy(fzl, fz,           sizeof(float) * nbodies, cudaMemcpyHostToDevice));
+            cudaCatchError(cudaMemcpy(fx_prevl, fx_prev, sizeof(float) * nbodies, cudaMemcpyHostToDevice));
+            cudaCatchError(cudaMemcpy(fy_prevl, fy_prev, sizeof(float) * nbodies, cudaMemcpyHostToDevice));
+            cudaCatchError(cudaMemcpy(fz_prevl, fz_prev, sizeof(float) * nbodies, cudaMemcpyHostToDevice));
+
+            // The adaptive speed lives on the device, see RPFA2Kernels.cu.
+            setSpeedState(global_speed, speed_efficiency);
+            cudaCatchError(cudaGetLastError());
+        }
+        catch (...)
+        {
+            freeGPUMemory();
+            free(body_mass); free(body_pos); free(sources); free(targets); free(weights);
+            free(fx); free(fy); free(fz); free(fx_prev); free(fy_prev); free(fz_prev);
+            throw;
+        }
     }
 
     void CUDAForceAtlas2::freeGPUMemory()
@@ -171,6 +209,7 @@ namespace RPGraph
         cudaFree(node_posl);
         cudaFree(sourcesl);
         cudaFree(targetsl);
+        cudaFree(weightsl);
         cudaFree(countl);
         cudaFree(startl);
         cudaFree(sortl);
@@ -179,11 +218,15 @@ namespace RPGraph
         cudaFree(fx_prevl);
         cudaFree(fyl);
         cudaFree(fy_prevl);
+        cudaFree(fzl);
+        cudaFree(fz_prevl);
 
         cudaFree(maxxl);
         cudaFree(maxyl);
+        cudaFree(maxzl);
         cudaFree(minxl);
         cudaFree(minyl);
+        cudaFree(minzl);
 
         cudaFree(swgl);
         cudaFree(etral);
@@ -195,10 +238,13 @@ namespace RPGraph
         free(body_pos);
         free(sources);
         free(targets);
+        free(weights);
         free(fx);
         free(fy);
+        free(fz);
         free(fx_prev);
         free(fy_prev);
+        free(fz_prev);
 
         freeGPUMemory();
     }
@@ -206,13 +252,13 @@ namespace RPGraph
     void CUDAForceAtlas2::doStep()
     {
         cudaGetLastError(); // clear any errors
-        GravityKernel<<<mp_count * FACTOR6, THREADS6>>>(nbodies, k_g, strong_gravity, body_massl, body_posl, fxl, fyl);
+        GravityKernel<<<mp_count * FACTOR6, THREADS6>>>(nbodies, k_g, strong_gravity, body_massl, body_posl, fxl, fyl, fzl);
         cudaCatchError(cudaGetLastError());
 
-        AttractiveForceKernel<<<mp_count * FACTOR6, THREADS6>>>(nedges, body_posl, fxl, fyl, sourcesl, targetsl);
+        AttractiveForceKernel<<<mp_count * FACTOR6, THREADS6>>>(nedges, body_posl, fxl, fyl, fzl, sourcesl, targetsl, weightsl);
         cudaCatchError(cudaGetLastError());
 
-        BoundingBoxKernel<<<mp_count * FACTOR1, THREADS1>>>(nnodes, nbodies, startl, childl, node_massl, body_posl, node_posl, maxxl, maxyl, minxl, minyl);
+        BoundingBoxKernel<<<mp_count * FACTOR1, THREADS1>>>(nnodes, nbodies, startl, childl, node_massl, body_posl, node_posl, maxxl, maxyl, maxzl, minxl, minyl, minzl);
         cudaCatchError(cudaGetLastError());
 
         // Build Barnes-Hut Tree
@@ -234,13 +280,13 @@ namespace RPGraph
         cudaCatchError(cudaGetLastError());
 
         // Compute repulsive forces between nodes using BH. tree.
-        ForceCalculationKernel<<<mp_count * FACTOR5, THREADS5>>>(nnodes, nbodies, itolsq, epssq, sortl, childl, body_massl, node_massl, body_posl, node_posl, fxl, fyl, k_r);
+        ForceCalculationKernel<<<mp_count * FACTOR5, THREADS5>>>(nnodes, nbodies, itolsq, epssq, sortl, childl, body_massl, node_massl, body_posl, node_posl, fxl, fyl, fzl, k_r);
         cudaCatchError(cudaGetLastError());
 
-        SpeedKernel<<<mp_count * FACTOR1, THREADS1>>>(nbodies, fxl, fyl, fx_prevl, fy_prevl, body_massl, swgl, etral);
+        SpeedKernel<<<mp_count * FACTOR1, THREADS1>>>(nbodies, fxl, fyl, fzl, fx_prevl, fy_prevl, fz_prevl, body_massl, swgl, etral);
         cudaCatchError(cudaGetLastError());
 
-        DisplacementKernel<<<mp_count * FACTOR6, THREADS6>>>(nbodies, body_posl, fxl, fyl, fx_prevl, fy_prevl);
+        DisplacementKernel<<<mp_count * FACTOR6, THREADS6>>>(nbodies, body_posl, fxl, fyl, fzl, fx_prevl, fy_prevl, fz_prevl);
         cudaCatchError(cudaGetLastError());
 
         cudaCatchError(cudaDeviceSynchronize());
@@ -249,13 +295,13 @@ namespace RPGraph
 
     void CUDAForceAtlas2::retrieveLayoutFromGPU()
     {
-        cudaCatchError(cudaMemcpy(body_pos, body_posl, sizeof(float2) * nbodies, cudaMemcpyDeviceToHost));
+        cudaCatchError(cudaMemcpy(body_pos, body_posl, sizeof(float3) * nbodies, cudaMemcpyDeviceToHost));
         cudaDeviceSynchronize();
     }
 
     void CUDAForceAtlas2::sendLayoutToGPU()
     {
-        cudaCatchError(cudaMemcpy(body_posl, body_pos, sizeof(float2) * nbodies, cudaMemcpyHostToDevice));
+        cudaCatchError(cudaMemcpy(body_posl, body_pos, sizeof(float3) * nbodies, cudaMemcpyHostToDevice));
         cudaDeviceSynchronize();
     }
 
@@ -264,16 +310,72 @@ namespace RPGraph
         cudaCatchError(cudaMemcpy(body_massl, body_mass, sizeof(float) * nbodies, cudaMemcpyHostToDevice));
         cudaCatchError(cudaMemcpy(sourcesl, sources, sizeof(int) * nedges, cudaMemcpyHostToDevice));
         cudaCatchError(cudaMemcpy(targetsl, targets, sizeof(int) * nedges, cudaMemcpyHostToDevice));
+        cudaCatchError(cudaMemcpy(weightsl, weights, sizeof(float) * nedges, cudaMemcpyHostToDevice));
         cudaDeviceSynchronize();
     }
 
     void CUDAForceAtlas2::sync_layout()
     {
         retrieveLayoutFromGPU();
-        for(nid_t n = 0; n < layout.graph.num_nodes(); ++n)
+        for(nid_t n = 0; n < (nid_t)nbodies; ++n)
         {
             layout.setX(n, body_pos[n].x);
             layout.setY(n, body_pos[n].y);
+            layout.setZ(n, body_pos[n].z);
         }
     }
+
+    StepTelemetry CUDAForceAtlas2::telemetry()
+    {
+        int maxdepth, bottom;
+        getSpeedState(global_speed, speed_efficiency);
+        getSpeedTotals(last_step.total_swinging, last_step.total_traction);
+        getTreeStats(maxdepth, bottom);
+        cudaCatchError(cudaGetLastError());
+        last_step.tree_depth = maxdepth;
+        last_step.tree_cells = nnodes + 1 - bottom;
+        return ForceAtlas2::telemetry();
+    }
+
+    void CUDAForceAtlas2::getState(std::vector<float> &positions,
+                                   std::vector<float> &prev_forces)
+    {
+        retrieveLayoutFromGPU();
+        cudaCatchError(cudaMemcpy(fx_prev, fx_prevl, sizeof(float) * nbodies, cudaMemcpyDeviceToHost));
+        cudaCatchError(cudaMemcpy(fy_prev, fy_prevl, sizeof(float) * nbodies, cudaMemcpyDeviceToHost));
+        cudaCatchError(cudaMemcpy(fz_prev, fz_prevl, sizeof(float) * nbodies, cudaMemcpyDeviceToHost));
+        getSpeedState(global_speed, speed_efficiency);
+        cudaCatchError(cudaGetLastError());
+
+        positions.resize(3 * (size_t)nbodies);
+        prev_forces.resize(3 * (size_t)nbodies);
+        for (int n = 0; n < nbodies; ++n)
+        {
+            positions[3*n]   = body_pos[n].x;
+            positions[3*n+1] = body_pos[n].y;
+            positions[3*n+2] = body_pos[n].z;
+            prev_forces[3*n]   = fx_prev[n];
+            prev_forces[3*n+1] = fy_prev[n];
+            prev_forces[3*n+2] = fz_prev[n];
+        }
+    }
+
+    void CUDAForceAtlas2::setState(const std::vector<float> &positions,
+                                   const std::vector<float> &prev_forces)
+    {
+        for (int n = 0; n < nbodies; ++n)
+        {
+            body_pos[n] = {positions[3*n], positions[3*n+1], positions[3*n+2]};
+            fx_prev[n] = prev_forces[3*n];
+            fy_prev[n] = prev_forces[3*n+1];
+            fz_prev[n] = prev_forces[3*n+2];
+        }
+        sendLayoutToGPU();
+        cudaCatchError(cudaMemcpy(fx_prevl, fx_prev, sizeof(float) * nbodies, cudaMemcpyHostToDevice));
+        cudaCatchError(cudaMemcpy(fy_prevl, fy_prev, sizeof(float) * nbodies, cudaMemcpyHostToDevice));
+        cudaCatchError(cudaMemcpy(fz_prevl, fz_prev, sizeof(float) * nbodies, cudaMemcpyHostToDevice));
+        setSpeedState(global_speed, speed_efficiency);
+        cudaCatchError(cudaGetLastError());
+        sync_layout();
+    }
 }
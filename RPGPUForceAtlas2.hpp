@@ -35,24 +35,35 @@ namespace RPGraph
         ~CUDAForceAtlas2();
         void doStep() override;
         void sync_layout() override;
+        // Copies the statistics from the device; displacements aren't
+        // tracked.
+        StepTelemetry telemetry() override;
+
+    protected:
+        void getState(std::vector<float> &positions,
+                      std::vector<float> &prev_forces) override;
+        void setState(const std::vector<float> &positions,
+                      const std::vector<float> &prev_forces) override;
 
     private:
         /// CUDA Specific stuff.
         // Host storage.
         float *body_mass;
-        float2 *body_pos;
-        float *fx, *fy, *fx_prev, *fy_prev;
+        float3 *body_pos;
+        float *fx, *fy, *fz, *fx_prev, *fy_prev, *fz_prev;
 
         // Quick way to represent a graph on the GPU
         int *sources, *targets;
+        float *weights;
 
         // Pointers to device memory (all suffixed with 'l').
         int   *errl,  *sortl, *childl, *countl, *startl;
         int   *sourcesl, *targetsl;
+        float *weightsl;
         float *body_massl, *node_massl;
-        float2 *body_posl, *node_posl;
-        float *minxl, *minyl, *maxxl, *maxyl;
-        float *fxl, *fyl, *fx_prevl, *fy_prevl;
+        float3 *body_posl, *node_posl;
+        float *minxl, *minyl, *minzl, *maxxl, *maxyl, *maxzl;
+        float *fxl, *fyl, *fzl, *fx_prevl, *fy_prevl, *fz_prevl;
         float *swgl, *etral;
 
         int mp_count; // Number of multiprocessors on GPU.
@@ -36,6 +36,8 @@ namespace RPGraph
     {
         node_count = 0;
         edge_count = 0;
+        revision_count = 0;
+        identity_ids = false;
 
         std::fstream edgelist_file(edgelist_path, std::ifstream::in);
 
@@ -55,34 +57,57 @@ namespace RPGraph
         edgelist_file.close();
     }
 
+    bool UGraph::has_original_id(nid_t original_id) const
+    {
+        return identity_ids ? original_id < node_count : node_map.count(original_id) > 0;
+    }
+
+    nid_t UGraph::mapped_id(nid_t original_id) const
+    {
+        return identity_ids ? original_id : node_map.at(original_id);
+    }
+
+    nid_t UGraph::original_id(nid_t node_id) const
+    {
+        return identity_ids ? node_id : node_map_r.at(node_id);
+    }
+
     bool UGraph::has_node(nid_t nid)
     {
-        return node_map.count(nid) > 0;
+        return has_original_id(nid);
     }
 
     bool UGraph::has_edge(nid_t s, nid_t t)
     {
         if(!has_node(s) or !has_node(t)) return false;
+        return adjacent(mapped_id(s), mapped_id(t));
+    }
 
-        nid_t s_mapped = node_map[s];
-        nid_t t_mapped = node_map[t];
-
-        if(adjacency_list.count(std::min(s_mapped, t_mapped)) == 0) return false;
+    bool UGraph::adjacent(nid_t source, nid_t target) const
+    {
+        auto it = adjacency_list.find(std::min(source, target));
+        if(it == adjacency_list.end()) return false;
 
-        std::vector<nid_t> neighbors = adjacency_list[std::min(s_mapped, t_mapped)];
-        if(std::find(neighbors.begin(), neighbors.end(), std::max(s_mapped, t_mapped)) == neighbors.end())
-            return false;
-        else
-            return true;
+        const std::vector<nid_t> &neighbors = it->second;
+        return std::find(neighbors.begin(), neighbors.end(), std::max(source, target)) != neighbors.end();
     }
 
     void UGraph::add_node(nid_t nid)
     {
         if(!has_node(nid))
         {
-            node_map[nid] = node_count;
-            node_map_r[node_count] = nid;
-            node_count++;
+            if (identity_ids)
+            {
+                // All bins up to `nid' exist.
+                node_count = nid + 1;
+            }
+            else
+            {
+                node_map[nid] = node_count;
+                node_map_r[node_count] = nid;
+                node_count++;
+            }
+            revision_count++;
         }
     }
 
@@ -91,32 +116,160 @@ namespace RPGraph
         if(has_edge(s, t)) return;
         if(!has_node(s)) add_node(s);
         if(!has_node(t)) add_node(t);
-        nid_t s_mapped = node_map[s];
-        nid_t t_mapped = node_map[t];
+        nid_t s_mapped = mapped_id(s);
+        nid_t t_mapped = mapped_id(t);
 
         // Insert edge into adjacency_list
         adjacency_list[std::min(s_mapped, t_mapped)].push_back(std::max(s_mapped, t_mapped));
         degrees[s_mapped] += 1;
         degrees[t_mapped] += 1;
         edge_count++;
+        revision_count++;
     }
 	
 	// Add the new method implementations here
 	void UGraph::add_edge_with_weight(nid_t source, nid_t target, float weight) 
 	{
         add_edge(source, target);
-        edge_weights[std::make_pair(source, target)] = weight;
+        const nid_t s_mapped = mapped_id(source), t_mapped = mapped_id(target);
+        edge_weights[std::make_pair(std::min(s_mapped, t_mapped), std::max(s_mapped, t_mapped))] = weight;
+        revision_count++;
     }
 
     float UGraph::get_edge_weight(nid_t source, nid_t target) const 
 	{
-        std::pair<nid_t, nid_t> key = std::make_pair(source, target);
+        std::pair<nid_t, nid_t> key = std::make_pair(std::min(source, target), std::max(source, target));
         if (edge_weights.find(key) != edge_weights.end()) {
             return edge_weights.at(key);
         }
         return 0.0f; // or any default value you want to return for non-existent edges
     }
 
+    bool UGraph::remove_edge(nid_t source, nid_t target)
+    {
+        if(!has_edge(source, target)) return false;
+        const nid_t s_mapped = mapped_id(source), t_mapped = mapped_id(target);
+        const nid_t lo = std::min(s_mapped, t_mapped), hi = std::max(s_mapped, t_mapped);
+
+        std::vector<nid_t> &neighbors = adjacency_list[lo];
+        neighbors.erase(std::find(neighbors.begin(), neighbors.end(), hi));
+        if (neighbors.empty()) adjacency_list.erase(lo);
+        edge_weights.erase(std::make_pair(lo, hi));
+        degrees[s_mapped] -= 1;
+        degrees[t_mapped] -= 1;
+        edge_count--;
+        revision_count++;
+        return true;
+    }
+
+    std::vector<nid_t> UGraph::isolate_node(nid_t node)
+    {
+        std::vector<nid_t> neighbors;
+        if(!has_node(node)) return neighbors;
+        const nid_t n = mapped_id(node);
+
+        // Neighbours with smaller ids are only found in their own lists.
+        for (const std::pair<const nid_t, std::vector<nid_t>> &entry : adjacency_list)
+        {
+            if (entry.first == n)
+                neighbors.insert(neighbors.end(), entry.second.begin(), entry.second.end());
+            else if (entry.first < n and std::find(entry.second.begin(), entry.second.end(), n) != entry.second.end())
+                neighbors.push_back(entry.first);
+        }
+        std::sort(neighbors.begin(), neighbors.end());
+        for (nid_t t : neighbors) remove_edge(node, original_id(t));
+        return neighbors;
+    }
+
+
+    void UGraph::readContactMatrix(std::string path, bool upper_triangle)
+    {
+        if (node_count > 0)
+        {
+            fprintf(stderr, "error: Contact matrix %s read into a non-empty graph.\n", path.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        FILE *file = fopen(path.c_str(), "rb");
+        if (!file)
+        {
+            fprintf(stderr, "error: Could not open contact matrix at %s\n", path.c_str());
+            exit(EXIT_FAILURE);
+        }
+        identity_ids = true;
+
+        // Records are read in blocks. Edges are inserted without checking
+        // for duplicates, which are merged at the end.
+        struct Record
+        {
+            uint32_t row, col;
+            float count;
+        };
+        static_assert(sizeof(Record) == 12, "COO records are 12 bytes");
+        std::vector<Record> records(1 << 16);
+        size_t num_read;
+        while ((num_read = fread(records.data(), sizeof(Record), records.size(), file)) > 0)
+        {
+            for (size_t i = 0; i < num_read; ++i)
+            {
+                const Record &r = records[i];
+                if (r.row == r.col) continue;
+                if (!upper_triangle and r.row > r.col) continue;
+
+                const nid_t s = std::min(r.row, r.col), t = std::max(r.row, r.col);
+                node_count = std::max(node_count, t + 1);
+                adjacency_list[s].push_back(t);
+                edge_weights[std::make_pair(s, t)] = r.count;
+            }
+        }
+
+        // Repeated pairs become a single edge, with the last count read,
+        // as for edgelists.
+        merge_repeated_edges();
+
+        if (ferror(file))
+        {
+            fprintf(stderr, "error: Could not read contact matrix at %s\n", path.c_str());
+            exit(EXIT_FAILURE);
+        }
+        fclose(file);
+        revision_count++;
+    }
+
+    void UGraph::setEdges(nid_t num_nodes, size_t num_edges, const nid_t *sources,
+                          const nid_t *targets, const float *weights)
+    {
+        identity_ids = true;
+        node_count = num_nodes;
+        for (size_t e = 0; e < num_edges; ++e)
+        {
+            if (sources[e] == targets[e]) continue;
+            const nid_t s = std::min(sources[e], targets[e]);
+            const nid_t t = std::max(sources[e], targets[e]);
+            adjacency_list[s].push_back(t);
+            edge_weights[std::make_pair(s, t)] = weights ? weights[e] : 1.0f;
+        }
+        merge_repeated_edges();
+        revision_count++;
+    }
+
+    void UGraph::merge_repeated_edges()
+    {
+        for (std::pair<const nid_t, std::vector<nid_t>> &entry : adjacency_list)
+        {
+            std::vector<nid_t> &neighbors = entry.second;
+            std::sort(neighbors.begin(), neighbors.end());
+            neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+            degrees[entry.first] += neighbors.size();
+            for (nid_t t : neighbors) degrees[t] += 1;
+            edge_count += neighbors.size();
+        }
+    }
+
+    uint64_t UGraph::revision() const
+    {
+        return revision_count;
+    }
 
     nid_t UGraph::num_nodes()
     {
@@ -128,9 +281,12 @@ namespace RPGraph
         return edge_count;
     }
 
+    // Lookups of nodes without edges don't insert them, so that layouts
+    // can read the same graph from several threads.
     nid_t UGraph::degree(nid_t nid)
     {
-        return degrees[nid];
+        auto it = degrees.find(nid);
+        return it == degrees.end() ? 0 : it->second;
     }
 
     nid_t UGraph::in_degree(nid_t nid)
@@ -144,7 +300,8 @@ namespace RPGraph
     }
     std::vector<nid_t> UGraph::neighbors_with_geq_id(nid_t nid)
     {
-        return adjacency_list[nid];
+        auto it = adjacency_list.find(nid);
+        return it == adjacency_list.end() ? std::vector<nid_t>() : it->second;
     }
 
     /* Definitions for CSRUGraph */
@@ -24,6 +24,7 @@
 
 #ifndef RPGraph_hpp
 #define RPGraph_hpp
+#include <stdint.h>
 #include <vector>
 #include <string>
 #include <unordered_map>
@@ -65,13 +66,18 @@ namespace RPGraph
     };
 
     // Very basic (adjacency list) representation of an undirected graph.
+    // Reading it doesn't change it, so layouts running in different
+    // threads can share one graph.
     class UGraph : public Graph
     {
     private:
         nid_t node_count, edge_count;
+        uint64_t revision_count; // Incremented on every change.
+        bool identity_ids; // Ids in the input are used as is, see readContactMatrix().
         std::unordered_map<nid_t, nid_t> degrees;
         std::unordered_map<nid_t, std::vector<nid_t>> adjacency_list;
 		// Add this to the Graph class definition in the "RPGraph.hpp" header file
+		// Keyed by the (smaller, larger) UGraph ids of the endpoints.
 		std::unordered_map<std::pair<nid_t, nid_t>, float, pair_hash> edge_weights;
 
 
@@ -79,23 +85,73 @@ namespace RPGraph
         bool has_edge(nid_t s, nid_t t);
         void add_node(nid_t nid);
         void add_edge(nid_t s, nid_t t);
+        // Sorts the adjacency lists, merges repeated edges and counts
+        // degrees and edges, after bulk insertion into an empty graph.
+        void merge_repeated_edges();
 
     public:
 	    UGraph() 
 		{
         node_count = 0;
         edge_count = 0;
+        revision_count = 0;
+        identity_ids = false;
 		}
         // Construct UGraph from edgelist. IDs in edgelist are mapped to
         // [0, 1, ..., num_nodes-1]. Removes any self-edges.
         UGraph(std::string edgelist_path);
         std::unordered_map<nid_t, nid_t> node_map; // el id -> UGraph id
         std::unordered_map<nid_t, nid_t> node_map_r; // UGraph id -> el id
+
+        // Reads a binary contact matrix in coordinate (COO) form, a list
+        // of (uint32 row, uint32 col, float32 count) records, little
+        // endian. Rows and columns are (dense) bin indices, which are used
+        // as node ids as they are, without node_map. If `upper_triangle',
+        // each pair of bins is stored once, in either order; otherwise
+        // the matrix is stored in full, and entries below the diagonal
+        // are skipped. Contacts of a bin with itself are dropped, and
+        // repeated pairs merged. Only for an empty graph.
+        void readContactMatrix(std::string path, bool upper_triangle);
+
+        // Builds the graph from arrays of `num_edges' undirected edges,
+        // between nodes in [0, num_nodes), which are used as node ids as
+        // they are (as for contact matrices), so nodes may have no edges.
+        // Self-edges are dropped, and repeated pairs merged, keeping the
+        // last weight. Edges weigh 1 if `weights' is null. Only for an
+        // empty graph, and with all ids checked by the caller.
+        void setEdges(nid_t num_nodes, size_t num_edges, const nid_t *sources,
+                      const nid_t *targets, const float *weights);
+
+        // Translate between ids as found in the input and UGraph ids.
+        // Use these rather than node_map(_r), which are empty for
+        // contact matrices.
+        bool has_original_id(nid_t original_id) const;
+        nid_t mapped_id(nid_t original_id) const;
+        nid_t original_id(nid_t node_id) const;
 		
 		
 		// Add the new function declarations here
+        // Adds the edge between nodes with ids `source' and `target', as
+        // found in the input, and sets its weight.
         void add_edge_with_weight(nid_t source, nid_t target, float weight);
+        // Weight of the edge between UGraph ids `source' and `target', in
+        // either order. 0 if there is no such edge.
         float get_edge_weight(nid_t source, nid_t target) const;
+        // True if UGraph ids `source' and `target' share an edge.
+        bool adjacent(nid_t source, nid_t target) const;
+
+        // Removes the edge between nodes with ids `source' and `target', as
+        // found in the input. Returns false if there is no such edge.
+        bool remove_edge(nid_t source, nid_t target);
+        // Removes all edges of the node with id `node', as found in the
+        // input, and returns the UGraph ids of its former neighbours.
+        // UGraph ids are dense, so the node itself stays, without edges.
+        // Takes time linear in the number of edges.
+        std::vector<nid_t> isolate_node(nid_t node);
+
+        // Changes whenever nodes, edges or weights change, such that
+        // data derived from the graph can be cached.
+        uint64_t revision() const;
 
         virtual nid_t num_nodes() override;
         virtual nid_t num_edges() override;
@@ -23,20 +23,31 @@
 
 
 #include "RPGraphLayout.hpp"
-#include "../lib/pngwriter/src/pngwriter.h"
+#include "RPRasterizer.hpp"
+#include "RPDensityMap.hpp"
+#include "RPFrameStream.hpp"
+#include "RPBarnesHutApproximator.hpp"
+#include <memory>
 #include <algorithm>
 #include <set>
+#include <functional>
 #include <fstream>
 #include <cmath>
 #include <limits>
 #include <iostream>
+#include <map>
+#include <sstream>
+#include <unordered_map>
 
 namespace RPGraph
 {
     GraphLayout::GraphLayout(UGraph &graph, float width, float height, float depth) //Modify for z coordinate- 16th November
-        : graph(graph), width(width), height(height), depth(depth) //Modify for z coordinate- 16th November
+        : edge_mode(EDGES_ALL), png_level(6), has_positions(false), num_removed(0),
+          edge_cache_revision(0), edge_cache_valid(false),
+          width(width), height(height), depth(depth), graph(graph) //Modify for z coordinate- 16th November
     {
-        coordinates = (Coordinate *) malloc(graph.num_nodes() * sizeof(Coordinate));
+        num_coordinates = graph.num_nodes();
+        coordinates = (Coordinate *) malloc(num_coordinates * sizeof(Coordinate));
     }
 
     GraphLayout::~GraphLayout()
@@ -46,11 +57,296 @@ namespace RPGraph
 
     void GraphLayout::randomizePositions()
     {
+        std::uniform_real_distribution<float> x_dist(-width/2.0, width/2.0);
+        std::uniform_real_distribution<float> y_dist(-height/2.0, height/2.0);
+        std::uniform_real_distribution<float> z_dist(-depth/2.0, depth/2.0);
         for (nid_t i = 0; i <  graph.num_nodes(); ++i)
         {
-            setX(i, get_random(-width/2.0, width/2.0));
-            setY(i, get_random(-height/2.0, height/2.0));
-            setZ(i, get_random(-depth/2.0, depth/2.0)); // Randomize the z-coordinate //Modify for z coordinate- 16th November
+            setX(i, x_dist(rng));
+            setY(i, y_dist(rng));
+            setZ(i, z_dist(rng)); // Randomize the z-coordinate //Modify for z coordinate- 16th November
+        }
+        has_positions = true;
+    }
+
+    nid_t GraphLayout::loadPositions(std::string path)
+    {
+        const nid_t num_nodes = graph.num_nodes();
+        std::vector<bool> placed(num_nodes, false);
+        nid_t num_matched = 0, num_unknown = 0;
+        bool planar = false;
+
+        auto place = [&](nid_t original_id, float x, float y, float z)
+        {
+            if (not graph.has_original_id(original_id))
+            {
+                num_unknown++;
+                return;
+            }
+            const nid_t n = graph.mapped_id(original_id);
+            if (not placed[n]) num_matched++;
+            placed[n] = true;
+            setCoordinates(n, Coordinate(x, y, z));
+        };
+
+        const bool binary = path.size() >= 4 and path.compare(path.size()-4, 4, ".bin") == 0;
+        std::ifstream in_file(path, binary ? std::ifstream::binary : std::ifstream::in);
+        if (not in_file.is_open())
+        {
+            fprintf(stderr, "error: Could not read layout at %s\n", path.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        if (binary)
+        {
+            // Records of writeToBin: id, x, y.
+            planar = true;
+            nid_t id;
+            float x, y;
+            while (in_file.read(reinterpret_cast<char *>(&id), sizeof(id)) and
+                   in_file.read(reinterpret_cast<char *>(&x), sizeof(x)) and
+                   in_file.read(reinterpret_cast<char *>(&y), sizeof(y)))
+                place(id, x, y, 0.0f);
+        }
+        else
+        {
+            // Lines of writeToCSV, `id,x,y,z', or `id,x,y'.
+            std::string line;
+            while (std::getline(in_file, line))
+            {
+                unsigned long id;
+                float x, y, z;
+                const int fields = sscanf(line.c_str(), "%lu,%f,%f,%f", &id, &x, &y, &z);
+                if (fields < 3) continue;
+                if (fields == 3)
+                {
+                    planar = true;
+                    z = 0.0f;
+                }
+                place(id, x, y, z);
+            }
+        }
+        in_file.close();
+
+        if (num_unknown > 0)
+            fprintf(stderr, "warning: %u nodes in %s are not in the graph.\n", num_unknown, path.c_str());
+        if (num_matched == 0)
+        {
+            fprintf(stderr, "warning: No nodes of the graph in %s, randomizing.\n", path.c_str());
+            randomizePositions();
+            return 0;
+        }
+
+        placeNearNeighbors(placed, planar);
+        has_positions = true;
+        return num_matched;
+    }
+
+    nid_t GraphLayout::addNodes()
+    {
+        const nid_t num_nodes = graph.num_nodes();
+        if (num_nodes <= num_coordinates) return 0;
+        const nid_t num_added = num_nodes - num_coordinates;
+
+        Coordinate *grown = (Coordinate *) realloc(coordinates, num_nodes * sizeof(Coordinate));
+        if (grown == nullptr)
+        {
+            fprintf(stderr, "error: Could not grow the layout to %u nodes.\n", num_nodes);
+            exit(EXIT_FAILURE);
+        }
+        coordinates = grown;
+        std::vector<bool> placed(num_nodes, false);
+        for (nid_t n = 0; n < num_coordinates; ++n) placed[n] = true;
+        const bool had_nodes = num_coordinates > 0;
+        num_coordinates = num_nodes;
+
+        // Without groups for them, new nodes aren't displayed.
+        if (not node_group.empty()) node_group.resize(num_nodes, -1);
+
+        if (had_nodes and has_positions) placeNearNeighbors(placed, false);
+        else randomizePositions();
+        return num_added;
+    }
+
+    void GraphLayout::removeNode(nid_t n)
+    {
+        if (isRemoved(n)) return;
+        if (removed.size() <= n) removed.resize(graph.num_nodes(), false);
+        removed[n] = true;
+        num_removed++;
+        edge_cache_valid = false;
+    }
+
+    bool GraphLayout::isRemoved(nid_t n) const
+    {
+        return n < removed.size() && removed[n];
+    }
+
+    void GraphLayout::placeNearNeighbors(std::vector<bool> &placed, bool planar)
+    {
+        const nid_t num_nodes = graph.num_nodes();
+
+        // Symmetric adjacency, to find the placed neighbours of a node.
+        std::vector<uint64_t> adj_offsets(num_nodes+1, 0);
+        for (nid_t n = 0; n < num_nodes; ++n)
+        {
+            for (nid_t t : graph.neighbors_with_geq_id(n))
+            {
+                adj_offsets[n+1]++;
+                adj_offsets[t+1]++;
+            }
+        }
+        for (nid_t n = 0; n < num_nodes; ++n) adj_offsets[n+1] += adj_offsets[n];
+        std::vector<nid_t> adj_targets(adj_offsets[num_nodes]);
+        std::vector<uint64_t> fill(adj_offsets.begin(), adj_offsets.end()-1);
+        for (nid_t n = 0; n < num_nodes; ++n)
+        {
+            for (nid_t t : graph.neighbors_with_geq_id(n))
+            {
+                adj_targets[fill[n]++] = t;
+                adj_targets[fill[t]++] = n;
+            }
+        }
+
+        // New nodes are offset by a fraction of the mean length of the
+        // loaded edges, so that they don't coincide with each other.
+        double length_sum = 0.0;
+        uint64_t num_lengths = 0;
+        float lo[3] = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+                       std::numeric_limits<float>::max()};
+        float hi[3] = {std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(),
+                       std::numeric_limits<float>::lowest()};
+        for (nid_t n = 0; n < num_nodes; ++n)
+        {
+            if (not placed[n]) continue;
+            const Coordinate c = getCoordinate(n);
+            lo[0] = std::min(lo[0], c.x); hi[0] = std::max(hi[0], c.x);
+            lo[1] = std::min(lo[1], c.y); hi[1] = std::max(hi[1], c.y);
+            lo[2] = std::min(lo[2], c.z); hi[2] = std::max(hi[2], c.z);
+            for (uint64_t e = adj_offsets[n]; e < adj_offsets[n+1]; ++e)
+            {
+                if (adj_targets[e] > n and placed[adj_targets[e]])
+                {
+                    length_sum += getDistance(n, adj_targets[e]);
+                    num_lengths++;
+                }
+            }
+        }
+        float spread = num_lengths > 0 ? 0.1f * length_sum / num_lengths : 0.0f;
+        if (spread <= 0.0f) spread = 0.01f * std::max(std::max(hi[0] - lo[0], hi[1] - lo[1]), 1.0f);
+        std::uniform_real_distribution<float> offset(-spread, spread);
+
+        if (planar)
+        {
+            for (nid_t n = 0; n < num_nodes; ++n)
+                if (placed[n]) setZ(n, offset(rng));
+            lo[2] = -spread;
+            hi[2] = spread;
+        }
+
+        // Breadth-first from the placed nodes: each level is placed at
+        // the mean of its neighbours in the levels before it.
+        std::vector<nid_t> queue;
+        std::vector<bool> reached(placed);
+        for (nid_t n = 0; n < num_nodes; ++n)
+            if (placed[n]) queue.push_back(n);
+        std::vector<Coordinate> means;
+        size_t head = 0;
+        while (head < queue.size())
+        {
+            const size_t level = queue.size();
+            for (; head < level; ++head)
+            {
+                const nid_t n = queue[head];
+                for (uint64_t e = adj_offsets[n]; e < adj_offsets[n+1]; ++e)
+                {
+                    const nid_t t = adj_targets[e];
+                    if (reached[t]) continue;
+                    reached[t] = true;
+                    queue.push_back(t);
+                }
+            }
+            // In order of id, for the offsets not to depend on the order
+            // of the edges.
+            std::sort(queue.begin() + level, queue.end());
+
+            means.clear();
+            for (size_t i = level; i < queue.size(); ++i)
+            {
+                const nid_t n = queue[i];
+                float x = 0.0f, y = 0.0f, z = 0.0f;
+                nid_t num_placed = 0;
+                for (uint64_t e = adj_offsets[n]; e < adj_offsets[n+1]; ++e)
+                {
+                    const nid_t t = adj_targets[e];
+                    if (not placed[t]) continue;
+                    x += getX(t);
+                    y += getY(t);
+                    z += getZ(t);
+                    num_placed++;
+                }
+                means.push_back(Coordinate(x / num_placed, y / num_placed, z / num_placed));
+            }
+            for (size_t i = level; i < queue.size(); ++i)
+            {
+                const Coordinate &mean = means[i - level];
+                setCoordinates(queue[i], Coordinate(mean.x + offset(rng),
+                                                    mean.y + offset(rng),
+                                                    mean.z + offset(rng)));
+                placed[queue[i]] = true;
+            }
+        }
+
+        // Components without any loaded node.
+        for (int d = 0; d < 3; ++d) if (hi[d] <= lo[d]) { lo[d] -= spread; hi[d] += spread; }
+        std::uniform_real_distribution<float> x_dist(lo[0], hi[0]), y_dist(lo[1], hi[1]), z_dist(lo[2], hi[2]);
+        for (nid_t n = 0; n < num_nodes; ++n)
+        {
+            if (placed[n]) continue;
+            const float x = x_dist(rng), y = y_dist(rng), z = z_dist(rng);
+            setCoordinates(n, Coordinate(x, y, z));
+        }
+    }
+
+    bool GraphLayout::hasPositions() const
+    {
+        return has_positions;
+    }
+
+    static_assert(sizeof(Coordinate) == 3 * sizeof(float), "Coordinates are packed x, y, z");
+
+    const float *GraphLayout::positionData() const
+    {
+        return reinterpret_cast<const float *>(coordinates);
+    }
+
+    void GraphLayout::setPositions(const float *xyz)
+    {
+        for (nid_t n = 0; n < graph.num_nodes(); ++n)
+            setCoordinates(n, Coordinate(xyz[3*n], xyz[3*n+1], xyz[3*n+2]));
+        has_positions = true;
+    }
+
+    void GraphLayout::seedRandom(uint32_t seed)
+    {
+        rng.seed(seed);
+    }
+
+    std::string GraphLayout::randomState() const
+    {
+        std::ostringstream state;
+        state << rng;
+        return state.str();
+    }
+
+    void GraphLayout::setRandomState(const std::string &state)
+    {
+        std::istringstream in(state);
+        in >> rng;
+        if (in.fail())
+        {
+            fprintf(stderr, "error: Invalid random number generator state.\n");
+            exit(EXIT_FAILURE);
         }
     }
 
@@ -69,11 +365,12 @@ namespace RPGraph
         return coordinates[node_id].z;
     }
 
+    // Extents are of the nodes that aren't removed.
     float GraphLayout::minX()
     {
         float minX = std::numeric_limits<float>::max();
         for (nid_t n = 0; n < graph.num_nodes(); ++n)
-            if (getX(n) < minX) minX = getX(n);
+            if (!isRemoved(n) && getX(n) < minX) minX = getX(n);
         return minX;
     }
 
@@ -81,7 +378,7 @@ namespace RPGraph
     {
         float maxX = std::numeric_limits<float>::min();
         for (nid_t n = 0; n < graph.num_nodes(); ++n)
-            if (getX(n) > maxX) maxX = getX(n);
+            if (!isRemoved(n) && getX(n) > maxX) maxX = getX(n);
         return maxX;
     }
 
@@ -89,7 +386,7 @@ namespace RPGraph
     {
         float minY = std::numeric_limits<float>::max();
         for (nid_t n = 0; n < graph.num_nodes(); ++n)
-            if (getY(n) < minY) minY = getY(n);
+            if (!isRemoved(n) && getY(n) < minY) minY = getY(n);
         return minY;
     }
 
@@ -97,7 +394,7 @@ namespace RPGraph
     {
         float maxY = std::numeric_limits<float>::min();
         for (nid_t n = 0; n < graph.num_nodes(); ++n)
-            if (getY(n) > maxY) maxY = getY(n);
+            if (!isRemoved(n) && getY(n) > maxY) maxY = getY(n);
         return maxY;
     }
 
@@ -106,7 +403,7 @@ namespace RPGraph
     {
         float minZ = std::numeric_limits<float>::max();
         for (nid_t n = 0; n < graph.num_nodes(); ++n)
-            if (getZ(n) < minZ) minZ = getZ(n);
+            if (!isRemoved(n) && getZ(n) < minZ) minZ = getZ(n);
         return minZ;
     }
     //Modify for z coordinate- 16th November
@@ -114,7 +411,7 @@ namespace RPGraph
     {
         float maxZ = std::numeric_limits<float>::min();
         for (nid_t n = 0; n < graph.num_nodes(); ++n)
-            if (getZ(n) > maxZ) maxZ = getZ(n);
+            if (!isRemoved(n) && getZ(n) > maxZ) maxZ = getZ(n);
         return maxZ;
     }
 
@@ -213,14 +510,215 @@ namespace RPGraph
 
 
 //New Extension for Filtering Nodes and Edges
-    bool shouldDisplayNode(nid_t node_id) {
-        return node_id < 1259;
+    // Nodes without a group are not displayed, nor are their edges, and
+    // neither are removed nodes.
+    bool GraphLayout::shouldDisplayNode(nid_t node_id) const
+    {
+        return (node_group.empty() || node_group[node_id] >= 0) && !isRemoved(node_id);
+    }
+
+    int GraphLayout::groupOf(nid_t node_id) const
+    {
+        return node_group.empty() ? 0 : node_group[node_id];
+    }
+
+    int GraphLayout::numGroups() const
+    {
+        return node_group.empty() ? 1 : group_names.size();
+    }
+
+    void GraphLayout::groupColor(int group, float &r, float &g, float &b) const
+    {
+        // The first three match the colors formerly hardcoded per chromosome.
+        static const float palette[][3] = {
+            {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 1.0f, 0.0f},
+            {1.0f, 0.5f, 0.0f}, {0.6f, 0.0f, 0.8f}, {0.0f, 0.7f, 0.7f},
+            {0.9f, 0.0f, 0.6f}, {0.5f, 0.5f, 0.0f}, {0.4f, 0.2f, 0.0f},
+            {0.0f, 0.3f, 0.6f}, {0.5f, 0.8f, 0.2f}, {0.3f, 0.3f, 0.3f}
+        };
+        const int num_colors = sizeof(palette) / sizeof(palette[0]);
+        const float *color = palette[std::max(group, 0) % num_colors];
+        r = color[0];
+        g = color[1];
+        b = color[2];
+    }
+
+    void GraphLayout::loadNodeGroups(std::string path)
+    {
+        std::ifstream in_file(path);
+        if (!in_file.is_open())
+        {
+            fprintf(stderr, "error: Could not read node groups at %s\n", path.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        node_group.assign(graph.num_nodes(), -1);
+        group_names.clear();
+        std::unordered_map<std::string, int> group_ids;
+        nid_t num_unknown = 0;
+
+        // Each line has a node id (as in the edgelist) and a group name.
+        std::string line;
+        while (std::getline(in_file, line))
+        {
+            if (line.empty() || line[0] == '#') continue;
+
+            std::istringstream iss(line);
+            nid_t id;
+            std::string name;
+            if (!(iss >> id >> name)) continue;
+
+            if (!graph.has_original_id(id))
+            {
+                num_unknown++;
+                continue;
+            }
+
+            if (group_ids.count(name) == 0)
+            {
+                group_ids[name] = group_names.size();
+                group_names.push_back(name);
+            }
+            node_group[graph.mapped_id(id)] = group_ids[name];
+        }
+        in_file.close();
+
+        if (num_unknown > 0)
+            fprintf(stderr, "warning: %u annotated nodes are not in the graph.\n", num_unknown);
+
+        edge_cache_valid = false;
+    }
+
+    void GraphLayout::setPNGLevel(int level)
+    {
+        png_level = level;
+    }
+
+    void GraphLayout::setEdgeMode(EdgeMode mode)
+    {
+        if (mode != edge_mode) edge_cache_valid = false;
+        edge_mode = mode;
     }
 
-    bool shouldDisplayEdge(nid_t source_id, nid_t target_id) {
-        return (source_id < 1259) && (target_id < 1259);
+
+    // Edges of this weight are drawn opaque, and don't count towards the
+    // maximum weight used for scaling opacity and color.
+    static const float saturated_weight = 10000.0f;
+
+    // Fraction of the displayable edges, by highest weight, that is drawn.
+    static const float displayed_edge_fraction = 0.25f;
+
+    void GraphLayout::updateEdgeCache()
+    {
+        if (edge_cache_valid && edge_cache_revision == graph.revision()) return;
+
+        // Bucket the edges between displayed nodes by the (unordered) pair
+        // of groups of their endpoints, with buckets in order of that pair.
+        std::map<std::pair<int, int>, uint32_t> bucket_ids;
+        for (nid_t n1 = 0; n1 < graph.num_nodes(); ++n1)
+        {
+            if (!shouldDisplayNode(n1)) continue;
+            for (nid_t n2 : graph.neighbors_with_geq_id(n1))
+            {
+                if (n1 == n2 || !shouldDisplayNode(n2)) continue;
+                const int g1 = groupOf(n1), g2 = groupOf(n2);
+                bucket_ids[std::make_pair(std::min(g1, g2), std::max(g1, g2))]++;
+            }
+        }
+
+        bucket_groups.clear();
+        bucket_offsets.assign(1, 0);
+        for (std::pair<const std::pair<int, int>, uint32_t> &bucket : bucket_ids)
+        {
+            bucket_groups.push_back(bucket.first);
+            bucket_offsets.push_back(bucket_offsets.back() + bucket.second);
+            bucket.second = bucket_groups.size() - 1;
+        }
+
+        edge_src.resize(bucket_offsets.back());
+        edge_dst.resize(bucket_offsets.back());
+        edge_weight.resize(bucket_offsets.back());
+        std::vector<size_t> fill(bucket_offsets.begin(), bucket_offsets.end()-1);
+        for (nid_t n1 = 0; n1 < graph.num_nodes(); ++n1)
+        {
+            if (!shouldDisplayNode(n1)) continue;
+            for (nid_t n2 : graph.neighbors_with_geq_id(n1))
+            {
+                if (n1 == n2 || !shouldDisplayNode(n2)) continue;
+                const int g1 = groupOf(n1), g2 = groupOf(n2);
+                const size_t e = fill[bucket_ids[std::make_pair(std::min(g1, g2), std::max(g1, g2))]]++;
+                edge_src[e] = n1;
+                edge_dst[e] = n2;
+                edge_weight[e] = graph.get_edge_weight(n1, n2);
+            }
+        }
+
+        // Only the buckets of the edge mode are considered below.
+        selected_buckets.clear();
+        for (size_t b = 0; b < bucket_groups.size(); ++b)
+        {
+            const bool intra = bucket_groups[b].first == bucket_groups[b].second;
+            if (edge_mode == EDGES_ALL || (edge_mode == EDGES_INTRA) == intra)
+                selected_buckets.push_back(b);
+        }
+
+        // Weights of the edges that may be displayed.
+        std::vector<float> candidates;
+        float max_unsaturated = -std::numeric_limits<float>::max();
+        bool any_unsaturated = false;
+        for (size_t b : selected_buckets)
+        {
+            for (size_t e = bucket_offsets[b]; e < bucket_offsets[b+1]; ++e)
+            {
+                candidates.push_back(edge_weight[e]);
+                if (edge_weight[e] != saturated_weight)
+                {
+                    max_unsaturated = std::max(max_unsaturated, edge_weight[e]);
+                    any_unsaturated = true;
+                }
+            }
+        }
+
+        // Select the `num_top' highest weights, in linear time.
+        const size_t num_top = candidates.size() * displayed_edge_fraction;
+        edge_displayed.assign((edge_dst.size() + 63) / 64, 0);
+        display_min_weight = display_max_weight = 0.0f;
+        if (num_top > 0)
+        {
+            std::nth_element(candidates.begin(), candidates.begin() + (num_top - 1),
+                             candidates.end(), std::greater<float>());
+            const float threshold = candidates[num_top - 1];
+            size_t num_at_threshold = std::count(candidates.begin(), candidates.begin() + num_top,
+                                                 threshold);
+
+            // Mark all edges above the threshold, and as many edges
+            // at the threshold as fit in the top `num_top'.
+            for (size_t b : selected_buckets)
+            {
+                for (size_t e = bucket_offsets[b]; e < bucket_offsets[b+1]; ++e)
+                {
+                    if (edge_weight[e] < threshold) continue;
+                    if (edge_weight[e] == threshold)
+                    {
+                        if (num_at_threshold == 0) continue;
+                        num_at_threshold--;
+                    }
+                    edge_displayed[e / 64] |= (uint64_t) 1 << (e % 64);
+                }
+            }
+
+            display_min_weight = threshold;
+            display_max_weight = any_unsaturated ? max_unsaturated : saturated_weight;
+        }
+
+        edge_cache_revision = graph.revision();
+        edge_cache_valid = true;
     }
 
+    bool GraphLayout::isEdgeDisplayed(size_t e) const
+    {
+        return (edge_displayed[e / 64] >> (e % 64)) & 1;
+    }
 
     // Linear interpolation function- for Continuous Coloring- 14th october
     float lerp(float a, float b, float t) {
@@ -228,7 +726,7 @@ namespace RPGraph
     }
 
     void GraphLayout::writeToPNG(const int image_w, const int image_h,
-                                 std::string path)
+                                 std::string path, ThreadPool *pool)
     {
         const float xRange = getXRange();
         const float yRange = getYRange();
@@ -237,8 +735,6 @@ namespace RPGraph
         const float yCenter = center.y;
         const float minX = xCenter - xRange/2.0;
         const float minY = yCenter - yRange/2.0;
-        const float xScale = image_w/xRange;
-        const float yScale = image_h/yRange;
 
         // Here we need to do some guessing as to what the optimal
         // opacity of nodes and edges might be, given network size.
@@ -287,62 +783,159 @@ namespace RPGraph
 */
 
 //Start of Intra-Chromosomal Setting- 30th October
-        //14th October,2023-Update-TO display highest 20% weighted edges for intra-chromosome edges
-        std::vector<std::pair<std::pair<nid_t, nid_t>, float>> intra_chromosome_edges;
-            for (nid_t n1 = 0; n1 < graph.num_nodes(); ++n1) {
-                for (nid_t n2 : graph.neighbors_with_geq_id(n1)) {
-                    if (shouldDisplayEdge(n1, n2) && n1 != n2) {  // Assuming `shouldDisplayEdge` checks if n1 and n2 are from the same chromosome for intra-chromosomal edges
-                        float edgeWeight = graph.get_edge_weight(n1, n2);
-                        intra_chromosome_edges.push_back({{n1, n2}, edgeWeight});
-                    }
-                }
-            }
+        // Edge selection and coloring moved to drawViews().
+//End of Intra-Chromosomal Setting
+        
+        // Draw through the same projection as before, without depth.
+        const Coordinate lo(minX, minY, 0.0f);
+        const Coordinate hi(minX + xRange, minY + yRange, 0.0f);
+        const OrthographicProjection view(AXIS_X, AXIS_Y, lo, hi, image_w, image_h, 0.0f);
+        std::vector<const Projection *> views(1, &view);
+        std::vector<Rasterizer> rasters(1, Rasterizer(image_w, image_h));
+        drawViews(views, rasters);
 
-            // Sort the edges by weight for intra-chromosome edges
-            std::sort(intra_chromosome_edges.begin(), intra_chromosome_edges.end(), [](const std::pair<std::pair<nid_t, nid_t>, float>& a, const std::pair<std::pair<nid_t, nid_t>, float>& b) {
-                return a.second > b.second;
-            });
+        // Write it to disk.
+        rasters[0].render(pool);
+        rasters[0].writePNG(path, png_level, pool);
+    }
 
-            // Consider only the top 25% for intra-chromosome edges
-            size_t num_top_edges = intra_chromosome_edges.size() * 0.25;
-            std::set<std::pair<nid_t, nid_t>> top_edges;
-            for (size_t i = 0; i < num_top_edges; ++i) {
-                top_edges.insert(intra_chromosome_edges[i].first);
+    void GraphLayout::writeViewsToPNG(const int image_w, const int image_h,
+                                      std::string path_prefix, const Camera *camera,
+                                      ThreadPool *pool)
+    {
+        const Coordinate center = getCenter();
+        const Coordinate lo(center.x - getXRange()/2.0f, center.y - getYRange()/2.0f,
+                            center.z - getZRange()/2.0f);
+        const Coordinate hi(center.x + getXRange()/2.0f, center.y + getYRange()/2.0f,
+                            center.z + getZRange()/2.0f);
+
+        // Each view as seen from outside the layout, with x (or y for the
+        // side view) to the right.
+        const OrthographicProjection xy(AXIS_X, AXIS_Y, lo, hi, image_w, image_h, 1.0f);
+        const OrthographicProjection xz(AXIS_X, AXIS_Z, lo, hi, image_w, image_h, -1.0f);
+        const OrthographicProjection yz(AXIS_Y, AXIS_Z, lo, hi, image_w, image_h, 1.0f);
+        std::vector<const Projection *> views = {&xy, &xz, &yz};
+        std::vector<std::string> suffixes = {"_xy.png", "_xz.png", "_yz.png"};
+
+        std::unique_ptr<PerspectiveProjection> perspective;
+        if (camera)
+        {
+            perspective.reset(new PerspectiveProjection(*camera, image_w, image_h,
+                                                        getSpan() * 1e-4f));
+            views.push_back(perspective.get());
+            suffixes.push_back("_camera.png");
+        }
+
+        std::vector<Rasterizer> rasters(views.size(), Rasterizer(image_w, image_h));
+        drawViews(views, rasters);
+
+        for (size_t v = 0; v < views.size(); ++v)
+        {
+            rasters[v].render(pool);
+            rasters[v].writePNG(path_prefix + suffixes[v], png_level, pool);
+        }
+    }
+
+    OrthographicProjection GraphLayout::flatView(const int image_w, const int image_h)
+    {
+        const Coordinate center = getCenter();
+        const Coordinate lo(center.x - getXRange()/2.0f, center.y - getYRange()/2.0f, 0.0f);
+        const Coordinate hi(center.x + getXRange()/2.0f, center.y + getYRange()/2.0f, 0.0f);
+        return OrthographicProjection(AXIS_X, AXIS_Y, lo, hi, image_w, image_h, 0.0f);
+    }
+
+    void GraphLayout::writeToStream(FrameStream &stream, ThreadPool *pool)
+    {
+        const OrthographicProjection view = flatView(stream.width(), stream.height());
+        std::vector<const Projection *> views(1, &view);
+        std::vector<Rasterizer> rasters(1, Rasterizer(stream.width(), stream.height()));
+        drawViews(views, rasters);
+        rasters[0].render(pool);
+
+        frame_rgb.resize((size_t) stream.width() * stream.height() * 3);
+        rasters[0].toneMap8(frame_rgb.data(), 1.0f, 1.0f, 1.0f, pool);
+        stream.writeFrame(frame_rgb.data(), pool);
+    }
+
+    void GraphLayout::writeDensityToPNG(const int image_w, const int image_h,
+                                        std::string path, float sigma, int edge_samples,
+                                        ThreadPool *pool)
+    {
+        const OrthographicProjection view = flatView(image_w, image_h);
+
+        // All edges of the selected buckets count, not only the heaviest
+        // ones writeToPNG draws. Each adds a total weight of 1, as do nodes.
+        updateEdgeCache();
+        edge_samples = std::max(edge_samples, 1);
+        const float sample_weight = 1.0f / edge_samples;
+
+        const int num_threads = pool ? pool->size() : 1;
+        DensityMap density(image_w, image_h, num_threads);
+        const std::function<void(int)> splat = [&](int tid)
+        {
+            float x, y, z;
+            const nid_t n_begin = (uint64_t) graph.num_nodes() * tid / num_threads;
+            const nid_t n_end = (uint64_t) graph.num_nodes() * (tid+1) / num_threads;
+            for (nid_t n = n_begin; n < n_end; ++n)
+            {
+                if (!shouldDisplayNode(n)) continue;
+                view.project(getCoordinate(n), x, y, z);
+                density.add(tid, x, y, 1.0f);
             }
 
-            //15th October- 2023: Taking account into 20% highest weighted edges to find the max and min from that
-            float minWeight = intra_chromosome_edges[num_top_edges - 1].second;
-            float maxWeight = intra_chromosome_edges[0].second;
-            // If the maxWeight is 10000.0, find the next highest value that isn't 10000.0
-            while (maxWeight == 10000 && !intra_chromosome_edges.empty()) {
-                intra_chromosome_edges.erase(intra_chromosome_edges.begin());  // remove the top edge
-                if (!intra_chromosome_edges.empty()) {
-                    maxWeight = intra_chromosome_edges[0].second;  // update the maxWeight to the next top edge's weight
+            for (size_t b : selected_buckets)
+            {
+                const size_t size = bucket_offsets[b+1] - bucket_offsets[b];
+                const size_t e_begin = bucket_offsets[b] + size * tid / num_threads;
+                const size_t e_end = bucket_offsets[b] + size * (tid+1) / num_threads;
+                for (size_t e = e_begin; e < e_end; ++e)
+                {
+                    const Coordinate c1 = getCoordinate(edge_src[e]);
+                    const Coordinate c2 = getCoordinate(edge_dst[e]);
+                    for (int s = 0; s < edge_samples; ++s)
+                    {
+                        // Evenly spaced samples, the midpoint if there is one.
+                        const float t = (s + 0.5f) / edge_samples;
+                        const Coordinate c(c1.x + (c2.x - c1.x) * t, c1.y + (c2.y - c1.y) * t,
+                                           c1.z + (c2.z - c1.z) * t);
+                        view.project(c, x, y, z);
+                        density.add(tid, x, y, sample_weight);
+                    }
                 }
             }
-//End of Intra-Chromosomal Setting
-        
+        };
+        if (pool) pool->run_on_all(splat);
+        else splat(0);
+
+        density.render(sigma, pool);
+        density.writePNG(path, png_level, pool);
+    }
+
+    void GraphLayout::drawViews(const std::vector<const Projection *> &views,
+                                std::vector<Rasterizer> &rasters)
+    {
+        //14th October,2023-Update-TO display highest 20% weighted edges for intra-chromosome edges
+        // The selection and its weight range are computed once per graph, see updateEdgeCache().
+        updateEdgeCache();
+        const float minWeight = display_min_weight;
+        const float maxWeight = display_max_weight;
+
         //const float edge_opacity = 0.01;
         float edge_opacity = 0.01;
-        // Write to file.
-        pngwriter layout_png(image_w, image_h, 0, path.c_str());
-        layout_png.invert(); // set bg. to white
-
-    for (nid_t n1 = 0; n1 < graph.num_nodes(); ++n1)
-    {
-            // for (nid_t n2 : graph.neighbors_with_geq_id(n1)) {
-            //     // ... and edge.
-            //     if (shouldDisplayEdge(n1, n2)){
-            //     layout_png.line_blend((getX(n1) - minX)*xScale, (getY(n1) - minY)*yScale,
-            //                           (getX(n2) - minX)*xScale, (getY(n2) - minY)*yScale,
-            //                           edge_opacity, 17400, 17700, 17600);}
-            // }
-        for (nid_t n2 : graph.neighbors_with_geq_id(n1)) {
-            if (top_edges.count({n1, n2}) > 0) {
-                float edgeWeight = graph.get_edge_weight(n1, n2);
+        float x0, y0, z0, x1, y1, z1;
+
+        // Edges of the buckets selected by the edge mode (see setEdgeMode).
+        for (size_t b : selected_buckets)
+        {
+            for (size_t e = bucket_offsets[b]; e < bucket_offsets[b+1]; ++e)
+            {
+                if (!isEdgeDisplayed(e)) continue;
+                const nid_t n1 = edge_src[e];
+                const nid_t n2 = edge_dst[e];
+                float edgeWeight = edge_weight[e];
 
                 // Working on Edge Opacity
-                if (edgeWeight < 10000.0) {
+                if (edgeWeight < saturated_weight) {
                     edge_opacity = edgeWeight / maxWeight * 2;
 
                     //15th OCtober Update- Fixing edge opacity to see if color blending works or not
@@ -353,178 +946,39 @@ namespace RPGraph
 
                 // Scale the weight between 0 (green) and 1 (red)
                 float t;
-                if(edgeWeight!=10000.0){
+                if(edgeWeight!=saturated_weight){
                     t = (edgeWeight - minWeight) / (maxWeight - minWeight);
                 }
                 else{
                     t = 0.3;
                 }
-                
-
-
-
-                
 
                 // Calculate the RGB values based on weight
-                int red = lerp(0, 65535, t);
-                //std::cout << "Value of red: " << red << std::endl;
-                int green = lerp(65535, 0, t);
-                //std::cout << "Value of green: " << green << std::endl;
-                int blue = 0;  // Constant for simplicity.
-/* For Inter Chromosomal Setting- 30th October
-                if ((n1 > 0 && n1 <= 558) && (n2 > 0 && n2 <= 558)) {
-                    layout_png.line_blend((getX(n1) - minX) * xScale, (getY(n1) - minY) * yScale,
-                                        (getX(n2) - minX) * xScale, (getY(n2) - minY) * yScale,
-                                        edge_opacity, red, green, 0);
-                } else if ((n1 > 1012 && n1 <= 1258) && (n2 > 1012 && n2 <= 1258)) {
-                    // You can update this block and others similarly if you want different coloring based on different node ranges.
-                    layout_png.line_blend((getX(n1) - minX) * xScale, (getY(n1) - minY) * yScale,
-                                        (getX(n2) - minX) * xScale, (getY(n2) - minY) * yScale,
-                                        edge_opacity, red, green, 0);
-                } else if ((n1 > 558 && n1 <= 1012) && (n2 > 558 && n2 <= 1012)) {
-                    layout_png.line_blend((getX(n1) - minX) * xScale, (getY(n1) - minY) * yScale,
-                                        (getX(n2) - minX) * xScale, (getY(n2) - minY) * yScale,
-                                        edge_opacity, red, green, 0);
-                }
-*/
-//For intra-chromosomal setting- 30th October
-                if ((n1> 0 && n1 <= 558) && (n2>558 && n2 <= 1012))
-                {
-                                    layout_png.line_blend((getX(n1) - minX)*xScale, (getY(n1) - minY)*yScale,
-                                      (getX(n2) - minX)*xScale, (getY(n2) - minY)*yScale,
-                                      edge_opacity, red, green, 0);
-
-                }
-                else if ((n1> 0 && n1 <= 558) && (n2>1012 && n2 <= 1258))
+                float red = lerp(0, 1, t);
+                float green = lerp(1, 0, t);
+                const Coordinate c1 = getCoordinate(n1), c2 = getCoordinate(n2);
+                for (size_t v = 0; v < views.size(); ++v)
                 {
-                    // Plot edge with blue color
-                                    layout_png.line_blend((getX(n1) - minX)*xScale, (getY(n1) - minY)*yScale,
-                                      (getX(n2) - minX)*xScale, (getY(n2) - minY)*yScale,
-                                      edge_opacity, red, green, 0);
+                    if (!views[v]->projectLine(c1, c2, x0, y0, z0, x1, y1, z1)) continue;
+                    rasters[v].addLine(x0, y0, x1, y1, red, green, 0.0f, edge_opacity, z0, z1);
                 }
-                else if ((n1> 558 && n1 <= 1012) && (n2>0 && n2 <= 558))
-                {
-                    // Plot edge with blue color
-                                    layout_png.line_blend((getX(n1) - minX)*xScale, (getY(n1) - minY)*yScale,
-                                      (getX(n2) - minX)*xScale, (getY(n2) - minY)*yScale,
-                                      edge_opacity, red, green, 0);
-                }
-                else if ((n1> 558 && n1 <= 1012) && (n2>1012 && n2 <= 1258))
-                {
-                    // Plot edge with blue color
-                                    layout_png.line_blend((getX(n1) - minX)*xScale, (getY(n1) - minY)*yScale,
-                                      (getX(n2) - minX)*xScale, (getY(n2) - minY)*yScale,
-                                      edge_opacity, red, green, 0);
-                }
-                else if ((n1> 1012 && n1 <= 1258) && (n2>0 && n2 <= 558))
-                {
-                    // Plot edge with blue color
-                                    layout_png.line_blend((getX(n1) - minX)*xScale, (getY(n1) - minY)*yScale,
-                                      (getX(n2) - minX)*xScale, (getY(n2) - minY)*yScale,
-                                      edge_opacity, red, green, 0);
-                }
-                else if ((n1> 1012 && n1 <= 1258) && (n2>558 && n2 <= 1012))
-                {
-                    // Plot edge with blue color
-                                    layout_png.line_blend((getX(n1) - minX)*xScale, (getY(n1) - minY)*yScale,
-                                      (getX(n2) - minX)*xScale, (getY(n2) - minY)*yScale,
-                                      edge_opacity, red, green, 0);
-                }
-                //
             }
         }
 
-        //         //Intra Interaction
-
-        //         if ((n1> 0 && n1 <= 558) && (n2>0 && n2 <= 558))
-        //         {
-        //             // Plot edge with red color
-        //             layout_png.line((getX(n1) - minX) * xScale, (getY(n1) - minY) * yScale,
-        //                             (getX(n2) - minX) * xScale, (getY(n2) - minY) * yScale,
-        //                             0, 0, 0);
-        //         }
-        //         else if ((n1> 558 && n1 <= 1012) && (n2>558 && n2 <= 1012))
-        //         {
-        //             // Plot edge with green color
-        //             layout_png.line((getX(n1) - minX) * xScale, (getY(n1) - minY) * yScale,
-        //                             (getX(n2) - minX) * xScale, (getY(n2) - minY) * yScale,
-        //                             0, 0, 0);
-        //         }
-        //         else if ((n1> 1012 && n1 <= 1258) && (n2>1012 && n2 <= 1258))
-        //         {
-        //             // Plot edge with blue color
-        //             layout_png.line((getX(n1) - minX) * xScale, (getY(n1) - minY) * yScale,
-        //                             (getX(n2) - minX) * xScale, (getY(n2) - minY) * yScale,
-        //                             0, 0, 0);
-        //         }
-        //     }
-        // }
-
-        if (shouldDisplayNode(n1))
-        {
-            // Plot node
-            if (n1 <= 558)
-            {            
-                layout_png.filledcircle((getX(n1) - minX)*xScale,
-                                       (getY(n1) - minY)*yScale,
-                                       5, 6000000, 0, 0);
-                           
-            // Update on 20th June- Checking for edge_list_Combined_with_NewYT_normalized (Replaced bins 200 to 400)- Making these black to see 
-            //what happens to the replaced bins 
-
-            //Update on 11 July- Replaced bins at 200-400, 600-800, 1000-1200... Making black nodes for those 3 parts
-            // if (n1 >=200 && n1 <=400)
-            // {            
-            //     layout_png.filledcircle((getX(n1) - minX)*xScale,
-            //                            (getY(n1) - minY)*yScale,
-            //                            5, 0, 0, 0);
-                                    
-
-            // }               
-
-            }
-            else if (n1 > 558 && n1 <= 1012)
-            {
-                layout_png.filledcircle((getX(n1) - minX)*xScale,
-                                       (getY(n1) - minY)*yScale,
-                                       5, 0, 0, 6000000);
-
-            //     if (n1 >=600 && n1 <=800)
-            // {            
-            //     layout_png.filledcircle((getX(n1) - minX)*xScale,
-            //                            (getY(n1) - minY)*yScale,
-            //                            5, 0, 0, 0);
-                                    
-
-            // }  
-
-            }
+        // Nodes, colored by group.
+        for (nid_t n1 = 0; n1 < graph.num_nodes(); ++n1)
+        {
+            if (!shouldDisplayNode(n1)) continue;
 
-            else if (n1 > 1012 && n1 <= 1258)
+            float r, g, b;
+            groupColor(groupOf(n1), r, g, b);
+            const Coordinate c = getCoordinate(n1);
+            for (size_t v = 0; v < views.size(); ++v)
             {
-                layout_png.filledcircle((getX(n1) - minX)*xScale,
-                                       (getY(n1) - minY)*yScale,
-                                       5, 0, 6000000, 0);
-
-            //     if (n1 >=1000 && n1 <=1200)
-            // {            
-            //     layout_png.filledcircle((getX(n1) - minX)*xScale,
-            //                            (getY(n1) - minY)*yScale,
-            //                            5, 0, 0, 0);
-                                    
-
-            // } 
-
+                if (!views[v]->project(c, x0, y0, z0)) continue;
+                rasters[v].addDisc(x0, y0, 5, r, g, b, z0);
             }
-
         }
-
-        //Inter-Interaction
-
-
-    }
-        // Write it to disk.
-        layout_png.write_png();
     }
 
 
@@ -581,7 +1035,8 @@ namespace RPGraph
 
         for (nid_t n = 0; n < graph.num_nodes(); ++n)
         {
-            nid_t id = graph.node_map_r[n]; // id as found in edgelist
+            if (isRemoved(n)) continue;
+            nid_t id = graph.original_id(n); // id as found in edgelist
             out_file << id << "," << getX(n) << "," << getY(n) << "," << getZ(n) << "\n"; // Include Z coordinate
         }
 
@@ -600,7 +1055,8 @@ namespace RPGraph
 
         for (nid_t n = 0; n < graph.num_nodes(); ++n)
         {
-            nid_t id = graph.node_map_r[n]; // id as found in edgelist
+            if (isRemoved(n)) continue;
+            nid_t id = graph.original_id(n); // id as found in edgelist
             float x = getX(n);
             float y = getY(n);
 
@@ -612,4 +1068,328 @@ namespace RPGraph
         out_file.close();
     }
 
+    // Appends the bytes of `value' to `out', in host (i.e. little endian
+    // on all platforms we build for) byte order.
+    template <typename T>
+    static void append_bytes(std::vector<char> &out, const T &value)
+    {
+        const char *bytes = reinterpret_cast<const char *>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    static void append_color(std::vector<char> &out, float r, float g, float b)
+    {
+        append_bytes(out, (uint8_t) (r * 255.0f + 0.5f));
+        append_bytes(out, (uint8_t) (g * 255.0f + 0.5f));
+        append_bytes(out, (uint8_t) (b * 255.0f + 0.5f));
+    }
+
+    void GraphLayout::collectEdges(std::vector<uint32_t> &endpoints, std::vector<float> &weights)
+    {
+        endpoints.clear();
+        weights.clear();
+
+        // Without removed nodes, indices are the node ids.
+        std::vector<uint32_t> index;
+        if (num_removed > 0)
+        {
+            index.resize(graph.num_nodes());
+            uint32_t i = 0;
+            for (nid_t n = 0; n < graph.num_nodes(); ++n)
+            {
+                index[n] = i;
+                if (!isRemoved(n)) i++;
+            }
+        }
+
+        for (nid_t n1 = 0; n1 < graph.num_nodes(); ++n1)
+        {
+            if (isRemoved(n1)) continue;
+            for (nid_t n2 : graph.neighbors_with_geq_id(n1))
+            {
+                if (n1 == n2 || isRemoved(n2)) continue;
+                endpoints.push_back(index.empty() ? n1 : index[n1]);
+                endpoints.push_back(index.empty() ? n2 : index[n2]);
+                weights.push_back(graph.get_edge_weight(n1, n2));
+            }
+        }
+    }
+
+    void GraphLayout::writeToPLY(std::string path)
+    {
+        if (is_file_exists(path.c_str()))
+        {
+            printf("Error: File exists at %s\n", path.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        const bool with_colors = !node_group.empty();
+        std::vector<uint32_t> endpoints;
+        std::vector<float> weights;
+        collectEdges(endpoints, weights);
+
+        std::ostringstream header;
+        header << "ply\n"
+               << "format binary_little_endian 1.0\n"
+               << "comment graph_viewer layout, vertex ids as in the edgelist\n"
+               << "element vertex " << graph.num_nodes() - num_removed << "\n"
+               << "property float x\n" << "property float y\n" << "property float z\n";
+        if (with_colors)
+            header << "property uchar red\n" << "property uchar green\n" << "property uchar blue\n";
+        header << "property uint id\n"
+               << "element edge " << weights.size() << "\n"
+               << "property uint vertex1\n" << "property uint vertex2\n"
+               << "property float weight\n"
+               << "end_header\n";
+
+        // Both elements are assembled in memory, and written at once.
+        std::vector<char> body;
+        body.reserve((size_t) graph.num_nodes() * (with_colors ? 19 : 16) + weights.size() * 12);
+        for (nid_t n = 0; n < graph.num_nodes(); ++n)
+        {
+            if (isRemoved(n)) continue;
+            append_bytes(body, getX(n));
+            append_bytes(body, getY(n));
+            append_bytes(body, getZ(n));
+            if (with_colors)
+            {
+                float r, g, b;
+                groupColor(groupOf(n), r, g, b);
+                append_color(body, r, g, b);
+            }
+            append_bytes(body, (uint32_t) graph.original_id(n));
+        }
+        for (size_t e = 0; e < weights.size(); ++e)
+        {
+            append_bytes(body, endpoints[2*e]);
+            append_bytes(body, endpoints[2*e + 1]);
+            append_bytes(body, weights[e]);
+        }
+
+        std::ofstream out_file(path, std::ofstream::binary);
+        const std::string head = header.str();
+        out_file.write(head.data(), head.size());
+        out_file.write(body.data(), body.size());
+        out_file.close();
+    }
+
+    void GraphLayout::writeToLOD(std::string path, int num_levels, ThreadPool *pool)
+    {
+        if (is_file_exists(path.c_str()))
+        {
+            printf("Error: File exists at %s\n", path.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        // Octree over the layout, with masses as in ForceAtlas2. Small
+        // leaves make for gradual levels.
+        const Coordinate center = getCenter();
+        BarnesHutApproximator tree(center, getSpan() * 1.01f + 1.0f, 1.0f, 8);
+        for (nid_t n = 0; n < graph.num_nodes(); ++n)
+            if (!isRemoved(n)) tree.insertParticle(getCoordinate(n), graph.degree(n) + 1);
+        tree.summarize(pool);
+
+        std::vector<std::vector<BarnesHutCluster>> levels;
+        std::vector<std::vector<uint32_t>> cluster_of;
+        tree.clusterLevels(std::max(num_levels - 1, 1), levels, cluster_of);
+
+        // Levels that don't refine the one before (the tree ended) are dropped.
+        while (levels.size() > 1 && levels.back().size() == levels[levels.size()-2].size())
+        {
+            levels.pop_back();
+            cluster_of.pop_back();
+        }
+
+        // The finest level has a cluster per node, indexed as the particles.
+        std::vector<BarnesHutCluster> nodes;
+        for (nid_t n = 0; n < graph.num_nodes(); ++n)
+        {
+            if (isRemoved(n)) continue;
+            nodes.push_back(BarnesHutCluster{getCoordinate(n), (float) graph.degree(n) + 1, 1,
+                                             cluster_of.back()[nodes.size()]});
+        }
+        levels.push_back(nodes);
+
+        // Edges between clusters, with the summed weight of the edges
+        // between their nodes, per level.
+        std::vector<uint32_t> endpoints;
+        std::vector<float> weights;
+        collectEdges(endpoints, weights);
+        std::vector<std::vector<std::pair<uint64_t, float>>> level_edges(levels.size());
+        const ThreadPool::RangeFn aggregate = [&](size_t begin, size_t end)
+        {
+            for (size_t l = begin; l < end; ++l)
+            {
+                std::vector<std::pair<uint64_t, float>> &out = level_edges[l];
+                for (size_t e = 0; e < weights.size(); ++e)
+                {
+                    uint32_t a = endpoints[2*e], b = endpoints[2*e + 1];
+                    if (l < cluster_of.size())
+                    {
+                        a = cluster_of[l][a];
+                        b = cluster_of[l][b];
+                    }
+                    if (a == b || a == BarnesHutApproximator::NO_CLUSTER ||
+                        b == BarnesHutApproximator::NO_CLUSTER) continue;
+                    if (a > b) std::swap(a, b);
+                    out.push_back(std::make_pair((uint64_t) a << 32 | b, weights[e]));
+                }
+
+                std::sort(out.begin(), out.end(),
+                          [](const std::pair<uint64_t, float> &x, const std::pair<uint64_t, float> &y)
+                          { return x.first < y.first; });
+                size_t kept = 0;
+                for (size_t i = 0; i < out.size(); ++i)
+                {
+                    if (kept > 0 && out[kept-1].first == out[i].first) out[kept-1].second += out[i].second;
+                    else out[kept++] = out[i];
+                }
+                out.resize(kept);
+            }
+        };
+        if (pool) pool->parallel_for(levels.size(), aggregate);
+        else aggregate(0, levels.size());
+
+        // Header: magic, number of levels, then per level the byte offset
+        // of its data, its number of clusters and its number of edges.
+        // Per level: clusters (x, y, z, mass as float32, size as uint32),
+        // parents (uint32, into the level before), and edges (two uint32
+        // cluster indices and a float32 weight). All little endian.
+        std::vector<char> out;
+        const char magic[8] = {'R', 'P', 'G', 'L', 'O', 'D', '0', '1'};
+        out.insert(out.end(), magic, magic + 8);
+        append_bytes(out, (uint32_t) levels.size());
+        append_bytes(out, (uint32_t) 0);
+        uint64_t offset = out.size() + levels.size() * 24;
+        for (size_t l = 0; l < levels.size(); ++l)
+        {
+            append_bytes(out, offset);
+            append_bytes(out, (uint64_t) levels[l].size());
+            append_bytes(out, (uint64_t) level_edges[l].size());
+            offset += levels[l].size() * 24 + level_edges[l].size() * 12;
+        }
+        for (size_t l = 0; l < levels.size(); ++l)
+        {
+            for (const BarnesHutCluster &c : levels[l])
+            {
+                append_bytes(out, c.mass_center.x);
+                append_bytes(out, c.mass_center.y);
+                append_bytes(out, c.mass_center.z);
+                append_bytes(out, c.mass);
+                append_bytes(out, (uint32_t) c.size);
+            }
+            for (const BarnesHutCluster &c : levels[l]) append_bytes(out, c.parent);
+            for (const std::pair<uint64_t, float> &e : level_edges[l])
+            {
+                append_bytes(out, (uint32_t) (e.first >> 32));
+                append_bytes(out, (uint32_t) e.first);
+                append_bytes(out, e.second);
+            }
+        }
+
+        std::ofstream out_file(path, std::ofstream::binary);
+        out_file.write(out.data(), out.size());
+        out_file.close();
+    }
+
+    void GraphLayout::writeToGLB(std::string path)
+    {
+        if (is_file_exists(path.c_str()))
+        {
+            printf("Error: File exists at %s\n", path.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        const bool with_colors = !node_group.empty();
+        std::vector<uint32_t> endpoints;
+        std::vector<float> weights;
+        collectEdges(endpoints, weights);
+        const nid_t num_nodes = graph.num_nodes();
+        const nid_t num_vertices = num_nodes - num_removed;
+
+        // The binary buffer holds positions, then colors (RGBA, as vertex
+        // attributes must be 4-byte aligned), then edge indices.
+        std::vector<char> bin;
+        float lo[3] = {0.0f, 0.0f, 0.0f}, hi[3] = {0.0f, 0.0f, 0.0f};
+        for (nid_t n = 0; n < num_nodes; ++n)
+        {
+            if (isRemoved(n)) continue;
+            const bool first = bin.empty();
+            const float c[3] = {getX(n), getY(n), getZ(n)};
+            for (int i = 0; i < 3; ++i)
+            {
+                lo[i] = first ? c[i] : std::min(lo[i], c[i]);
+                hi[i] = first ? c[i] : std::max(hi[i], c[i]);
+                append_bytes(bin, c[i]);
+            }
+        }
+        const size_t colors_offset = bin.size();
+        if (with_colors)
+        {
+            for (nid_t n = 0; n < num_nodes; ++n)
+            {
+                if (isRemoved(n)) continue;
+                float r, g, b;
+                groupColor(groupOf(n), r, g, b);
+                append_color(bin, r, g, b);
+                append_bytes(bin, (uint8_t) 255);
+            }
+        }
+        const size_t indices_offset = bin.size();
+        for (uint32_t id : endpoints) append_bytes(bin, id);
+        while (bin.size() % 4 != 0) bin.push_back(0);
+
+        std::ostringstream json;
+        json.precision(9);
+        json << "{\"asset\":{\"version\":\"2.0\",\"generator\":\"graph_viewer\"},"
+             << "\"scene\":0,\"scenes\":[{\"nodes\":[0]}],\"nodes\":[{\"mesh\":0}],"
+             << "\"buffers\":[{\"byteLength\":" << bin.size() << "}],"
+             << "\"bufferViews\":["
+             << "{\"buffer\":0,\"byteOffset\":0,\"byteLength\":" << colors_offset
+             << ",\"target\":34962}";
+        if (with_colors)
+            json << ",{\"buffer\":0,\"byteOffset\":" << colors_offset
+                 << ",\"byteLength\":" << indices_offset - colors_offset << ",\"target\":34962}";
+        if (!endpoints.empty())
+            json << ",{\"buffer\":0,\"byteOffset\":" << indices_offset
+                 << ",\"byteLength\":" << endpoints.size() * 4 << ",\"target\":34963}";
+        json << "],\"accessors\":["
+             << "{\"bufferView\":0,\"componentType\":5126,\"count\":" << num_vertices
+             << ",\"type\":\"VEC3\",\"min\":[" << lo[0] << "," << lo[1] << "," << lo[2]
+             << "],\"max\":[" << hi[0] << "," << hi[1] << "," << hi[2] << "]}";
+        if (with_colors)
+            json << ",{\"bufferView\":1,\"componentType\":5121,\"normalized\":true,"
+                 << "\"count\":" << num_vertices << ",\"type\":\"VEC4\"}";
+        if (!endpoints.empty())
+            json << ",{\"bufferView\":" << (with_colors ? 2 : 1) << ",\"componentType\":5125,"
+                 << "\"count\":" << endpoints.size() << ",\"type\":\"SCALAR\"}";
+
+        // Nodes as points, edges as lines between them.
+        const std::string attributes = with_colors ? "{\"POSITION\":0,\"COLOR_0\":1}"
+                                                   : "{\"POSITION\":0}";
+        json << "],\"meshes\":[{\"primitives\":["
+             << "{\"attributes\":" << attributes << ",\"mode\":0}";
+        if (!endpoints.empty())
+            json << ",{\"attributes\":" << attributes << ",\"indices\":" << (with_colors ? 2 : 1)
+                 << ",\"mode\":1}";
+        json << "]}]}";
+
+        std::string json_chunk = json.str();
+        while (json_chunk.size() % 4 != 0) json_chunk += ' ';
+
+        std::vector<char> glb;
+        append_bytes(glb, (uint32_t) 0x46546C67); // "glTF"
+        append_bytes(glb, (uint32_t) 2);
+        append_bytes(glb, (uint32_t) (12 + 8 + json_chunk.size() + 8 + bin.size()));
+        append_bytes(glb, (uint32_t) json_chunk.size());
+        append_bytes(glb, (uint32_t) 0x4E4F534A); // "JSON"
+        glb.insert(glb.end(), json_chunk.begin(), json_chunk.end());
+        append_bytes(glb, (uint32_t) bin.size());
+        append_bytes(glb, (uint32_t) 0x004E4942); // "BIN"
+
+        std::ofstream out_file(path, std::ofstream::binary);
+        out_file.write(glb.data(), glb.size());
+        out_file.write(bin.data(), bin.size());
+        out_file.close();
+    }
 }
@@ -26,7 +26,13 @@
 
 #include "RPGraph.hpp"
 #include "RPCommon.hpp"
+#include "RPProjection.hpp"
+#include "RPThreadPool.hpp"
+#include "RPRasterizer.hpp"
+#include "RPFrameStream.hpp"
+#include <random>
 #include <string>
+#include <vector>
 //Modify for z coordinate- 14th November
 namespace RPGraph
 {/*
@@ -66,10 +72,67 @@ namespace RPGraph
         void writeToBin(std::string path);*/
 
 
+    // Edges displayed by writeToPNG: between nodes of the same group,
+    // between nodes of different groups, or all.
+    enum EdgeMode { EDGES_INTRA, EDGES_INTER, EDGES_ALL };
+
     class GraphLayout
     {
     private:
         Coordinate *coordinates;
+        nid_t num_coordinates; // Nodes the layout has room for.
+        EdgeMode edge_mode;
+        int png_level;
+        std::mt19937 rng; // Of randomizePositions, seeded with 5489 by default.
+        bool has_positions; // Set by randomizePositions and loadPositions.
+
+        // Group of each node, or -1 if it has none. Empty if no groups
+        // were loaded, in which case all nodes are in group 0.
+        std::vector<int> node_group;
+        std::vector<std::string> group_names;
+
+        // Nodes taken out of the graph (see removeNode()). Empty if none
+        // were; nodes added since then are not in it.
+        std::vector<bool> removed;
+        nid_t num_removed;
+
+        // The edges between displayed nodes, bucketed by the pair of groups
+        // of their endpoints: bucket b has the edges [bucket_offsets[b],
+        // bucket_offsets[b+1]) between groups bucket_groups[b]. Also the
+        // buckets selected by the edge mode, and a bitmask of the edges
+        // writeToPNG displays. Kept until the graph, groups or edge mode
+        // change (see UGraph::revision()).
+        uint64_t edge_cache_revision;
+        bool edge_cache_valid;
+        std::vector<size_t> bucket_offsets;
+        std::vector<std::pair<int, int>> bucket_groups;
+        std::vector<size_t> selected_buckets;
+        std::vector<nid_t> edge_src, edge_dst;
+        std::vector<float> edge_weight;
+        std::vector<uint64_t> edge_displayed;
+        float display_min_weight, display_max_weight;
+
+        void updateEdgeCache();
+        bool isEdgeDisplayed(size_t e) const;
+
+        // Places the nodes that aren't `placed' near the mean of their
+        // placed neighbours, in rounds outwards; those not connected to
+        // any placed node randomly within the placed ones. If `planar',
+        // placed nodes get a z from a thin slab first.
+        void placeNearNeighbors(std::vector<bool> &placed, bool planar);
+
+        // Adds the displayed edges and nodes to each of `rasters', through
+        // the view of the same index, reading each edge and node once.
+        void drawViews(const std::vector<const Projection *> &views,
+                       std::vector<Rasterizer> &rasters);
+        // The xy-plane, stretched to fill the image.
+        OrthographicProjection flatView(const int image_w, const int image_h);
+        // All edges but self-loops, as pairs of endpoints, with their
+        // weights. Endpoints are indices among the nodes that aren't
+        // removed, as the exports list them.
+        void collectEdges(std::vector<uint32_t> &endpoints, std::vector<float> &weights);
+
+        std::vector<uint8_t> frame_rgb; // Kept between frames of a stream.
 
     protected:
         float width, height, depth; // Added depth for 3D
@@ -83,6 +146,41 @@ namespace RPGraph
 
         // Randomize the layout position of all nodes.
         void randomizePositions();
+        void seedRandom(uint32_t seed);
+        // State of the random number generator, to be saved and restored
+        // with the positions.
+        std::string randomState() const;
+        void setRandomState(const std::string &state);
+
+        // Warm start: takes the positions of nodes from a layout written
+        // by writeToCSV or writeToBin, matched by their ids in the
+        // edgelist. Nodes not in the file are placed near the mean of
+        // their placed neighbours, in rounds outwards from the matched
+        // nodes; nodes not connected to any of those are placed randomly
+        // within the loaded layout. Binary layouts are 2D, so z is drawn
+        // from a thin slab the layout can unfold from. Returns the number
+        // of nodes matched.
+        nid_t loadPositions(std::string path);
+        // False until positions were randomized or loaded.
+        bool hasPositions() const;
+        // Makes room for the nodes added to the graph since the layout
+        // was created (or last grew), and places them as loadPositions
+        // places nodes missing from its file. Moves positionData().
+        // Returns the number of nodes added.
+        nid_t addNodes();
+        // Takes node `n', which has no edges left, out of the layout: it
+        // isn't displayed or exported anymore, and has no mass in
+        // ForceAtlas2. Node ids stay as they are.
+        void removeNode(nid_t n);
+        bool isRemoved(nid_t n) const;
+
+        // Positions of all nodes, as x, y, z per node. The array is
+        // allocated with the layout, so the pointer stays valid until
+        // nodes are added (see addNodes()); engines that don't keep
+        // positions in the layout update it on sync_layout().
+        const float *positionData() const;
+        // Sets all positions from such an array, as a warm start.
+        void setPositions(const float *xyz);
 
         float getX(nid_t node_id), getY(nid_t node_id), getZ(nid_t node_id); // Added getZ
         float getXRange(), getYRange(), getZRange(), getSpan(); // Added getZRange
@@ -95,11 +193,49 @@ namespace RPGraph
         void setX(nid_t node_id, float x_value), setY(nid_t node_id, float y_value), setZ(nid_t node_id, float z_value); // Added setZ
         void moveNode(nid_t, Real3DVector v); // Changed to Real3DVector
         void setCoordinates(nid_t node_id, Coordinate c);
-        void writeToPNG(const int image_w, const int image_h, std::string path);
+        // Renders on `pool', if given.
+        void writeToPNG(const int image_w, const int image_h, std::string path,
+                        ThreadPool *pool = nullptr);
+        // Writes views along the z, y and x axes to <path_prefix>_xy.png,
+        // _xz.png and _yz.png, and the view through `camera', if given, to
+        // _camera.png. The layout is traversed once for all of them.
+        void writeViewsToPNG(const int image_w, const int image_h, std::string path_prefix,
+                             const Camera *camera = nullptr, ThreadPool *pool = nullptr);
+        // Writes the density of the nodes and the edges of the edge mode,
+        // each edge sampled at `edge_samples' points, blurred with a
+        // Gaussian of `sigma' pixels. Cost doesn't depend on edge lengths.
+        void writeDensityToPNG(const int image_w, const int image_h, std::string path,
+                               float sigma = 2.0f, int edge_samples = 1,
+                               ThreadPool *pool = nullptr);
+        // Appends the image writeToPNG would write, of the stream's size.
+        void writeToStream(FrameStream &stream, ThreadPool *pool = nullptr);
         void writeToCSV(std::string path);
         void writeToBin(std::string path);
-
-
+        // 3D layout with the edges, for viewers: binary PLY with vertex
+        // and edge elements, or glTF 2.0 (GLB) with nodes as points and
+        // edges as lines. Vertices are colored by group if groups were
+        // loaded; PLY also has the edgelist ids and the edge weights.
+        void writeToPLY(std::string path);
+        void writeToGLB(std::string path);
+        // Level-of-detail file for viewers, from an octree over the layout:
+        // up to `num_levels' levels of clusters (mass centers and masses),
+        // coarse to fine, the last with one cluster per node, and the
+        // summed weights of the edges between clusters. An index of byte
+        // offsets allows reading levels separately; the format is given in
+        // the implementation.
+        void writeToLOD(std::string path, int num_levels = 8, ThreadPool *pool = nullptr);
+        // zlib level (0-9) of the PNG files written, 6 by default. Low
+        // levels keep up with the layout when writing many snapshots.
+        void setPNGLevel(int level);
+
+        // Reads the group (e.g. chromosome) of each node from a file with
+        // lines `node_id group_name', with ids as in the edgelist.
+        void loadNodeGroups(std::string path);
+        void setEdgeMode(EdgeMode mode);
+        bool shouldDisplayNode(nid_t node_id) const;
+        int groupOf(nid_t node_id) const;
+        int numGroups() const;
+        void groupColor(int group, float &r, float &g, float &b) const;
     };
 }
 
@@ -0,0 +1,262 @@
+/*
+ ==============================================================================
+
+ RPGraphLayoutC.cpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#include "RPGraphLayoutC.h"
+#include "RPGraph.hpp"
+#include "RPGraphLayout.hpp"
+#include "RPThreadPool.hpp"
+#include "RPCPUForceAtlas2.hpp"
+#include "RPCPUBHForceAtlas2.hpp"
+#include <memory>
+#include <new>
+#include <random>
+
+#ifdef __NVCC__
+#include <cuda_runtime_api.h>
+#include "RPGPUForceAtlas2.hpp"
+#endif
+
+struct rpg_graph
+{
+    RPGraph::UGraph graph;
+};
+
+// Members are destroyed in reverse order: the engine before the layout it
+// steps, and both before the pool they run on.
+struct rpg_layout
+{
+    std::unique_ptr<RPGraph::ThreadPool> pool;
+    std::unique_ptr<RPGraph::GraphLayout> layout;
+    std::unique_ptr<RPGraph::ForceAtlas2> fa2;
+    rpg_step_callback callback = nullptr;
+    void *user_data = nullptr;
+};
+
+// Library code reports the errors an API call can run into by throwing,
+// e.g. std::bad_alloc. They must not cross the C boundary.
+template <typename F>
+static rpg_status guarded(F f)
+{
+    try
+    {
+        return f();
+    }
+    catch (const std::bad_alloc &)
+    {
+        return RPG_ERROR_OUT_OF_MEMORY;
+    }
+    #ifdef __NVCC__
+    catch (const CudaError &e)
+    {
+        return e.code == cudaErrorMemoryAllocation ? RPG_ERROR_OUT_OF_MEMORY : RPG_ERROR_INTERNAL;
+    }
+    #endif
+    catch (...)
+    {
+        return RPG_ERROR_INTERNAL;
+    }
+}
+
+extern "C"
+{
+    const char *rpg_status_string(rpg_status status)
+    {
+        switch (status)
+        {
+            case RPG_OK: return "ok";
+            case RPG_ERROR_INVALID_ARGUMENT: return "invalid argument";
+            case RPG_ERROR_UNSUPPORTED: return "unsupported";
+            case RPG_ERROR_OUT_OF_MEMORY: return "out of memory";
+            case RPG_ERROR_INTERNAL: return "internal error";
+        }
+        return "unknown status";
+    }
+
+    rpg_status rpg_graph_create(uint32_t num_nodes, size_t num_edges,
+                                const uint32_t *sources, const uint32_t *targets,
+                                const float *weights, rpg_graph **graph)
+    {
+        if (graph == nullptr or num_nodes == 0) return RPG_ERROR_INVALID_ARGUMENT;
+        if (num_edges > 0 and (sources == nullptr or targets == nullptr))
+            return RPG_ERROR_INVALID_ARGUMENT;
+        for (size_t e = 0; e < num_edges; ++e)
+            if (sources[e] >= num_nodes or targets[e] >= num_nodes)
+                return RPG_ERROR_INVALID_ARGUMENT;
+
+        return guarded([&]() -> rpg_status
+        {
+            std::unique_ptr<rpg_graph> g(new rpg_graph());
+            g->graph.setEdges(num_nodes, num_edges, sources, targets, weights);
+            *graph = g.release();
+            return RPG_OK;
+        });
+    }
+
+    void rpg_graph_destroy(rpg_graph *graph)
+    {
+        delete graph;
+    }
+
+    uint32_t rpg_graph_num_nodes(rpg_graph *graph)
+    {
+        return graph ? graph->graph.num_nodes() : 0;
+    }
+
+    uint32_t rpg_graph_num_edges(rpg_graph *graph)
+    {
+        return graph ? graph->graph.num_edges() : 0;
+    }
+
+    void rpg_layout_options_init(rpg_layout_options *options)
+    {
+        if (options == nullptr) return;
+        options->engine = RPG_ENGINE_CPU;
+        options->barnes_hut = 1;
+        options->strong_gravity = 0;
+        options->gravity = 1.0f;
+        options->scale = 1.0f;
+        options->seed = std::mt19937::default_seed;
+        options->num_threads = 0;
+    }
+
+    rpg_status rpg_layout_create(rpg_graph *graph, const rpg_layout_options *options,
+                                 const float *positions, rpg_layout **layout)
+    {
+        if (graph == nullptr or layout == nullptr) return RPG_ERROR_INVALID_ARGUMENT;
+        rpg_layout_options o;
+        rpg_layout_options_init(&o);
+        if (options) o = *options;
+        if (o.num_threads < 0) return RPG_ERROR_INVALID_ARGUMENT;
+
+        // Checked here, as the engines exit on these.
+        if (o.engine == RPG_ENGINE_CUDA)
+        {
+            #ifdef __NVCC__
+            int device_count = 0;
+            if (not o.barnes_hut) return RPG_ERROR_UNSUPPORTED;
+            if (cudaGetDeviceCount(&device_count) != cudaSuccess or device_count == 0)
+                return RPG_ERROR_UNSUPPORTED;
+            // Errors of the CUDA runtime then throw, see assert_d.
+            cuda_errors_throw = true;
+            #else
+            return RPG_ERROR_UNSUPPORTED;
+            #endif
+        }
+        else if (o.engine != RPG_ENGINE_CPU and o.engine != RPG_ENGINE_CPUBH)
+            return RPG_ERROR_INVALID_ARGUMENT;
+
+        return guarded([&]() -> rpg_status
+        {
+            std::unique_ptr<rpg_layout> l(new rpg_layout());
+            l->layout.reset(new RPGraph::GraphLayout(graph->graph));
+            if (l->layout->positionData() == nullptr) return RPG_ERROR_OUT_OF_MEMORY;
+            l->layout->seedRandom(o.seed);
+            if (positions) l->layout->setPositions(positions);
+
+            if (o.engine == RPG_ENGINE_CUDA)
+            {
+                #ifdef __NVCC__
+                l->fa2.reset(new RPGraph::CUDAForceAtlas2(*l->layout, true, o.strong_gravity,
+                                                          o.gravity, o.scale));
+                #endif
+            }
+            else
+            {
+                l->pool.reset(new RPGraph::ThreadPool(o.num_threads));
+                if (o.engine == RPG_ENGINE_CPUBH)
+                    l->fa2.reset(new RPGraph::CPUBHForceAtlas2(*l->layout, o.strong_gravity,
+                                                               o.gravity, o.scale, l->pool.get()));
+                else
+                    l->fa2.reset(new RPGraph::CPUForceAtlas2(*l->layout, o.barnes_hut, o.strong_gravity,
+                                                             o.gravity, o.scale, l->pool.get()));
+            }
+            *layout = l.release();
+            return RPG_OK;
+        });
+    }
+
+    void rpg_layout_destroy(rpg_layout *layout)
+    {
+        delete layout;
+    }
+
+    void rpg_layout_set_callback(rpg_layout *layout, rpg_step_callback callback, void *user_data)
+    {
+        if (layout == nullptr) return;
+        layout->callback = callback;
+        layout->user_data = user_data;
+    }
+
+    rpg_status rpg_layout_step(rpg_layout *layout, int num_steps)
+    {
+        if (layout == nullptr or num_steps < 0) return RPG_ERROR_INVALID_ARGUMENT;
+
+        return guarded([&]() -> rpg_status
+        {
+            // Engines that keep positions elsewhere sync them into the
+            // layout, only when they are looked at.
+            for (int i = 0; i < num_steps; ++i)
+            {
+                layout->fa2->doStep();
+                if (layout->callback)
+                {
+                    layout->fa2->sync_layout();
+                    if (layout->callback(layout, layout->fa2->getIteration(), layout->user_data))
+                        return RPG_OK;
+                }
+            }
+            if (not layout->callback) layout->fa2->sync_layout();
+            return RPG_OK;
+        });
+    }
+
+    const float *rpg_layout_positions(const rpg_layout *layout)
+    {
+        return layout ? layout->layout->positionData() : nullptr;
+    }
+
+    int rpg_layout_iteration(const rpg_layout *layout)
+    {
+        return layout ? layout->fa2->getIteration() : 0;
+    }
+
+    rpg_status rpg_layout_telemetry(rpg_layout *layout, rpg_telemetry *telemetry)
+    {
+        if (layout == nullptr or telemetry == nullptr) return RPG_ERROR_INVALID_ARGUMENT;
+
+        return guarded([&]() -> rpg_status
+        {
+            const RPGraph::StepTelemetry t = layout->fa2->telemetry();
+            telemetry->iteration = t.iteration;
+            telemetry->total_swinging = t.total_swinging;
+            telemetry->total_traction = t.total_traction;
+            telemetry->global_speed = t.global_speed;
+            telemetry->speed_efficiency = t.speed_efficiency;
+            telemetry->max_displacement = t.max_displacement;
+            telemetry->mean_displacement = t.mean_displacement;
+            telemetry->tree_depth = t.tree_depth;
+            telemetry->tree_cells = t.tree_cells;
+            return RPG_OK;
+        });
+    }
+}
@@ -0,0 +1,140 @@
+/*
+ ==============================================================================
+
+ RPGraphLayoutC.h
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#ifndef RPGraphLayoutC_h
+#define RPGraphLayoutC_h
+
+/*
+ C interface to the layout engines, for use in-process from C or through
+ an FFI. It is built into a shared library from the sources of graph_viewer
+ without graph_viewer.cpp, e.g.
+
+     g++ -std=c++11 -O3 -fPIC -shared -pthread RP*.cpp -lz -o libgraphlayout.so
+
+ (or with nvcc, including the .cu files, for the CUDA engine).
+
+ Functions return RPG_OK or an error code, and never exit the process.
+ Once a CUDA layout was created, errors of the CUDA runtime anywhere in
+ the process throw RPGraph's CudaError rather than exiting.
+ A graph and the layouts of it may be used from different threads, but
+ each layout from one thread at a time.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+    RPG_OK = 0,
+    RPG_ERROR_INVALID_ARGUMENT = 1, /* null pointer or node id out of range */
+    RPG_ERROR_UNSUPPORTED = 2,      /* e.g. CUDA not compiled for, or no device */
+    RPG_ERROR_OUT_OF_MEMORY = 3,    /* of the host or the CUDA device */
+    RPG_ERROR_INTERNAL = 4          /* e.g. any other error of the CUDA runtime */
+} rpg_status;
+
+typedef enum
+{
+    RPG_ENGINE_CPU = 0,   /* CPUForceAtlas2 */
+    RPG_ENGINE_CPUBH = 1, /* CPUBHForceAtlas2, always Barnes-Hut */
+    RPG_ENGINE_CUDA = 2   /* CUDAForceAtlas2, requires Barnes-Hut */
+} rpg_engine;
+
+typedef struct
+{
+    rpg_engine engine;
+    int barnes_hut;     /* Approximate repulsion, nonzero by default. */
+    int strong_gravity; /* Zero by default. */
+    float gravity, scale;
+    uint32_t seed;      /* Of the random initial positions. */
+    int num_threads;    /* Of the CPU engines; 0 for all hardware threads. */
+} rpg_layout_options;
+
+/* Statistics of the last step, see RPGraph::StepTelemetry. */
+typedef struct
+{
+    int iteration;
+    float total_swinging, total_traction;
+    float global_speed, speed_efficiency;
+    float max_displacement, mean_displacement; /* -1 if not tracked */
+    int tree_depth;
+    uint32_t tree_cells;
+} rpg_telemetry;
+
+typedef struct rpg_graph rpg_graph;
+typedef struct rpg_layout rpg_layout;
+
+/* Called after each step with the number of steps done so far. Positions
+   are up to date when it is called. A nonzero return value stops
+   rpg_layout_step after this step. */
+typedef int (*rpg_step_callback)(rpg_layout *layout, int iteration, void *user_data);
+
+const char *rpg_status_string(rpg_status status);
+
+/* Builds a graph of `num_nodes' nodes, with ids [0, num_nodes), and
+   `num_edges' undirected edges sources[e]--targets[e] of weight weights[e]
+   (1 if `weights' is null). Self-edges are dropped and repeated edges
+   merged. The arrays are copied. */
+rpg_status rpg_graph_create(uint32_t num_nodes, size_t num_edges,
+                            const uint32_t *sources, const uint32_t *targets,
+                            const float *weights, rpg_graph **graph);
+/* Layouts of the graph must be destroyed first. */
+void rpg_graph_destroy(rpg_graph *graph);
+uint32_t rpg_graph_num_nodes(rpg_graph *graph);
+uint32_t rpg_graph_num_edges(rpg_graph *graph);
+
+/* Defaults: CPU engine with Barnes-Hut, weak gravity 1, scale 1, seed
+   5489 and all hardware threads. */
+void rpg_layout_options_init(rpg_layout_options *options);
+
+/* Creates a layout of `graph' with an engine as given by `options' (the
+   defaults if null). Nodes start at `positions', as x, y, z per node, if
+   not null; otherwise at random. */
+rpg_status rpg_layout_create(rpg_graph *graph, const rpg_layout_options *options,
+                             const float *positions, rpg_layout **layout);
+void rpg_layout_destroy(rpg_layout *layout);
+
+/* Calls `callback' after each step, or no longer if it is null. */
+void rpg_layout_set_callback(rpg_layout *layout, rpg_step_callback callback, void *user_data);
+
+/* Does `num_steps' steps, or fewer if the callback stops them. */
+rpg_status rpg_layout_step(rpg_layout *layout, int num_steps);
+
+/* Positions of all nodes, as x, y, z per node. The pointer stays valid
+   until the layout is destroyed; its contents are updated by each step
+   and must not be written. */
+const float *rpg_layout_positions(const rpg_layout *layout);
+
+/* Number of steps done so far. */
+int rpg_layout_iteration(const rpg_layout *layout);
+
+rpg_status rpg_layout_telemetry(rpg_layout *layout, rpg_telemetry *telemetry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RPGraphLayoutC_h */
@@ -0,0 +1,320 @@
+/*
+ ==============================================================================
+
+ RPLayoutMetrics.cpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#include "RPLayoutMetrics.hpp"
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+namespace RPGraph
+{
+    const uint16_t LayoutMetrics::UNREACHED;
+
+    static void parallel_range(ThreadPool *pool, size_t n, const ThreadPool::RangeFn &f)
+    {
+        if (pool) pool->parallel_for(n, f);
+        else f(0, n);
+    }
+
+    // Up to `k' distinct elements of `nodes', in random order.
+    static std::vector<nid_t> sample_nodes(std::vector<nid_t> nodes, nid_t k, std::mt19937 &rng)
+    {
+        const nid_t n = nodes.size();
+        k = std::min(k, n);
+        for (nid_t i = 0; i < k; ++i)
+        {
+            std::uniform_int_distribution<nid_t> pick(i, n - 1);
+            std::swap(nodes[i], nodes[pick(rng)]);
+        }
+        nodes.resize(k);
+        return nodes;
+    }
+
+    // Ranks of `values' from 1, ties getting the mean of their ranks.
+    static std::vector<double> ranks(const std::vector<float> &values)
+    {
+        std::vector<size_t> order(values.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return values[a] < values[b]; });
+
+        std::vector<double> result(values.size());
+        for (size_t i = 0; i < order.size(); )
+        {
+            size_t j = i + 1;
+            while (j < order.size() and values[order[j]] == values[order[i]]) j++;
+            const double rank = (i + 1 + j) / 2.0; // Mean of ranks i+1 .. j.
+            for (size_t t = i; t < j; ++t) result[order[t]] = rank;
+            i = j;
+        }
+        return result;
+    }
+
+    static double pearson(const std::vector<double> &x, const std::vector<double> &y)
+    {
+        const size_t n = x.size();
+        if (n < 2) return 0.0;
+        const double mean_x = std::accumulate(x.begin(), x.end(), 0.0) / n;
+        const double mean_y = std::accumulate(y.begin(), y.end(), 0.0) / n;
+        double sxy = 0.0, sxx = 0.0, syy = 0.0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            sxy += (x[i] - mean_x) * (y[i] - mean_y);
+            sxx += (x[i] - mean_x) * (x[i] - mean_x);
+            syy += (y[i] - mean_y) * (y[i] - mean_y);
+        }
+        return sxx > 0.0 and syy > 0.0 ? sxy / sqrt(sxx * syy) : 0.0;
+    }
+
+    // Value at fraction `q' of the sorted `values', interpolated.
+    static double quantile(const std::vector<float> &sorted, double q)
+    {
+        if (sorted.empty()) return 0.0;
+        const double pos = q * (sorted.size() - 1);
+        const size_t i = (size_t)pos;
+        if (i + 1 >= sorted.size()) return sorted.back();
+        return sorted[i] + (pos - i) * (sorted[i+1] - sorted[i]);
+    }
+
+    LayoutMetrics::LayoutMetrics(GraphLayout &layout, const MetricsOptions &options, ThreadPool *pool)
+    : num_nodes{layout.graph.num_nodes()}, options(options)
+    {
+        UGraph &graph = layout.graph;
+        for (nid_t n = 0; n < num_nodes; ++n)
+            if (not layout.isRemoved(n)) nodes.push_back(n);
+
+        // Self-loops (e.g. the diagonal of a contact matrix) have no
+        // length and no neighbour, so they are left out of all metrics.
+        adj_offsets.assign(num_nodes+1, 0);
+        for (nid_t n = 0; n < num_nodes; ++n)
+        {
+            for (nid_t t : graph.neighbors_with_geq_id(n))
+            {
+                if (t == n) continue;
+                adj_offsets[n+1]++;
+                adj_offsets[t+1]++;
+            }
+        }
+        for (nid_t n = 0; n < num_nodes; ++n) adj_offsets[n+1] += adj_offsets[n];
+        adj_targets.resize(adj_offsets[num_nodes]);
+        adj_weights.resize(adj_offsets[num_nodes]);
+        std::vector<uint64_t> fill(adj_offsets.begin(), adj_offsets.end()-1);
+        std::mt19937 rng(options.seed);
+        const double edge_fraction = (double)options.max_edges / std::max(graph.num_edges(), (nid_t)1);
+        std::uniform_real_distribution<double> coin(0.0, 1.0);
+        for (nid_t n = 0; n < num_nodes; ++n)
+        {
+            for (nid_t t : graph.neighbors_with_geq_id(n))
+            {
+                if (t == n) continue;
+                const float w = graph.get_edge_weight(n, t);
+                adj_targets[fill[n]] = t;
+                adj_weights[fill[n]++] = w;
+                adj_targets[fill[t]] = n;
+                adj_weights[fill[t]++] = w;
+
+                if (edge_fraction >= 1.0 or coin(rng) < edge_fraction)
+                {
+                    edge_u.push_back(std::min(n, t));
+                    edge_v.push_back(std::max(n, t));
+                    edge_w.push_back(w);
+                }
+            }
+        }
+
+        // Hop distances from the stress sources, one BFS each.
+        stress_sources = sample_nodes(nodes, std::max(options.stress_sources, 0), rng);
+        hops.assign(stress_sources.size() * (size_t)num_nodes, UNREACHED);
+        parallel_range(pool, stress_sources.size(), [&](size_t begin, size_t end)
+        {
+            std::vector<nid_t> queue(num_nodes);
+            for (size_t s = begin; s < end; ++s)
+            {
+                uint16_t *row = &hops[s * num_nodes];
+                size_t head = 0, tail = 0;
+                queue[tail++] = stress_sources[s];
+                row[stress_sources[s]] = 0;
+                while (head < tail)
+                {
+                    const nid_t n = queue[head++];
+                    if (row[n] + 1 >= UNREACHED) continue;
+                    for (uint64_t e = adj_offsets[n]; e < adj_offsets[n+1]; ++e)
+                    {
+                        const nid_t t = adj_targets[e];
+                        if (row[t] != UNREACHED) continue;
+                        row[t] = row[n] + 1;
+                        queue[tail++] = t;
+                    }
+                }
+            }
+        });
+
+        // Strongest neighbours of the sampled nodes, heaviest edges first.
+        std::vector<uint64_t> candidates;
+        for (nid_t n : sample_nodes(nodes, nodes.size(), rng))
+        {
+            if ((int)neighborhood_nodes.size() >= options.neighborhood_nodes) break;
+            if (adj_offsets[n+1] == adj_offsets[n]) continue;
+            candidates.clear();
+            for (uint64_t e = adj_offsets[n]; e < adj_offsets[n+1]; ++e) candidates.push_back(e);
+            std::sort(candidates.begin(), candidates.end(), [&](uint64_t a, uint64_t b)
+            {
+                if (adj_weights[a] != adj_weights[b]) return adj_weights[a] > adj_weights[b];
+                return adj_targets[a] < adj_targets[b];
+            });
+
+            if (neighbor_offsets.empty()) neighbor_offsets.push_back(0);
+            neighborhood_nodes.push_back(n);
+            const size_t k = std::min(std::min(candidates.size(), (size_t)std::max(options.neighborhood_k, 1)),
+                                      nodes.size() - 1);
+            for (size_t i = 0; i < k; ++i) strongest_neighbors.push_back(adj_targets[candidates[i]]);
+            neighbor_offsets.push_back(strongest_neighbors.size());
+        }
+    }
+
+    // Normalized stress, sum((s * d - h)^2 / h^2) / pairs over pairs at h
+    // hops and distance d, with s minimizing it. Per source only sums A =
+    // sum(d / h), B = sum(d^2 / h^2) and the number of pairs C are needed:
+    // s = A / B, and the stress is 1 - A^2 / (B C).
+    double LayoutMetrics::stress(GraphLayout &layout, ThreadPool *pool) const
+    {
+        const size_t num_sources = stress_sources.size();
+        std::vector<double> sum_a(num_sources), sum_b(num_sources), count(num_sources);
+        parallel_range(pool, num_sources, [&](size_t begin, size_t end)
+        {
+            for (size_t s = begin; s < end; ++s)
+            {
+                const uint16_t *row = &hops[s * num_nodes];
+                double a = 0.0, b = 0.0, c = 0.0;
+                for (nid_t n = 0; n < num_nodes; ++n)
+                {
+                    if (row[n] == 0 or row[n] == UNREACHED) continue;
+                    const double ratio = layout.getDistance(stress_sources[s], n) / row[n];
+                    a += ratio;
+                    b += ratio * ratio;
+                    c += 1.0;
+                }
+                sum_a[s] = a;
+                sum_b[s] = b;
+                count[s] = c;
+            }
+        });
+
+        double a = 0.0, b = 0.0, c = 0.0;
+        for (size_t s = 0; s < num_sources; ++s)
+        {
+            a += sum_a[s];
+            b += sum_b[s];
+            c += count[s];
+        }
+        if (c == 0.0 or b == 0.0) return 0.0;
+        return std::max(1.0 - a * a / (b * c), 0.0);
+    }
+
+    double LayoutMetrics::neighborhoodPreservation(GraphLayout &layout, ThreadPool *pool) const
+    {
+        const size_t num_sampled = neighborhood_nodes.size();
+        if (num_sampled == 0) return 0.0;
+
+        std::vector<double> preserved(num_sampled);
+        parallel_range(pool, num_sampled, [&](size_t begin, size_t end)
+        {
+            std::vector<std::pair<float, nid_t>> nearest(nodes.size());
+            for (size_t i = begin; i < end; ++i)
+            {
+                const nid_t n = neighborhood_nodes[i];
+                const size_t k = neighbor_offsets[i+1] - neighbor_offsets[i];
+
+                // The k nearest other nodes in the layout.
+                nearest.clear();
+                for (nid_t t : nodes)
+                    if (t != n) nearest.push_back(std::make_pair(layout.getDistance(n, t), t));
+                std::nth_element(nearest.begin(), nearest.begin() + (k - 1), nearest.end());
+
+                size_t hits = 0;
+                for (uint64_t j = neighbor_offsets[i]; j < neighbor_offsets[i+1]; ++j)
+                {
+                    for (size_t m = 0; m < k; ++m)
+                    {
+                        if (nearest[m].second == strongest_neighbors[j])
+                        {
+                            hits++;
+                            break;
+                        }
+                    }
+                }
+                preserved[i] = (double)hits / k;
+            }
+        });
+        return std::accumulate(preserved.begin(), preserved.end(), 0.0) / num_sampled;
+    }
+
+    LayoutQuality LayoutMetrics::compute(GraphLayout &layout, ThreadPool *pool) const
+    {
+        LayoutQuality q;
+        q.stress = stress(layout, pool);
+        q.neighborhood_preservation = neighborhoodPreservation(layout, pool);
+
+        const size_t num_edges = edge_u.size();
+        std::vector<float> lengths(num_edges);
+        parallel_range(pool, num_edges, [&](size_t begin, size_t end)
+        {
+            for (size_t e = begin; e < end; ++e) lengths[e] = layout.getDistance(edge_u[e], edge_v[e]);
+        });
+
+        double sum = 0.0, sum_sq = 0.0;
+        for (float l : lengths)
+        {
+            sum += l;
+            sum_sq += (double)l * l;
+        }
+        q.edge_length_mean = num_edges > 0 ? sum / num_edges : 0.0;
+        const double variance = num_edges > 0 ? sum_sq / num_edges - q.edge_length_mean * q.edge_length_mean : 0.0;
+        q.edge_length_cv = q.edge_length_mean > 0.0 ? sqrt(std::max(variance, 0.0)) / q.edge_length_mean : 0.0;
+
+        q.distance_weight_spearman = pearson(ranks(lengths), ranks(edge_w));
+
+        std::sort(lengths.begin(), lengths.end());
+        q.edge_length_min = quantile(lengths, 0.0);
+        q.edge_length_p25 = quantile(lengths, 0.25);
+        q.edge_length_median = quantile(lengths, 0.5);
+        q.edge_length_p75 = quantile(lengths, 0.75);
+        q.edge_length_max = quantile(lengths, 1.0);
+        return q;
+    }
+
+    std::string LayoutQuality::toJSON(int iteration) const
+    {
+        char line[512];
+        snprintf(line, sizeof(line),
+                 "{\"iteration\": %d, \"stress\": %.6g, "
+                 "\"edge_length\": {\"mean\": %.6g, \"cv\": %.6g, \"min\": %.6g, \"p25\": %.6g, "
+                 "\"median\": %.6g, \"p75\": %.6g, \"max\": %.6g}, "
+                 "\"neighborhood_preservation\": %.6g, \"distance_weight_spearman\": %.6g}",
+                 iteration, stress, edge_length_mean, edge_length_cv, edge_length_min,
+                 edge_length_p25, edge_length_median, edge_length_p75, edge_length_max,
+                 neighborhood_preservation, distance_weight_spearman);
+        return line;
+    }
+}
@@ -0,0 +1,113 @@
+/*
+ ==============================================================================
+
+ RPLayoutMetrics.hpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#ifndef RPLayoutMetrics_hpp
+#define RPLayoutMetrics_hpp
+
+#include "RPGraph.hpp"
+#include "RPGraphLayout.hpp"
+#include "RPThreadPool.hpp"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace RPGraph
+{
+    // Sample sizes of LayoutMetrics.
+    struct MetricsOptions
+    {
+        int stress_sources = 32;       // BFS sources for stress.
+        int neighborhood_nodes = 1000; // Nodes whose neighbourhoods are compared.
+        int neighborhood_k = 10;       // Largest neighbourhood compared.
+        size_t max_edges = 1000000;    // Edges for lengths and correlation.
+        uint32_t seed = 1;
+    };
+
+    // Quality of one layout.
+    struct LayoutQuality
+    {
+        // Normalized stress of the layout, at the scale that minimizes
+        // it, against hop distances in the graph: 0 is perfect.
+        double stress;
+        // Edge lengths: mean, coefficient of variation and quantiles.
+        double edge_length_mean, edge_length_cv;
+        double edge_length_min, edge_length_p25, edge_length_median,
+               edge_length_p75, edge_length_max;
+        // Mean fraction of a node's strongest (up to k) neighbours among
+        // as many of its nearest nodes in the layout.
+        double neighborhood_preservation;
+        // Spearman correlation of edge lengths with edge weights, e.g.
+        // contact frequencies; negative if heavy edges are short.
+        double distance_weight_spearman;
+
+        // One line of JSON, without a newline.
+        std::string toJSON(int iteration) const;
+    };
+
+    // Computes quality metrics of layouts of one graph, in parallel.
+    // Samples (and the BFS distances of stress) are drawn once, so that
+    // metrics of different snapshots are comparable, e.g. for stopping
+    // rules. Removed nodes (see GraphLayout::removeNode()) are left out.
+    // The graph, and the nodes removed, must not change afterwards.
+    class LayoutMetrics
+    {
+    public:
+        // Of layouts of the graph of `layout', with its removed nodes.
+        LayoutMetrics(GraphLayout &layout, const MetricsOptions &options = MetricsOptions(),
+                      ThreadPool *pool = nullptr);
+
+        // Of the current positions in `layout' (which should be synced).
+        LayoutQuality compute(GraphLayout &layout, ThreadPool *pool = nullptr) const;
+
+    private:
+        nid_t num_nodes;
+        MetricsOptions options;
+        std::vector<nid_t> nodes; // Those that aren't removed.
+
+        // Symmetric adjacency (CSR) of the graph, with edge weights.
+        std::vector<uint64_t> adj_offsets;
+        std::vector<nid_t> adj_targets;
+        std::vector<float> adj_weights;
+
+        // Hop distances from each stress source to all nodes, row by row,
+        // UNREACHED if not connected (or farther than that).
+        static const uint16_t UNREACHED = 0xFFFF;
+        std::vector<nid_t> stress_sources;
+        std::vector<uint16_t> hops;
+
+        // Sampled nodes with their strongest neighbours: those of node
+        // neighborhood_nodes[i] are [neighbor_offsets[i], neighbor_offsets[i+1]).
+        std::vector<nid_t> neighborhood_nodes;
+        std::vector<uint64_t> neighbor_offsets;
+        std::vector<nid_t> strongest_neighbors;
+
+        // Sampled edges (u < v), with their weights.
+        std::vector<nid_t> edge_u, edge_v;
+        std::vector<float> edge_w;
+
+        double stress(GraphLayout &layout, ThreadPool *pool) const;
+        double neighborhoodPreservation(GraphLayout &layout, ThreadPool *pool) const;
+    };
+}
+
+#endif /* RPLayoutMetrics_hpp */
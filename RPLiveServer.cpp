@@ -0,0 +1,577 @@
+/*
+ ==============================================================================
+
+ RPLiveServer.cpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#include "RPLiveServer.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <sstream>
+
+// Binary WebSocket messages (frames of the layout), little-endian (the
+// byte order of the hosts this runs on):
+//   uint8      type: 0 for a key frame, 1 for a delta frame
+//   uint8[3]   zero
+//   uint32     number of nodes n
+//   int32      iteration
+//   uint32     number of the frame, counted by the server
+//   float[3]   grid origin, float[3] grid step: x = origin.x + q * step.x
+//   key frame:   uint16[3n] q, x, y, z per node
+//   delta frame: 3n varints (LEB128), the zigzag-encoded differences of
+//                each q with that of the previous frame, which has the
+//                same grid and number of nodes
+// A client gets a key frame first, after any frame it missed, and whenever
+// the grid changes.
+#define FRESH 4
+#define MAX_CLIENTS 16
+#define MAX_REQUEST_SIZE 16384
+#define MAX_MESSAGE_SIZE 65536
+
+static const char *page_html =
+    "<!DOCTYPE html><html><head><meta charset=\"utf-8\"><title>graph_viewer</title></head>\n"
+    "<body style=\"margin:0;font:12px monospace\">\n"
+    "<canvas id=\"c\" width=\"800\" height=\"800\"></canvas><pre id=\"t\"></pre>\n"
+    "<script>\n"
+    "var c = document.getElementById('c'), g = c.getContext('2d'), t = document.getElementById('t'), q = null;\n"
+    "var ws = new WebSocket('ws://' + location.host + '/frames');\n"
+    "ws.binaryType = 'arraybuffer';\n"
+    "ws.onmessage = function(e) {\n"
+    "  if (typeof e.data == 'string') { t.textContent = e.data; return; }\n"
+    "  var v = new DataView(e.data), n = v.getUint32(4, true), i, p = 40;\n"
+    "  if (v.getUint8(0) == 0) {\n"
+    "    q = new Uint16Array(3 * n);\n"
+    "    for (i = 0; i < 3 * n; i++) q[i] = v.getUint16(p + 2 * i, true);\n"
+    "  } else {\n"
+    "    for (i = 0; i < 3 * n; i++) {\n"
+    "      var z = 0, s = 1, b;\n"
+    "      do { b = v.getUint8(p++); z += (b & 127) * s; s *= 128; } while (b & 128);\n"
+    "      q[i] += z % 2 ? -(z + 1) / 2 : z / 2;\n"
+    "    }\n"
+    "  }\n"
+    "  var x0 = 65535, y0 = 65535, x1 = 0, y1 = 0;\n"
+    "  for (i = 0; i < n; i++) {\n"
+    "    x0 = Math.min(x0, q[3*i]); x1 = Math.max(x1, q[3*i]);\n"
+    "    y0 = Math.min(y0, q[3*i+1]); y1 = Math.max(y1, q[3*i+1]);\n"
+    "  }\n"
+    "  var f = 780 / Math.max(x1 - x0, y1 - y0, 1);\n"
+    "  g.clearRect(0, 0, c.width, c.height);\n"
+    "  g.fillStyle = '#246';\n"
+    "  for (i = 0; i < n; i++) g.fillRect(10 + (q[3*i] - x0) * f, 790 - (q[3*i+1] - y0) * f, 2, 2);\n"
+    "};\n"
+    "</script></body></html>\n";
+
+namespace RPGraph
+{
+    // SHA-1 (RFC 3174) of `data', which the WebSocket handshake needs.
+    static std::string sha1(const std::string &data)
+    {
+        uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+        std::string m = data;
+        const uint64_t bit_length = (uint64_t) data.size() * 8;
+        m += (char) 0x80;
+        while (m.size() % 64 != 56) m += (char) 0x00;
+        for (int i = 7; i >= 0; --i) m += (char) ((bit_length >> (8 * i)) & 0xFF);
+
+        auto rotl = [](uint32_t x, int n) { return (x << n) | (x >> (32 - n)); };
+        for (size_t chunk = 0; chunk < m.size(); chunk += 64)
+        {
+            uint32_t w[80];
+            for (int i = 0; i < 16; ++i)
+                w[i] = (uint32_t) (uint8_t) m[chunk + 4*i] << 24 | (uint32_t) (uint8_t) m[chunk + 4*i + 1] << 16
+                     | (uint32_t) (uint8_t) m[chunk + 4*i + 2] << 8 | (uint32_t) (uint8_t) m[chunk + 4*i + 3];
+            for (int i = 16; i < 80; ++i) w[i] = rotl(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+            uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+            for (int i = 0; i < 80; ++i)
+            {
+                uint32_t f, k;
+                if (i < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+                else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+                else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+                else             { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+                const uint32_t temp = rotl(a, 5) + f + e + k + w[i];
+                e = d;
+                d = c;
+                c = rotl(b, 30);
+                b = a;
+                a = temp;
+            }
+            h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+        }
+
+        std::string digest;
+        for (int i = 0; i < 5; ++i)
+            for (int j = 3; j >= 0; --j) digest += (char) ((h[i] >> (8 * j)) & 0xFF);
+        return digest;
+    }
+
+    static std::string base64(const std::string &data)
+    {
+        static const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::string out;
+        for (size_t i = 0; i < data.size(); i += 3)
+        {
+            uint32_t v = (uint32_t) (uint8_t) data[i] << 16;
+            if (i + 1 < data.size()) v |= (uint32_t) (uint8_t) data[i+1] << 8;
+            if (i + 2 < data.size()) v |= (uint8_t) data[i+2];
+            out += alphabet[(v >> 18) & 63];
+            out += alphabet[(v >> 12) & 63];
+            out += i + 1 < data.size() ? alphabet[(v >> 6) & 63] : '=';
+            out += i + 2 < data.size() ? alphabet[v & 63] : '=';
+        }
+        return out;
+    }
+
+    // An unmasked (server to client) WebSocket message.
+    static std::string ws_message(int opcode, const std::string &payload)
+    {
+        std::string m;
+        m += (char) (0x80 | opcode);
+        const uint64_t n = payload.size();
+        if (n < 126) m += (char) n;
+        else if (n < 65536)
+        {
+            m += (char) 126;
+            m += (char) (n >> 8);
+            m += (char) (n & 0xFF);
+        }
+        else
+        {
+            m += (char) 127;
+            for (int i = 7; i >= 0; --i) m += (char) ((n >> (8 * i)) & 0xFF);
+        }
+        return m + payload;
+    }
+
+    template <typename T>
+    static void append(std::string &s, T value)
+    {
+        s.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    static std::string http_response(std::string status, std::string type, const std::string &body)
+    {
+        return "HTTP/1.1 " + status + "\r\nContent-Type: " + type
+             + "\r\nContent-Length: " + std::to_string(body.size())
+             + "\r\nCache-Control: no-store\r\nConnection: close\r\n\r\n" + body;
+    }
+
+    LiveServer::LiveServer(int port, float max_fps)
+    : middle{1}, back{0}, front{2}, frame_requested{false}, has_frame{false},
+      max_fps{std::max(max_fps, 0.1f)}, stopping{false}, frames_sent{0}
+    {
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        const int one = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        // Localhost only: there is no authentication.
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        if (listen_fd < 0 or bind(listen_fd, (sockaddr *) &address, sizeof(address)) != 0
+            or listen(listen_fd, MAX_CLIENTS) != 0)
+        {
+            fprintf(stderr, "error: Could not listen on port %d (%s)\n", port, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+
+        for (int i = 0; i < 3; ++i) origin[i] = step[i] = 0.0f;
+        thread = std::thread(&LiveServer::run, this);
+    }
+
+    LiveServer::~LiveServer()
+    {
+        stopping = true;
+        thread.join();
+
+        // Tells WebSocket clients the layout has ended, if they can take it.
+        const std::string goodbye = ws_message(0x8, "");
+        for (Client &c : clients)
+        {
+            if (c.fd < 0) continue;
+            if (c.websocket and c.out.empty()) send(c.fd, goodbye.data(), goodbye.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            close(c.fd);
+        }
+        close(listen_fd);
+    }
+
+    bool LiveServer::frameRequested() const
+    {
+        return frame_requested.load(std::memory_order_relaxed);
+    }
+
+    void LiveServer::publish(const float *xyz, nid_t num_nodes, const StepTelemetry &telemetry)
+    {
+        Frame &frame = buffers[back];
+        frame.positions.assign(xyz, xyz + 3 * (size_t) num_nodes);
+        frame.telemetry = telemetry;
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & 3;
+        frame_requested.store(false, std::memory_order_relaxed);
+    }
+
+    bool LiveServer::takeFrame()
+    {
+        if (not (middle.load(std::memory_order_acquire) & FRESH)) return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+        return true;
+    }
+
+    void LiveServer::run()
+    {
+        typedef std::chrono::steady_clock clock;
+        const auto interval = std::chrono::duration_cast<clock::duration>(
+                                  std::chrono::duration<double>(1.0 / max_fps));
+        auto next_tick = clock::now();
+        std::vector<pollfd> fds;
+
+        while (not stopping)
+        {
+            fds.clear();
+            fds.push_back({listen_fd, POLLIN, 0});
+            for (Client &c : clients)
+                fds.push_back({c.fd, (short) (POLLIN | (c.out.empty() ? 0 : POLLOUT)), 0});
+
+            // While a frame is requested, the layout may hand it over any
+            // time, so look for it often.
+            int timeout = 5;
+            if (not frame_requested)
+            {
+                const auto until_tick = std::chrono::duration_cast<std::chrono::milliseconds>(next_tick - clock::now());
+                timeout = std::min(std::max((int) until_tick.count(), 0), 50);
+            }
+            poll(fds.data(), fds.size(), timeout);
+
+            for (size_t i = 0; i < clients.size(); ++i)
+            {
+                Client &c = clients[i];
+                if (fds[i+1].revents & (POLLIN | POLLHUP | POLLERR))
+                {
+                    char buffer[65536];
+                    const ssize_t n = recv(c.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+                    if (n > 0)
+                    {
+                        c.in.append(buffer, n);
+                        handleInput(c);
+                    }
+                    else if (n == 0 or (errno != EAGAIN and errno != EWOULDBLOCK))
+                    {
+                        close(c.fd);
+                        c.fd = -1;
+                        continue;
+                    }
+                }
+                if (not c.out.empty()) flush(c);
+            }
+
+            if (fds[0].revents & POLLIN)
+            {
+                int fd;
+                while ((fd = accept(listen_fd, nullptr, nullptr)) >= 0)
+                {
+                    if (clients.size() >= MAX_CLIENTS)
+                    {
+                        close(fd);
+                        continue;
+                    }
+                    fcntl(fd, F_SETFL, O_NONBLOCK);
+                    Client c;
+                    c.fd = fd;
+                    clients.push_back(c);
+                }
+            }
+
+            if (not frame_requested and clock::now() >= next_tick)
+            {
+                frame_requested = true;
+                next_tick = clock::now() + interval;
+            }
+            if (takeFrame())
+            {
+                has_frame = true;
+                broadcast();
+            }
+
+            clients.erase(std::remove_if(clients.begin(), clients.end(), [](Client &c)
+            {
+                if (c.fd >= 0 and c.closing and c.out.empty())
+                {
+                    close(c.fd);
+                    c.fd = -1;
+                }
+                return c.fd < 0;
+            }), clients.end());
+        }
+    }
+
+    void LiveServer::flush(Client &client)
+    {
+        while (not client.out.empty())
+        {
+            const ssize_t n = send(client.fd, client.out.data(), client.out.size(),
+                                   MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n > 0) client.out.erase(0, n);
+            else
+            {
+                if (n < 0 and (errno == EAGAIN or errno == EWOULDBLOCK)) return;
+                close(client.fd);
+                client.fd = -1;
+                client.out.clear();
+                return;
+            }
+        }
+    }
+
+    void LiveServer::handleInput(Client &client)
+    {
+        if (client.websocket)
+        {
+            handleMessages(client);
+            return;
+        }
+
+        const size_t end = client.in.find("\r\n\r\n");
+        if (end == std::string::npos)
+        {
+            if (client.in.size() > MAX_REQUEST_SIZE) client.closing = true;
+            return;
+        }
+        const std::string request = client.in.substr(0, end);
+        client.in.erase(0, end + 4);
+        handleRequest(client, request);
+        if (client.websocket) handleMessages(client);
+    }
+
+    void LiveServer::handleRequest(Client &client, const std::string &request)
+    {
+        std::istringstream lines(request);
+        std::string line, method, path;
+        std::getline(lines, line);
+        std::istringstream(line) >> method >> path;
+
+        // Header names are case-insensitive.
+        std::map<std::string, std::string> headers;
+        while (std::getline(lines, line))
+        {
+            const size_t colon = line.find(':');
+            if (colon == std::string::npos) continue;
+            std::string name = line.substr(0, colon), value = line.substr(colon + 1);
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            value.erase(0, value.find_first_not_of(" \t"));
+            value.erase(value.find_last_not_of(" \t\r") + 1);
+            headers[name] = value;
+        }
+
+        std::string upgrade = headers["upgrade"];
+        std::transform(upgrade.begin(), upgrade.end(), upgrade.begin(), ::tolower);
+        if (method != "GET")
+            client.out += http_response("405 Method Not Allowed", "text/plain", "Only GET is supported.\n");
+        else if (path == "/frames" and upgrade == "websocket" and !headers["sec-websocket-key"].empty())
+        {
+            const std::string accept = base64(sha1(headers["sec-websocket-key"]
+                                                   + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"));
+            client.out += "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+                          "Connection: Upgrade\r\nSec-WebSocket-Accept: " + accept + "\r\n\r\n";
+            client.websocket = true;
+            client.needs_key = true;
+            flush(client);
+            return;
+        }
+        else if (path == "/telemetry")
+            client.out += http_response("200 OK", "application/json",
+                                        (has_frame ? buffers[front].telemetry.toJSON() : "null") + "\n");
+        else if (path == "/")
+            client.out += http_response("200 OK", "text/html", page_html);
+        else
+            client.out += http_response("404 Not Found", "text/plain", "Not found.\n");
+        client.closing = true;
+        flush(client);
+    }
+
+    // Messages from clients are masked. Only close and ping need an answer.
+    void LiveServer::handleMessages(Client &client)
+    {
+        while (client.fd >= 0 and not client.closing)
+        {
+            const std::string &in = client.in;
+            if (in.size() < 2) return;
+            const int opcode = in[0] & 0x0F;
+            const bool masked = in[1] & 0x80;
+            uint64_t length = in[1] & 0x7F;
+            size_t offset = 2;
+            if (length == 126)
+            {
+                if (in.size() < 4) return;
+                length = (uint64_t) (uint8_t) in[2] << 8 | (uint8_t) in[3];
+                offset = 4;
+            }
+            else if (length == 127)
+            {
+                if (in.size() < 10) return;
+                length = 0;
+                for (int i = 0; i < 8; ++i) length = length << 8 | (uint8_t) in[2 + i];
+                offset = 10;
+            }
+            if (not masked or length > MAX_MESSAGE_SIZE)
+            {
+                client.closing = true;
+                return;
+            }
+            if (in.size() < offset + 4 + length) return;
+
+            std::string payload = in.substr(offset + 4, length);
+            for (size_t i = 0; i < payload.size(); ++i) payload[i] ^= in[offset + i % 4];
+            client.in.erase(0, offset + 4 + length);
+
+            if (opcode == 0x8)
+            {
+                client.out += ws_message(0x8, payload.substr(0, 2));
+                client.closing = true;
+            }
+            else if (opcode == 0x9)
+                client.out += ws_message(0xA, payload);
+        }
+    }
+
+    // Chooses a new grid, with room for the layout to grow, if the
+    // positions don't fit the current one, or have become so small that
+    // the grid would lose precision. Returns whether it did.
+    bool LiveServer::fitGrid(const std::vector<float> &positions)
+    {
+        const size_t n = positions.size() / 3;
+        float lo[3], hi[3];
+        for (int a = 0; a < 3; ++a)
+        {
+            lo[a] = n > 0 ? positions[a] : 0.0f;
+            hi[a] = lo[a];
+        }
+        for (size_t i = 0; i < n; ++i)
+            for (int a = 0; a < 3; ++a)
+            {
+                lo[a] = std::min(lo[a], positions[3*i + a]);
+                hi[a] = std::max(hi[a], positions[3*i + a]);
+            }
+
+        bool fits = prev_q.size() == positions.size();
+        for (int a = 0; a < 3 and fits; ++a)
+        {
+            const float grid_hi = origin[a] + 65535.0f * step[a];
+            fits = lo[a] >= origin[a] and hi[a] <= grid_hi
+               and (hi[a] - lo[a]) * 4.0f >= grid_hi - origin[a];
+        }
+        if (fits) return false;
+
+        for (int a = 0; a < 3; ++a)
+        {
+            const float extent = std::max(hi[a] - lo[a], 1e-3f);
+            origin[a] = lo[a] - extent * 0.25f;
+            step[a] = extent * 1.5f / 65535.0f;
+        }
+        return true;
+    }
+
+    void LiveServer::broadcast()
+    {
+        const Frame &frame = buffers[front];
+        const size_t n = frame.positions.size() / 3;
+        const bool new_grid = fitGrid(frame.positions);
+
+        std::vector<uint16_t> q(3 * n);
+        for (size_t i = 0; i < 3 * n; ++i)
+        {
+            const float v = roundf((frame.positions[i] - origin[i % 3]) / step[i % 3]);
+            q[i] = (uint16_t) std::min(std::max(v, 0.0f), 65535.0f);
+        }
+
+        auto encode_header = [&](uint8_t type)
+        {
+            std::string header;
+            append<uint8_t>(header, type);
+            header.append(3, '\0');
+            append<uint32_t>(header, n);
+            append<int32_t>(header, frame.telemetry.iteration);
+            append<uint32_t>(header, frames_sent);
+            for (int a = 0; a < 3; ++a) append<float>(header, origin[a]);
+            for (int a = 0; a < 3; ++a) append<float>(header, step[a]);
+            return header;
+        };
+
+        // Each encoding is made once, if any client needs it.
+        std::string key, delta;
+        const std::string telemetry = ws_message(0x1, frame.telemetry.toJSON());
+        for (Client &c : clients)
+        {
+            if (not c.websocket or c.closing or c.fd < 0) continue;
+            // A client still receiving an earlier frame misses this one.
+            if (not c.out.empty())
+            {
+                c.needs_key = true;
+                continue;
+            }
+
+            const bool send_key = c.needs_key or new_grid;
+            if (send_key and key.empty())
+            {
+                std::string payload = encode_header(0);
+                for (uint16_t v : q) append<uint16_t>(payload, v);
+                key = ws_message(0x2, payload);
+            }
+            else if (not send_key and delta.empty())
+            {
+                std::string payload = encode_header(1);
+                for (size_t i = 0; i < q.size(); ++i)
+                {
+                    const int32_t d = (int32_t) q[i] - (int32_t) prev_q[i];
+                    uint32_t z = ((uint32_t) d << 1) ^ (uint32_t) (d >> 31);
+                    while (z >= 0x80)
+                    {
+                        payload += (char) (z | 0x80);
+                        z >>= 7;
+                    }
+                    payload += (char) z;
+                }
+                delta = ws_message(0x2, payload);
+            }
+
+            c.out += telemetry;
+            c.out += send_key ? key : delta;
+            c.needs_key = false;
+            flush(c);
+        }
+
+        prev_q.swap(q);
+        frames_sent++;
+    }
+}
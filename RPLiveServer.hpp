@@ -0,0 +1,108 @@
+/*
+ ==============================================================================
+
+ RPLiveServer.hpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#ifndef RPLiveServer_hpp
+#define RPLiveServer_hpp
+
+#include "RPGraph.hpp"
+#include "RPForceAtlas2.hpp"
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace RPGraph
+{
+    // HTTP server on localhost, for watching a layout from a browser or
+    // any other client on the same machine. It runs on its own thread:
+    //   GET /           a page drawing the layout (xy-plane) as it runs
+    //   GET /telemetry  statistics of the last frame, as JSON
+    //   GET /frames     WebSocket: per frame, the telemetry as a text
+    //                   message, then the positions as a binary one
+    // Frames are sent at most `max_fps' times per second. Positions are
+    // quantized to 16 bits per axis on a grid, then sent as differences
+    // from the previous frame; the format is given in the implementation.
+    // The layout thread hands frames over through a lock-free slot, so
+    // neither waits for the other, and slow clients only miss frames.
+    class LiveServer
+    {
+    public:
+        LiveServer(int port, float max_fps = 10.0f);
+        ~LiveServer();
+
+        // True when the server is ready for the next frame, such that
+        // the layout is only synced and copied when it will be sent.
+        bool frameRequested() const;
+        // Positions as x, y, z per node.
+        void publish(const float *xyz, nid_t num_nodes, const StepTelemetry &telemetry);
+
+    private:
+        struct Frame
+        {
+            std::vector<float> positions;
+            StepTelemetry telemetry;
+        };
+
+        struct Client
+        {
+            int fd;
+            bool websocket = false;
+            bool needs_key = true; // Missed (or never had) the previous frame.
+            bool closing = false;  // Closed once `out' is sent.
+            std::string in, out;
+        };
+
+        // Triple buffer: the layout thread fills buffers[back], the server
+        // reads buffers[front], and they swap with `middle', whose FRESH
+        // bit is set when it holds a frame the server hasn't taken.
+        Frame buffers[3];
+        std::atomic<int> middle;
+        int back, front;
+        std::atomic<bool> frame_requested;
+        bool has_frame;
+
+        const float max_fps;
+        int listen_fd;
+        std::atomic<bool> stopping;
+        std::thread thread;
+        std::vector<Client> clients;
+
+        // Quantization grid: position = origin + q * step. prev_q are
+        // the values of the last frame sent.
+        float origin[3], step[3];
+        std::vector<uint16_t> prev_q;
+        uint64_t frames_sent;
+
+        void run();
+        bool takeFrame();
+        void handleInput(Client &client);
+        void handleRequest(Client &client, const std::string &request);
+        void handleMessages(Client &client);
+        void broadcast();
+        bool fitGrid(const std::vector<float> &positions);
+        void flush(Client &client);
+    };
+}
+
+#endif /* RPLiveServer_hpp */
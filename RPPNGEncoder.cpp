@@ -0,0 +1,228 @@
+/*
+ ==============================================================================
+
+ RPPNGEncoder.cpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#include "RPPNGEncoder.hpp"
+#include <zlib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+// Amount of (filtered) image data per compressed block, as in pigz.
+#define PNG_BLOCK_SIZE (128 * 1024)
+// The deflate window, i.e. how much earlier data a block can refer to.
+#define PNG_DICT_SIZE (32 * 1024)
+
+namespace RPGraph
+{
+    static void parallel_range(ThreadPool *pool, size_t n, const ThreadPool::RangeFn &f)
+    {
+        if (pool) pool->parallel_for(n, f);
+        else f(0, n);
+    }
+
+    static void put_u32(std::vector<uint8_t> &out, uint32_t v)
+    {
+        out.push_back(v >> 24);
+        out.push_back(v >> 16);
+        out.push_back(v >> 8);
+        out.push_back(v);
+    }
+
+    static uint8_t paeth(uint8_t a, uint8_t b, uint8_t c)
+    {
+        const int p = a + b - c;
+        const int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+        if (pa <= pb && pa <= pc) return a;
+        return pb <= pc ? b : c;
+    }
+
+    // Writes row `y' with its filter type byte to `out'. Stored images
+    // aren't filtered, others use the Paeth filter, which tends to
+    // compress best for drawings with smooth or flat areas.
+    static void filter_row(const uint8_t *rgb, int width, int y, bool filter, uint8_t *out)
+    {
+        const size_t stride = (size_t) width * 3;
+        const uint8_t *row = rgb + y * stride;
+        out[0] = filter ? 4 : 0;
+        if (!filter)
+        {
+            std::copy(row, row + stride, out + 1);
+            return;
+        }
+
+        const uint8_t *prev = y > 0 ? row - stride : nullptr;
+        for (size_t i = 0; i < stride; ++i)
+        {
+            const uint8_t a = i >= 3 ? row[i-3] : 0;
+            const uint8_t b = prev ? prev[i] : 0;
+            const uint8_t c = prev && i >= 3 ? prev[i-3] : 0;
+            out[i+1] = row[i] - paeth(a, b, c);
+        }
+    }
+
+    static void write_chunk(FILE *file, const char *type, const uint8_t *data, uint32_t length,
+                            uint32_t crc)
+    {
+        std::vector<uint8_t> head;
+        put_u32(head, length);
+        head.insert(head.end(), type, type + 4);
+        std::vector<uint8_t> tail;
+        put_u32(tail, crc);
+        fwrite(head.data(), 1, head.size(), file);
+        if (length > 0) fwrite(data, 1, length, file);
+        fwrite(tail.data(), 1, tail.size(), file);
+    }
+
+    static uint32_t chunk_crc(const char *type, const uint8_t *data, uint32_t length)
+    {
+        const uLong crc = crc32(0L, (const Bytef *) type, 4);
+        return length > 0 ? crc32(crc, data, length) : crc;
+    }
+
+    void writePNG(std::string path, const uint8_t *rgb, int width, int height,
+                  int level, ThreadPool *pool)
+    {
+        level = std::min(std::max(level, 0), 9);
+        const bool filter = level > 0;
+        const size_t line = (size_t) width * 3 + 1;
+
+        // Filter all rows first; blocks need the data before them as dictionary.
+        std::vector<uint8_t> filtered(line * height);
+        parallel_range(pool, height, [&](size_t begin, size_t end)
+        {
+            for (size_t y = begin; y < end; ++y)
+                filter_row(rgb, width, y, filter, &filtered[y * line]);
+        });
+
+        const size_t num_blocks = std::max((filtered.size() + PNG_BLOCK_SIZE - 1) / PNG_BLOCK_SIZE,
+                                           (size_t) 1);
+        std::vector<std::vector<uint8_t>> blocks(num_blocks);
+        std::vector<uLong> block_adler(num_blocks);
+        std::vector<size_t> block_len(num_blocks);
+        std::vector<int> block_error(num_blocks, Z_OK);
+
+        parallel_range(pool, num_blocks, [&](size_t begin, size_t end)
+        {
+            for (size_t b = begin; b < end; ++b)
+            {
+                const size_t start = b * PNG_BLOCK_SIZE;
+                const size_t len = std::min(filtered.size() - start, (size_t) PNG_BLOCK_SIZE);
+                const bool last = b == num_blocks - 1;
+                block_len[b] = len;
+                block_adler[b] = adler32(adler32(0L, Z_NULL, 0), &filtered[start], len);
+
+                // The first block starts the zlib stream.
+                std::vector<uint8_t> &out = blocks[b];
+                if (b == 0)
+                {
+                    static const uint8_t flevel[10] = {0x01, 0x01, 0x5E, 0x5E, 0x5E,
+                                                       0x5E, 0x9C, 0xDA, 0xDA, 0xDA};
+                    out.push_back(0x78);
+                    out.push_back(flevel[level]);
+                }
+
+                z_stream strm = z_stream();
+                int err = deflateInit2(&strm, level, Z_DEFLATED, -15, 8,
+                                       filter ? Z_FILTERED : Z_DEFAULT_STRATEGY);
+                if (err == Z_OK && start > 0 && level > 0)
+                {
+                    const size_t dict = std::min(start, (size_t) PNG_DICT_SIZE);
+                    err = deflateSetDictionary(&strm, &filtered[start - dict], dict);
+                }
+
+                strm.next_in = &filtered[start];
+                strm.avail_in = len;
+                const size_t head = out.size();
+                out.resize(head + deflateBound(&strm, len) + 16);
+                strm.next_out = &out[head];
+                strm.avail_out = out.size() - head;
+                while (err == Z_OK)
+                {
+                    err = deflate(&strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+                    if (err == Z_BUF_ERROR) err = Z_OK; // Only out of space.
+                    if (err != Z_OK || (!last && strm.avail_out > 0)) break;
+
+                    const size_t used = out.size() - strm.avail_out;
+                    out.resize(out.size() * 2);
+                    strm.next_out = &out[used];
+                    strm.avail_out = out.size() - used;
+                }
+                out.resize(out.size() - strm.avail_out);
+                block_error[b] = err == Z_STREAM_END ? Z_OK : err;
+                deflateEnd(&strm);
+            }
+        });
+
+        for (size_t b = 0; b < num_blocks; ++b)
+        {
+            if (block_error[b] != Z_OK)
+            {
+                fprintf(stderr, "error: Could not compress %s (zlib error %d).\n",
+                        path.c_str(), block_error[b]);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        // The stream ends with the checksum of all data.
+        uLong adler = block_adler[0];
+        for (size_t b = 1; b < num_blocks; ++b)
+            adler = adler32_combine(adler, block_adler[b], block_len[b]);
+        put_u32(blocks.back(), adler);
+
+        std::vector<uint32_t> crcs(num_blocks);
+        parallel_range(pool, num_blocks, [&](size_t begin, size_t end)
+        {
+            for (size_t b = begin; b < end; ++b)
+                crcs[b] = chunk_crc("IDAT", blocks[b].data(), blocks[b].size());
+        });
+
+        FILE *file = fopen(path.c_str(), "wb");
+        if (!file)
+        {
+            fprintf(stderr, "error: Could not open %s for writing.\n", path.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        fwrite(signature, 1, sizeof(signature), file);
+
+        // 8 bits per channel, RGB, no interlacing.
+        std::vector<uint8_t> ihdr;
+        put_u32(ihdr, width);
+        put_u32(ihdr, height);
+        const uint8_t ihdr_rest[5] = {8, 2, 0, 0, 0};
+        ihdr.insert(ihdr.end(), ihdr_rest, ihdr_rest + 5);
+        write_chunk(file, "IHDR", ihdr.data(), ihdr.size(), chunk_crc("IHDR", ihdr.data(), ihdr.size()));
+
+        for (size_t b = 0; b < num_blocks; ++b)
+            write_chunk(file, "IDAT", blocks[b].data(), blocks[b].size(), crcs[b]);
+        write_chunk(file, "IEND", nullptr, 0, chunk_crc("IEND", nullptr, 0));
+
+        if (ferror(file) || fclose(file) != 0)
+        {
+            fprintf(stderr, "error: Could not write %s.\n", path.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+}
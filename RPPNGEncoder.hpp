@@ -0,0 +1,47 @@
+/*
+ ==============================================================================
+
+ RPPNGEncoder.hpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#ifndef RPPNGEncoder_hpp
+#define RPPNGEncoder_hpp
+
+#include "RPThreadPool.hpp"
+#include <stdint.h>
+#include <string>
+
+namespace RPGraph
+{
+    // Writes an image of interleaved 8-bit RGB, with rows from top to
+    // bottom (as produced by Rasterizer::toneMap8), to a PNG file at `path'.
+    // `level' is the zlib compression level: 0 only stores the pixels,
+    // 1 is fastest and 9 smallest.
+    //
+    // Rows are compressed in independent blocks, in parallel on `pool' if
+    // given, as pigz does: each block is primed with the 32 KiB of data
+    // before it and ends on a byte boundary (a sync flush), so the blocks
+    // concatenate into one zlib stream. Each block is written as its own
+    // IDAT chunk, and checksums of the blocks are combined afterwards.
+    void writePNG(std::string path, const uint8_t *rgb, int width, int height,
+                  int level = 6, ThreadPool *pool = nullptr);
+}
+
+#endif /* RPPNGEncoder_hpp */
@@ -0,0 +1,146 @@
+/*
+ ==============================================================================
+
+ RPProjection.cpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#include "RPProjection.hpp"
+#include <math.h>
+
+namespace RPGraph
+{
+    static float component(const Coordinate &c, int axis)
+    {
+        return axis == AXIS_X ? c.x : axis == AXIS_Y ? c.y : c.z;
+    }
+
+    static void cross(const float *a, const float *b, float *out)
+    {
+        out[0] = a[1]*b[2] - a[2]*b[1];
+        out[1] = a[2]*b[0] - a[0]*b[2];
+        out[2] = a[0]*b[1] - a[1]*b[0];
+    }
+
+    static void normalize(float *v)
+    {
+        const float len = sqrtf(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+        if (len == 0.0f) return;
+        v[0] /= len;
+        v[1] /= len;
+        v[2] /= len;
+    }
+
+    bool Projection::projectLine(const Coordinate &c1, const Coordinate &c2,
+                                 float &x0, float &y0, float &z0,
+                                 float &x1, float &y1, float &z1) const
+    {
+        return project(c1, x0, y0, z0) && project(c2, x1, y1, z1);
+    }
+
+    OrthographicProjection::OrthographicProjection(Axis u, Axis v,
+                                                   const Coordinate &lo, const Coordinate &hi,
+                                                   int image_w, int image_h, float depth_sign)
+    : axis_u{u}, axis_v{v}, axis_d{3 - u - v},
+      min_u{component(lo, u)}, min_v{component(lo, v)},
+      scale_u{image_w / (component(hi, u) - component(lo, u))},
+      scale_v{image_h / (component(hi, v) - component(lo, v))},
+      depth_sign{depth_sign}
+    {}
+
+    bool OrthographicProjection::project(const Coordinate &c, float &x, float &y, float &z) const
+    {
+        x = (component(c, axis_u) - min_u) * scale_u;
+        y = (component(c, axis_v) - min_v) * scale_v;
+        z = depth_sign == 0.0f ? 0.0f : -depth_sign * component(c, axis_d);
+        return true;
+    }
+
+    PerspectiveProjection::PerspectiveProjection(const Camera &camera,
+                                                 int image_w, int image_h, float near)
+    : center_x{image_w / 2.0f}, center_y{image_h / 2.0f},
+      focal{(image_h / 2.0f) / tanf(camera.fov * (float) M_PI / 360.0f)}, near{near}
+    {
+        eye[0] = camera.eye.x;
+        eye[1] = camera.eye.y;
+        eye[2] = camera.eye.z;
+        forward[0] = camera.target.x - camera.eye.x;
+        forward[1] = camera.target.y - camera.eye.y;
+        forward[2] = camera.target.z - camera.eye.z;
+        normalize(forward);
+
+        float world_up[3] = {0.0f, 1.0f, 0.0f};
+        if (fabsf(forward[1]) > 0.99f)
+        {
+            world_up[1] = 0.0f;
+            world_up[2] = 1.0f;
+        }
+        cross(forward, world_up, right);
+        normalize(right);
+        cross(right, forward, up);
+    }
+
+    void PerspectiveProjection::toCamera(const Coordinate &c, float *v) const
+    {
+        const float d[3] = {c.x - eye[0], c.y - eye[1], c.z - eye[2]};
+        v[0] = d[0]*right[0] + d[1]*right[1] + d[2]*right[2];
+        v[1] = d[0]*up[0] + d[1]*up[1] + d[2]*up[2];
+        v[2] = d[0]*forward[0] + d[1]*forward[1] + d[2]*forward[2];
+    }
+
+    void PerspectiveProjection::toImage(const float *v, float &x, float &y, float &z) const
+    {
+        x = center_x + v[0] * focal / v[2];
+        y = center_y + v[1] * focal / v[2];
+        z = v[2];
+    }
+
+    bool PerspectiveProjection::project(const Coordinate &c, float &x, float &y, float &z) const
+    {
+        float v[3];
+        toCamera(c, v);
+        if (v[2] < near) return false;
+        toImage(v, x, y, z);
+        return true;
+    }
+
+    bool PerspectiveProjection::projectLine(const Coordinate &c1, const Coordinate &c2,
+                                            float &x0, float &y0, float &z0,
+                                            float &x1, float &y1, float &z1) const
+    {
+        float a[3], b[3];
+        toCamera(c1, a);
+        toCamera(c2, b);
+        if (a[2] < near && b[2] < near) return false;
+
+        // Move the end behind the near plane onto it.
+        float *behind = a[2] < near ? a : b[2] < near ? b : nullptr;
+        if (behind)
+        {
+            const float *front = behind == a ? b : a;
+            const float t = (near - front[2]) / (behind[2] - front[2]);
+            for (int i = 0; i < 3; ++i) behind[i] = front[i] + t * (behind[i] - front[i]);
+            behind[2] = near;
+        }
+
+        toImage(a, x0, y0, z0);
+        toImage(b, x1, y1, z1);
+        return true;
+    }
+}
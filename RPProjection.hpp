@@ -0,0 +1,99 @@
+/*
+ ==============================================================================
+
+ RPProjection.hpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#ifndef RPProjection_hpp
+#define RPProjection_hpp
+
+#include "RPCommon.hpp"
+
+namespace RPGraph
+{
+    enum Axis { AXIS_X = 0, AXIS_Y = 1, AXIS_Z = 2 };
+
+    // Maps layout coordinates to image coordinates (in pixels, as used by
+    // Rasterizer) and a depth, where smaller depths are nearer the viewer.
+    class Projection
+    {
+    public:
+        virtual ~Projection() {}
+
+        // Returns false if `c' is not in view.
+        virtual bool project(const Coordinate &c, float &x, float &y, float &z) const = 0;
+
+        // Projects the segment from c1 to c2, cut to the part in view.
+        // Returns false if no part of it is.
+        virtual bool projectLine(const Coordinate &c1, const Coordinate &c2,
+                                 float &x0, float &y0, float &z0,
+                                 float &x1, float &y1, float &z1) const;
+    };
+
+    // Parallel projection of the box [lo, hi] along one axis, stretched to
+    // fill the image. Axes `u' and `v' run to the right and up in the image.
+    // The box is viewed from the positive side of the remaining axis if
+    // `depth_sign' is 1, from the negative side if it is -1. If it is 0
+    // all depths are 0, so later discs are drawn over earlier ones.
+    class OrthographicProjection : public Projection
+    {
+    public:
+        OrthographicProjection(Axis u, Axis v, const Coordinate &lo, const Coordinate &hi,
+                               int image_w, int image_h, float depth_sign);
+
+        bool project(const Coordinate &c, float &x, float &y, float &z) const override;
+
+    private:
+        int axis_u, axis_v, axis_d;
+        float min_u, min_v, scale_u, scale_v, depth_sign;
+    };
+
+    // A pinhole camera at `eye', looking at `target'. `fov' is the vertical
+    // field of view in degrees. The image's up direction is the y axis, or
+    // the z axis if the camera looks (nearly) along y.
+    struct Camera
+    {
+        Coordinate eye, target;
+        float fov;
+    };
+
+    // Perspective projection through `camera'. Depth is the distance along
+    // the viewing direction; points closer than `near' are not in view,
+    // and segments are cut off at that distance.
+    class PerspectiveProjection : public Projection
+    {
+    public:
+        PerspectiveProjection(const Camera &camera, int image_w, int image_h, float near);
+
+        bool project(const Coordinate &c, float &x, float &y, float &z) const override;
+        bool projectLine(const Coordinate &c1, const Coordinate &c2,
+                         float &x0, float &y0, float &z0,
+                         float &x1, float &y1, float &z1) const override;
+
+    private:
+        float eye[3], right[3], up[3], forward[3];
+        float center_x, center_y, focal, near;
+
+        void toCamera(const Coordinate &c, float *v) const;
+        void toImage(const float *v, float &x, float &y, float &z) const;
+    };
+}
+
+#endif /* RPProjection_hpp */
@@ -0,0 +1,400 @@
+/*
+ ==============================================================================
+
+ RPRasterizer.cpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#include "RPRasterizer.hpp"
+#include "RPPNGEncoder.hpp"
+#include <math.h>
+#include <cmath>
+#include <algorithm>
+
+// Primitives are binned in blocks of this size, each block by one thread.
+#define RASTER_BIN_BLOCK 4096
+
+namespace RPGraph
+{
+    static void parallel_range(ThreadPool *pool, size_t n, const ThreadPool::RangeFn &f)
+    {
+        if (pool) pool->parallel_for(n, f);
+        else f(0, n);
+    }
+
+    // A line is drawn as one pixel per column, or per row if it is steep,
+    // at the row (column) nearest to the line. In the terms of this struct,
+    // the line covers major coordinates [m0, m1], and has minor coordinate
+    // minor(m) = c0 + (m - a0) * slope, and depth(m) = z0 + (m - a0) * dz.
+    struct LineWalk
+    {
+        bool steep;
+        float a0, c0, slope;
+        float z0, dz;
+        int m0, m1;
+
+        LineWalk(float x0, float y0, float x1, float y1, float za = 0.0f, float zb = 0.0f)
+        {
+            steep = fabsf(y1 - y0) > fabsf(x1 - x0);
+            if (steep)
+            {
+                std::swap(x0, y0);
+                std::swap(x1, y1);
+            }
+            if (x0 > x1)
+            {
+                std::swap(x0, x1);
+                std::swap(y0, y1);
+                std::swap(za, zb);
+            }
+            a0 = x0;
+            c0 = y0;
+            z0 = za;
+            slope = x1 == x0 ? 0.0f : (y1 - y0) / (x1 - x0);
+            dz = x1 == x0 ? 0.0f : (zb - za) / (x1 - x0);
+            m0 = (int) floorf(x0 + 0.5f);
+            m1 = (int) floorf(x1 + 0.5f);
+        }
+
+        int minor(int m) const
+        {
+            return (int) floorf(c0 + (m - a0) * slope + 0.5f);
+        }
+
+        float depth(int m) const
+        {
+            return z0 + (m - a0) * dz;
+        }
+    };
+
+    // Clips the segment to the rectangle [x_lo, x_hi] x [y_lo, y_hi]
+    // (Liang-Barsky), moving its end points and depths along. Returns
+    // false if nothing of it is left.
+    static bool clip_line(float &x0, float &y0, float &z0, float &x1, float &y1, float &z1,
+                          float x_lo, float y_lo, float x_hi, float y_hi)
+    {
+        const float dx = x1 - x0, dy = y1 - y0;
+        const float p[4] = {-dx, dx, -dy, dy};
+        const float q[4] = {x0 - x_lo, x_hi - x0, y0 - y_lo, y_hi - y0};
+        float t0 = 0.0f, t1 = 1.0f;
+        for (int i = 0; i < 4; ++i)
+        {
+            if (p[i] == 0.0f)
+            {
+                if (q[i] < 0.0f) return false;
+                continue;
+            }
+            const float t = q[i] / p[i];
+            if (p[i] < 0.0f) t0 = std::max(t0, t);
+            else t1 = std::min(t1, t);
+            if (t0 > t1) return false;
+        }
+
+        const float dz = z1 - z0;
+        if (t1 < 1.0f)
+        {
+            x1 = x0 + t1 * dx;
+            y1 = y0 + t1 * dy;
+            z1 = z0 + t1 * dz;
+        }
+        if (t0 > 0.0f)
+        {
+            x0 += t0 * dx;
+            y0 += t0 * dy;
+            z0 += t0 * dz;
+        }
+        return true;
+    }
+
+    // Sorts primitive ids by tile, such that ids[offsets[t], offsets[t+1])
+    // are the (ascending) ids of the primitives overlapping tile t.
+    // tiles_of(i, out) appends the tiles overlapped by primitive i to out.
+    template <typename F>
+    static void bin_primitives(size_t count, int num_tiles, F tiles_of, ThreadPool *pool,
+                               std::vector<uint32_t> &offsets, std::vector<uint32_t> &ids)
+    {
+        const size_t num_blocks = (count + RASTER_BIN_BLOCK - 1) / RASTER_BIN_BLOCK;
+        std::vector<std::vector<std::pair<uint32_t, uint32_t>>> pairs(num_blocks);
+        std::vector<uint32_t> counts(num_blocks * num_tiles, 0);
+
+        parallel_range(pool, num_blocks, [&](size_t begin, size_t end)
+        {
+            std::vector<uint32_t> tiles;
+            for (size_t b = begin; b < end; ++b)
+            {
+                const size_t last = std::min((b+1) * RASTER_BIN_BLOCK, count);
+                for (size_t i = b * RASTER_BIN_BLOCK; i < last; ++i)
+                {
+                    tiles.clear();
+                    tiles_of(i, tiles);
+                    for (uint32_t t : tiles)
+                    {
+                        pairs[b].push_back(std::make_pair(t, (uint32_t) i));
+                        counts[b * num_tiles + t]++;
+                    }
+                }
+            }
+        });
+
+        // Turn counts into the write position of each block, per tile.
+        offsets.assign(num_tiles+1, 0);
+        uint32_t total = 0;
+        for (int t = 0; t < num_tiles; ++t)
+        {
+            offsets[t] = total;
+            for (size_t b = 0; b < num_blocks; ++b)
+            {
+                const uint32_t c = counts[b * num_tiles + t];
+                counts[b * num_tiles + t] = total;
+                total += c;
+            }
+        }
+        offsets[num_tiles] = total;
+
+        ids.resize(total);
+        parallel_range(pool, num_blocks, [&](size_t begin, size_t end)
+        {
+            for (size_t b = begin; b < end; ++b)
+                for (const std::pair<uint32_t, uint32_t> &p : pairs[b])
+                    ids[counts[b * num_tiles + p.first]++] = p.second;
+        });
+    }
+
+    Rasterizer::Rasterizer(int width, int height, int tile_size)
+    : image_w{std::max(width, 1)}, image_h{std::max(height, 1)},
+      tile_size{std::max(tile_size, 1)},
+      tiles_x{(image_w + this->tile_size - 1) / this->tile_size},
+      tiles_y{(image_h + this->tile_size - 1) / this->tile_size}
+    {}
+
+    int Rasterizer::width() const
+    {
+        return image_w;
+    }
+
+    int Rasterizer::height() const
+    {
+        return image_h;
+    }
+
+    void Rasterizer::addLine(float x0, float y0, float x1, float y1,
+                             float r, float g, float b, float alpha,
+                             float z0, float z1)
+    {
+        if (!std::isfinite(x0) || !std::isfinite(y0) ||
+            !std::isfinite(x1) || !std::isfinite(y1) || alpha <= 0.0f) return;
+
+        // Lines far off screen (e.g. projected from close to a camera) are
+        // cut to just beyond the image, which keeps pixel coordinates small.
+        if (!clip_line(x0, y0, z0, x1, y1, z1, -1.0f, -1.0f, image_w, image_h)) return;
+        lines.push_back(Line{x0, y0, x1, y1, r, g, b, alpha, z0, z1});
+    }
+
+    void Rasterizer::addDisc(float x, float y, float radius, float r, float g, float b,
+                             float z)
+    {
+        if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(radius)) return;
+        if (x + radius < 0.0f || y + radius < 0.0f ||
+            x - radius > image_w || y - radius > image_h) return;
+        discs.push_back(Disc{x, y, radius, r, g, b, z});
+    }
+
+    void Rasterizer::bin(ThreadPool *pool)
+    {
+        const int num_tiles = tiles_x * tiles_y;
+
+        bin_primitives(lines.size(), num_tiles, [&](size_t i, std::vector<uint32_t> &out)
+        {
+            const Line &l = lines[i];
+            const LineWalk walk(l.x0, l.y0, l.x1, l.y1);
+            const int major_size = walk.steep ? image_h : image_w;
+            const int minor_tiles = walk.steep ? tiles_x : tiles_y;
+            const int m0 = std::max(walk.m0, 0);
+            const int m1 = std::min(walk.m1, major_size - 1);
+
+            // Per strip of tiles along the major axis, the minor coordinate
+            // of the line spans the tiles between its two ends in the strip.
+            for (int strip = m0 / tile_size; m0 <= m1 && strip <= m1 / tile_size; ++strip)
+            {
+                const int first = std::max(strip * tile_size, m0);
+                const int last = std::min((strip+1) * tile_size - 1, m1);
+                int c_lo = walk.minor(first), c_hi = walk.minor(last);
+                if (c_lo > c_hi) std::swap(c_lo, c_hi);
+                const int t_lo = std::max(c_lo, 0) / tile_size;
+                const int t_hi = std::min(c_hi / tile_size, minor_tiles - 1);
+                if (c_hi < 0) continue;
+                for (int t = t_lo; t <= t_hi; ++t)
+                    out.push_back(walk.steep ? strip * tiles_x + t : t * tiles_x + strip);
+            }
+        }, pool, tile_line_offsets, tile_line_ids);
+
+        bin_primitives(discs.size(), num_tiles, [&](size_t i, std::vector<uint32_t> &out)
+        {
+            const Disc &d = discs[i];
+            const int x_lo = std::max((int) floorf(d.x - d.radius), 0) / tile_size;
+            const int x_hi = std::min((int) ceilf(d.x + d.radius), image_w - 1) / tile_size;
+            const int y_lo = std::max((int) floorf(d.y - d.radius), 0) / tile_size;
+            const int y_hi = std::min((int) ceilf(d.y + d.radius), image_h - 1) / tile_size;
+            for (int ty = y_lo; ty <= y_hi; ++ty)
+                for (int tx = x_lo; tx <= x_hi; ++tx)
+                    out.push_back(ty * tiles_x + tx);
+        }, pool, tile_disc_offsets, tile_disc_ids);
+    }
+
+    void Rasterizer::rasterizeTile(int tile)
+    {
+        const int tx0 = (tile % tiles_x) * tile_size;
+        const int ty0 = (tile / tiles_x) * tile_size;
+        const int tx1 = std::min(tx0 + tile_size, image_w);
+        const int ty1 = std::min(ty0 + tile_size, image_h);
+
+        // Discs go first, so that lines can be tested against their depth.
+        for (uint32_t k = tile_disc_offsets[tile]; k < tile_disc_offsets[tile+1]; ++k)
+        {
+            const Disc &d = discs[tile_disc_ids[k]];
+            const int cx = (int) floorf(d.x + 0.5f);
+            const int cy = (int) floorf(d.y + 0.5f);
+            const int r = (int) floorf(d.radius + 0.5f);
+            for (int y = std::max(cy - r, ty0); y < std::min(cy + r + 1, ty1); ++y)
+            {
+                for (int x = std::max(cx - r, tx0); x < std::min(cx + r + 1, tx1); ++x)
+                {
+                    if ((x-cx)*(x-cx) + (y-cy)*(y-cy) > r*r) continue;
+                    const size_t p = (size_t) y * image_w + x;
+                    if (disc_covered[p] && d.z > disc_depth[p]) continue;
+                    disc_rgb[p*3 + 0] = d.r;
+                    disc_rgb[p*3 + 1] = d.g;
+                    disc_rgb[p*3 + 2] = d.b;
+                    disc_depth[p] = d.z;
+                    disc_covered[p] = 1;
+                }
+            }
+        }
+
+        for (uint32_t k = tile_line_offsets[tile]; k < tile_line_offsets[tile+1]; ++k)
+        {
+            const Line &l = lines[tile_line_ids[k]];
+            const LineWalk walk(l.x0, l.y0, l.x1, l.y1, l.z0, l.z1);
+            const int major_lo = walk.steep ? ty0 : tx0;
+            const int major_hi = walk.steep ? ty1 : tx1;
+            const int minor_lo = walk.steep ? tx0 : ty0;
+            const int minor_hi = walk.steep ? tx1 : ty1;
+
+            const int first = std::max(walk.m0, major_lo);
+            const int last = std::min(walk.m1, major_hi - 1);
+            for (int m = first; m <= last; ++m)
+            {
+                const int c = walk.minor(m);
+                if (c < minor_lo || c >= minor_hi) continue;
+                const size_t p = walk.steep ? (size_t) m * image_w + c
+                                            : (size_t) c * image_w + m;
+                if (disc_covered[p] && walk.depth(m) >= disc_depth[p]) continue;
+                float *acc = &accum[p * 4];
+                acc[0] += l.r * l.alpha;
+                acc[1] += l.g * l.alpha;
+                acc[2] += l.b * l.alpha;
+                acc[3] += l.alpha;
+            }
+        }
+    }
+
+    void Rasterizer::render(ThreadPool *pool)
+    {
+        accum.assign((size_t) image_w * image_h * 4, 0.0f);
+        disc_rgb.assign((size_t) image_w * image_h * 3, 0.0f);
+        disc_depth.assign((size_t) image_w * image_h, 0.0f);
+        disc_covered.assign((size_t) image_w * image_h, 0);
+
+        bin(pool);
+
+        // Tiles are scheduled by the number of primitives they overlap.
+        const int num_tiles = tiles_x * tiles_y;
+        std::vector<uint64_t> cost_prefix(num_tiles+1, 0);
+        for (int t = 0; t < num_tiles; ++t)
+        {
+            cost_prefix[t+1] = cost_prefix[t] + 1
+                             + (tile_line_offsets[t+1] - tile_line_offsets[t])
+                             + (tile_disc_offsets[t+1] - tile_disc_offsets[t]);
+        }
+
+        const ThreadPool::RangeFn rasterize = [&](size_t begin, size_t end)
+        {
+            for (size_t t = begin; t < end; ++t) rasterizeTile(t);
+        };
+        if (pool) pool->parallel_for(num_tiles, rasterize, cost_prefix.data());
+        else rasterize(0, num_tiles);
+    }
+
+    // Lines cover a fraction 1 - exp(-alpha) of the background, with
+    // their alpha-weighted average color. Discs cover it completely.
+    void Rasterizer::composePixel(size_t p, float bg_r, float bg_g, float bg_b,
+                                  float &r, float &g, float &b) const
+    {
+        if (disc_covered[p])
+        {
+            r = disc_rgb[p*3 + 0];
+            g = disc_rgb[p*3 + 1];
+            b = disc_rgb[p*3 + 2];
+            return;
+        }
+
+        const float *acc = &accum[p * 4];
+        r = bg_r;
+        g = bg_g;
+        b = bg_b;
+        if (acc[3] > 0.0f)
+        {
+            const float coverage = 1.0f - expf(-acc[3]);
+            r += (acc[0] / acc[3] - bg_r) * coverage;
+            g += (acc[1] / acc[3] - bg_g) * coverage;
+            b += (acc[2] / acc[3] - bg_b) * coverage;
+        }
+        r = std::min(std::max(r, 0.0f), 1.0f);
+        g = std::min(std::max(g, 0.0f), 1.0f);
+        b = std::min(std::max(b, 0.0f), 1.0f);
+    }
+
+    void Rasterizer::toneMap8(uint8_t *rgb, float bg_r, float bg_g, float bg_b,
+                              ThreadPool *pool) const
+    {
+        parallel_range(pool, image_h, [&](size_t begin, size_t end)
+        {
+            for (size_t row = begin; row < end; ++row)
+            {
+                const int y = image_h - 1 - row;
+                for (int x = 0; x < image_w; ++x)
+                {
+                    float r, g, b;
+                    composePixel((size_t) y * image_w + x, bg_r, bg_g, bg_b, r, g, b);
+                    uint8_t *out = &rgb[(row * image_w + x) * 3];
+                    out[0] = (uint8_t) (r * 255.0f + 0.5f);
+                    out[1] = (uint8_t) (g * 255.0f + 0.5f);
+                    out[2] = (uint8_t) (b * 255.0f + 0.5f);
+                }
+            }
+        });
+    }
+
+    void Rasterizer::writePNG(std::string path, int level, ThreadPool *pool) const
+    {
+        std::vector<uint8_t> rgb((size_t) image_w * image_h * 3);
+        toneMap8(rgb.data(), 1.0f, 1.0f, 1.0f, pool);
+        RPGraph::writePNG(path, rgb.data(), image_w, image_h, level, pool);
+    }
+}
@@ -0,0 +1,112 @@
+/*
+ ==============================================================================
+
+ RPRasterizer.hpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#ifndef RPRasterizer_hpp
+#define RPRasterizer_hpp
+
+#include "RPThreadPool.hpp"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace RPGraph
+{
+    // Renders lines and discs into an image. Primitives are first collected,
+    // then binned into square screen tiles, after which tiles are rasterized
+    // in parallel. Lines accumulate with additive alpha into a float buffer,
+    // so their order doesn't matter. Discs are opaque and z-buffered: the
+    // disc of smallest depth is drawn, or the latest one in case of a tie.
+    // Lines are hidden where they lie behind (or at the depth of) a disc.
+    // With all depths left at 0 discs are thus drawn over the lines, later
+    // ones over earlier ones.
+    // Pixel (0, 0) is the bottom left of the image, as in pngwriter.
+    class Rasterizer
+    {
+    public:
+        Rasterizer(int width, int height, int tile_size = 64);
+
+        // Colors and alpha are in [0, 1]. Smaller depths are nearer to the
+        // viewer; the depth of a line is interpolated between its ends.
+        void addLine(float x0, float y0, float x1, float y1,
+                     float r, float g, float b, float alpha,
+                     float z0 = 0.0f, float z1 = 0.0f);
+        void addDisc(float x, float y, float radius, float r, float g, float b,
+                     float z = 0.0f);
+
+        // Rasterizes all primitives added so far, on `pool' if given.
+        void render(ThreadPool *pool = nullptr);
+
+        // Composes the rendered image on a background of the given
+        // color, as interleaved RGB with 8 bits per channel. Rows run
+        // from the top of the image to its bottom.
+        void toneMap8(uint8_t *rgb, float bg_r = 1.0f, float bg_g = 1.0f, float bg_b = 1.0f,
+                      ThreadPool *pool = nullptr) const;
+
+        // Writes the rendered image on a white background, see
+        // RPGraph::writePNG for `level'.
+        void writePNG(std::string path, int level = 6, ThreadPool *pool = nullptr) const;
+
+        int width() const;
+        int height() const;
+
+    private:
+        struct Line
+        {
+            float x0, y0, x1, y1;
+            float r, g, b, alpha;
+            float z0, z1;
+        };
+
+        struct Disc
+        {
+            float x, y, radius;
+            float r, g, b;
+            float z;
+        };
+
+        const int image_w, image_h, tile_size;
+        const int tiles_x, tiles_y;
+
+        std::vector<Line> lines;
+        std::vector<Disc> discs;
+
+        // Ids of the lines (discs) overlapping tile t, in the order they were
+        // added, are tile_line_ids[tile_line_offsets[t], tile_line_offsets[t+1]).
+        std::vector<uint32_t> tile_line_offsets, tile_line_ids;
+        std::vector<uint32_t> tile_disc_offsets, tile_disc_ids;
+
+        // Per pixel: premultiplied line color and summed alpha (RGBA),
+        // and the color and depth of the nearest disc, if any.
+        std::vector<float> accum;
+        std::vector<float> disc_rgb;
+        std::vector<float> disc_depth;
+        std::vector<uint8_t> disc_covered;
+
+        void bin(ThreadPool *pool);
+        void rasterizeTile(int tile);
+        void composePixel(size_t p, float bg_r, float bg_g, float bg_b,
+                          float &r, float &g, float &b) const;
+    };
+}
+
+#endif /* RPRasterizer_hpp */
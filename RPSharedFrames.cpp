@@ -0,0 +1,251 @@
+/*
+ ==============================================================================
+
+ RPSharedFrames.cpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#include "RPSharedFrames.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+// Shared memory layout, in host byte order, all offsets 64-byte aligned:
+//   header (64 bytes):
+//     char[8]   magic "RPSHMFR1"
+//     uint32    capacity, the largest number of nodes in a frame
+//     uint32    number of slots
+//     uint64    size of a slot in bytes
+//     uint64    frames published so far (atomic); frame f is in slot
+//               f % slots, so the latest one is in (frames-1) % slots
+//     uint32    nonzero once the publisher is gone (atomic)
+//   slots, each:
+//     uint64    sequence (atomic): 2f+1 while frame f is written into
+//               the slot, 2f+2 once it is complete
+//     int32     iteration
+//     uint32    number of nodes
+//     uint64    monotonic_ns() when the frame was published
+//     (padding to 64 bytes)
+//     float[3n] positions, x, y, z per node
+// A reader loads `frames', the sequence of the latest slot (which must be
+// 2f+2), copies the frame and loads the sequence again. If it changed, the
+// publisher has overwritten the slot meanwhile, and the reader starts over.
+#define SHARED_FRAMES_MAGIC "RPSHMFR1"
+
+namespace RPGraph
+{
+    struct SharedFrameHeader
+    {
+        char magic[8];
+        uint32_t capacity;
+        uint32_t num_slots;
+        uint64_t slot_size;
+        std::atomic<uint64_t> frames;
+        std::atomic<uint32_t> closed;
+    };
+
+    struct SharedFrameSlot
+    {
+        std::atomic<uint64_t> sequence;
+        std::atomic<int32_t> iteration;
+        std::atomic<uint32_t> num_nodes;
+        std::atomic<uint64_t> timestamp_ns;
+    };
+
+    static const size_t header_size = 64;
+    static const size_t slot_header_size = 64;
+    static_assert(sizeof(SharedFrameHeader) <= header_size, "Header fits its 64 bytes");
+    static_assert(sizeof(SharedFrameSlot) <= slot_header_size, "Slot header fits its 64 bytes");
+
+    uint64_t monotonic_ns()
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (uint64_t) t.tv_sec * 1000000000ull + t.tv_nsec;
+    }
+
+    static SharedFrameSlot *frame_slot(uint8_t *mapping, uint64_t frame)
+    {
+        const SharedFrameHeader *header = reinterpret_cast<SharedFrameHeader *>(mapping);
+        return reinterpret_cast<SharedFrameSlot *>(mapping + header_size
+                                                   + (frame % header->num_slots) * header->slot_size);
+    }
+
+    SharedFramePublisher::SharedFramePublisher(std::string name, nid_t capacity, int num_slots)
+    : name{name}, mapping{nullptr}, mapping_size{0}, frames{0}
+    {
+        num_slots = std::max(num_slots, 1);
+        const uint64_t slot_size = (slot_header_size + 3 * sizeof(float) * (uint64_t) capacity + 63) / 64 * 64;
+        mapping_size = header_size + num_slots * slot_size;
+
+        // Readers of an earlier object keep that one.
+        shm_unlink(name.c_str());
+        const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0 or ftruncate(fd, mapping_size) != 0)
+        {
+            fprintf(stderr, "error: Could not create shared memory %s\n", name.c_str());
+            exit(EXIT_FAILURE);
+        }
+        void *m = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (m == MAP_FAILED)
+        {
+            fprintf(stderr, "error: Could not map shared memory %s\n", name.c_str());
+            exit(EXIT_FAILURE);
+        }
+        mapping = static_cast<uint8_t *>(m);
+
+        for (int s = 0; s < num_slots; ++s)
+        {
+            SharedFrameSlot *slot = new (mapping + header_size + s * slot_size) SharedFrameSlot();
+            slot->sequence.store(0, std::memory_order_relaxed);
+        }
+        SharedFrameHeader *header = new (mapping) SharedFrameHeader();
+        header->capacity = capacity;
+        header->num_slots = num_slots;
+        header->slot_size = slot_size;
+        header->frames.store(0, std::memory_order_relaxed);
+        header->closed.store(0, std::memory_order_relaxed);
+        // Readers check the magic first, so it is written last.
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(header->magic, SHARED_FRAMES_MAGIC, 8);
+    }
+
+    SharedFramePublisher::~SharedFramePublisher()
+    {
+        SharedFrameHeader *header = reinterpret_cast<SharedFrameHeader *>(mapping);
+        header->closed.store(1, std::memory_order_release);
+        munmap(mapping, mapping_size);
+        shm_unlink(name.c_str());
+    }
+
+    void SharedFramePublisher::publish(const float *xyz, nid_t num_nodes, int iteration)
+    {
+        SharedFrameHeader *header = reinterpret_cast<SharedFrameHeader *>(mapping);
+        if (num_nodes > header->capacity)
+        {
+            fprintf(stderr, "error: Frame of %u nodes exceeds the %u of shared memory %s\n",
+                    num_nodes, header->capacity, name.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        const uint64_t timestamp = monotonic_ns();
+        SharedFrameSlot *slot = frame_slot(mapping, frames);
+        slot->sequence.store(2 * frames + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        slot->iteration.store(iteration, std::memory_order_relaxed);
+        slot->num_nodes.store(num_nodes, std::memory_order_relaxed);
+        slot->timestamp_ns.store(timestamp, std::memory_order_relaxed);
+        memcpy(reinterpret_cast<uint8_t *>(slot) + slot_header_size, xyz, 3 * sizeof(float) * (size_t) num_nodes);
+
+        slot->sequence.store(2 * frames + 2, std::memory_order_release);
+        frames++;
+        header->frames.store(frames, std::memory_order_release);
+    }
+
+    void SharedFramePublisher::publish(GraphLayout &layout, int iteration)
+    {
+        publish(layout.positionData(), layout.graph.num_nodes(), iteration);
+    }
+
+    SharedFrameReader::SharedFrameReader(std::string name)
+    : name{name}, mapping{nullptr}, mapping_size{0}
+    {
+        const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        struct stat st;
+        if (fd < 0 or fstat(fd, &st) != 0 or (size_t) st.st_size < header_size)
+        {
+            fprintf(stderr, "error: Could not open shared memory %s\n", name.c_str());
+            exit(EXIT_FAILURE);
+        }
+        mapping_size = st.st_size;
+        void *m = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (m == MAP_FAILED)
+        {
+            fprintf(stderr, "error: Could not map shared memory %s\n", name.c_str());
+            exit(EXIT_FAILURE);
+        }
+        mapping = static_cast<const uint8_t *>(m);
+
+        const SharedFrameHeader *header = reinterpret_cast<const SharedFrameHeader *>(mapping);
+        if (memcmp(header->magic, SHARED_FRAMES_MAGIC, 8) != 0 or
+            header_size + header->num_slots * header->slot_size > mapping_size)
+        {
+            fprintf(stderr, "error: %s is not (yet) a frame buffer of graph_viewer\n", name.c_str());
+            exit(EXIT_FAILURE);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+
+    SharedFrameReader::~SharedFrameReader()
+    {
+        munmap(const_cast<uint8_t *>(mapping), mapping_size);
+    }
+
+    bool SharedFrameReader::readLatest(SharedFrame &frame)
+    {
+        const SharedFrameHeader *header = reinterpret_cast<const SharedFrameHeader *>(mapping);
+
+        // Only fails repeatedly if the publisher laps the whole ring
+        // during each copy.
+        for (int attempt = 0; attempt < 64; ++attempt)
+        {
+            const uint64_t frames = header->frames.load(std::memory_order_acquire);
+            if (frames <= frame.number) return false;
+
+            const uint64_t f = frames - 1;
+            const SharedFrameSlot *slot = frame_slot(const_cast<uint8_t *>(mapping), f);
+            const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+            if (sequence != 2 * f + 2) continue;
+
+            const int iteration = slot->iteration.load(std::memory_order_relaxed);
+            const nid_t num_nodes = std::min(slot->num_nodes.load(std::memory_order_relaxed),
+                                             header->capacity);
+            const uint64_t timestamp = slot->timestamp_ns.load(std::memory_order_relaxed);
+            frame.positions.resize(3 * (size_t) num_nodes);
+            memcpy(frame.positions.data(), reinterpret_cast<const uint8_t *>(slot) + slot_header_size,
+                   3 * sizeof(float) * (size_t) num_nodes);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot->sequence.load(std::memory_order_relaxed) != sequence) continue;
+
+            frame.number = frames;
+            frame.iteration = iteration;
+            frame.timestamp_ns = timestamp;
+            return true;
+        }
+        return false;
+    }
+
+    bool SharedFrameReader::closed() const
+    {
+        const SharedFrameHeader *header = reinterpret_cast<const SharedFrameHeader *>(mapping);
+        return header->closed.load(std::memory_order_acquire) != 0;
+    }
+}
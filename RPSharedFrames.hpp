@@ -0,0 +1,96 @@
+/*
+ ==============================================================================
+
+ RPSharedFrames.hpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#ifndef RPSharedFrames_hpp
+#define RPSharedFrames_hpp
+
+#include "RPGraph.hpp"
+#include "RPGraphLayout.hpp"
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace RPGraph
+{
+    // CLOCK_MONOTONIC in nanoseconds, which is the same in all processes.
+    uint64_t monotonic_ns();
+
+    // Publishes layout positions to other processes through a POSIX
+    // shared memory object (e.g. "/graph_viewer"), a ring buffer of the
+    // last few frames. Each slot is guarded by a sequence counter (a
+    // seqlock), so the publisher never waits for readers, and readers
+    // detect and retry frames overwritten while they copied them. The
+    // format is given in the implementation. The object is removed when
+    // the publisher is destroyed; readers that mapped it keep it.
+    class SharedFramePublisher
+    {
+    public:
+        // Replaces any object of the same name. Frames have up to
+        // `capacity' nodes.
+        SharedFramePublisher(std::string name, nid_t capacity, int num_slots = 4);
+        ~SharedFramePublisher();
+
+        // Positions as x, y, z per node; the layout must be synced.
+        void publish(const float *xyz, nid_t num_nodes, int iteration);
+        void publish(GraphLayout &layout, int iteration);
+
+    private:
+        std::string name;
+        uint8_t *mapping;
+        size_t mapping_size;
+        uint64_t frames; // Published so far.
+    };
+
+    // A frame copied by SharedFrameReader.
+    struct SharedFrame
+    {
+        uint64_t number = 0; // Of published frames, from 1.
+        int iteration = 0;
+        uint64_t timestamp_ns = 0; // monotonic_ns() when it was published.
+        std::vector<float> positions; // x, y, z per node.
+    };
+
+    // Reads frames of a SharedFramePublisher, from any process, without
+    // locking: the latest frame is copied, and copied again if the
+    // publisher overwrote it meanwhile.
+    class SharedFrameReader
+    {
+    public:
+        SharedFrameReader(std::string name);
+        ~SharedFrameReader();
+
+        // Copies the latest frame into `frame' if it is newer than
+        // frame.number. Returns false if there is no newer frame.
+        bool readLatest(SharedFrame &frame);
+        // True once the publisher is gone; no more frames will come.
+        bool closed() const;
+
+    private:
+        std::string name;
+        const uint8_t *mapping;
+        size_t mapping_size;
+    };
+}
+
+#endif /* RPSharedFrames_hpp */
@@ -0,0 +1,236 @@
+/*
+ ==============================================================================
+
+ RPThreadPool.cpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#include "RPThreadPool.hpp"
+#include <algorithm>
+
+// A loop is split into about this many ranges per thread, which leaves
+// enough pieces to steal when ranges turn out to differ in cost.
+#define POOL_RANGES_PER_THREAD 8
+
+namespace RPGraph
+{
+    // The pool (and worker id) of the current thread, if it is a worker.
+    static thread_local const ThreadPool *current_pool = nullptr;
+    static thread_local int current_id = 0;
+
+    ThreadPool::ThreadPool(int num_threads)
+    : num_queued{0}, stop{false}, broadcast_fn{nullptr}, broadcast_gen{0},
+      broadcast_left{0}
+    {
+        if (num_threads <= 0) num_threads = std::thread::hardware_concurrency();
+        num_threads = std::max(num_threads, 1);
+
+        for (int i = 0; i < num_threads; ++i)
+            workers.emplace_back(new Worker());
+        for (int id = 1; id < num_threads; ++id)
+            threads.emplace_back(&ThreadPool::workerLoop, this, id);
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(sleep_lock);
+            stop = true;
+        }
+        wake.notify_all();
+        for (std::thread &t : threads) t.join();
+    }
+
+    int ThreadPool::size() const
+    {
+        return workers.size();
+    }
+
+    int ThreadPool::currentId() const
+    {
+        return current_pool == this ? current_id : 0;
+    }
+
+    void ThreadPool::push(int id, const Task &task)
+    {
+        {
+            std::lock_guard<std::mutex> guard(workers[id]->lock);
+            workers[id]->tasks.push_back(task);
+        }
+        num_queued++;
+
+        // Taking `sleep_lock' ensures a worker about to sleep sees the task.
+        std::lock_guard<std::mutex> guard(sleep_lock);
+        wake.notify_one();
+    }
+
+    // Takes the most recently pushed task of worker `id'.
+    bool ThreadPool::pop(int id, Task &task)
+    {
+        std::lock_guard<std::mutex> guard(workers[id]->lock);
+        if (workers[id]->tasks.empty()) return false;
+        task = workers[id]->tasks.back();
+        workers[id]->tasks.pop_back();
+        num_queued--;
+        return true;
+    }
+
+    // Takes the oldest (i.e. largest) task of another worker.
+    bool ThreadPool::steal(int id, Task &task)
+    {
+        const int n = workers.size();
+        for (int i = 1; i < n; ++i)
+        {
+            Worker &victim = *workers[(id + i) % n];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (victim.tasks.empty()) continue;
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            num_queued--;
+            return true;
+        }
+        return false;
+    }
+
+    void ThreadPool::execute(int id, Task task)
+    {
+        Job &job = *task.job;
+
+        // Split off the upper half until the range is small enough,
+        // leaving the halves for this thread (or thieves) to take.
+        while (task.end - task.begin > 1)
+        {
+            size_t mid;
+            if (job.cost_prefix)
+            {
+                const uint64_t *c = job.cost_prefix;
+                if (c[task.end] - c[task.begin] <= job.grain) break;
+                const uint64_t half = c[task.begin] + (c[task.end] - c[task.begin]) / 2;
+                mid = std::upper_bound(c + task.begin + 1, c + task.end, half) - c;
+                mid = std::min(std::max(mid, task.begin + 1), task.end - 1);
+            }
+            else
+            {
+                if (task.end - task.begin <= job.grain) break;
+                mid = task.begin + (task.end - task.begin) / 2;
+            }
+
+            push(id, Task{&job, mid, task.end});
+            task.end = mid;
+        }
+
+        (*job.f)(task.begin, task.end);
+        job.remaining -= task.end - task.begin;
+    }
+
+    void ThreadPool::runJob(Job &job, size_t n)
+    {
+        const int id = currentId();
+        job.remaining = n;
+        execute(id, Task{&job, 0, n});
+
+        // Help out until all ranges of this job are done.
+        Task task;
+        while (job.remaining.load() > 0)
+        {
+            if (pop(id, task) || steal(id, task)) execute(id, task);
+            else std::this_thread::yield();
+        }
+    }
+
+    void ThreadPool::parallel_for(size_t n, const RangeFn &f)
+    {
+        if (n == 0) return;
+        if (size() == 1) return f(0, n);
+
+        Job job;
+        job.f = &f;
+        job.cost_prefix = nullptr;
+        job.grain = std::max(n / (size() * POOL_RANGES_PER_THREAD), (size_t)1);
+        runJob(job, n);
+    }
+
+    void ThreadPool::parallel_for(size_t n, const RangeFn &f, const uint64_t *cost_prefix)
+    {
+        if (n == 0) return;
+        if (size() == 1) return f(0, n);
+
+        Job job;
+        job.f = &f;
+        job.cost_prefix = cost_prefix;
+        job.grain = std::max((cost_prefix[n] - cost_prefix[0]) / (size() * POOL_RANGES_PER_THREAD),
+                             (uint64_t)1);
+        runJob(job, n);
+    }
+
+    void ThreadPool::run_on_all(const std::function<void(int tid)> &f)
+    {
+        if (size() == 1) return f(0);
+
+        // Must not be called from a worker, which would never get to run its own tid.
+        std::lock_guard<std::mutex> broadcast_guard(broadcast_lock);
+        broadcast_left = size() - 1;
+        {
+            std::lock_guard<std::mutex> guard(sleep_lock);
+            broadcast_fn = &f;
+            broadcast_gen++;
+        }
+        wake.notify_all();
+
+        f(0);
+
+        Task task;
+        while (broadcast_left.load() > 0)
+        {
+            if (pop(0, task) || steal(0, task)) execute(0, task);
+            else std::this_thread::yield();
+        }
+    }
+
+    void ThreadPool::workerLoop(int id)
+    {
+        current_pool = this;
+        current_id = id;
+        uint64_t seen_gen = 0;
+
+        Task task;
+        while (true)
+        {
+            if (pop(id, task) || steal(id, task))
+            {
+                execute(id, task);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> guard(sleep_lock);
+            if (broadcast_gen != seen_gen)
+            {
+                seen_gen = broadcast_gen;
+                const std::function<void(int)> *f = broadcast_fn;
+                guard.unlock();
+                (*f)(id);
+                broadcast_left--;
+                continue;
+            }
+            if (stop) return;
+            if (num_queued.load() > 0) continue;
+            wake.wait(guard);
+        }
+    }
+}
@@ -0,0 +1,113 @@
+/*
+ ==============================================================================
+
+ RPThreadPool.hpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+#ifndef RPThreadPool_hpp
+#define RPThreadPool_hpp
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace RPGraph
+{
+    // Persistent pool of worker threads with per-thread task deques.
+    // A parallel loop is split into ranges, which are split further (in
+    // halves, by cost) as they are taken. Idle threads steal the largest
+    // pending ranges from the other threads' deques. The thread that
+    // starts a loop takes part in it, and keeps executing tasks while it
+    // waits, so loops can be nested and the pool can be shared.
+    class ThreadPool
+    {
+    public:
+        typedef std::function<void(size_t begin, size_t end)> RangeFn;
+
+        // Uses all hardware threads if `num_threads' is 0.
+        ThreadPool(int num_threads = 0);
+        ~ThreadPool();
+
+        // Number of threads taking part in a loop, including the caller.
+        int size() const;
+
+        // Calls f(begin, end) on disjoint ranges covering [0, n), in parallel.
+        void parallel_for(size_t n, const RangeFn &f);
+
+        // As above, but ranges are split such that they have about equal
+        // cost. `cost_prefix' has n+1 entries, and cost_prefix[i] is the
+        // total cost of the items in [0, i).
+        void parallel_for(size_t n, const RangeFn &f, const uint64_t *cost_prefix);
+
+        // Calls f(tid) for each tid in [0, size()), all at the same time.
+        // For phases whose threads wait on each other (cf. the CUDA kernels).
+        void run_on_all(const std::function<void(int tid)> &f);
+
+    private:
+        struct Job
+        {
+            const RangeFn *f;
+            const uint64_t *cost_prefix;
+            uint64_t grain; // Ranges are not split below this cost.
+            std::atomic<size_t> remaining;
+        };
+
+        struct Task
+        {
+            Job *job;
+            size_t begin, end;
+        };
+
+        struct Worker
+        {
+            std::mutex lock;
+            std::deque<Task> tasks;
+        };
+
+        std::vector<std::unique_ptr<Worker>> workers; // [0] is used by callers.
+        std::vector<std::thread> threads;
+        std::atomic<int> num_queued;
+
+        std::mutex sleep_lock;
+        std::condition_variable wake;
+        bool stop;
+
+        std::mutex broadcast_lock;
+        const std::function<void(int)> *broadcast_fn;
+        uint64_t broadcast_gen;
+        std::atomic<int> broadcast_left;
+
+        void workerLoop(int id);
+        void push(int id, const Task &task);
+        bool pop(int id, Task &task);
+        bool steal(int id, Task &task);
+        void execute(int id, Task task);
+        void runJob(Job &job, size_t n);
+        int currentId() const;
+    };
+}
+
+#endif /* RPThreadPool_hpp */
@@ -26,104 +26,600 @@
 #include <math.h>
 #include <fstream>
 #include <sstream>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <set>
+#include <thread>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/stat.h>
 #include "RPCommon.hpp"
 #include "RPGraph.hpp"
 #include "RPGraphLayout.hpp"
 #include "RPCPUForceAtlas2.hpp"
+#include "RPCPUBHForceAtlas2.hpp"
+#include "RPLayoutMetrics.hpp"
+#include "RPSharedFrames.hpp"
+#include "RPLiveServer.hpp"
 
 #ifdef __NVCC__
 #include <cuda_runtime_api.h>
 #include "RPGPUForceAtlas2.hpp"
 #endif
 
-int main(int argc, const char **argv)
+// Writes the Barnes-Hut interactions of each node in the last
+// iteration as `node_id,interactions', using ids as in the edgelist.
+static void write_interaction_counts(RPGraph::UGraph &graph,
+                                     const std::vector<uint32_t> &counts,
+                                     std::string path)
 {
-    // For reproducibility.
-    //srandom(1234);
-
-    // Parse commandline arguments
-    if (argc < 10 or (std::string(argv[10]) == "png" and argc < 12))
+    if (counts.empty())
     {
-        fprintf(stderr, "Usage: graph_viewer gpu|cpu max_iterations num_snaps sg|wg scale gravity exact|approximate edgelist_path out_path [png image_w image_h|csv|bin]\n");
-        exit(EXIT_FAILURE);
+        fprintf(stderr, "warning: This engine doesn't record interaction counts.\n");
+        return;
     }
 
-    const bool cuda_requested = std::string(argv[1]) == "gpu" or std::string(argv[1]) == "cuda";
-    const int max_iterations = std::stoi(argv[2]);
-    const int num_screenshots = std::stoi(argv[3]);
-    const bool strong_gravity = std::string(argv[4]) == "sg";
-    const float scale = std::stof(argv[5]);
-    const float gravity = std::stof(argv[6]);
-    const bool approximate = std::string(argv[7]) == "approximate";
-    std::string edgelist_path = argv[8];
-    std::string out_path = argv[9];
+    std::ofstream out_file(path);
+    for (RPGraph::nid_t n = 0; n < counts.size(); ++n)
+        out_file << graph.original_id(n) << "," << counts[n] << "\n";
+    out_file.close();
+}
+
+// Options of one layout, as given on the commandline.
+struct LayoutOptions
+{
+    bool cuda_requested, cpubh_requested;
+    int max_iterations, num_screenshots;
+    bool strong_gravity;
+    float scale, gravity;
+    bool approximate;
+    std::string edgelist_path, out_path;
     std::string out_format = "png";
     int image_w = 1250;
     int image_h = 1250;
+    int num_threads = 0; // All hardware threads.
+    bool write_costs = false;
+    std::string groups_path;
+    RPGraph::EdgeMode edge_mode = RPGraph::EDGES_ALL;
+    bool use_camera = false;
+    RPGraph::Camera camera = {RPGraph::Coordinate(0, 0, 0), RPGraph::Coordinate(0, 0, 0), 60};
+    float density_sigma = 2.0f;
+    int edge_samples = 1;
+    int png_level = 6;
+    std::string stream_target;
+    int fps = 25;
+    int lod_levels = 0;
+    std::string coo_storage; // Empty if the input is a text edgelist.
+    bool use_seed = false;
+    uint32_t seed = 0;
+    int checkpoint_period = 0;
+    std::string resume_path;
+    std::string warm_path;
+    std::string update_path;
+    int update_hops = 2;
+    int update_steps = 50; // Steps refined around the edits, then all nodes move.
+    int num_starts = 1;
+    bool write_metrics = false;
+    RPGraph::MetricsOptions metrics;
+    int telemetry_period = 0;
+    bool telemetry_binary = false;
+    std::string publish_name;
+    int publish_period = 0;
+    int serve_port = 0;
+    float serve_fps = 10.0f;
+    float start_margin = 0.02f;
+};
+
+// One of several layouts of the same graph, from different random starts.
+struct LayoutStart
+{
+    std::unique_ptr<RPGraph::GraphLayout> layout;
+    std::unique_ptr<RPGraph::ForceAtlas2> fa2;
+    double energy;
+    bool running;
+};
+
+// Calls f on each running start, concurrently, one thread per start.
+static void for_each_running(std::vector<LayoutStart> &starts, RPGraph::ThreadPool &pool,
+                             const std::function<void(LayoutStart &)> &f)
+{
+    std::vector<LayoutStart *> running;
+    for (LayoutStart &s : starts) if (s.running) running.push_back(&s);
+    std::atomic<size_t> next{0};
+    pool.run_on_all([&](int)
+    {
+        for (size_t k = next++; k < running.size(); k = next++) f(*running[k]);
+    });
+}
+
+// Up to `max_pairs' distinct pairs of nodes, drawn uniformly; all pairs if
+// there are no more than that.
+static std::vector<std::pair<RPGraph::nid_t, RPGraph::nid_t>>
+sample_node_pairs(RPGraph::nid_t num_nodes, size_t max_pairs, uint32_t seed)
+{
+    std::vector<std::pair<RPGraph::nid_t, RPGraph::nid_t>> pairs;
+    if (num_nodes < 2) return pairs;
+    if ((double)num_nodes * (num_nodes - 1) / 2 <= max_pairs)
+    {
+        for (RPGraph::nid_t a = 0; a < num_nodes; ++a)
+            for (RPGraph::nid_t b = a + 1; b < num_nodes; ++b)
+                pairs.push_back(std::make_pair(a, b));
+        return pairs;
+    }
+
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<RPGraph::nid_t> node(0, num_nodes - 1);
+    while (pairs.size() < max_pairs)
+    {
+        const RPGraph::nid_t a = node(rng), b = node(rng);
+        if (a != b) pairs.push_back(std::make_pair(a, b));
+    }
+    return pairs;
+}
+
+// Applies the edits in `path' to `graph', one per line, with ids as in the
+// edgelist:
+//   + source target weight  adds the edge, or changes its weight
+//   - source target         removes the edge
+//   - node                  removes all edges of the node
+// Lines starting with `#' are skipped. Adds the changed edges, as pairs of
+// UGraph ids, to `changed_edges', and their endpoints to `touched'. Adds
+// the removed nodes that have no edges after all edits to `removed'.
+static void apply_edits(RPGraph::UGraph &graph, std::string path,
+                        std::vector<std::pair<RPGraph::nid_t, RPGraph::nid_t>> &changed_edges,
+                        std::vector<RPGraph::nid_t> &touched,
+                        std::vector<RPGraph::nid_t> &removed)
+{
+    std::ifstream edits(path);
+    std::string line;
+    int line_no = 0;
+    while (std::getline(edits, line))
+    {
+        line_no++;
+        std::istringstream iss(line);
+        std::string op;
+        if (!(iss >> op) or op[0] == '#') continue;
+
+        RPGraph::nid_t source, target;
+        float weight;
+        if (op == "+" and iss >> source >> target >> weight)
+        {
+            if (source == target) continue;
+            graph.add_edge_with_weight(source, target, weight);
+            changed_edges.push_back(std::make_pair(graph.mapped_id(source), graph.mapped_id(target)));
+        }
+        else if (op == "-" and iss >> source)
+        {
+            if (iss >> target)
+            {
+                if (graph.remove_edge(source, target))
+                    changed_edges.push_back(std::make_pair(graph.mapped_id(source), graph.mapped_id(target)));
+            }
+            else if (graph.has_original_id(source))
+            {
+                for (RPGraph::nid_t t : graph.isolate_node(source))
+                    changed_edges.push_back(std::make_pair(graph.mapped_id(source), t));
+                removed.push_back(graph.mapped_id(source));
+            }
+        }
+        else
+        {
+            fprintf(stderr, "error: Line %d of %s is not an edit.\n", line_no, path.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (const std::pair<RPGraph::nid_t, RPGraph::nid_t> &edge : changed_edges)
+    {
+        touched.push_back(edge.first);
+        touched.push_back(edge.second);
+    }
+    std::sort(touched.begin(), touched.end());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+    // Nodes may have gotten edges again after their removal.
+    std::sort(removed.begin(), removed.end());
+    removed.erase(std::unique(removed.begin(), removed.end()), removed.end());
+    removed.erase(std::remove_if(removed.begin(), removed.end(),
+                                 [&](RPGraph::nid_t n) { return graph.degree(n) > 0; }),
+                  removed.end());
+}
+
+// Parses graph_viewer's commandline arguments; argv[0] is skipped.
+static void parse_options(int argc, const char **argv, LayoutOptions &o)
+{
+    const std::string format_arg = argc > 10 ? argv[10] : "";
+    const bool sized_format = format_arg == "png" or format_arg == "views" or
+                              format_arg == "density" or format_arg == "y4m" or format_arg == "rgb";
+    if (argc < 10 or (sized_format and argc < 13))
+    {
+        fprintf(stderr, "Usage: graph_viewer gpu|cpu|cpubh max_iterations num_snaps sg|wg scale gravity exact|approximate edgelist_path out_path [png image_w image_h|views image_w image_h|density image_w image_h|y4m image_w image_h|rgb image_w image_h|csv|bin|ply|glb] [threads num_threads] [costs] [groups groups_path] [edges intra|inter|all] [camera eye_x eye_y eye_z fov] [blur sigma] [samples edge_samples] [compression png_level] [stream file|'|command'] [fps frame_rate] [lod num_levels] [coo full|upper] [seed random_seed] [checkpoint period] [resume checkpoint_path] [warm layout_path] [starts num_starts] [margin start_margin] [metrics num_sources num_nodes k] [telemetry period [json|bin]] [publish shm_name period] [serve port fps] [update edits_path hops [steps]]\n"
+                        "       graph_viewer batch manifest_path [threads num_threads]\n"
+                        "       graph_viewer watch shm_name [frames num_frames]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    o.cuda_requested = std::string(argv[1]) == "gpu" or std::string(argv[1]) == "cuda";
+    o.cpubh_requested = std::string(argv[1]) == "cpubh";
+    o.max_iterations = std::stoi(argv[2]);
+    o.num_screenshots = std::stoi(argv[3]);
+    o.strong_gravity = std::string(argv[4]) == "sg";
+    o.scale = std::stof(argv[5]);
+    o.gravity = std::stof(argv[6]);
+    o.approximate = std::string(argv[7]) == "approximate";
+    o.edgelist_path = argv[8];
+    o.out_path = argv[9];
 
     for (int arg_no = 10; arg_no < argc; arg_no++)
     {
         if(std::string(argv[arg_no]) == "png")
         {
-            out_format = "png";
-            image_w = std::stoi(argv[arg_no+1]);
-            image_h = std::stoi(argv[arg_no+2]);
+            o.out_format = "png";
+            o.image_w = std::stoi(argv[arg_no+1]);
+            o.image_h = std::stoi(argv[arg_no+2]);
+            arg_no += 2;
+        }
+
+        else if(std::string(argv[arg_no]) == "views")
+        {
+            o.out_format = "views";
+            o.image_w = std::stoi(argv[arg_no+1]);
+            o.image_h = std::stoi(argv[arg_no+2]);
+            arg_no += 2;
+        }
+
+        else if(std::string(argv[arg_no]) == "density")
+        {
+            o.out_format = "density";
+            o.image_w = std::stoi(argv[arg_no+1]);
+            o.image_h = std::stoi(argv[arg_no+2]);
+            arg_no += 2;
+        }
+
+        // One video stream of all snapshots, see RPGraph::FrameStream.
+        else if(std::string(argv[arg_no]) == "y4m" or std::string(argv[arg_no]) == "rgb")
+        {
+            o.out_format = argv[arg_no];
+            o.image_w = std::stoi(argv[arg_no+1]);
+            o.image_h = std::stoi(argv[arg_no+2]);
             arg_no += 2;
         }
 
         else if(std::string(argv[arg_no]) == "csv")
         {
-            out_format = "csv";
+            o.out_format = "csv";
         }
 
         else if(std::string(argv[arg_no]) == "bin")
         {
-            out_format = "bin";
+            o.out_format = "bin";
+        }
+
+        else if(std::string(argv[arg_no]) == "ply" or std::string(argv[arg_no]) == "glb")
+        {
+            o.out_format = argv[arg_no];
+        }
+
+        else if(std::string(argv[arg_no]) == "threads" and arg_no+1 < argc)
+        {
+            o.num_threads = std::stoi(argv[arg_no+1]);
+            arg_no += 1;
+        }
+
+        else if(std::string(argv[arg_no]) == "costs")
+        {
+            o.write_costs = true;
+        }
+
+        else if(std::string(argv[arg_no]) == "groups" and arg_no+1 < argc)
+        {
+            o.groups_path = argv[arg_no+1];
+            arg_no += 1;
+        }
+
+        else if(std::string(argv[arg_no]) == "edges" and arg_no+1 < argc)
+        {
+            const std::string mode = argv[arg_no+1];
+            if (mode == "intra") o.edge_mode = RPGraph::EDGES_INTRA;
+            else if (mode == "inter") o.edge_mode = RPGraph::EDGES_INTER;
+            else if (mode == "all") o.edge_mode = RPGraph::EDGES_ALL;
+            else
+            {
+                fprintf(stderr, "error: Unknown edge mode '%s', use intra, inter or all.\n", mode.c_str());
+                exit(EXIT_FAILURE);
+            }
+            arg_no += 1;
+        }
+
+        // Adds a perspective view to `views', looking at the layout's center.
+        else if(std::string(argv[arg_no]) == "camera" and arg_no+4 < argc)
+        {
+            o.use_camera = true;
+            o.camera.eye = RPGraph::Coordinate(std::stof(argv[arg_no+1]), std::stof(argv[arg_no+2]),
+                                             std::stof(argv[arg_no+3]));
+            o.camera.fov = std::stof(argv[arg_no+4]);
+            arg_no += 4;
+        }
+
+        else if(std::string(argv[arg_no]) == "blur" and arg_no+1 < argc)
+        {
+            o.density_sigma = std::stof(argv[arg_no+1]);
+            arg_no += 1;
+        }
+
+        else if(std::string(argv[arg_no]) == "samples" and arg_no+1 < argc)
+        {
+            o.edge_samples = std::stoi(argv[arg_no+1]);
+            arg_no += 1;
+        }
+
+        // 0 (store) to 9 (smallest), 1 is fastest.
+        else if(std::string(argv[arg_no]) == "compression" and arg_no+1 < argc)
+        {
+            o.png_level = std::stoi(argv[arg_no+1]);
+            arg_no += 1;
+        }
+
+        else if(std::string(argv[arg_no]) == "stream" and arg_no+1 < argc)
+        {
+            o.stream_target = argv[arg_no+1];
+            arg_no += 1;
+        }
+
+        // Writes a level-of-detail file of the final layout.
+        else if(std::string(argv[arg_no]) == "lod" and arg_no+1 < argc)
+        {
+            o.lod_levels = std::stoi(argv[arg_no+1]);
+            arg_no += 1;
+        }
+
+        // Reads edgelist_path as a binary contact matrix, see UGraph::readContactMatrix.
+        else if(std::string(argv[arg_no]) == "coo" and arg_no+1 < argc)
+        {
+            o.coo_storage = argv[arg_no+1];
+            if (o.coo_storage != "full" and o.coo_storage != "upper")
+            {
+                fprintf(stderr, "error: Unknown contact matrix storage '%s', use full or upper.\n", o.coo_storage.c_str());
+                exit(EXIT_FAILURE);
+            }
+            arg_no += 1;
+        }
+
+        else if(std::string(argv[arg_no]) == "fps" and arg_no+1 < argc)
+        {
+            o.fps = std::stoi(argv[arg_no+1]);
+            arg_no += 1;
+        }
+
+        // Seeds the random initial layout.
+        else if(std::string(argv[arg_no]) == "seed" and arg_no+1 < argc)
+        {
+            o.use_seed = true;
+            o.seed = std::stoul(argv[arg_no+1]);
+            arg_no += 1;
+        }
+
+        // Every `period' iterations, the state of the layout is written
+        // to one checkpoint file, which `resume' continues from.
+        else if(std::string(argv[arg_no]) == "checkpoint" and arg_no+1 < argc)
+        {
+            o.checkpoint_period = std::stoi(argv[arg_no+1]);
+            arg_no += 1;
+        }
+
+        else if(std::string(argv[arg_no]) == "resume" and arg_no+1 < argc)
+        {
+            o.resume_path = argv[arg_no+1];
+            arg_no += 1;
+        }
+
+        // Runs layouts from `num_starts' seeds side by side, and keeps the
+        // one of lowest energy. Those trailing it by more than `margin'
+        // (relative to its energy) are stopped early.
+        else if(std::string(argv[arg_no]) == "starts" and arg_no+1 < argc)
+        {
+            o.num_starts = std::max(std::stoi(argv[arg_no+1]), 1);
+            arg_no += 1;
+        }
+
+        else if(std::string(argv[arg_no]) == "margin" and arg_no+1 < argc)
+        {
+            o.start_margin = std::stof(argv[arg_no+1]);
+            arg_no += 1;
+        }
+
+        // Appends quality metrics of each snapshot to a JSON lines file,
+        // see RPGraph::LayoutMetrics for the sample sizes.
+        else if(std::string(argv[arg_no]) == "metrics" and arg_no+3 < argc)
+        {
+            o.write_metrics = true;
+            o.metrics.stress_sources = std::stoi(argv[arg_no+1]);
+            o.metrics.neighborhood_nodes = std::stoi(argv[arg_no+2]);
+            o.metrics.neighborhood_k = std::stoi(argv[arg_no+3]);
+            arg_no += 3;
+        }
+
+        // Appends convergence statistics of every period-th step, as
+        // JSON lines or binary records (see RPGraph::StepTelemetry).
+        else if(std::string(argv[arg_no]) == "telemetry" and arg_no+1 < argc)
+        {
+            o.telemetry_period = std::stoi(argv[arg_no+1]);
+            arg_no += 1;
+            if (arg_no+1 < argc and (std::string(argv[arg_no+1]) == "json" or
+                                     std::string(argv[arg_no+1]) == "bin"))
+            {
+                o.telemetry_binary = std::string(argv[arg_no+1]) == "bin";
+                arg_no += 1;
+            }
+        }
+
+        // Publishes the positions of every period-th step to shared memory,
+        // for viewers (see graph_viewer watch).
+        else if(std::string(argv[arg_no]) == "publish" and arg_no+2 < argc)
+        {
+            o.publish_name = argv[arg_no+1];
+            o.publish_period = std::stoi(argv[arg_no+2]);
+            arg_no += 2;
+        }
+
+        // Serves the layout's progress on http://localhost:port, sending
+        // up to fps frames per second (see RPGraph::LiveServer).
+        else if(std::string(argv[arg_no]) == "serve" and arg_no+2 < argc)
+        {
+            o.serve_port = std::stoi(argv[arg_no+1]);
+            o.serve_fps = std::stof(argv[arg_no+2]);
+            arg_no += 2;
+        }
+
+        // Starts from the positions in a csv or bin output of an earlier run.
+        else if(std::string(argv[arg_no]) == "warm" and arg_no+1 < argc)
+        {
+            o.warm_path = argv[arg_no+1];
+            arg_no += 1;
+        }
+
+        // Applies the edits in a file to the graph before the first step,
+        // and refines the layout around them for a number of steps (see
+        // apply_edits).
+        else if(std::string(argv[arg_no]) == "update" and arg_no+2 < argc)
+        {
+            o.update_path = argv[arg_no+1];
+            o.update_hops = std::stoi(argv[arg_no+2]);
+            arg_no += 2;
+            if (arg_no+1 < argc and isdigit(argv[arg_no+1][0]))
+            {
+                o.update_steps = std::stoi(argv[arg_no+1]);
+                arg_no += 1;
+            }
         }
     }
+}
 
+// The files a layout writes that must not exist yet, as their writers
+// don't overwrite files: snapshots in formats other than images, the
+// levels of detail, metrics and telemetry.
+static std::vector<std::string> new_output_paths(const LayoutOptions &o)
+{
+    std::vector<std::string> paths;
+    const std::string prefix = o.out_path + "/out/out.ca-AstroPh";
+    if (o.num_screenshots > 0 and (o.out_format == "csv" or o.out_format == "bin" or
+                                   o.out_format == "ply" or o.out_format == "glb"))
+    {
+        // As in run_layout, which continues after a resumed checkpoint.
+        const int snap_period = ceil((float)o.max_iterations/o.num_screenshots);
+        const int first = o.resume_path.empty() ? 1 : RPGraph::ForceAtlas2::checkpointIteration(o.resume_path) + 1;
+        for (int iteration = first; iteration <= o.max_iterations; ++iteration)
+            if (iteration % snap_period == 0 or iteration == o.max_iterations)
+                paths.push_back(prefix + "_" + std::to_string(iteration) + "." + o.out_format);
+    }
+    if (o.lod_levels > 0) paths.push_back(prefix + ".lod");
+    if (o.write_metrics) paths.push_back(prefix + ".metrics.jsonl");
+    if (o.telemetry_period > 0) paths.push_back(prefix + ".telemetry" + (o.telemetry_binary ? ".bin" : ".jsonl"));
+    return paths;
+}
 
-    if(cuda_requested and not approximate)
+// Exits if the options can't be run.
+static void check_options(const LayoutOptions &o)
+{
+    if(o.cuda_requested and not o.approximate)
     {
         fprintf(stderr, "error: The CUDA implementation (currently) requires Barnes-Hut approximation.\n");
         exit(EXIT_FAILURE);
     }
 
+    if(o.cpubh_requested and not o.approximate)
+    {
+        fprintf(stderr, "error: The cpubh implementation requires Barnes-Hut approximation.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // CUDA engines keep their tree and speed in device globals, so only
+    // one can run at a time.
+    if(o.cuda_requested and o.num_starts > 1)
+    {
+        fprintf(stderr, "error: The CUDA implementation runs a single start only.\n");
+        exit(EXIT_FAILURE);
+    }
+
     // Check in_path and out_path
-    if (!is_file_exists(edgelist_path))
+    if (!is_file_exists(o.edgelist_path))
+    {
+        fprintf(stderr, "error: No edgelist at %s\n", o.edgelist_path.c_str());
+        exit(EXIT_FAILURE);
+    }
+    if (!is_file_exists(o.out_path))
+    {
+        fprintf(stderr, "error: No output folder at %s\n", o.out_path.c_str());
+        exit(EXIT_FAILURE);
+    }
+    if (!o.update_path.empty() and !is_file_exists(o.update_path))
+    {
+        fprintf(stderr, "error: No edits at %s\n", o.update_path.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    // Rather than failing once the layout got to them.
+    for (const std::string &path : new_output_paths(o))
+    {
+        if (is_file_exists(path))
+        {
+            printf("Error: File exists at %s\n", path.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (o.num_starts > 1 and !o.resume_path.empty())
+    {
+        fprintf(stderr, "error: A checkpoint can only be resumed with a single start.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The checkpoint is of the graph after the edits, which would be
+    // applied again.
+    if (!o.update_path.empty() and !o.resume_path.empty())
     {
-        fprintf(stderr, "error: No edgelist at %s\n", edgelist_path.c_str());
+        fprintf(stderr, "error: A checkpoint can't be resumed with graph updates.\n");
         exit(EXIT_FAILURE);
     }
-    if (!is_file_exists(out_path))
+
+    if (!o.update_path.empty() and o.cuda_requested)
     {
-        fprintf(stderr, "error: No output folder at %s\n", out_path.c_str());
+        fprintf(stderr, "error: The CUDA implementation doesn't support graph updates.\n");
         exit(EXIT_FAILURE);
     }
 
     // If not compiled with cuda support, check if cuda is requested.
     #ifndef __NVCC__
-    if(cuda_requested)
+    if(o.cuda_requested)
     {
         fprintf(stderr, "error: CUDA was requested, but not compiled for.\n");
         exit(EXIT_FAILURE);
     }
     #endif
+}
 
-
-
-
-
-
+// Runs one layout on `pool', printing progress if `verbose'.
+static void run_layout(LayoutOptions o, RPGraph::ThreadPool &pool, bool verbose)
+{
     // Load graph.
-    printf("Loading edgelist at '%s'...", edgelist_path.c_str());
-    fflush(stdout);
+    if (verbose)
+    {
+        printf("Loading edgelist at '%s'...", o.edgelist_path.c_str());
+        fflush(stdout);
+    }
     //RPGraph::UGraph graph = RPGraph::UGraph(edgelist_path);
     RPGraph::UGraph graph;
 
-    std::ifstream file(edgelist_path);
+    if (!o.coo_storage.empty())
+        graph.readContactMatrix(o.edgelist_path, o.coo_storage == "upper");
+
+    std::ifstream file(o.edgelist_path);
 
-    if (file.is_open()) {
+    if (o.coo_storage.empty() and file.is_open()) {
         std::string line;
         while (std::getline(file, line)) {
             std::istringstream iss(line);
@@ -137,55 +633,462 @@ int main(int argc, const char **argv)
     file.close();
 
 
-    printf("done.\n");
-    printf("    fetched %d nodes and %d edges.\n", graph.num_nodes(), graph.num_edges());
+    if (verbose)
+    {
+        printf("done.\n");
+        printf("    fetched %d nodes and %d edges.\n", graph.num_nodes(), graph.num_edges());
+    }
 
-    // Create the GraphLayout and ForceAtlas2 objects.
-    RPGraph::GraphLayout layout(graph);
-    RPGraph::ForceAtlas2 *fa2;
-    #ifdef __NVCC__
-    if(cuda_requested)
-        fa2 = new RPGraph::CUDAForceAtlas2(layout, approximate,
-                                           strong_gravity, gravity, scale);
-    else
-    #endif
-        fa2 = new RPGraph::CPUForceAtlas2(layout, approximate,
-                                          strong_gravity, gravity, scale);
+    // Create the GraphLayout and ForceAtlas2 objects, one per start, each
+    // seeded differently. A single start runs on the whole pool, several
+    // run side by side on one thread each.
+    const uint32_t base_seed = o.use_seed ? o.seed : std::mt19937::default_seed;
+    RPGraph::ThreadPool serial(1);
+    std::vector<LayoutStart> starts(o.num_starts);
+    for (int i = 0; i < o.num_starts; ++i)
+    {
+        starts[i].layout.reset(new RPGraph::GraphLayout(graph));
+        RPGraph::GraphLayout &layout = *starts[i].layout;
+        if (!o.groups_path.empty()) layout.loadNodeGroups(o.groups_path);
+        layout.setEdgeMode(o.edge_mode);
+        layout.setPNGLevel(o.png_level);
+        layout.seedRandom(base_seed + i);
+        if (!o.warm_path.empty())
+        {
+            const RPGraph::nid_t num_matched = layout.loadPositions(o.warm_path);
+            if (verbose and i == 0)
+                printf("Took the positions of %u of %u nodes from %s\n", num_matched, graph.num_nodes(), o.warm_path.c_str());
+        }
+
+        RPGraph::ThreadPool *engine_pool = o.num_starts > 1 ? &serial : &pool;
+        RPGraph::ForceAtlas2 *fa2;
+        #ifdef __NVCC__
+        if(o.cuda_requested)
+            fa2 = new RPGraph::CUDAForceAtlas2(layout, o.approximate,
+                                               o.strong_gravity, o.gravity, o.scale);
+        else
+        #endif
+        if(o.cpubh_requested)
+            fa2 = new RPGraph::CPUBHForceAtlas2(layout, o.strong_gravity, o.gravity, o.scale, engine_pool);
+        else
+            fa2 = new RPGraph::CPUForceAtlas2(layout, o.approximate,
+                                              o.strong_gravity, o.gravity, o.scale, engine_pool);
+        starts[i].fa2.reset(fa2);
+        starts[i].energy = 0.0;
+        starts[i].running = true;
+    }
+
+    // The same sample of node pairs is used for the energy of all starts.
+    std::vector<std::pair<RPGraph::nid_t, RPGraph::nid_t>> energy_pairs;
+    if (o.num_starts > 1) energy_pairs = sample_node_pairs(graph.num_nodes(), 200000, base_seed);
+    size_t best = 0;
+    int num_running = o.num_starts;
+
+    std::unique_ptr<RPGraph::FrameStream> stream;
+    if (o.out_format == "y4m" or o.out_format == "rgb")
+    {
+        if (o.stream_target.empty()) o.stream_target = o.out_path + "/out/out.ca-AstroPh." + o.out_format;
+        stream.reset(new RPGraph::FrameStream(o.stream_target, o.image_w, o.image_h,
+                                              o.out_format == "y4m" ? RPGraph::STREAM_Y4M
+                                                                  : RPGraph::STREAM_RGB,
+                                              o.fps));
+    }
+
+    if (!o.resume_path.empty())
+    {
+        starts[0].fa2->readCheckpoint(o.resume_path);
+        if (verbose)
+            printf("Resuming from iteration %d of %s\n", starts[0].fa2->getIteration(), o.resume_path.c_str());
+    }
+    const std::string checkpoint_path = o.out_path + "/out/out.ca-AstroPh.checkpoint";
+
+    // The graph changes under the layouts, which update only what the
+    // edits touch, and the next steps refine around them. Removed nodes
+    // leave the layouts and their outputs.
+    int focus_until = 0;
+    if (!o.update_path.empty())
+    {
+        std::vector<std::pair<RPGraph::nid_t, RPGraph::nid_t>> changed_edges;
+        std::vector<RPGraph::nid_t> touched, removed;
+        apply_edits(graph, o.update_path, changed_edges, touched, removed);
+        for (LayoutStart &s : starts)
+        {
+            for (RPGraph::nid_t n : removed) s.layout->removeNode(n);
+            s.fa2->updateGraph(changed_edges);
+            s.fa2->focus(touched, o.update_hops);
+        }
+        focus_until = starts[0].fa2->getIteration() + o.update_steps;
+        if (verbose)
+            printf("Applied %zu edge changes from %s, removed %zu nodes, now %u nodes and %u edges.\n",
+                   changed_edges.size(), o.update_path.c_str(), removed.size(),
+                   graph.num_nodes() - (RPGraph::nid_t)removed.size(), graph.num_edges());
+    }
+
+    std::unique_ptr<RPGraph::LayoutMetrics> metrics;
+    FILE *metrics_file = nullptr;
+    if (o.write_metrics)
+    {
+        const std::string metrics_path = o.out_path + "/out/out.ca-AstroPh.metrics.jsonl";
+        if (is_file_exists(metrics_path))
+        {
+            printf("Error: File exists at %s\n", metrics_path.c_str());
+            exit(EXIT_FAILURE);
+        }
+        metrics_file = fopen(metrics_path.c_str(), "w");
+        // All starts have the same nodes removed.
+        metrics.reset(new RPGraph::LayoutMetrics(*starts[0].layout, o.metrics, &pool));
+    }
 
-    printf("Started Layout algorithm...\n");
-    const int snap_period = ceil((float)max_iterations/num_screenshots);
-    const int print_period = ceil((float)max_iterations*0.05);
+    std::unique_ptr<RPGraph::SharedFramePublisher> publisher;
+    if (!o.publish_name.empty() and o.publish_period > 0)
+        publisher.reset(new RPGraph::SharedFramePublisher(o.publish_name, graph.num_nodes()));
 
-    for (int iteration = 1; iteration <= max_iterations; ++iteration)
+    std::unique_ptr<RPGraph::LiveServer> server;
+    if (o.serve_port > 0)
     {
-        fa2->doStep();
+        server.reset(new RPGraph::LiveServer(o.serve_port, o.serve_fps));
+        if (verbose) printf("Serving progress on http://localhost:%d/\n", o.serve_port);
+    }
+
+    FILE *telemetry_file = nullptr;
+    if (o.telemetry_period > 0)
+    {
+        const std::string telemetry_path = o.out_path + "/out/out.ca-AstroPh.telemetry"
+                                         + (o.telemetry_binary ? ".bin" : ".jsonl");
+        if (is_file_exists(telemetry_path))
+        {
+            printf("Error: File exists at %s\n", telemetry_path.c_str());
+            exit(EXIT_FAILURE);
+        }
+        telemetry_file = fopen(telemetry_path.c_str(), o.telemetry_binary ? "wb" : "w");
+    }
+
+    if (verbose) printf("Started Layout algorithm...\n");
+    const int snap_period = ceil((float)o.max_iterations/o.num_screenshots);
+    const int print_period = ceil((float)o.max_iterations*0.05);
+    const int compare_period = std::max(o.max_iterations / 20, 1);
+
+    for (int iteration = starts[0].fa2->getIteration() + 1; iteration <= o.max_iterations; ++iteration)
+    {
+        if (focus_until > 0 and iteration == focus_until + 1)
+            for (LayoutStart &s : starts) s.fa2->clearFocus();
+
+        if (num_running == 1)
+            starts[best].fa2->doStep();
+        else
+        {
+            for_each_running(starts, pool, [](LayoutStart &s) { s.fa2->doStep(); });
+
+            // Stops starts whose energy trails the best by more than the
+            // margin. Early on energies say little, so only from a quarter
+            // of the way on; the last comparison picks the final layout.
+            if (iteration % compare_period == 0 or iteration == o.max_iterations)
+            {
+                for_each_running(starts, pool, [&](LayoutStart &s) { s.energy = s.fa2->energy(energy_pairs); });
+                for (size_t i = 0; i < starts.size(); ++i)
+                    if (starts[i].running and starts[i].energy < starts[best].energy) best = i;
+
+                const double threshold = starts[best].energy + o.start_margin * fabs(starts[best].energy);
+                for (size_t i = 0; i < starts.size(); ++i)
+                {
+                    if (not starts[i].running or i == best) continue;
+                    if (iteration == o.max_iterations or
+                        (4 * iteration >= o.max_iterations and starts[i].energy > threshold))
+                    {
+                        starts[i].running = false;
+                        num_running--;
+                        if (verbose)
+                            printf("Stopped start %zu at iteration %d, energy %g (best %g).\n",
+                                   i, iteration, starts[i].energy, starts[best].energy);
+                    }
+                }
+                if (num_running == 1)
+                {
+                    starts[best].fa2->setThreadPool(&pool);
+                    if (verbose) printf("Keeping start %zu (seed %u).\n", best, base_seed + (uint32_t)best);
+                }
+            }
+        }
+
+        // Outputs are of the best start so far.
+        RPGraph::GraphLayout &layout = *starts[best].layout;
+        RPGraph::ForceAtlas2 *fa2 = starts[best].fa2.get();
+        if (o.checkpoint_period > 0 and iteration % o.checkpoint_period == 0)
+            fa2->writeCheckpoint(checkpoint_path);
+
+        if (publisher and iteration % o.publish_period == 0)
+        {
+            fa2->sync_layout();
+            publisher->publish(layout, iteration);
+        }
+
+        if (server and server->frameRequested())
+        {
+            fa2->sync_layout();
+            server->publish(layout.positionData(), graph.num_nodes(), fa2->telemetry());
+        }
+
+        // Flushed per record, so that the stream can be followed live.
+        if (telemetry_file and iteration % o.telemetry_period == 0)
+        {
+            const RPGraph::StepTelemetry t = fa2->telemetry();
+            if (o.telemetry_binary) t.writeBinary(telemetry_file);
+            else fprintf(telemetry_file, "%s\n", t.toJSON().c_str());
+            fflush(telemetry_file);
+        }
+
         // If we need to, write the result to a png
-        if (num_screenshots > 0 && (iteration % snap_period == 0 || iteration == max_iterations))
+        if (o.num_screenshots > 0 && (iteration % snap_period == 0 || iteration == o.max_iterations))
         {
             std::string edgelist_basename = "out/out.ca-AstroPh";
-            std::string out_filename = edgelist_basename + "_" + std::to_string(iteration) + "." + out_format;
-            std::string out_filepath = out_path + "/" + out_filename;
-            printf("Starting iteration %d (%.2f%%), writing %s...", iteration, 100*(float)iteration/max_iterations, out_format.c_str());
-            fflush(stdout);
+            std::string out_filename = edgelist_basename + "_" + std::to_string(iteration);
+            if (o.out_format == "density") out_filename += ".png";
+            else if (o.out_format != "views") out_filename += "." + o.out_format;
+            std::string out_filepath = o.out_path + "/" + out_filename;
+            if (verbose)
+            {
+                printf("Starting iteration %d (%.2f%%), writing %s...", iteration, 100*(float)iteration/o.max_iterations, o.out_format.c_str());
+                fflush(stdout);
+            }
             fa2->sync_layout();
 
-            if (out_format == "png")
-                layout.writeToPNG(image_w, image_h, out_filepath);
-            else if (out_format == "csv")
+            if (o.out_format == "png")
+                layout.writeToPNG(o.image_w, o.image_h, out_filepath, &pool);
+            else if (o.out_format == "views")
+            {
+                o.camera.target = layout.getCenter();
+                layout.writeViewsToPNG(o.image_w, o.image_h, out_filepath,
+                                       o.use_camera ? &o.camera : nullptr, &pool);
+            }
+            else if (o.out_format == "density")
+                layout.writeDensityToPNG(o.image_w, o.image_h, out_filepath,
+                                         o.density_sigma, o.edge_samples, &pool);
+            else if (stream)
+                layout.writeToStream(*stream, &pool);
+            else if (o.out_format == "csv")
                 layout.writeToCSV(out_filepath);
-            else if (out_format == "bin")
+            else if (o.out_format == "bin")
                 layout.writeToBin(out_filepath);
+            else if (o.out_format == "ply")
+                layout.writeToPLY(out_filepath);
+            else if (o.out_format == "glb")
+                layout.writeToGLB(out_filepath);
+
+            if (metrics)
+            {
+                fprintf(metrics_file, "%s\n", metrics->compute(layout, &pool).toJSON(iteration).c_str());
+                fflush(metrics_file);
+            }
 
-            printf("done.\n");
+            if (o.write_costs)
+                write_interaction_counts(graph, fa2->interactionCounts(),
+                                         o.out_path + "/out/costs_" + std::to_string(iteration) + ".csv");
+
+            if (verbose) printf("done.\n");
         }
 
         // Else we print (if we need to)
-        else if (iteration % print_period == 0)
+        else if (verbose and iteration % print_period == 0)
+        {
+            printf("Starting iteration %d (%.2f%%).\n", iteration, 100*(float)iteration/o.max_iterations);
+        }
+    }
+
+    stream.reset(); // Waits for a pipe's command to finish.
+    if (metrics_file) fclose(metrics_file);
+    if (telemetry_file) fclose(telemetry_file);
+
+    if (o.lod_levels > 0)
+    {
+        starts[best].fa2->sync_layout();
+        starts[best].layout->writeToLOD(o.out_path + "/out/out.ca-AstroPh.lod", o.lod_levels, &pool);
+    }
+}
+
+// Creates directory `path' and any missing parents.
+static void make_directories(std::string path)
+{
+    for (size_t i = 1; i <= path.size(); ++i)
+    {
+        if (i < path.size() and path[i] != '/') continue;
+        const std::string prefix = path.substr(0, i);
+        if (mkdir(prefix.c_str(), 0755) != 0 and errno != EEXIST)
+        {
+            fprintf(stderr, "error: Could not create directory %s\n", prefix.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Runs the layouts of a manifest with one job per line, each given by the
+// arguments of graph_viewer, and each with its own output folder, which
+// is created if needed. Empty lines and lines starting with `#' are
+// skipped, and `threads' is ignored: all jobs share one pool. All jobs
+// are checked before any runs, including that no two write the same file.
+// A job is estimated to cost the size of its edgelist times its
+// iterations. Jobs costing more than a thread's share of the total (and
+// CUDA jobs) run first, one after the other, each on the whole pool.
+// The rest then run concurrently, a single thread each, largest first,
+// each thread taking the next job as soon as it is done.
+static void run_batch(std::string manifest_path, int num_threads)
+{
+    std::ifstream manifest(manifest_path);
+    if (!manifest.is_open())
+    {
+        fprintf(stderr, "error: No manifest at %s\n", manifest_path.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<LayoutOptions> jobs;
+    std::vector<double> costs;
+    std::set<std::string> outputs;
+    std::string line;
+    int line_no = 0;
+    while (std::getline(manifest, line))
+    {
+        line_no++;
+        std::istringstream iss(line);
+        std::vector<std::string> args = {"graph_viewer"};
+        std::string arg;
+        while (iss >> arg) args.push_back(arg);
+        if (args.size() == 1 or args[1][0] == '#') continue;
+        if (args.size() < 10)
+        {
+            fprintf(stderr, "error: Line %d of %s is not a layout job.\n", line_no, manifest_path.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        std::vector<const char *> job_argv;
+        for (const std::string &a : args) job_argv.push_back(a.c_str());
+        LayoutOptions o;
+        parse_options(job_argv.size(), job_argv.data(), o);
+        make_directories(o.out_path + "/out");
+        check_options(o);
+        for (const std::string &path : new_output_paths(o))
+        {
+            if (!outputs.insert(path).second)
+            {
+                fprintf(stderr, "error: Line %d of %s writes %s, as an earlier job does.\n",
+                        line_no, manifest_path.c_str(), path.c_str());
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        struct stat edgelist_stat;
+        const double size = stat(o.edgelist_path.c_str(), &edgelist_stat) == 0 ? edgelist_stat.st_size : 0;
+        jobs.push_back(o);
+        costs.push_back(size * std::max(o.max_iterations, 1));
+    }
+    manifest.close();
+
+    std::vector<size_t> order(jobs.size());
+    for (size_t i = 0; i < jobs.size(); ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return costs[a] > costs[b]; });
+
+    RPGraph::ThreadPool pool(num_threads);
+    double total_cost = 0.0;
+    for (double c : costs) total_cost += c;
+    std::vector<size_t> large_jobs, small_jobs;
+    for (size_t i : order)
+    {
+        if (jobs[i].cuda_requested or costs[i] * pool.size() > total_cost) large_jobs.push_back(i);
+        else small_jobs.push_back(i);
+    }
+
+    printf("Running %zu layouts on %d threads, %zu of them on all threads...\n",
+           jobs.size(), pool.size(), large_jobs.size());
+    std::atomic<size_t> num_done{0};
+    auto run_job = [&](size_t i, RPGraph::ThreadPool &job_pool)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        run_layout(jobs[i], job_pool, false);
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        printf("    %zu/%zu: %s done in %.1f s.\n", ++num_done, jobs.size(),
+               jobs[i].out_path.c_str(), elapsed.count());
+        fflush(stdout);
+    };
+
+    for (size_t i : large_jobs) run_job(i, pool);
+
+    std::atomic<size_t> next_job{0};
+    pool.run_on_all([&](int)
+    {
+        RPGraph::ThreadPool serial(1);
+        for (size_t k = next_job++; k < small_jobs.size(); k = next_job++)
+            run_job(small_jobs[k], serial);
+    });
+}
+
+// Reads the frames published under `name' by a layout running elsewhere
+// (see the publish option), until it ends or `max_frames' were read, and
+// prints the latency of each, from publishing to a complete copy here.
+// Polls without sleeping, so latencies aren't rounded up to a timer tick.
+static void run_watch(std::string name, int max_frames)
+{
+    RPGraph::SharedFrameReader reader(name);
+    RPGraph::SharedFrame frame;
+    std::vector<double> latencies; // In microseconds.
+    uint64_t first_frame = 0;
+
+    while (max_frames <= 0 or (int) latencies.size() < max_frames)
+    {
+        // Checked before reading, so that a frame that came just before
+        // closing is still read.
+        const bool closed = reader.closed();
+        if (not reader.readLatest(frame))
         {
-            printf("Starting iteration %d (%.2f%%).\n", iteration, 100*(float)iteration/max_iterations);
+            if (closed) break;
+            std::this_thread::yield();
+            continue;
         }
+        const double latency = (RPGraph::monotonic_ns() - frame.timestamp_ns) / 1000.0;
+        if (latencies.empty()) first_frame = frame.number;
+        latencies.push_back(latency);
+        printf("frame %llu: iteration %d, %zu nodes, latency %.1f us\n",
+               (unsigned long long) frame.number, frame.iteration,
+               frame.positions.size() / 3, latency);
+    }
+
+    if (latencies.empty())
+    {
+        printf("No frames read.\n");
+        return;
+    }
+    const uint64_t skipped = frame.number - first_frame + 1 - latencies.size();
+    std::sort(latencies.begin(), latencies.end());
+    auto quantile = [&](double q) { return latencies[(size_t) (q * (latencies.size() - 1))]; };
+    printf("Read %zu frames, skipped %llu superseded ones. Latency (us): min %.1f, median %.1f, p99 %.1f, max %.1f\n",
+           latencies.size(), (unsigned long long) skipped, latencies.front(), quantile(0.5),
+           quantile(0.99), latencies.back());
+}
+
+int main(int argc, const char **argv)
+{
+    // For reproducibility.
+    //srandom(1234);
+
+    if (argc > 2 and std::string(argv[1]) == "batch")
+    {
+        int num_threads = 0; // All hardware threads.
+        if (argc > 4 and std::string(argv[3]) == "threads") num_threads = std::stoi(argv[4]);
+        run_batch(argv[2], num_threads);
+        exit(EXIT_SUCCESS);
     }
 
-    delete fa2;
+    if (argc > 2 and std::string(argv[1]) == "watch")
+    {
+        int max_frames = 0; // Until the layout ends.
+        if (argc > 4 and std::string(argv[3]) == "frames") max_frames = std::stoi(argv[4]);
+        run_watch(argv[2], max_frames);
+        exit(EXIT_SUCCESS);
+    }
+
+    // Parse commandline arguments
+    LayoutOptions o;
+    parse_options(argc, argv, o);
+    check_options(o);
+
+    RPGraph::ThreadPool pool(o.num_threads);
+    run_layout(o, pool, true);
     exit(EXIT_SUCCESS);
-}
\ No newline at end of file
+}
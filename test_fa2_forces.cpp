@@ -0,0 +1,273 @@
+/*
+ ==============================================================================
+
+ test_fa2_forces.cpp
+ Copyright © 2016, 2017, 2018  G. Brinkmann
+
+ This file is part of graph_viewer.
+
+ graph_viewer is free software: you can redistribute it and/or modify
+ it under the terms of version 3 of the GNU Affero General Public License as
+ published by the Free Software Foundation.
+
+ graph_viewer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with graph_viewer.  If not, see <https://www.gnu.org/licenses/>.
+
+ ==============================================================================
+*/
+
+/*
+ Checks the forces of the host engines, and the per-body arithmetic of
+ RPFA2Math.hpp they share with the CUDA kernels, against forces summed
+ exactly over all pairs of nodes, on a few small graphs. Built from the
+ sources of graph_viewer without graph_viewer.cpp, e.g.
+
+     g++ -std=c++11 -O2 -pthread test_fa2_forces.cpp RP*.cpp -lz -o test_fa2_forces
+
+ and run without arguments; exits with EXIT_FAILURE if a check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <random>
+#include <string>
+#include <vector>
+#include "RPGraph.hpp"
+#include "RPGraphLayout.hpp"
+#include "RPFA2Math.hpp"
+#include "RPCPUForceAtlas2.hpp"
+#include "RPCPUBHForceAtlas2.hpp"
+
+using RPGraph::nid_t;
+
+static int num_failed = 0;
+
+static void check(bool ok, const std::string &what)
+{
+    printf("%s: %s\n", ok ? "ok" : "FAILED", what.c_str());
+    if (!ok) num_failed++;
+}
+
+// The forces of an engine's last step, which it keeps as the previous
+// forces of the next.
+template <typename Engine>
+class ForceProbe : public Engine
+{
+public:
+    using Engine::Engine;
+
+    // Accuracy of Barnes-Hut, 1 by default.
+    void setTheta(float theta)
+    {
+        this->theta = theta;
+        this->itolsq = 1.0f / (theta * theta);
+    }
+
+    std::vector<float> forces()
+    {
+        std::vector<float> positions, prev_forces;
+        this->getState(positions, prev_forces);
+        return prev_forces;
+    }
+};
+
+// Forces of ForceAtlas2 at `positions', summed over all pairs of nodes in
+// double precision: gravity towards the origin, attraction along the
+// edges, linear in their length and weight, and repulsion of k_r times
+// the product of the masses (degree + 1) over the distance.
+static std::vector<float> exact_forces(RPGraph::UGraph &graph, const std::vector<float> &positions,
+                                       bool strong_gravity, float k_g, float k_r)
+{
+    const nid_t num_nodes = graph.num_nodes();
+    std::vector<double> f(3 * (size_t)num_nodes, 0.0);
+    for (nid_t n = 0; n < num_nodes; ++n)
+    {
+        const double px = positions[3*n], py = positions[3*n+1], pz = positions[3*n+2];
+        const double m = graph.degree(n) + 1.0;
+        const double d = sqrt(px*px + py*py + pz*pz);
+        const double g = strong_gravity ? k_g * m : (d == 0.0 ? 0.0 : k_g * m / d);
+        f[3*n]   -= px * g;
+        f[3*n+1] -= py * g;
+        f[3*n+2] -= pz * g;
+
+        for (nid_t t = 0; t < num_nodes; ++t)
+        {
+            if (t == n) continue;
+            const double dx = px - positions[3*t];
+            const double dy = py - positions[3*t+1];
+            const double dz = pz - positions[3*t+2];
+            const double r = k_r * m * (graph.degree(t) + 1.0) / (dx*dx + dy*dy + dz*dz);
+            f[3*n]   += dx * r;
+            f[3*n+1] += dy * r;
+            f[3*n+2] += dz * r;
+        }
+
+        for (nid_t t : graph.neighbors_with_geq_id(n))
+        {
+            if (t == n) continue;
+            const double w = graph.get_edge_weight(n, t);
+            for (int i = 0; i < 3; ++i)
+            {
+                const double a = (positions[3*t+i] - positions[3*n+i]) * w;
+                f[3*n+i] += a;
+                f[3*t+i] -= a;
+            }
+        }
+    }
+    return std::vector<float>(f.begin(), f.end());
+}
+
+// Root of the summed squared differences over that of the exact forces.
+static double relative_error(const std::vector<float> &forces, const std::vector<float> &exact)
+{
+    double diff = 0.0, norm = 0.0;
+    for (size_t i = 0; i < exact.size(); ++i)
+    {
+        diff += ((double)forces[i] - exact[i]) * ((double)forces[i] - exact[i]);
+        norm += (double)exact[i] * exact[i];
+    }
+    return norm == 0.0 ? sqrt(diff) : sqrt(diff / norm);
+}
+
+// One step of `Engine' with Barnes-Hut accuracy `theta', from
+// `positions'; returns the forces of the step.
+template <typename Engine, typename... Args>
+static std::vector<float> engine_forces(RPGraph::UGraph &graph, const std::vector<float> &positions,
+                                        float theta, Args... args)
+{
+    RPGraph::GraphLayout layout(graph);
+    layout.setPositions(positions.data());
+    ForceProbe<Engine> engine(layout, args...);
+    engine.setTheta(theta);
+    engine.doStep();
+    return engine.forces();
+}
+
+static void check_graph(const std::string &name, RPGraph::UGraph &graph, uint32_t seed)
+{
+    const float gravity = 1.0f, scale = 2.0f;
+
+    // Nodes are spread out, so that Barnes-Hut has cells to approximate.
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> coordinate(-50.0f, 50.0f);
+    std::vector<float> positions(3 * (size_t)graph.num_nodes());
+    for (float &c : positions) c = coordinate(rng);
+
+    RPGraph::ThreadPool pool(2);
+    for (int strong = 0; strong < 2; ++strong)
+    {
+        const std::string what = name + (strong ? ", strong gravity" : "");
+        const std::vector<float> exact = exact_forces(graph, positions, strong, gravity, scale);
+
+        const double cpu_exact = relative_error(
+            engine_forces<RPGraph::CPUForceAtlas2>(graph, positions, 1.0f, false, (bool)strong,
+                                                   gravity, scale, &pool),
+            exact);
+        check(cpu_exact < 1e-4, what + ": exact cpu (error " + std::to_string(cpu_exact) + ")");
+
+        // Barnes-Hut within a few percent at the default accuracy, and
+        // close to exact at a high one. The softening of cpubh keeps a
+        // small error.
+        for (float theta : {1.0f, 0.25f})
+        {
+            const double tolerance = theta == 1.0f ? 0.1 : 1e-3;
+            const std::string at = " at theta " + std::to_string(theta).substr(0, 4);
+
+            const double cpu_bh = relative_error(
+                engine_forces<RPGraph::CPUForceAtlas2>(graph, positions, theta, true, (bool)strong,
+                                                       gravity, scale, &pool),
+                exact);
+            check(cpu_bh < tolerance, what + ": cpu Barnes-Hut" + at + " (error " + std::to_string(cpu_bh) + ")");
+
+            const double cpubh = relative_error(
+                engine_forces<RPGraph::CPUBHForceAtlas2>(graph, positions, theta, (bool)strong,
+                                                         gravity, scale, &pool),
+                exact);
+            check(cpubh < tolerance, what + ": cpubh" + at + " (error " + std::to_string(cpubh) + ")");
+        }
+    }
+}
+
+// The per-body functions against the same forces written out.
+static void check_fa2_math()
+{
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> coordinate(-10.0f, 10.0f);
+    bool repulsion_ok = true, gravity_ok = true, child_ok = true;
+    for (int i = 0; i < 1000; ++i)
+    {
+        const float x1 = coordinate(rng), y1 = coordinate(rng), z1 = coordinate(rng);
+        const float x2 = coordinate(rng), y2 = coordinate(rng), z2 = coordinate(rng);
+        const double dx = x1 - x2, dy = y1 - y2, dz = z1 - z2;
+        const double d2 = dx*dx + dy*dy + dz*dz;
+
+        // Magnitude k_r * m1 * m2 / d, as a factor of the distance vector.
+        const float f = RPGraph::fa2_repulsion_factor(1.5f, 3.0f, 4.0f, d2);
+        repulsion_ok &= fabs(f * sqrt(d2) - 1.5 * 3.0 * 4.0 / sqrt(d2)) <= 1e-5 * (18.0 / sqrt(d2));
+
+        // Magnitude k_g * m, or k_g * m * d when strong.
+        const double d = sqrt((double)x1*x1 + (double)y1*y1 + (double)z1*z1);
+        const float g = RPGraph::fa2_gravity_factor(0.5f, false, 3.0f, x1, y1, z1);
+        const float sg = RPGraph::fa2_gravity_factor(0.5f, true, 3.0f, x1, y1, z1);
+        gravity_ok &= fabs(g * d - 1.5) <= 1e-5 * 1.5;
+        gravity_ok &= fabs(sg * d - 1.5 * d) <= 1e-5 * 1.5 * d;
+
+        const int j = RPGraph::bh_child_index(x2, y2, z2, x1, y1, z1);
+        child_ok &= ((j & 1) != 0) == (x1 > x2) and ((j & 2) != 0) == (y1 > y2) and ((j & 4) != 0) == (z1 > z2);
+    }
+    check(repulsion_ok, "fa2_repulsion_factor");
+    check(gravity_ok, "fa2_gravity_factor");
+    check(RPGraph::fa2_gravity_factor(0.5f, false, 3.0f, 0.0f, 0.0f, 0.0f) == 0.0f,
+          "fa2_gravity_factor at the origin");
+    check(child_ok, "bh_child_index");
+
+    const float swg = RPGraph::fa2_swinging(1.0f, 2.0f, 2.0f, 0.0f, 0.0f, 0.0f);
+    const float tra = RPGraph::fa2_traction(1.0f, 2.0f, 2.0f, 1.0f, 2.0f, 2.0f);
+    check(fabs(swg - 3.0f) < 1e-6f and fabs(tra - 3.0f) < 1e-6f, "fa2_swinging, fa2_traction");
+    check(fabs(RPGraph::fa2_displacement_factor(4.0f, 4.0f) - 4.0f / 5.0f) < 1e-6f,
+          "fa2_displacement_factor");
+}
+
+int main()
+{
+    check_fa2_math();
+
+    RPGraph::UGraph path;
+    for (nid_t n = 0; n < 5; ++n) path.add_edge_with_weight(n, n+1, 1.0f);
+    check_graph("path", path, 1);
+
+    RPGraph::UGraph star;
+    for (nid_t n = 1; n < 9; ++n) star.add_edge_with_weight(0, n, n);
+    check_graph("weighted star", star, 2);
+
+    RPGraph::UGraph complete;
+    for (nid_t s = 0; s < 6; ++s)
+        for (nid_t t = s+1; t < 6; ++t) complete.add_edge_with_weight(s, t, 0.5f);
+    check_graph("complete", complete, 3);
+
+    RPGraph::UGraph random;
+    std::mt19937 rng(4);
+    std::uniform_int_distribution<nid_t> node(0, 299);
+    std::uniform_real_distribution<float> weight(0.1f, 2.0f);
+    for (nid_t n = 0; n < 300; ++n) random.add_edge_with_weight(n, (n+1) % 300, weight(rng));
+    for (int e = 0; e < 900; ++e)
+    {
+        const nid_t s = node(rng), t = node(rng);
+        if (s != t) random.add_edge_with_weight(s, t, weight(rng));
+    }
+    check_graph("random", random, 5);
+
+    if (num_failed > 0)
+    {
+        printf("%d checks failed.\n", num_failed);
+        exit(EXIT_FAILURE);
+    }
+    printf("All checks passed.\n");
+    exit(EXIT_SUCCESS);
+}